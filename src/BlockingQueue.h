@@ -0,0 +1,554 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef BLOCKINGQUEUE_H
+#define BLOCKINGQUEUE_H
+
+#include "Clock.h"
+#include "EventCount.h"
+#include "Mutex.h"
+#include "OverflowPolicy.h"
+#include "QueueStats.h"
+#include "WaitStrategy.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Bounded queue of values guarded by a mutex, whose consumers and
+ * producers can wait for it to become ready.
+ *
+ * Values are kept into a Container that decides their order, it must expose:
+ * - @a size() returning the number of values.
+ * - @a emplace_back(args...) inserting a value built from the arguments, or
+ *   merging it into a queued one.
+ * - @a push_back_n(values, count) inserting copies of an array of values.
+ * - @a push_back_range(first, last, max_count) inserting copies of the values
+ *   of a range, advancing @a first.
+ * - @a pop_front_n(values, count) moving out the first values.
+ * - @a evict(value) moving out the value to be discarded first when the queue
+ *   overflows (see @ref Overflow::DROP_OLDEST).
+ *
+ * Blocked threads sleep on event counts with the mutex released, waiting
+ * threads are notified after the mutex has been released: they don't wake
+ * up just to block on it again. Statistics are kept by a @ref
+ * QueueStatsRecorder and can be read without locking the mutex.
+ *
+ * When full, the queue behaves according to its @ref OverflowPolicy: lossy
+ * policies never block producers and hand the discarded values to the
+ * policy callback once the mutex has been released.
+ *
+ * This is the engine of the mutex based message queues, see @ref
+ * IMessageQueue and @ref MessageQueueT for the documentation of the methods.
+ *
+ * @ingroup threading-base
+ */
+template<typename T, typename Container>
+class BlockingQueue
+{
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param max_capacity Maximum number of values that can be queued at the
+     *        same time.
+     *
+     * @param wait_strategy How blocked threads wait.
+     *
+     * @param overflow What a push does when the queue is full.
+     *
+     * @param container_args Arguments passed to the constructor of the
+     *        container.
+     */
+    template<typename... Args>
+    BlockingQueue(std::size_t max_capacity,
+                  const WaitStrategy &wait_strategy,
+                  const OverflowPolicy<T> &overflow,
+                  Args &&... container_args)
+            :
+            m_max_capacity(max_capacity),
+            m_cancelled(false),
+            m_strategy(wait_strategy),
+            m_overflow(overflow),
+            m_queue(std::forward<Args>(container_args)...),
+            m_size_hint(0)
+    {
+    }
+
+    /**
+     * @brief Inserts one value built in place from the passed arguments,
+     * waiting if requested until the deadline (if any) for a free slot.
+     */
+    template<typename... Args>
+    std::size_t
+    emplace(bool blocking, const Deadline *deadline, Args &&... args)
+    {
+        if (m_overflow.lossy())
+        {
+            return push_lossy(T(std::forward<Args>(args)...));
+        }
+
+        std::size_t ret = 0;
+        {
+            Locker<Mutex> locker(m_mutex);
+            QueueStatsRecorder::Wait waiting(m_stats.producers());
+
+            std::size_t size = m_queue.size();
+
+            // Waits for a consumer to make room:
+            while (size >= m_max_capacity && blocking && !m_cancelled)
+            {
+                waiting.start();
+                if (!wait(m_not_full, deadline))
+                {
+                    blocking = false; // Deadline expired, last check.
+                }
+
+                size = m_queue.size();
+            }
+
+            if (size >= m_max_capacity)
+            {
+                m_stats.rejected();
+                return 0; // Failure.
+            }
+
+            m_queue.emplace_back(std::forward<Args>(args)...);
+            ret = m_queue.size();
+            m_size_hint.store(ret, std::memory_order_relaxed);
+            m_stats.pushed(1, ret);
+        }
+
+        m_not_empty.notify();
+
+        return ret;
+    }
+
+    /**
+     * @brief Pops one value, waiting if requested until the deadline (if
+     * any).
+     */
+    std::size_t
+    pop(T &value, bool blocking, const Deadline *deadline)
+    {
+        std::size_t ret = 0;
+        {
+            Locker<Mutex> locker(m_mutex);
+
+            ret = wait_not_empty(blocking, deadline);
+            if (ret > 0)
+            {
+                extract(&value, 1);
+            }
+        }
+
+        if (ret > 0)
+        {
+            m_not_full.notify();
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Inserts copies of the passed values while there is room.
+     */
+    std::size_t
+    push_bulk(const T *values, std::size_t count)
+    {
+        std::size_t ret = 0;
+        {
+            Locker<Mutex> locker(m_mutex);
+
+            ret = std::min(count, m_max_capacity - m_queue.size());
+            m_queue.push_back_n(values, ret);
+            inserted(ret);
+        }
+
+        m_not_empty.notify(ret);
+
+        // The values left out are either rejected or handled one by one:
+        if (!m_overflow.lossy())
+        {
+            m_stats.rejected(count - ret);
+            return ret;
+        }
+
+        for (; ret < count; ++ret)
+        {
+            push_lossy(T(values[ret]));
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Inserts copies of the values of a range while there is room.
+     */
+    template<typename Iterator>
+    std::size_t
+    push_range(Iterator first, Iterator last)
+    {
+        std::size_t ret = 0;
+        {
+            Locker<Mutex> locker(m_mutex);
+
+            ret = m_queue.push_back_range(first, last,
+                                          m_max_capacity - m_queue.size());
+            inserted(ret);
+        }
+
+        m_not_empty.notify(ret);
+
+        // The values left out are either rejected or handled one by one:
+        if (!m_overflow.lossy())
+        {
+            // Counted while iterating, the range may be single-pass:
+            std::size_t rejected = 0;
+            for (; first != last; ++first)
+            {
+                ++rejected;
+            }
+
+            m_stats.rejected(rejected);
+            return ret;
+        }
+
+        for (; first != last; ++first, ++ret)
+        {
+            push_lossy(T(*first));
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Pops many values at once, waiting if requested for the first
+     * one.
+     */
+    std::size_t
+    pop_bulk(T *values, std::size_t max_count, bool blocking)
+    {
+        std::size_t ret = 0;
+        {
+            Locker<Mutex> locker(m_mutex);
+
+            ret = std::min(wait_not_empty(blocking, nullptr), max_count);
+            extract(values, ret);
+        }
+
+        m_not_full.notify(ret);
+
+        return ret;
+    }
+
+    /**
+     * @brief Pops many values, collecting them until @a max_count values have
+     * been popped or until the passed deadline.
+     */
+    std::size_t
+    pop_bulk_until(T *values,
+                   std::size_t max_count,
+                   const Deadline &deadline)
+    {
+        std::size_t ret = 0;
+        std::size_t pending = 0; // Popped without notifying the producers.
+        {
+            Locker<Mutex> locker(m_mutex);
+            QueueStatsRecorder::Wait timer(m_stats.consumers());
+
+            bool waiting = !m_cancelled;
+
+            // Collects values until the batch is complete, producers are
+            // notified before waiting for more:
+            while (waiting)
+            {
+                pending = std::min(m_queue.size(), max_count - ret);
+                extract(values + ret, pending);
+                ret += pending;
+
+                if (ret == max_count)
+                {
+                    break;
+                }
+
+                m_not_full.notify(pending);
+                pending = 0;
+                timer.start();
+                waiting = wait(m_not_empty, &deadline) && !m_cancelled;
+            }
+
+            // Last check after the deadline:
+            if (!m_cancelled && ret < max_count)
+            {
+                std::size_t count = std::min(m_queue.size(), max_count - ret);
+                extract(values + ret, count);
+                ret += count;
+                pending += count;
+            }
+        }
+
+        m_not_full.notify(pending);
+
+        return ret;
+    }
+
+    /**
+     * @brief Cancels the queue releasing all blocked threads.
+     */
+    void
+    cancel()
+    {
+        {
+            Locker<Mutex> locker(m_mutex);
+            m_cancelled = true;
+        }
+
+        m_not_empty.notify_all();
+        m_not_full.notify_all();
+    }
+
+    /**
+     * @brief Returns @a true if the queue have been cancelled.
+     */
+    bool
+    is_cancelled() const
+    {
+        return m_cancelled;
+    }
+
+    /**
+     * @brief Returns the number of queued values.
+     */
+    std::size_t
+    size() const
+    {
+        Locker<Mutex> locker(m_mutex);
+        return m_queue.size();
+    }
+
+    /**
+     * @brief Returns the number of queued values as of the last change,
+     * without locking.
+     */
+    std::size_t
+    size_hint() const
+    {
+        return m_size_hint.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns a snapshot of the statistics, without locking.
+     */
+    QueueStats
+    stats() const
+    {
+        return m_stats.snapshot(m_size_hint.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief Registers an event count notified whenever values are pushed or
+     * the queue is cancelled (see @ref EventCount::add_listener).
+     */
+    void
+    add_listener(IEventListener &listener)
+    {
+        m_not_empty.add_listener(listener);
+    }
+
+    /**
+     * @brief Removes a listener registered by @ref add_listener.
+     */
+    void
+    remove_listener(IEventListener &listener)
+    {
+        m_not_empty.remove_listener(listener);
+    }
+
+private:
+
+    // Inserts one value according to the lossy overflow policy, discarding
+    // either the value itself or the oldest one when the queue is full.
+    std::size_t
+    push_lossy(T value)
+    {
+        std::size_t ret = 0;
+        bool queued = false;
+        bool discarded = false;
+        {
+            Locker<Mutex> locker(m_mutex);
+
+            ret = m_queue.size();
+            if (ret < m_max_capacity)
+            {
+                m_queue.emplace_back(std::move(value));
+                ret = m_queue.size();
+                queued = true;
+            }
+            else if (m_overflow.kind() == Overflow::DROP_OLDEST && ret > 0)
+            {
+                // Appended first, so that the evicted value can be moved out
+                // into the local one:
+                m_queue.emplace_back(std::move(value));
+                m_queue.evict(value);
+                queued = true;
+                discarded = true;
+            }
+            else
+            {
+                discarded = true;
+            }
+
+            if (queued)
+            {
+                inserted(1);
+            }
+        }
+
+        if (queued)
+        {
+            m_not_empty.notify();
+        }
+
+        if (discarded)
+        {
+            m_stats.evicted();
+            m_overflow.discard(value);
+        }
+
+        return ret;
+    }
+
+    // Waits, if requested until the deadline (if any), for the queue to be
+    // not empty and returns its size. The mutex must be locked by the caller.
+    std::size_t
+    wait_not_empty(bool blocking, const Deadline *deadline)
+    {
+        // A cancelled queue releases blocking consumers even if not empty:
+        std::size_t ret = (blocking && m_cancelled) ? 0 : m_queue.size();
+        QueueStatsRecorder::Wait waiting(m_stats.consumers());
+
+        while (ret == 0 && blocking && !m_cancelled) // <- while needed because of spurious wake-ups.
+        {
+            waiting.start();
+            if (!wait(m_not_empty, deadline))
+            {
+                blocking = false; // Deadline expired, last check.
+            }
+
+            ret = m_cancelled ? 0 : m_queue.size();
+        }
+
+        return ret;
+    }
+
+    // Performs unlock-wait-lock op. on the passed event count, spinning first
+    // without the lock if the wait strategy allows it. Returns false if the
+    // deadline (if any) expired. The mutex must be locked by the caller.
+    bool
+    wait(EventCount &event, const Deadline *deadline)
+    {
+        if (m_strategy.kind() != WaitStrategy::PARK)
+        {
+            // Spinning threads only peek the size of the queue:
+            auto ready = [&]()
+            {
+                std::size_t size = m_size_hint.load(std::memory_order_relaxed);
+                return m_cancelled
+                       || (&event == &m_not_empty ? size > 0
+                                                  : size < m_max_capacity);
+            };
+
+            m_mutex.unlock();
+            bool spun = m_strategy.spin(ready, deadline);
+            m_mutex.lock();
+
+            if (spun || !m_strategy.parks())
+            {
+                return spun;
+            }
+        }
+
+        // The wait is prepared while the mutex is still locked, so that the
+        // notification of any later change can't be missed:
+        EventCount::Key key = event.prepare_wait();
+        m_mutex.unlock();
+        bool ret = event.wait(key, deadline);
+        m_mutex.lock();
+
+        return ret;
+    }
+
+    // Counts the values just inserted, the mutex must be locked by the
+    // caller that notifies the consumers.
+    void
+    inserted(std::size_t count)
+    {
+        std::size_t size = m_queue.size();
+        m_size_hint.store(size, std::memory_order_relaxed);
+        m_stats.pushed(count, size);
+    }
+
+    // Pops the first values, the mutex must be locked by the caller that
+    // notifies the producers.
+    void
+    extract(T *values, std::size_t count)
+    {
+        m_queue.pop_front_n(values, count);
+        m_size_hint.store(m_queue.size(), std::memory_order_relaxed);
+        m_stats.popped(count);
+    }
+
+    const std::size_t m_max_capacity;
+    std::atomic<bool> m_cancelled;
+    WaitStrategy m_strategy;
+    const OverflowPolicy<T> m_overflow;
+
+    mutable Mutex m_mutex;
+    EventCount m_not_empty; // Consumers blocked on an empty queue.
+    EventCount m_not_full;  // Producers blocked on a full queue.
+    Container m_queue;
+
+    // Size of the queue readable without locking, for spinning threads.
+    std::atomic<std::size_t> m_size_hint;
+
+    QueueStatsRecorder m_stats;
+
+};
+
+// ----------------------------------------------------------------------------
+
+#endif // BLOCKINGQUEUE_H
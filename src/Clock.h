@@ -0,0 +1,83 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <chrono>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Monotonic clock used by timed waits.
+ *
+ * It is not affected by changes of the system time, on Linux it is based on
+ * @a CLOCK_MONOTONIC.
+ *
+ * @ingroup threading-base
+ */
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * @brief Point in time, measured by @ref Clock, when a timed wait expires.
+ *
+ * @ingroup threading-base
+ */
+typedef Clock::time_point Deadline;
+
+/**
+ * @brief Returns the deadline that expires after the passed timeout.
+ *
+ * Timeouts too long to be represented saturate to the farthest deadline, so
+ * for example @a std::chrono::hours::max() means "wait forever".
+ *
+ * @ingroup threading-base
+ */
+template<typename Rep, typename Period>
+Deadline
+deadline_after(const std::chrono::duration<Rep, Period> &timeout)
+{
+    const Deadline now = Clock::now();
+
+    if (timeout <= timeout.zero())
+    {
+        return now;
+    }
+
+    // Compares in floating point to avoid overflows converting the units:
+    typedef std::chrono::duration<double> Seconds;
+    if (Seconds(timeout) >= Seconds(Deadline::max() - now))
+    {
+        return Deadline::max();
+    }
+
+    return now + std::chrono::duration_cast<Clock::duration>(timeout);
+}
+
+#endif // CLOCK_H
@@ -0,0 +1,286 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef COALESCINGMESSAGEQUEUE_H
+#define COALESCINGMESSAGEQUEUE_H
+
+#include "BlockingQueue.h"
+#include "Clock.h"
+#include "CoalescingSlots.h"
+#include "QueueStats.h"
+#include "WaitStrategy.h"
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <utility>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Message queue where each message carries a key and supersedes the
+ * pending message with the same key, if any.
+ *
+ * Meant for state updates: when a producer pushes several updates of the
+ * same entity before a consumer gets to them, the consumer processes only
+ * one. A message pushed while another one with the same key is pending is
+ * merged into it (by default it replaces it) and the pending message keeps
+ * its position in the queue; otherwise the message is appended. Both push
+ * and pop take constant time, and the memory is bounded by the number of
+ * distinct pending keys (see @ref CoalescingSlots).
+ *
+ * The queue is unbounded, hence pushes never block. Its statistics count
+ * the merged pushes as pushes, so that @a pushes - @a pops - @a size is the
+ * number of merged messages. Copies of the queue object share the same
+ * queue.
+ *
+ * @note
+ * - Only the pop methods of this class can (optionally) block the calling
+ *   thread.
+ * - This class is 100% thread safe.
+ *
+ * @tparam Key Type of the keys, hashable, copyable and default
+ *         constructible.
+ *
+ * @tparam M Type of the messages, it must be default constructible and
+ *         movable.
+ *
+ * @tparam Merge Function object called as @a merge(pending, incoming) with
+ *         the queue locked, to merge an incoming message into the pending
+ *         one with the same key (see @ref ReplacePending).
+ *
+ * @tparam Hash Hash function of the keys.
+ *
+ * @ingroup threading-high
+ */
+template<typename Key,
+         typename M,
+         typename Merge = ReplacePending<M>,
+         typename Hash = std::hash<Key> >
+class CoalescingMessageQueueT
+{
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param merge Function merging incoming messages into pending ones.
+     *
+     * @param wait_strategy How blocked consumers wait for the queue to become
+     *        ready.
+     */
+    explicit CoalescingMessageQueueT(const Merge &merge = Merge(),
+                                     const WaitStrategy &wait_strategy
+                                         = WaitStrategy())
+            :
+            m_impl(std::make_shared<Implementation>(
+                    std::numeric_limits<std::size_t>::max(),
+                    wait_strategy,
+                    OverflowPolicy<Entry>(),
+                    merge))
+    {
+    }
+
+    /**
+     * @brief Pushes a copy of one message into the queue.
+     *
+     * @param key The key of the message.
+     *
+     * @param message The message, merged into the pending one with the same
+     *        key if any.
+     *
+     * @return The number of messages pending after the insertion, that is at
+     * least @a one.
+     *
+     * @pre
+     * - The queue have not been cancelled.
+     */
+    std::size_t
+    push(const Key &key, const M &message)
+    {
+        return m_impl->emplace(false, nullptr, key, message);
+    }
+
+    /**
+     * @brief Moves one message into the queue.
+     *
+     * @copydetails push(const Key &key, const M &message)
+     */
+    std::size_t
+    push(const Key &key, M &&message)
+    {
+        return m_impl->emplace(false, nullptr, key, std::move(message));
+    }
+
+    /**
+     * @brief Pops one message and its key from the queue.
+     *
+     * @param[out] key The key of the popped message, assigned only in case
+     *             of success.
+     *
+     * @copydetails MessageQueueT::pop
+     */
+    std::size_t
+    pop(Key &key, M &dst_message, bool block)
+    {
+        return pop_entry(key, dst_message, block, nullptr);
+    }
+
+    /**
+     * @brief Pops one message from the queue.
+     *
+     * @copydetails MessageQueueT::pop
+     */
+    std::size_t
+    pop(M &dst_message, bool block)
+    {
+        Key key;
+        return pop_entry(key, dst_message, block, nullptr);
+    }
+
+    /**
+     * @brief Pops one message and its key from the queue waiting at most
+     * until the passed deadline.
+     *
+     * @copydetails IMessageQueue::pop_until
+     */
+    std::size_t
+    pop_until(Key &key, M &dst_message, const Deadline &deadline)
+    {
+        return pop_entry(key, dst_message, true, &deadline);
+    }
+
+    /**
+     * @brief Pops one message and its key from the queue waiting at most for
+     * the passed timeout.
+     *
+     * Same as @ref pop_until with a deadline computed by @ref deadline_after.
+     */
+    template<typename Rep, typename Period>
+    std::size_t
+    pop_for(Key &key,
+            M &dst_message,
+            const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return pop_until(key, dst_message, deadline_after(timeout));
+    }
+
+    /**
+     * @copydoc IMessageQueue::cancel()
+     */
+    void
+    cancel()
+    {
+        m_impl->cancel();
+    }
+
+    /**
+     * @copydoc IMessageQueue::is_cancelled()
+     */
+    bool
+    is_cancelled() const
+    {
+        return m_impl->is_cancelled();
+    }
+
+    /**
+     * @brief Returns the number of pending messages, that is the number of
+     * distinct pending keys.
+     */
+    std::size_t
+    size() const
+    {
+        return m_impl->size();
+    }
+
+    /**
+     * @copydoc IMessageQueue::size_hint()
+     */
+    std::size_t
+    size_hint() const
+    {
+        return m_impl->size_hint();
+    }
+
+    /**
+     * @copydoc IMessageQueue::stats()
+     */
+    QueueStats
+    stats() const
+    {
+        return m_impl->stats();
+    }
+
+    /**
+     * @copydoc IMessageQueue::add_listener()
+     */
+    void
+    add_listener(IEventListener &listener)
+    {
+        m_impl->add_listener(listener);
+    }
+
+    /**
+     * @copydoc IMessageQueue::remove_listener()
+     */
+    void
+    remove_listener(IEventListener &listener)
+    {
+        m_impl->remove_listener(listener);
+    }
+
+private:
+
+    typedef CoalescingSlots<Key, M, Merge, Hash> Slots;
+    typedef typename Slots::Entry Entry;
+    typedef BlockingQueue<Entry, Slots> Implementation;
+
+    std::size_t
+    pop_entry(Key &key, M &dst_message, bool block, const Deadline *deadline)
+    {
+        Entry entry;
+        std::size_t ret = m_impl->pop(entry, block, deadline);
+        if (ret > 0)
+        {
+            key = std::move(entry.first);
+            dst_message = std::move(entry.second);
+        }
+
+        return ret;
+    }
+
+    std::shared_ptr<Implementation> m_impl;
+
+};
+
+// ----------------------------------------------------------------------------
+
+#endif // COALESCINGMESSAGEQUEUE_H
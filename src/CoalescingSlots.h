@@ -0,0 +1,251 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef COALESCINGSLOTS_H
+#define COALESCINGSLOTS_H
+
+#include "SlabAllocator.h"
+#include "SlotRing.h"
+
+#include <cstddef>
+#include <functional>
+#include <unordered_map>
+#include <utility>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Default merge function of @ref CoalescingSlots: the pending message
+ * is replaced by the incoming one.
+ *
+ * @ingroup threading-base
+ */
+template<typename M>
+struct ReplacePending
+{
+    void
+    operator()(M &pending, M &&incoming) const
+    {
+        pending = std::move(incoming);
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief FIFO sequence of keyed messages where at most one message is
+ * pending for each key.
+ *
+ * Entries are pairs of key and message kept into a @ref SlotRing, and an
+ * index maps each pending key to the sequence number of its entry. Inserting
+ * a message whose key is already pending merges it into the pending one,
+ * that keeps its position; otherwise the entry is appended. Both insertion
+ * and extraction take constant time and the memory is bounded by the number
+ * of distinct pending keys.
+ *
+ * The class exposes the interface expected by @ref BlockingQueue and it is
+ * not thread safe.
+ *
+ * @tparam Key Type of the keys, hashable and copyable.
+ *
+ * @tparam M Type of the messages, it must be movable.
+ *
+ * @tparam Merge Function object called as @a merge(pending, incoming) to
+ *         merge an incoming message (as a rvalue) into the pending one with
+ *         the same key.
+ *
+ * @tparam Hash Hash function of the keys.
+ *
+ * @ingroup threading-base
+ */
+template<typename Key,
+         typename M,
+         typename Merge = ReplacePending<M>,
+         typename Hash = std::hash<Key> >
+class CoalescingSlots
+{
+
+public:
+
+    /**
+     * @brief Type of the entries.
+     */
+    typedef std::pair<Key, M> Entry;
+
+    /**
+     * @brief Constructor.
+     *
+     * @param merge Function merging incoming messages into pending ones.
+     */
+    explicit CoalescingSlots(const Merge &merge = Merge())
+            :
+            m_merge(merge),
+            m_appended(0),
+            m_extracted(0)
+    {
+    }
+
+    CoalescingSlots(const CoalescingSlots &) = delete;
+    CoalescingSlots &operator=(const CoalescingSlots &) = delete;
+
+    /**
+     * @brief Returns the number of pending entries.
+     */
+    std::size_t
+    size() const
+    {
+        return m_entries.size();
+    }
+
+    /**
+     * @brief Inserts a message, merging it into the pending one with the same
+     * key if any.
+     */
+    template<typename K, typename V>
+    void
+    emplace_back(K &&key, V &&message)
+    {
+        insert(std::forward<K>(key), std::forward<V>(message));
+    }
+
+    /**
+     * @brief Inserts an entry, merging it into the pending one with the same
+     * key if any.
+     */
+    void
+    emplace_back(Entry &&entry)
+    {
+        insert(std::move(entry.first), std::move(entry.second));
+    }
+
+    /**
+     * @copydoc emplace_back(Entry &&entry)
+     */
+    void
+    emplace_back(const Entry &entry)
+    {
+        insert(entry.first, entry.second);
+    }
+
+    /**
+     * @brief Inserts copies of the passed entries.
+     */
+    void
+    push_back_n(const Entry *entries, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            insert(entries[i].first, entries[i].second);
+        }
+    }
+
+    /**
+     * @brief Inserts a copy of the entries of a range, until @a max_count
+     * entries have been inserted.
+     *
+     * @copydetails SlotRing::push_back_range
+     */
+    template<typename Iterator>
+    std::size_t
+    push_back_range(Iterator &first, Iterator last, std::size_t max_count)
+    {
+        std::size_t ret = 0;
+        while (first != last && ret < max_count)
+        {
+            const Entry &entry = *first++;
+            insert(entry.first, entry.second);
+            ++ret;
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Moves out the first entries.
+     *
+     * @pre
+     * - There are at least @a count entries.
+     */
+    void
+    pop_front_n(Entry *entries, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            m_index.erase(m_entries[0].first);
+            m_entries.pop_front_n(entries + i, 1);
+            ++m_extracted;
+        }
+    }
+
+    /**
+     * @brief Moves out the first entry, that is the oldest one.
+     *
+     * @pre
+     * - There is at least one entry.
+     */
+    void
+    evict(Entry &entry)
+    {
+        pop_front_n(&entry, 1);
+    }
+
+private:
+
+    typedef std::unordered_map<
+            Key, std::size_t, Hash, std::equal_to<Key>,
+            SlabStdAllocator< std::pair<const Key, std::size_t> > > Index;
+
+    template<typename K, typename V>
+    void
+    insert(K &&key, V &&message)
+    {
+        typename Index::iterator found = m_index.find(key);
+        if (found != m_index.end())
+        {
+            M &pending = m_entries[found->second - m_extracted].second;
+            m_merge(pending, M(std::forward<V>(message)));
+            return;
+        }
+
+        m_entries.emplace_back(std::forward<K>(key), std::forward<V>(message));
+        m_index.emplace(m_entries[m_entries.size() - 1].first, m_appended);
+        ++m_appended;
+    }
+
+    Merge m_merge;
+    SlotRing<Entry> m_entries;
+    Index m_index; // Sequence number of the entry of each pending key.
+
+    std::size_t m_appended;  // Sequence number of the next appended entry.
+    std::size_t m_extracted; // Sequence number of the first entry.
+
+};
+
+// ----------------------------------------------------------------------------
+
+#endif // COALESCINGSLOTS_H
@@ -31,7 +31,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 // ------------------------------------------------------------------------
 
+#include <errno.h>
 #include <pthread.h>
+#include <time.h>
 
 class CondPosix
         : public ICond
@@ -41,7 +43,12 @@ public:
 
     CondPosix()
     {
-        ::pthread_cond_init(&m_cond, nullptr);
+        // Timed waits are measured on the monotonic clock (see Clock):
+        pthread_condattr_t attr;
+        ::pthread_condattr_init(&attr);
+        ::pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        ::pthread_cond_init(&m_cond, &attr);
+        ::pthread_condattr_destroy(&attr);
     }
 
     virtual ~CondPosix()
@@ -60,6 +67,35 @@ public:
         ::pthread_cond_wait(&m_cond, mutex_handle);
     }
 
+    bool
+    wait_until(IMutex *mutex, const Deadline &deadline)
+    {
+        assert(mutex != nullptr);
+
+        pthread_mutex_t *mutex_handle =
+                reinterpret_cast< pthread_mutex_t * >(mutex->handle());
+
+        // Clock is steady_clock, whose epoch is the one of CLOCK_MONOTONIC:
+        Clock::duration since_epoch = deadline.time_since_epoch();
+        if (since_epoch < Clock::duration::zero())
+        {
+            since_epoch = Clock::duration::zero();
+        }
+
+        std::chrono::seconds secs =
+                std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+        std::chrono::nanoseconds nsecs =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        since_epoch - secs);
+
+        struct timespec abstime;
+        abstime.tv_sec = static_cast<time_t>(secs.count());
+        abstime.tv_nsec = static_cast<long>(nsecs.count());
+
+        int ret = ::pthread_cond_timedwait(&m_cond, mutex_handle, &abstime);
+        return ret != ETIMEDOUT;
+    }
+
     void
     signal()
     {
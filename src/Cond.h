@@ -27,6 +27,7 @@ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <Clock.h>
 #include <Mutex.h>
 
 #include <assert.h>
@@ -88,6 +89,28 @@ public:
      */
     virtual void wait(IMutex *mutex) = 0;
 
+    /**
+     * @brief The calling thread will wait until the condition variable is
+     * signaled by another thread or until the passed deadline expires.
+     *
+     * Same as @ref wait, but the mutex is locked back and the method returns
+     * also when the deadline expires.
+     *
+     * @param mutex The mutex to be unlocked/locked.
+     *
+     * @param deadline Point in time measured on the monotonic @ref Clock when
+     *        the wait expires.
+     *
+     * @return @a false if the deadline expired, @a true otherwise.
+     *
+     * @pre
+     * -# The passed mutex is currently locked by the calling thread.
+     *
+     * @post
+     * -# The passed mutex is locked back by the calling thread.
+     */
+    virtual bool wait_until(IMutex *mutex, const Deadline &deadline) = 0;
+
     /**
      * @brief Resumes at least one single thread that is waiting for the
      * condition.
@@ -161,6 +184,28 @@ public:
         m_cond->wait(mutex.interface());
     }
 
+    /**
+     * @copydoc ICond::wait_until
+     */
+    bool wait_until(Mutex &mutex, const Deadline &deadline)
+    {
+        return m_cond->wait_until(mutex.interface(), deadline);
+    }
+
+    /**
+     * @brief The calling thread will wait until the condition variable is
+     * signaled by another thread or until the passed timeout expires.
+     *
+     * Same as @ref wait_until with a deadline computed by @ref
+     * deadline_after.
+     */
+    template<typename Rep, typename Period>
+    bool wait_for(Mutex &mutex,
+                  const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return m_cond->wait_until(mutex.interface(), deadline_after(timeout));
+    }
+
     /**
      * @copydoc ICond::signal
      */
@@ -0,0 +1,287 @@
+/**
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "DelayQueue.h"
+
+#include "Locker.h"
+#include "Task.h"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#include <assert.h>
+
+// -----------------------------------------------------------------------------
+
+class DelayQueueTimer
+        :
+                public ITask
+{
+
+    DelayQueue &m_queue;
+
+public:
+
+    DelayQueueTimer(DelayQueue &queue)
+            : m_queue(queue)
+    {
+    }
+
+    virtual void
+    execute()
+    {
+        m_queue.run();
+    }
+
+};
+
+// -----------------------------------------------------------------------------
+
+DelayQueue::DelayQueue(IMessageQueue &target, Clock::duration resolution)
+        :
+        m_target(target),
+        m_resolution(resolution),
+        m_origin(Clock::now()),
+        m_wake(0),
+        m_cancelled(false)
+{
+    // Precondition verification:
+    assert(resolution > Clock::duration::zero());
+
+    m_thread = IThread::create(Task(new DelayQueueTimer(*this)));
+}
+
+// -----------------------------------------------------------------------------
+
+DelayQueue::~DelayQueue()
+{
+    std::vector<Message> pending;
+    join(pending);
+}
+
+// -----------------------------------------------------------------------------
+
+TimerId
+DelayQueue::push_at(const Deadline &deadline,
+                    Message message,
+                    Clock::duration period)
+{
+    // Precondition verification:
+    assert(message.get() != nullptr);
+
+    std::uint64_t period_ticks = 0;
+    if (period > Clock::duration::zero())
+    {
+        // Rounded up, never shorter than one tick:
+        period_ticks = std::uint64_t((period + m_resolution
+                                      - Clock::duration(1)) / m_resolution);
+    }
+
+    const std::uint64_t tick = tick_after(deadline);
+
+    Locker<Mutex> locker(m_mutex);
+    assert(!m_cancelled);
+
+    // An idle wheel jumps to the present, so that the timer thread doesn't
+    // step through the time elapsed meanwhile:
+    if (m_wheel.size() == 0)
+    {
+        m_wheel.advance(tick_before(Clock::now()), [](Message &, bool) { });
+    }
+
+    TimerId ret = m_wheel.insert(tick, std::move(message), period_ticks);
+
+    // Wakes up the timer thread if it sleeps past the new deadline:
+    if (m_wake != 0 && std::max(tick, m_wheel.now() + 1) < m_wake)
+    {
+        m_wake = 0;
+        m_wakeup.signal();
+    }
+
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+
+bool
+DelayQueue::cancel(const TimerId &timer)
+{
+    Locker<Mutex> locker(m_mutex);
+    return m_wheel.cancel(timer);
+}
+
+// -----------------------------------------------------------------------------
+
+std::size_t
+DelayQueue::size() const
+{
+    Locker<Mutex> locker(m_mutex);
+    return m_wheel.size();
+}
+
+// -----------------------------------------------------------------------------
+
+void
+DelayQueue::cancel()
+{
+    Locker<Mutex> locker(m_mutex);
+    m_cancelled = true;
+    m_wakeup.signal();
+}
+
+// -----------------------------------------------------------------------------
+
+void
+DelayQueue::join(std::vector<Message> &pending)
+{
+    cancel();
+
+    if (m_thread)
+    {
+        m_thread->join();
+        m_thread.reset();
+    }
+
+    Locker<Mutex> locker(m_mutex);
+    m_wheel.clear([&pending](Message &message)
+                  {
+                      pending.push_back(std::move(message));
+                  });
+
+    std::move(m_rejected.begin(), m_rejected.end(),
+              std::back_inserter(pending));
+    m_rejected.clear();
+}
+
+// -----------------------------------------------------------------------------
+
+void
+DelayQueue::run()
+{
+    // Due messages, flagged when periodic:
+    typedef std::pair<Message, bool> Due;
+    std::vector<Due> due;
+
+    m_mutex.lock();
+    while (!m_cancelled)
+    {
+        m_wheel.advance(tick_before(Clock::now()),
+                        [&due](Message &message, bool periodic)
+                        {
+                            due.push_back(Due(std::move(message), periodic));
+                        });
+
+        if (due.empty())
+        {
+            m_wake = m_wheel.next_tick();
+
+            Deadline deadline;
+            if (deadline_of(m_wake, deadline))
+            {
+                m_wakeup.wait_until(m_mutex, deadline);
+            }
+            else
+            {
+                m_wakeup.wait(m_mutex);
+            }
+
+            continue;
+        }
+
+        // Pushes unlocked, so that a full target doesn't hold back the
+        // scheduling threads:
+        m_wake = 0;
+        m_mutex.unlock();
+
+        // Rejected occurrences of periodic messages are dropped, since the
+        // messages are still scheduled:
+        std::size_t rejected = 0;
+        for (auto &entry: due)
+        {
+            if (m_target.push(entry.first, true) == 0 && !entry.second)
+            {
+                due[rejected++].first = std::move(entry.first);
+            }
+        }
+
+        m_mutex.lock();
+        for (std::size_t i = 0; i < rejected; ++i)
+        {
+            m_rejected.push_back(std::move(due[i].first));
+        }
+        due.clear();
+    }
+    m_mutex.unlock();
+}
+
+// -----------------------------------------------------------------------------
+
+std::uint64_t
+DelayQueue::tick_before(const Deadline &deadline) const
+{
+    if (deadline <= m_origin)
+    {
+        return 0;
+    }
+
+    return std::uint64_t((deadline - m_origin) / m_resolution);
+}
+
+// -----------------------------------------------------------------------------
+
+std::uint64_t
+DelayQueue::tick_after(const Deadline &deadline) const
+{
+    if (deadline <= m_origin)
+    {
+        return 0;
+    }
+
+    const Clock::duration elapsed = deadline - m_origin;
+    return std::uint64_t(elapsed / m_resolution)
+           + (elapsed % m_resolution != Clock::duration::zero() ? 1 : 0);
+}
+
+// -----------------------------------------------------------------------------
+
+bool
+DelayQueue::deadline_of(std::uint64_t tick, Deadline &deadline) const
+{
+    // Ticks too far to be represented mean "never":
+    if (tick > std::uint64_t((Deadline::max() - m_origin) / m_resolution))
+    {
+        return false;
+    }
+
+    deadline = m_origin + m_resolution * Clock::rep(tick);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,230 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef DELAYQUEUE_H
+#define DELAYQUEUE_H
+
+#include "Clock.h"
+#include "Cond.h"
+#include "MessageQueue.h"
+#include "Mutex.h"
+#include "Thread.h"
+#include "TimingWheel.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Identifies a message scheduled by a @ref DelayQueue in order to
+ * cancel it.
+ *
+ * @ingroup threading-high
+ */
+typedef TimingWheel<Message>::Handle TimerId;
+
+/**
+ * @brief Holds messages back until given deadlines, then pushes them into a
+ * target queue.
+ *
+ * Scheduled messages are timers of a @ref TimingWheel, so scheduling and
+ * cancelling cost O(1) even with millions of them pending. One timer thread
+ * sleeps until the nearest deadline and pushes the due messages into the
+ * target, where they become visible to its consumers.
+ *
+ * Deadlines are rounded up to the resolution of the queue: messages are
+ * never pushed early, and late by up to one resolution plus the scheduling
+ * latency of the timer thread. Messages due at the same tick are pushed in
+ * order of scheduling.
+ *
+ * Periodic messages are pushed at a fixed rate, once per interval from their
+ * first deadline, and the same message is pushed each time. A timer thread
+ * that falls behind pushes the missed occurrences at once.
+ *
+ * @note
+ * - The timer thread pushes blocking: a full target delays the following
+ *   messages too.
+ * - One-shot messages rejected by the target, when it is cancelled, are
+ *   kept and handed back by @ref join.
+ *
+ * The class is 100% thread safe.
+ *
+ * @ingroup threading-high
+ */
+class DelayQueue
+{
+
+public:
+
+    /**
+     * @brief Constructor, starts the timer thread.
+     *
+     * @param target The queue where due messages are pushed.
+     *
+     * @param resolution Duration of one tick of the timing wheel, that is the
+     *        granularity of the deadlines.
+     *
+     * @pre
+     * - The target outlives the queue.
+     * - The resolution is positive.
+     */
+    explicit DelayQueue(IMessageQueue &target,
+                        Clock::duration resolution
+                        = std::chrono::milliseconds(1));
+
+    /**
+     * @brief Destructor.
+     *
+     * Same as @ref join, pending messages are discarded.
+     */
+    ~DelayQueue();
+
+    DelayQueue(const DelayQueue &) = delete;
+    DelayQueue &operator=(const DelayQueue &) = delete;
+
+    /**
+     * @brief Schedules a message to be pushed at the passed deadline.
+     *
+     * @param deadline Point in time, measured on the monotonic @ref Clock,
+     *        when the message is due. Past deadlines are due at the next
+     *        tick.
+     *
+     * @param message The message to be scheduled.
+     *
+     * @param period If positive, the message is pushed again every @a period
+     *        after the deadline, until cancelled.
+     *
+     * @return The identifier of the scheduled message.
+     *
+     * @pre
+     * - The parameter message is not null.
+     * - The queue have not been cancelled.
+     */
+    TimerId push_at(const Deadline &deadline,
+                    Message message,
+                    Clock::duration period = Clock::duration::zero());
+
+    /**
+     * @brief Schedules a message to be pushed after the passed delay.
+     *
+     * Same as @ref push_at with a deadline computed by @ref deadline_after.
+     */
+    template<typename Rep, typename Period>
+    TimerId
+    push_after(const std::chrono::duration<Rep, Period> &delay,
+               Message message)
+    {
+        return push_at(deadline_after(delay), message);
+    }
+
+    /**
+     * @brief Schedules a message to be pushed every @a interval, the first
+     * time after one interval.
+     *
+     * Same as @ref push_at with a deadline computed by @ref deadline_after
+     * and a period of @a interval.
+     */
+    template<typename Rep, typename Period>
+    TimerId
+    push_every(const std::chrono::duration<Rep, Period> &interval,
+               Message message)
+    {
+        return push_at(deadline_after(interval), message,
+                       std::chrono::duration_cast<Clock::duration>(interval));
+    }
+
+    /**
+     * @brief Cancels a scheduled message, periodic ones included.
+     *
+     * An occurrence being pushed by the timer thread may still reach the
+     * target.
+     *
+     * @return @a true if the message was scheduled, @a false if it has
+     * already been pushed or cancelled.
+     */
+    bool cancel(const TimerId &timer);
+
+    /**
+     * @brief Returns the number of scheduled messages.
+     */
+    std::size_t size() const;
+
+    /**
+     * @brief Stops the timer thread, messages are not pushed anymore.
+     *
+     * The cancelled status is not reversible.
+     *
+     * @warning Doesn't wait for the timer thread to terminate, see @ref join.
+     */
+    void cancel();
+
+    /**
+     * @brief Cancels and waits for the termination of the timer thread,
+     * handing back the messages not pushed.
+     *
+     * @param[out] pending Vector where scheduled messages, periodic ones
+     *             once, and one-shot messages rejected by the target are
+     *             appended.
+     */
+    void join(std::vector<Message> &pending);
+
+private:
+
+    friend class DelayQueueTimer;
+
+    // Body of the timer thread:
+    void run();
+
+    // Converts points in time to ticks of the wheel and back:
+    std::uint64_t tick_before(const Deadline &deadline) const;
+    std::uint64_t tick_after(const Deadline &deadline) const;
+    bool deadline_of(std::uint64_t tick, Deadline &deadline) const;
+
+    IMessageQueue &m_target;
+    const Clock::duration m_resolution;
+    const Deadline m_origin;
+
+    mutable Mutex m_mutex;
+    Cond m_wakeup;
+    TimingWheel<Message> m_wheel;
+
+    // Tick the timer thread sleeps until, zero while it is awake:
+    std::uint64_t m_wake;
+
+    std::vector<Message> m_rejected;
+    bool m_cancelled;
+
+    Thread m_thread;
+
+};
+
+#endif // DELAYQUEUE_H
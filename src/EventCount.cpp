@@ -0,0 +1,321 @@
+/**
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "EventCount.h"
+#include "Mutex.h"
+
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+// ------------------------------------------------------------------------
+
+#if defined(__linux__)
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+// The futex word is the 32 bits value of the atomic:
+static_assert(sizeof(std::atomic<EventCount::Key>) == sizeof(int),
+              "The epoch must be usable as futex word.");
+
+int *
+futex_word(std::atomic<EventCount::Key> &epoch)
+{
+    return reinterpret_cast<int *>(&epoch);
+}
+
+// Sleeps while the word holds the expected value, returns false if the
+// deadline (if any) expired.
+bool
+futex_wait(std::atomic<EventCount::Key> &epoch,
+           EventCount::Key expected,
+           const Deadline *deadline)
+{
+    struct timespec abstime;
+    if (deadline != nullptr)
+    {
+        // Clock is steady_clock, whose epoch is the one of CLOCK_MONOTONIC
+        // used by FUTEX_WAIT_BITSET:
+        Clock::duration since_epoch = deadline->time_since_epoch();
+        if (since_epoch < Clock::duration::zero())
+        {
+            since_epoch = Clock::duration::zero();
+        }
+
+        std::chrono::seconds secs =
+                std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+        std::chrono::nanoseconds nsecs =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        since_epoch - secs);
+
+        abstime.tv_sec = static_cast<time_t>(secs.count());
+        abstime.tv_nsec = static_cast<long>(nsecs.count());
+    }
+
+    long ret = ::syscall(SYS_futex, futex_word(epoch),
+                         FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG,
+                         static_cast<int>(expected),
+                         deadline != nullptr ? &abstime : nullptr,
+                         nullptr,
+                         FUTEX_BITSET_MATCH_ANY);
+
+    return ret == 0 || errno != ETIMEDOUT;
+}
+
+void
+futex_wake(std::atomic<EventCount::Key> &epoch, std::size_t count)
+{
+    int num = (count < std::size_t(INT_MAX)) ? static_cast<int>(count)
+                                             : INT_MAX;
+
+    ::syscall(SYS_futex, futex_word(epoch), FUTEX_WAKE_PRIVATE, num,
+              nullptr, nullptr, 0);
+}
+
+} // anonymous namespace
+
+#else // Emulation through mutexes and condition variables.
+
+#include "Cond.h"
+
+namespace {
+
+// Threads sleeping on the same word share one bucket.
+struct Bucket
+{
+    Mutex mutex;
+    Cond cond;
+};
+
+Bucket &
+bucket_of(std::atomic<EventCount::Key> &epoch)
+{
+    static Bucket buckets[64];
+
+    std::uintptr_t address = reinterpret_cast<std::uintptr_t>(&epoch);
+    return buckets[(address / sizeof(epoch)) % 64];
+}
+
+bool
+futex_wait(std::atomic<EventCount::Key> &epoch,
+           EventCount::Key expected,
+           const Deadline *deadline)
+{
+    Bucket &bucket = bucket_of(epoch);
+    Locker<Mutex> locker(bucket.mutex);
+
+    // The notifying thread changes the word before locking the bucket:
+    if (epoch.load() != expected)
+    {
+        return true;
+    }
+
+    if (deadline == nullptr)
+    {
+        bucket.cond.wait(bucket.mutex);
+        return true;
+    }
+
+    return bucket.cond.wait_until(bucket.mutex, *deadline);
+}
+
+void
+futex_wake(std::atomic<EventCount::Key> &epoch, std::size_t)
+{
+    // The bucket may be shared, all its threads are woken:
+    Bucket &bucket = bucket_of(epoch);
+    Locker<Mutex> locker(bucket.mutex);
+    bucket.cond.broadcast();
+}
+
+} // anonymous namespace
+
+#endif
+
+// ------------------------------------------------------------------------
+
+namespace {
+
+// Set into EventCount::m_notifying while the list of listeners changes.
+const EventCount::Key WRITER = EventCount::Key(1) << 31;
+
+} // anonymous namespace
+
+// ------------------------------------------------------------------------
+
+struct EventCount::Listener
+{
+    IEventListener *m_listener;
+    Listener *m_next;
+};
+
+// ------------------------------------------------------------------------
+
+bool
+EventCount::wait(Key key, const Deadline *deadline)
+{
+    bool ret = true;
+
+    // Loops because of spurious wake-ups:
+    while (m_epoch.load(std::memory_order_acquire) == key)
+    {
+        if (!futex_wait(m_epoch, key, deadline))
+        {
+            ret = (m_epoch.load(std::memory_order_acquire) != key);
+            break;
+        }
+    }
+
+    m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+
+    return ret;
+}
+
+// ------------------------------------------------------------------------
+
+void
+EventCount::wake(std::size_t count)
+{
+    futex_wake(m_epoch, count);
+}
+
+// ------------------------------------------------------------------------
+
+void
+EventCount::lock_listeners()
+{
+    // Lists of listeners change rarely, writers just yield to each other:
+    while (m_notifying.fetch_or(WRITER, std::memory_order_acquire) & WRITER)
+    {
+        std::this_thread::yield();
+    }
+
+    // Notifying threads arrived after the flag back off, waits for the
+    // others to leave:
+    while (m_notifying.load(std::memory_order_acquire) != WRITER)
+    {
+        std::this_thread::yield();
+    }
+}
+
+// ------------------------------------------------------------------------
+
+void
+EventCount::unlock_listeners()
+{
+    m_notifying.fetch_and(~WRITER, std::memory_order_release);
+}
+
+// ------------------------------------------------------------------------
+
+void
+EventCount::add_listener(IEventListener &listener)
+{
+    lock_listeners();
+
+    Listener *node = new Listener;
+    node->m_listener = &listener;
+    node->m_next = m_listeners.load(std::memory_order_relaxed);
+
+    m_listeners.store(node, std::memory_order_seq_cst);
+
+    // Pairs with the fence in notify, as the one in prepare_wait: either the
+    // registering thread sees the changed condition or the notifying thread
+    // sees the listener.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    unlock_listeners();
+}
+
+// ------------------------------------------------------------------------
+
+void
+EventCount::remove_listener(IEventListener &listener)
+{
+    lock_listeners();
+
+    Listener *previous = nullptr;
+    Listener *node = m_listeners.load(std::memory_order_relaxed);
+    while (node != nullptr && node->m_listener != &listener)
+    {
+        previous = node;
+        node = node->m_next;
+    }
+
+    assert(node != nullptr);
+    if (node == nullptr)
+    {
+        unlock_listeners();
+        return;
+    }
+
+    if (previous == nullptr)
+    {
+        m_listeners.store(node->m_next, std::memory_order_relaxed);
+    }
+    else
+    {
+        previous->m_next = node->m_next;
+    }
+
+    unlock_listeners();
+
+    delete node;
+}
+
+// ------------------------------------------------------------------------
+
+void
+EventCount::notify_listeners()
+{
+    // Notifying threads share the list, no lock is held while listeners run
+    // so that they can notify other event counts in turn:
+    while (m_notifying.fetch_add(1, std::memory_order_acquire) & WRITER)
+    {
+        m_notifying.fetch_sub(1, std::memory_order_relaxed);
+        std::this_thread::yield();
+    }
+
+    for (Listener *node = m_listeners.load(std::memory_order_relaxed);
+         node != nullptr;
+         node = node->m_next)
+    {
+        node->m_listener->on_notify();
+    }
+
+    m_notifying.fetch_sub(1, std::memory_order_release);
+}
+
+// ------------------------------------------------------------------------
@@ -0,0 +1,282 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef EVENTCOUNT_H
+#define EVENTCOUNT_H
+
+#include "Clock.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#include <assert.h>
+
+// ------------------------------------------------------------------------
+
+/**
+ * @brief Abstract class to be implemented by objects notified along with an
+ * @ref EventCount (see @ref EventCount::add_listener).
+ *
+ * @ingroup threading-base
+ */
+class IEventListener
+{
+
+public:
+
+    /**
+     * @brief Destructor.
+     */
+    virtual ~IEventListener()
+    {
+    }
+
+    /**
+     * @brief Called at each notification of the event counts the listener is
+     * registered to.
+     *
+     * Called by the notifying thread, it must not block.
+     */
+    virtual void on_notify() = 0;
+
+};
+
+// ------------------------------------------------------------------------
+
+/**
+ * @brief Lightweight primitive to wait for a condition published through
+ * lock-free (or independently locked) data.
+ *
+ * An event count lets a thread sleep on a condition without holding any
+ * mutex: the waiting thread first announces itself with @ref prepare_wait,
+ * then checks the condition and finally either calls @ref cancel_wait (the
+ * condition is satisfied) or @ref wait with the key returned by @ref
+ * prepare_wait. The notifying thread changes the condition and calls @ref
+ * notify: a wait prepared before the notification never misses it.
+ *
+ * On Linux waits and wake-ups go straight to @a futex(2), elsewhere they are
+ * emulated with mutexes and condition variables. In both cases @ref notify
+ * doesn't perform any system call when nobody is waiting.
+ *
+ * Listeners can be registered to be notified along with the event count: a
+ * thread can then wait for any of several events by waiting on its own event
+ * count (see @ref Selector), or through a file descriptor (see @ref EventFd).
+ *
+ * @code
+   // Consumer:
+   while (!queue.try_pop(value))
+   {
+       EventCount::Key key = event.prepare_wait();
+       if (queue.try_pop(value))
+       {
+           event.cancel_wait();
+           break;
+       }
+       event.wait(key);
+   }
+
+   // Producer:
+   queue.push(value);
+   event.notify();
+   @endcode
+ *
+ * @ingroup threading-base
+ */
+class EventCount
+{
+
+public:
+
+    /**
+     * @brief Identifies the notifications already seen by a waiting thread.
+     */
+    typedef std::uint32_t Key;
+
+    /**
+     * @brief Constructor.
+     */
+    EventCount()
+            :
+            m_epoch(0),
+            m_waiters(0),
+            m_notifying(0),
+            m_listeners(nullptr)
+    {
+    }
+
+    /**
+     * @brief Destructor.
+     *
+     * @pre
+     * - All the listeners have been removed.
+     */
+    ~EventCount()
+    {
+        // Precondition verification:
+        assert(m_listeners.load(std::memory_order_relaxed) == nullptr);
+    }
+
+    /**
+     * @brief Announces that the calling thread is about to wait.
+     *
+     * Must be followed by either @ref cancel_wait or @ref wait.
+     *
+     * @return The key to be passed to @ref wait.
+     */
+    Key
+    prepare_wait()
+    {
+        m_waiters.fetch_add(1, std::memory_order_seq_cst);
+
+        // Pairs with the fence in notify: either the waiting thread sees the
+        // changed condition or the notifying thread sees the waiting one.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        return m_epoch.load(std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief Withdraws the announcement made by @ref prepare_wait.
+     */
+    void
+    cancel_wait()
+    {
+        m_waiters.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    /**
+     * @brief Blocks the calling thread until a notification newer than the
+     * passed key or until the passed deadline expires.
+     *
+     * Returns immediately if a notification happened since the call to @ref
+     * prepare_wait that returned the key.
+     *
+     * @param key The value returned by @ref prepare_wait.
+     *
+     * @param deadline Point in time when the wait expires, @a nullptr to
+     *        wait indefinitely.
+     *
+     * @return @a false if the deadline expired without notifications.
+     */
+    bool wait(Key key, const Deadline *deadline = nullptr);
+
+    /**
+     * @brief Wakes up to @a count waiting threads.
+     *
+     * To be called after the condition waited for has been changed. The
+     * threads that prepared their wait and are not sleeping yet won't sleep.
+     *
+     * @param count Maximum number of sleeping threads to be woken.
+     */
+    void
+    notify(std::size_t count = 1)
+    {
+        // Pairs with the fence in prepare_wait.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (count == 0)
+        {
+            return;
+        }
+
+        if (m_waiters.load(std::memory_order_relaxed) > 0)
+        {
+            m_epoch.fetch_add(1, std::memory_order_seq_cst);
+            wake(count);
+        }
+
+        if (m_listeners.load(std::memory_order_relaxed) != nullptr)
+        {
+            notify_listeners();
+        }
+    }
+
+    /**
+     * @brief Wakes all waiting threads.
+     */
+    void
+    notify_all()
+    {
+        notify(std::numeric_limits<std::size_t>::max());
+    }
+
+    /**
+     * @brief Registers a listener to be notified at each notification of the
+     * event count.
+     *
+     * The notifications following the registration are not missed: changes
+     * of the condition published after it are seen by the listener.
+     *
+     * Listeners may notify other event counts, themselves walking their own
+     * listeners: each event count guards its list on its own, so nested
+     * notifications never wait for each other.
+     *
+     * @pre
+     * - The listener doesn't notify this event count, neither directly nor
+     *   through the listeners of other event counts.
+     * - The listener doesn't add or remove listeners.
+     * - The listener is removed before either object is destroyed.
+     */
+    void add_listener(IEventListener &listener);
+
+    /**
+     * @brief Removes a listener registered by @ref add_listener.
+     *
+     * Once returned, the listener is not notified anymore.
+     */
+    void remove_listener(IEventListener &listener);
+
+private:
+
+    struct Listener;
+
+    // Wakes up to count threads sleeping on m_epoch.
+    void wake(std::size_t count);
+
+    // Notifies all the registered listeners.
+    void notify_listeners();
+
+    // Excludes the notifying threads and the other writers from the list.
+    void lock_listeners();
+    void unlock_listeners();
+
+    std::atomic<Key> m_epoch;   // Incremented at each notification.
+    std::atomic<Key> m_waiters; // Threads between prepare and cancel/wait.
+
+    // Threads walking the listeners, plus WRITER while the list changes.
+    std::atomic<Key> m_notifying;
+    std::atomic<Listener *> m_listeners;
+
+};
+
+// ------------------------------------------------------------------------
+
+#endif // EVENTCOUNT_H
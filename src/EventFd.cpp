@@ -0,0 +1,151 @@
+/**
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "EventFd.h"
+
+#include <cstdint>
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+
+// -----------------------------------------------------------------------------
+
+EventFd::EventFd()
+        :
+        m_read_fd(-1),
+        m_write_fd(-1),
+        m_signalled(false)
+{
+#if defined(__linux__)
+    m_read_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    m_write_fd = m_read_fd;
+#else
+    int fds[2];
+    if (::pipe(fds) == 0)
+    {
+        for (int fd: fds)
+        {
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+            ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+
+        m_read_fd = fds[0];
+        m_write_fd = fds[1];
+    }
+#endif
+
+    assert(m_read_fd >= 0);
+}
+
+// -----------------------------------------------------------------------------
+
+EventFd::~EventFd()
+{
+    if (m_write_fd != m_read_fd)
+    {
+        ::close(m_write_fd);
+    }
+
+    if (m_read_fd >= 0)
+    {
+        ::close(m_read_fd);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+int
+EventFd::fd() const
+{
+    return m_read_fd;
+}
+
+// -----------------------------------------------------------------------------
+
+void
+EventFd::signal()
+{
+    // Only the first notification since the last reset writes:
+    if (m_signalled.load(std::memory_order_relaxed)
+        || m_signalled.exchange(true, std::memory_order_acq_rel))
+    {
+        return;
+    }
+
+#if defined(__linux__)
+    const std::uint64_t value = 1;
+#else
+    const char value = 1;
+#endif
+
+    ssize_t ret;
+    do
+    {
+        ret = ::write(m_write_fd, &value, sizeof(value));
+    }
+    while (ret < 0 && errno == EINTR);
+}
+
+// -----------------------------------------------------------------------------
+
+void
+EventFd::reset()
+{
+    // Empties the descriptor. Meanwhile notifications still see the flag set
+    // and don't write:
+    char buffer[64];
+    ssize_t ret;
+    do
+    {
+        ret = ::read(m_read_fd, buffer, sizeof(buffer));
+    }
+    while (ret > 0 || (ret < 0 && errno == EINTR));
+
+    // Notifications from now on write again. Pairs with the fence in
+    // EventCount::notify: either the caller draining the queues sees the
+    // pushed messages or the notifying thread sees the cleared flag.
+    m_signalled.store(false, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+// -----------------------------------------------------------------------------
+
+void
+EventFd::on_notify()
+{
+    signal();
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef EVENTFD_H
+#define EVENTFD_H
+
+#include "EventCount.h"
+
+#include <atomic>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief File descriptor that becomes readable when the queues it listens to
+ * receive messages, so that they can be waited for by @a poll(2), @a
+ * select(2) or @a epoll(7) along with sockets and timers.
+ *
+ * On Linux the descriptor is an @a eventfd(2), elsewhere the read end of a
+ * pipe. Notifications are coalesced: after the first one the descriptor
+ * stays readable and further pushes don't perform any system call until the
+ * readiness is consumed by @ref reset.
+ *
+ * @code
+   EventFd ready;
+   queue->add_listener(ready);
+   epoll_ctl(epoll, EPOLL_CTL_ADD, ready.fd(), &event); // EPOLLIN.
+
+   // When the descriptor is reported as readable, and once after adding
+   // the listener for the messages pushed before:
+   ready.reset();
+   while (queue->pop(message, false))
+   {
+       ...
+   }
+
+   queue->remove_listener(ready);
+   @endcode
+ *
+ * @warning Messages pushed before @ref reset can be left unnotified: @ref
+ * reset must be called before draining the queues, not after.
+ *
+ * @ingroup threading-high
+ */
+class EventFd
+        :
+                public IEventListener
+{
+
+public:
+
+    /**
+     * @brief Constructor, creates the descriptor not readable.
+     *
+     * Descriptors are non-blocking and closed on @a exec(3).
+     */
+    EventFd();
+
+    /**
+     * @brief Destructor, closes the descriptor.
+     *
+     * @pre
+     * - The object has been removed from the queues it listens to.
+     */
+    virtual ~EventFd();
+
+    EventFd(const EventFd &) = delete;
+    EventFd &operator=(const EventFd &) = delete;
+
+    /**
+     * @brief Returns the descriptor to be polled for reading, @a -1 if it
+     * couldn't be created.
+     */
+    int fd() const;
+
+    /**
+     * @brief Makes the descriptor readable, if not already.
+     */
+    void signal();
+
+    /**
+     * @brief Consumes the readiness of the descriptor.
+     *
+     * To be called before draining the queues: notifications following the
+     * call make the descriptor readable again.
+     */
+    void reset();
+
+    /**
+     * @copybrief IEventListener::on_notify
+     *
+     * Same as @ref signal.
+     */
+    virtual void on_notify();
+
+private:
+
+    int m_read_fd;
+    int m_write_fd;
+
+    // Set from the first notification until reset, writes are skipped
+    // meanwhile.
+    std::atomic<bool> m_signalled;
+
+};
+
+#endif // EVENTFD_H
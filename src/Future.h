@@ -0,0 +1,438 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FUTURE_H
+#define FUTURE_H
+
+#include "Clock.h"
+#include "EventCount.h"
+#include "Task.h"
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <future>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <assert.h>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Storage of the result of a @ref FutureState, constructed once the
+ * function has returned.
+ */
+template<typename R>
+class FutureValue
+{
+
+    typename std::aligned_storage<sizeof(R), alignof(R)>::type m_storage;
+    bool m_set;
+
+public:
+
+    FutureValue()
+            : m_set(false)
+    {
+    }
+
+    ~FutureValue()
+    {
+        if (m_set)
+        {
+            reinterpret_cast<R *>(&m_storage)->~R();
+        }
+    }
+
+    FutureValue(const FutureValue &) = delete;
+    FutureValue &operator=(const FutureValue &) = delete;
+
+    // Stores the value returned by the function:
+    template<typename Function>
+    void
+    set(Function &function)
+    {
+        new (&m_storage) R(function());
+        m_set = true;
+    }
+
+    R
+    take()
+    {
+        assert(m_set);
+        return std::move(*reinterpret_cast<R *>(&m_storage));
+    }
+
+};
+
+/**
+ * @brief Storage of the result of a @ref FutureState whose function returns
+ * nothing.
+ */
+template<>
+class FutureValue<void>
+{
+
+public:
+
+    template<typename Function>
+    void
+    set(Function &function)
+    {
+        function();
+    }
+
+    void
+    take()
+    {
+    }
+
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Task that publishes the outcome of its execution, either a value
+ * or an exception, to a @ref Future.
+ *
+ * The task is itself the state shared with the future, so that submitting a
+ * function costs one single allocation. The outcome is published through one
+ * atomic flag: reading an outcome already available never takes a lock nor
+ * performs a system call, waiting for it sleeps on an @ref EventCount.
+ *
+ * @tparam R Type of the value, @a void for none. It must be movable.
+ *
+ * @ingroup threading-high
+ */
+template<typename R>
+class FutureState
+        :
+                public ITask
+{
+
+public:
+
+    MESSAGE_TYPE(FutureState, ITask)
+
+    /**
+     * @brief Returns @a true once the outcome is available.
+     */
+    bool
+    is_ready() const
+    {
+        return m_ready.load(std::memory_order_acquire);
+    }
+
+    /**
+     * @brief Waits for the outcome until the passed deadline.
+     *
+     * @return @a true if the outcome is available.
+     */
+    bool
+    wait_until(const Deadline &deadline)
+    {
+        while (!is_ready())
+        {
+            EventCount::Key key = m_ready_event.prepare_wait();
+            if (is_ready())
+            {
+                m_ready_event.cancel_wait();
+                break;
+            }
+
+            if (!m_ready_event.wait(key, &deadline))
+            {
+                return is_ready();
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Waits for the outcome and takes it.
+     *
+     * @return The value returned by the function.
+     *
+     * @throw The exception thrown by the function, or an @a std::future_error
+     * with code @a broken_promise if the task has been cancelled.
+     *
+     * @pre
+     * - The outcome has not been taken yet.
+     */
+    R
+    get()
+    {
+        wait_until(Deadline::max());
+
+        if (m_exception)
+        {
+            std::rethrow_exception(m_exception);
+        }
+
+        return m_value.take();
+    }
+
+    /**
+     * @copydoc ITask::is_handed_back
+     *
+     * Only if asked when the function was submitted (see @ref
+     * IThreadPool::submit).
+     */
+    virtual bool
+    is_handed_back() const
+    {
+        return m_handed_back;
+    }
+
+    /**
+     * @brief Breaks the promise of an outcome: the future throws an @a
+     * std::future_error with code @a broken_promise.
+     */
+    virtual void
+    cancel()
+    {
+        m_exception = std::make_exception_ptr(
+                std::future_error(std::future_errc::broken_promise));
+        set_ready();
+    }
+
+protected:
+
+    explicit FutureState(bool handed_back)
+            : m_ready(false),
+              m_handed_back(handed_back)
+    {
+    }
+
+    // Publishes the outcome and wakes the waiting threads:
+    void
+    set_ready()
+    {
+        m_ready.store(true, std::memory_order_release);
+        m_ready_event.notify_all();
+    }
+
+    FutureValue<R> m_value;
+    std::exception_ptr m_exception;
+
+private:
+
+    std::atomic<bool> m_ready;
+    EventCount m_ready_event;
+    const bool m_handed_back;
+
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Task that executes a function submitted to a pool (see @ref
+ * IThreadPool::submit).
+ *
+ * @tparam R Type of the value returned by the function.
+ *
+ * @tparam Function A function class that can be called without any
+ *         parameter, stored by value.
+ *
+ * @ingroup threading-high
+ */
+template<typename R, typename Function>
+class SubmittedTask
+        :
+                public FutureState<R>
+{
+
+    Function m_function;
+
+public:
+
+    MESSAGE_TYPE(SubmittedTask, FutureState<R>)
+
+    SubmittedTask(Function function, bool handed_back)
+            : FutureState<R>(handed_back),
+              m_function(std::move(function))
+    {
+    }
+
+    /**
+     * @copybrief ITask::execute
+     *
+     * Calls the function and publishes what it returns or throws.
+     */
+    virtual void
+    execute()
+    {
+        try
+        {
+            this->m_value.set(m_function);
+        }
+        catch (...)
+        {
+            this->m_exception = std::current_exception();
+        }
+
+        this->set_ready();
+    }
+
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Outcome of a function submitted to a pool, available once the
+ * function has been executed (see @ref IThreadPool::submit).
+ *
+ * Like @a std::future, the outcome can be taken once through @ref get.
+ *
+ * @tparam R Type of the value returned by the function, @a void for none.
+ *
+ * @ingroup threading-high
+ */
+template<typename R>
+class Future
+{
+
+    std::shared_ptr<FutureState<R>> m_state;
+
+public:
+
+    /**
+     * @brief Constructs a future without any outcome.
+     */
+    Future()
+    {
+    }
+
+    /**
+     * @brief Constructs the future of the passed task.
+     */
+    explicit Future(std::shared_ptr<FutureState<R>> state)
+            : m_state(std::move(state))
+    {
+    }
+
+    /**
+     * @brief Returns @a true if the future has an outcome to be taken.
+     */
+    bool
+    valid() const
+    {
+        return m_state.get() != nullptr;
+    }
+
+    /**
+     * @brief Returns @a true once the outcome is available.
+     *
+     * @pre
+     * - The future is valid.
+     */
+    bool
+    is_ready() const
+    {
+        return m_state->is_ready();
+    }
+
+    /**
+     * @brief Waits for the outcome.
+     *
+     * @warning A worker waiting for a function still pending in its own
+     * pool may wait forever, see @ref TaskGroup for nested parallelism.
+     *
+     * @pre
+     * - The future is valid.
+     */
+    void
+    wait() const
+    {
+        m_state->wait_until(Deadline::max());
+    }
+
+    /**
+     * @brief Waits for the outcome until the passed deadline.
+     *
+     * @return @a true if the outcome is available.
+     *
+     * @pre
+     * - The future is valid.
+     */
+    bool
+    wait_until(const Deadline &deadline) const
+    {
+        return m_state->wait_until(deadline);
+    }
+
+    /**
+     * @brief Waits for the outcome for the passed timeout.
+     *
+     * Same as @ref wait_until with a deadline computed by @ref
+     * deadline_after.
+     */
+    template<typename Rep, typename Period>
+    bool
+    wait_for(const std::chrono::duration<Rep, Period> &timeout) const
+    {
+        return wait_until(deadline_after(timeout));
+    }
+
+    /**
+     * @brief Waits for the outcome and takes it, the future is not valid
+     * anymore.
+     *
+     * @copydetails FutureState::get
+     *
+     * @pre
+     * - The future is valid.
+     */
+    R
+    get()
+    {
+        std::shared_ptr<FutureState<R>> state(std::move(m_state));
+        return state->get();
+    }
+
+    /**
+     * @brief Returns the task executing the function, that is the one popped
+     * from the pool when it is handed back.
+     *
+     * @pre
+     * - The future is valid.
+     */
+    Task
+    task() const
+    {
+        return m_state;
+    }
+
+};
+
+#endif // FUTURE_H
@@ -27,8 +27,13 @@ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include "SlabAllocator.h"
+
 #include <assert.h>
+#include <atomic>
 #include <memory>
+#include <type_traits>
+#include <utility>
 
 #ifndef MESSAGE_H
 #define MESSAGE_H
@@ -46,10 +51,64 @@ class IMessage;
 */
 typedef std::shared_ptr<IMessage> Message;
 
+/**
+ * @brief Tag identifying a message class without relying on RTTI.
+ *
+ * @see message_type_id(), MESSAGE_TYPE
+ *
+ * @ingroup threading-high
+ */
+typedef const void *MessageTypeId;
+
+/**
+ * @brief Returns the tag of the message class @a T.
+ *
+ * The tag is the address of a static variable owned by the template instance,
+ * hence it is unique for each class and is resolved at link time.
+ *
+ * @ingroup threading-high
+ */
+template<typename T>
+MessageTypeId
+message_type_id()
+{
+    static const char tag = 0;
+    return &tag;
+}
+
+/**
+ * @brief Registers the type tag of a message class.
+ *
+ * To be placed in the public section of every class derived from @ref
+ * IMessage that is extracted through a typed pop (e.g. @ref
+ * IMessageQueue::popT), so that the extracted type can be verified without
+ * RTTI. When built without RTTI, typed pops of classes without a tag are
+ * not verified at all (see @ref message_cast).
+ *
+ * @param Class The class being declared.
+ * @param Base The direct base class, itself derived from @ref IMessage.
+ *
+ * @ingroup threading-high
+ */
+#define MESSAGE_TYPE(Class, Base) \
+    typedef Class MessageTypeClass; \
+    virtual bool \
+    is_a(MessageTypeId type) const \
+    { \
+        return type == message_type_id<Class>() || Base::is_a(type); \
+    }
+
 /**
  * @brief Abstract class to be implemented to describe a Message that need to be
  * executed.
  *
+ * Every message embeds the link used by intrusive queues (see @ref
+ * MpscQueue), together with a reference to itself that is set only while the
+ * message is linked. That reference keeps a linked message alive after the
+ * pusher released it, and is moved to the consumer when the message is popped
+ * or released by the queue when destroyed: a message is never kept alive by
+ * itself once no queue links it anymore.
+ *
  * @ingroup threading-high
  */
 class IMessage
@@ -57,6 +116,100 @@ class IMessage
 
 public:
 
+    /**
+     * @brief Number of priority levels honoured by priority queues (see
+     * @ref IMessageQueue::BACKEND_PRIORITY).
+     */
+    static const unsigned PRIORITY_LEVELS = 32;
+
+    /**
+     * @brief The class whose tag is registered, redefined by @ref
+     * MESSAGE_TYPE.
+     */
+    typedef IMessage MessageTypeClass;
+
+    /**
+     * @brief Constructor.
+     *
+     * @param priority Priority of the message, higher values are popped
+     *        first by priority queues. Other queues ignore it.
+     *
+     * @pre
+     * - The priority is less than @ref PRIORITY_LEVELS.
+     */
+    explicit IMessage(unsigned priority = 0)
+            :
+            m_next(nullptr),
+            m_priority(priority)
+    {
+        // Precondition verification:
+        assert(priority < PRIORITY_LEVELS);
+    }
+
+    /**
+     * @brief Copy constructor.
+     *
+     * The queue link is not copied: the new message is not queued anywhere.
+     */
+    IMessage(const IMessage &other)
+            :
+            m_next(nullptr),
+            m_priority(other.m_priority)
+    {
+    }
+
+    /**
+     * @brief Assignment operator.
+     *
+     * The queue link is not copied: the message stays queued where it is.
+     */
+    IMessage &
+    operator=(const IMessage &other)
+    {
+        m_priority = other.m_priority;
+        return *this;
+    }
+
+    /**
+     * @brief Returns the priority of the message.
+     */
+    unsigned
+    priority() const
+    {
+        return m_priority;
+    }
+
+    /**
+     * @brief Changes the priority of the message.
+     *
+     * @param priority The new priority, higher values are popped first by
+     *        priority queues.
+     *
+     * @pre
+     * - The priority is less than @ref PRIORITY_LEVELS.
+     * - The message is not queued.
+     */
+    void
+    set_priority(unsigned priority)
+    {
+        // Precondition verification:
+        assert(priority < PRIORITY_LEVELS);
+
+        m_priority = priority;
+    }
+
+    /**
+     * @brief Tells whether the message is an instance of the class identified
+     * by @a type or of a class derived from it.
+     *
+     * Only classes registered with @ref MESSAGE_TYPE are recognised.
+     */
+    virtual bool
+    is_a(MessageTypeId type) const
+    {
+        return type == message_type_id<IMessage>();
+    }
+
     /**
      * @brief Destructor.
      */
@@ -64,8 +217,119 @@ public:
     {
     }
 
+private:
+
+    friend class MpscQueue;
+    friend class WorkStealingDeque;
+
+    // Link used by intrusive queues, so that queuing a message never
+    // allocates. A message can be linked into one such queue at a time.
+    std::atomic<IMessage *> m_next;
+
+    // Keeps the message alive while it is linked: set when the message is
+    // linked and moved out when it is detached, so that the owner of the
+    // link (e.g. MpscQueue) releases it when destroyed with the message
+    // still linked.
+    Message m_self;
+
+    unsigned m_priority;
+
 };
 
 // -----------------------------------------------------------------------------
 
+/**
+ * @brief Tells whether @a message is an instance of @a Derived.
+ *
+ * Relies on the tags registered with @ref MESSAGE_TYPE and, when available,
+ * falls back to RTTI for classes without a tag.
+ *
+ * @ingroup threading-high
+ */
+template<typename Derived>
+bool
+message_is(const IMessage &message)
+{
+    if (message.is_a(message_type_id<Derived>()))
+    {
+        return true;
+    }
+
+#if defined(__GXX_RTTI) || defined(_CPPRTTI)
+    // Casting a pointer variable, the address of a reference is never null:
+    const IMessage *pointer = &message;
+    return dynamic_cast<const Derived *>(pointer) != nullptr;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief Tells whether the type of messages can be compared with @a Derived
+ * by @ref message_is.
+ *
+ * That is always possible with RTTI, otherwise only if @a Derived is
+ * registered with @ref MESSAGE_TYPE.
+ *
+ * @ingroup threading-high
+ */
+template<typename Derived>
+bool
+message_is_verifiable()
+{
+#if defined(__GXX_RTTI) || defined(_CPPRTTI)
+    return true;
+#else
+    return std::is_same<typename Derived::MessageTypeClass, Derived>::value;
+#endif
+}
+
+/**
+ * @brief Casts a shared pointer to a message to a derived class.
+ *
+ * The cast is static: the type of the message is only verified by an
+ * assertion, so that release builds pay nothing for it. Without RTTI the
+ * type of classes not registered with @ref MESSAGE_TYPE can't be verified,
+ * so the cast is not checked at all for them.
+ *
+ * @pre
+ * - The message is null or an instance of @a Derived (see @ref message_is).
+ *
+ * @ingroup threading-high
+ */
+template<typename Derived, typename Base>
+std::shared_ptr<Derived>
+message_cast(const std::shared_ptr<Base> &message)
+{
+    // Precondition verification:
+    assert(!message
+           || !message_is_verifiable<Derived>()
+           || message_is<Derived>(*message));
+
+    return std::static_pointer_cast<Derived>(message);
+}
+
+// -----------------------------------------------------------------------------
+
+/**
+ * @brief Creates a message of class @a T.
+ *
+ * The message and its reference count share one block of @ref
+ * SlabAllocator, so creating a message on one thread and releasing it on
+ * another doesn't go through the global allocator.
+ *
+ * @param args Arguments forwarded to the constructor of @a T.
+ *
+ * @ingroup threading-high
+ */
+template<typename T, typename... Args>
+std::shared_ptr<T>
+make_message(Args &&... args)
+{
+    return std::allocate_shared<T>(SlabStdAllocator<T>(),
+                                   std::forward<Args>(args)...);
+}
+
+// -----------------------------------------------------------------------------
+
 #endif // MESSAGE_H
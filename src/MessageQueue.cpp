@@ -28,30 +28,36 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "MessageQueue.h"
-#include "Mutex.h"
-#include "Cond.h"
+#include "BlockingQueue.h"
+#include "MessageQueueBackends.h"
+#include "PriorityBuckets.h"
+#include "SlotRing.h"
 
-#include <deque>
+#include <utility>
 
 // -----------------------------------------------------------------------------
 
+/**
+ * Mutex based queue: messages are kept into a Container, that is either a
+ * @ref SlotRing for plain FIFO order or a @ref PriorityBuckets for priority
+ * order (see @ref BlockingQueue).
+ */
+template<typename Container>
 class MessageQueueImpl: public IMessageQueue
 {
-    typedef Locker<Mutex> Locker;
-
-    std::size_t m_max_capacity;
-    volatile bool m_cancelled;
 
-    mutable Mutex m_mutex;
-    mutable Cond m_cond;
-    std::deque<Message> m_queue;
+    BlockingQueue<Message, Container> m_queue;
 
 public:
 
-    MessageQueueImpl(std::size_t max_capacity)
+    template<typename... Args>
+    MessageQueueImpl(std::size_t max_capacity,
+                     const WaitStrategy &wait_strategy,
+                     const OverflowPolicy<Message> &overflow,
+                     Args &&... container_args)
             :
-            m_max_capacity(max_capacity),
-            m_cancelled(false)
+            m_queue(max_capacity, wait_strategy, overflow,
+                    std::forward<Args>(container_args)...)
     {
     }
 
@@ -67,70 +73,57 @@ public:
     virtual std::size_t
     pop(Message &message, bool blocking)
     {
-        std::size_t ret = 0;
+        return m_queue.pop(message, blocking, nullptr);
+    }
 
-        // Blocking implementation:
-        if (blocking)
-        {
-            Locker locker(m_mutex);
+    // -------------------------------------------------------------------------
 
-            while (!m_cancelled) // <- while needed because of spurious wake-ups.
-            {
-                ret = m_queue.size();
-                if (ret > 0)
-                {
-                    message = m_queue.front();
-                    m_queue.pop_front();
-                    break;
-                }
-
-                m_cond.wait(m_mutex); // Performs unlock-wait-lock op.
-                if (m_cancelled)
-                {
-                    break;
-                }
-            }
-        }
-        else
-        {
-            Locker locker(m_mutex);
+    virtual std::size_t
+    pop_until(Message &message, const Deadline &deadline)
+    {
+        return m_queue.pop(message, true, &deadline);
+    }
 
-            ret = m_queue.size();
-            if (ret > 0)
-            {
-                message = m_queue.front();
-                m_queue.pop_front();
-            }
-        }
+    // -------------------------------------------------------------------------
 
-        return ret;
+    virtual std::size_t
+    push(Message message, bool blocking)
+    {
+        return m_queue.emplace(blocking, nullptr, std::move(message));
     }
 
     // -------------------------------------------------------------------------
 
     virtual std::size_t
-    push(Message message)
+    push_until(Message message, const Deadline &deadline)
     {
-        std::size_t ret = 0;
-        Locker locker(m_mutex);
+        return m_queue.emplace(true, &deadline, std::move(message));
+    }
 
-        ret = m_queue.size();
-        if (ret < m_max_capacity)
-        {
-            m_queue.push_back(message);
+    // -------------------------------------------------------------------------
 
-            ret++;
-            if (ret == 1)
-            {
-                m_cond.signal();
-            }
-        }
-        else
-        {
-            ret = 0; // Failure.
-        }
+    virtual std::size_t
+    push_bulk(const Message *messages, std::size_t count)
+    {
+        return m_queue.push_bulk(messages, count);
+    }
 
-        return ret;
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    pop_bulk(Message *messages, std::size_t max_count, bool blocking)
+    {
+        return m_queue.pop_bulk(messages, max_count, blocking);
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    pop_bulk_until(Message *messages,
+                   std::size_t max_count,
+                   const Deadline &deadline)
+    {
+        return m_queue.pop_bulk_until(messages, max_count, deadline);
     }
 
     // -------------------------------------------------------------------------
@@ -138,9 +131,7 @@ public:
     virtual void
     cancel()
     {
-        Locker locker(m_mutex);
-        m_cancelled = true;
-        m_cond.broadcast();
+        m_queue.cancel();
     }
 
     // -------------------------------------------------------------------------
@@ -148,7 +139,7 @@ public:
     virtual bool
     is_cancelled() const
     {
-        return m_cancelled;
+        return m_queue.is_cancelled();
     }
 
     // -------------------------------------------------------------------------
@@ -157,18 +148,91 @@ public:
     std::size_t
     size() const
     {
-        Locker locker(m_mutex);
         return m_queue.size();
     }
 
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    size_hint() const
+    {
+        return m_queue.size_hint();
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual QueueStats
+    stats() const
+    {
+        return m_queue.stats();
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual void
+    add_listener(IEventListener &listener)
+    {
+        m_queue.add_listener(listener);
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual void
+    remove_listener(IEventListener &listener)
+    {
+        m_queue.remove_listener(listener);
+    }
+
 };
 
 // -----------------------------------------------------------------------------
 
 IMessageQueue *
-IMessageQueue::create(std::size_t max_capacity)
+IMessageQueue::create(const Options &options)
 {
-    return new MessageQueueImpl(max_capacity);
+    const std::size_t max_capacity = options.max_capacity();
+    const WaitStrategy &wait_strategy = options.wait_strategy();
+    const OverflowPolicy<Message> &overflow = options.overflow();
+
+    const bool bounded =
+            (max_capacity != std::numeric_limits<std::size_t>::max());
+
+    switch (options.backend())
+    {
+        case BACKEND_RING:
+            if (bounded)
+            {
+                return create_ring_message_queue(max_capacity, wait_strategy,
+                                                 overflow);
+            }
+            return create_segmented_message_queue(wait_strategy);
+
+        case BACKEND_SPSC:
+            // Evicting the oldest message would make the producer a second
+            // consumer:
+            if (bounded && overflow.kind() != Overflow::DROP_OLDEST)
+            {
+                return create_spsc_message_queue(max_capacity, wait_strategy,
+                                                 overflow);
+            }
+            break;
+
+        case BACKEND_PRIORITY:
+            return new MessageQueueImpl<PriorityBuckets>(
+                    max_capacity, wait_strategy, overflow,
+                    options.priority_aging());
+
+        case BACKEND_SHARDED:
+            return create_sharded_message_queue(max_capacity, wait_strategy,
+                                                overflow);
+
+        case BACKEND_MUTEX:
+            break;
+    }
+
+    return new MessageQueueImpl< SlotRing<Message> >(max_capacity,
+                                                     wait_strategy,
+                                                     overflow);
 }
 
 // -----------------------------------------------------------------------------
@@ -30,8 +30,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef MESSAGEQUEUE_H
 #define MESSAGEQUEUE_H
 
+#include "BlockingQueue.h"
+#include "Clock.h"
+#include "EventCount.h"
 #include "Message.h"
+#include "OverflowPolicy.h"
+#include "QueueStats.h"
+#include "SlotRing.h"
+#include "WaitStrategy.h"
 
+#include <algorithm>
 #include <cstddef>
 #include <limits>
 #include <memory>
@@ -51,8 +59,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * of the queue while maintaining a platform-agnostic interface.
  *
  * @note
- * - Only one method of this class can (optionally) block the calling thread:
- *   @ref IMessageQueue::pop.
+ * - Only two methods of this class can (optionally) block the calling thread:
+ *   @ref IMessageQueue::pop when the queue is empty and @ref
+ *   IMessageQueue::push when the queue is full.
  * - This class is 100% thread safe.
  *
  * @ingroup threading-high
@@ -62,18 +71,229 @@ class IMessageQueue
 
 public:
 
+    /**
+     * @brief Number of messages copied into each chunk by the range versions
+     * of the bulk methods.
+     *
+     * Every chunk is inserted with its own synchronization, so a range
+     * longer than this takes the lock (or the equivalent of the backend) once
+     * per chunk rather than once per call.
+     */
+    static const std::size_t BULK_BATCH_SIZE = 64;
+
+    /**
+     * @brief Available implementations of the queue.
+     */
+    enum Backend
+    {
+        /**
+         * Messages are stored into a growable ring (see @ref SlotRing) guarded
+         * by a mutex.
+         */
+        BACKEND_MUTEX,
+
+        /**
+         * Messages are stored into a lock-free ring buffer (see @ref
+         * RingBuffer): producers and consumers never take a lock unless a
+         * consumer needs to wait for an empty queue.
+         *
+         * A finite capacity is rounded up to the next power of two. With an
+         * unlimited capacity messages are stored into linked blocks instead
+         * (see @ref SegmentedQueue), that scale the same way.
+         */
+        BACKEND_RING,
+
+        /**
+         * Messages are stored into a wait-free ring buffer (see @ref
+         * SpscRingBuffer) that can be used by one single producer thread and
+         * one single consumer thread. Debug builds assert if a second
+         * producer or consumer shows up.
+         *
+         * Requires a finite capacity, that is rounded up to the next power of
+         * two.
+         */
+        BACKEND_SPSC,
+
+        /**
+         * Messages are stored into per-priority buckets guarded by a mutex
+         * (see @ref PriorityBuckets): messages with higher @ref
+         * IMessage::priority are popped first, messages with the same
+         * priority are popped in insertion order.
+         */
+        BACKEND_PRIORITY,
+
+        /**
+         * Messages are stored into independent lanes, each one guarded by its
+         * own mutex (see @ref ShardedQueue): every producer thread pushes into
+         * the lane it is bound to, so that many producers don't convoy on one
+         * single mutex.
+         *
+         * Messages pushed by the same thread are popped in insertion order,
+         * there is no global order among different producers.
+         *
+         * Pushes and pops return the size of the lane rather than the one of
+         * the whole queue, and the high water mark of @ref stats is sampled.
+         * Non-blocking pushes racing with pops may report the queue as full
+         * while the pops are freeing it.
+         */
+        BACKEND_SHARDED
+    };
+
+    /**
+     * @brief Options of the queues built by @ref create, each one set by its
+     * own named setter so that only the ones differing from the defaults are
+     * mentioned:
+     *
+     * @code
+       IMessageQueue *queue = IMessageQueue::create(
+               IMessageQueue::Options(1000)
+                       .set_backend(IMessageQueue::BACKEND_PRIORITY)
+                       .set_priority_aging(16));
+       @endcode
+     */
+    class Options
+    {
+
+    public:
+
+        /**
+         * @brief Constructor.
+         *
+         * @param max_capacity Maximum number of messages that can be queued
+         *        at the same time. By default this limit is relaxed as much
+         *        as possible.
+         */
+        explicit Options(std::size_t max_capacity
+                             = std::numeric_limits<std::size_t>::max())
+                :
+                m_max_capacity(max_capacity),
+                m_backend(BACKEND_MUTEX),
+                m_priority_aging(0)
+        {
+        }
+
+        /**
+         * @brief Sets the implementation to be used, @ref BACKEND_MUTEX by
+         * default.
+         *
+         * Backends that require a finite capacity fall back to @ref
+         * BACKEND_MUTEX when the capacity is left unlimited.
+         */
+        Options &
+        set_backend(Backend backend)
+        {
+            m_backend = backend;
+            return *this;
+        }
+
+        /**
+         * @brief Sets the number of pops after which waiting messages are
+         * promoted to the next priority level, so that low priorities cannot
+         * starve.
+         *
+         * Used by @ref BACKEND_PRIORITY only. @a Zero, the default, keeps
+         * priorities strict.
+         */
+        Options &
+        set_priority_aging(std::size_t priority_aging)
+        {
+            m_priority_aging = priority_aging;
+            return *this;
+        }
+
+        /**
+         * @brief Sets how blocked consumers and producers wait for the queue
+         * to become ready: spinning avoids the kernel round trip of parking
+         * when waits are short.
+         */
+        Options &
+        set_wait_strategy(const WaitStrategy &wait_strategy)
+        {
+            m_wait_strategy = wait_strategy;
+            return *this;
+        }
+
+        /**
+         * @brief Sets what a push does when the queue is full: fail (or
+         * wait) as by default, or discard either the pushed message or the
+         * oldest one (see @ref OverflowPolicy).
+         *
+         * @ref BACKEND_SPSC falls back to @ref BACKEND_MUTEX when evicting
+         * the oldest messages.
+         */
+        Options &
+        set_overflow(const OverflowPolicy<Message> &overflow)
+        {
+            m_overflow = overflow;
+            return *this;
+        }
+
+        std::size_t
+        max_capacity() const
+        {
+            return m_max_capacity;
+        }
+
+        Backend
+        backend() const
+        {
+            return m_backend;
+        }
+
+        std::size_t
+        priority_aging() const
+        {
+            return m_priority_aging;
+        }
+
+        const WaitStrategy &
+        wait_strategy() const
+        {
+            return m_wait_strategy;
+        }
+
+        const OverflowPolicy<Message> &
+        overflow() const
+        {
+            return m_overflow;
+        }
+
+    private:
+
+        std::size_t m_max_capacity;
+        Backend m_backend;
+        std::size_t m_priority_aging;
+        WaitStrategy m_wait_strategy;
+        OverflowPolicy<Message> m_overflow;
+
+    };
+
     /**
      * @brief Factory method to create a message queue implemented for the
      * current platform.
      *
+     * @param options The capacity, the implementation and the behavior of
+     *        the queue (see @ref Options).
+     *
+     * @return The newly created message queue.
+     */
+    static IMessageQueue *create(const Options &options);
+
+    /**
+     * @brief Factory method to create a message queue implemented for the
+     * current platform with the default options.
+     *
      * @param max_capacity Maximum number of messages that can be queued at
      *        the same time. By default this limit is relaxed as much as
      *        possible.
      *
      * @return The newly created message queue.
      */
-    static IMessageQueue *create(std::size_t max_capacity
-                                     = std::numeric_limits<std::size_t>::max());
+    static IMessageQueue *
+    create(std::size_t max_capacity = std::numeric_limits<std::size_t>::max())
+    {
+        return create(Options(max_capacity));
+    }
 
     /**
     * @brief Destructor.
@@ -87,17 +307,37 @@ public:
      *
      * @param message The message to be inserted.
      *
+     * @param blocking If set to @a true and the maximum allowed capacity
+     *        have been reached, the method blocks the current thread until
+     *        another thread pops a message or until the queue is cancelled.
+     *
      * @return
      * - On success, the number of messages contained by the queue after the
      *   insertion, that is at least @a one.
      * - On failure, @a zero. This may happen if the maximum allowed capacity
-     *   for the queue have been reached.
+     *   for the queue have been reached (and the queue have been cancelled,
+     *   when blocking).
+     *
+     * With a lossy @ref OverflowPolicy the push never blocks nor fails: when
+     * the queue is full a message is discarded instead.
      *
      * @pre
      * - The parameter message is not null.
      * - The queue have not been cancelled.
      */
-    virtual std::size_t push(Message message) = 0;
+    virtual std::size_t push(Message message, bool blocking) = 0;
+
+    /**
+     * @brief Pushes one message into the queue without blocking.
+     *
+     * Same as calling @ref push(Message message, bool blocking) with
+     * parameter @a blocking set to @a false.
+     */
+    std::size_t
+    push(Message message)
+    {
+        return push(message, false);
+    }
 
     /**
      * @brief Pops one message from the queue.
@@ -119,6 +359,213 @@ public:
      */
     virtual std::size_t pop(Message &message, bool blocking) = 0;
 
+    /**
+     * @brief Pops one message from the queue waiting at most until the passed
+     * deadline.
+     *
+     * @param[out] message Smart pointer that will be reset with the popped
+     *             message in case of success.
+     *
+     * @param deadline Point in time, measured on the monotonic @ref Clock,
+     *        when the method gives up waiting for a message.
+     *
+     * @return
+     * - On success, the number of messages contained by the queue before the
+     *   extraction, that is at least @a one.
+     * - On failure, @a zero (parameter message is not touched in that case).
+     *   This happens if the deadline expired or the queue have been
+     *   cancelled.
+     *
+     * @pre
+     * - The queue have not been cancelled.
+     */
+    virtual std::size_t pop_until(Message &message,
+                                  const Deadline &deadline) = 0;
+
+    /**
+     * @brief Pops one message from the queue waiting at most for the passed
+     * timeout.
+     *
+     * Same as @ref pop_until with a deadline computed by @ref deadline_after.
+     */
+    template<typename Rep, typename Period>
+    std::size_t
+    pop_for(Message &message,
+            const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return pop_until(message, deadline_after(timeout));
+    }
+
+    /**
+     * @brief Pushes one message into the queue waiting at most until the
+     * passed deadline for a free slot.
+     *
+     * @param message The message to be inserted.
+     *
+     * @param deadline Point in time, measured on the monotonic @ref Clock,
+     *        when the method gives up waiting for a free slot.
+     *
+     * @return
+     * - On success, the number of messages contained by the queue after the
+     *   insertion, that is at least @a one.
+     * - On failure, @a zero. This happens if the queue is still full when the
+     *   deadline expires or the queue have been cancelled.
+     *
+     * @pre
+     * - The parameter message is not null.
+     * - The queue have not been cancelled.
+     */
+    virtual std::size_t push_until(Message message,
+                                   const Deadline &deadline) = 0;
+
+    /**
+     * @brief Pushes one message into the queue waiting at most for the
+     * passed timeout for a free slot.
+     *
+     * Same as @ref push_until with a deadline computed by @ref
+     * deadline_after.
+     */
+    template<typename Rep, typename Period>
+    std::size_t
+    push_for(Message message,
+             const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return push_until(message, deadline_after(timeout));
+    }
+
+    /**
+     * @brief Pushes many messages into the queue at once.
+     *
+     * Messages are inserted in order until the maximum allowed capacity for
+     * the queue is reached. The whole batch is inserted with one single
+     * synchronization and resumes as many waiting consumers as needed.
+     *
+     * @param messages Array of messages to be inserted.
+     *
+     * @param count Number of messages in the array.
+     *
+     * @return The number of inserted messages, that are the first ones of the
+     * array. It is less than @a count if the maximum allowed capacity for the
+     * queue have been reached, unless the @ref OverflowPolicy is lossy.
+     *
+     * @pre
+     * - The messages are not null.
+     * - The queue have not been cancelled.
+     */
+    virtual std::size_t push_bulk(const Message *messages,
+                                  std::size_t count) = 0;
+
+    /**
+     * @brief Pushes a range of messages into the queue at once.
+     *
+     * Same as @ref push_bulk(const Message *messages, std::size_t count) for
+     * any range of elements convertible to @ref Message.
+     *
+     * The range is copied on the stack in chunks of @ref BULK_BATCH_SIZE
+     * messages and each chunk is inserted with its own synchronization: only
+     * ranges up to that size are inserted atomically with one single lock.
+     * To insert a longer batch at once pass it as an array instead.
+     *
+     * @param first Iterator to the first message to be inserted.
+     *
+     * @param last Iterator past the last message to be inserted.
+     *
+     * @return The number of inserted messages, that are the first ones of the
+     * range.
+     */
+    template<typename Iterator>
+    std::size_t
+    push_bulk(Iterator first, Iterator last)
+    {
+        std::size_t ret = 0;
+
+        while (first != last)
+        {
+            Message batch[BULK_BATCH_SIZE];
+            std::size_t count = 0;
+            while (first != last && count < BULK_BATCH_SIZE)
+            {
+                batch[count++] = *first++;
+            }
+
+            std::size_t pushed = push_bulk(batch, count);
+            ret += pushed;
+            if (pushed < count)
+            {
+                break;
+            }
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Pops many messages from the queue at once.
+     *
+     * Extracts the available messages, up to @a max_count, with one single
+     * synchronization.
+     *
+     * @param[out] messages Array that will be filled with the popped
+     *             messages.
+     *
+     * @param max_count Maximum number of messages to be popped, that is the
+     *        size of the array.
+     *
+     * @param blocking If set to @a true the method blocks the current thread
+     *        indefinitely until at least one message is pushed into the queue
+     *        by another thread or until the queue is not cancelled.
+     *
+     * @return The number of popped messages, @a zero on failure.
+     *
+     * @pre
+     * - The queue have not been cancelled.
+     */
+    virtual std::size_t pop_bulk(Message *messages,
+                                 std::size_t max_count,
+                                 bool blocking) = 0;
+
+    /**
+     * @brief Pops many messages from the queue, collecting them until @a
+     * max_count messages have been popped or until the passed deadline.
+     *
+     * Meant to drain the queue in micro batches: unlike @ref pop_bulk, the
+     * method doesn't return as soon as some message is available but keeps
+     * waiting for more until the batch is complete or the deadline expires.
+     *
+     * @param[out] messages Array that will be filled with the popped
+     *             messages.
+     *
+     * @param max_count Maximum number of messages to be popped, that is the
+     *        size of the array.
+     *
+     * @param deadline Point in time, measured on the monotonic @ref Clock,
+     *        when the method stops waiting for more messages.
+     *
+     * @return The number of popped messages, @a zero on failure.
+     *
+     * @pre
+     * - The queue have not been cancelled.
+     */
+    virtual std::size_t pop_bulk_until(Message *messages,
+                                       std::size_t max_count,
+                                       const Deadline &deadline) = 0;
+
+    /**
+     * @brief Pops many messages from the queue, collecting them until @a
+     * max_count messages have been popped or until the passed timeout.
+     *
+     * Same as @ref pop_bulk_until with a deadline computed by @ref
+     * deadline_after.
+     */
+    template<typename Rep, typename Period>
+    std::size_t
+    pop_bulk_for(Message *messages,
+                 std::size_t max_count,
+                 const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return pop_bulk_until(messages, max_count, deadline_after(timeout));
+    }
+
     /**
      * @brief Cancel the queue functionality indefinitely releasing any blocked
      * thread.
@@ -141,17 +588,64 @@ public:
      */
     virtual std::size_t size() const = 0;
 
+    /**
+     * @brief Returns the number of messages contained inside the queue,
+     * without ever taking a lock.
+     *
+     * The result may be stale by the time it is returned, but any change
+     * is visible to a thread woken by a listener notified after it (see
+     * @ref add_listener). Backends that track their size without locking
+     * return the same value as @ref size.
+     */
+    virtual std::size_t
+    size_hint() const
+    {
+        return size();
+    }
+
+    /**
+     * @brief Returns a snapshot of the statistics of the queue: high-water
+     * mark, pushed, popped and rejected messages, blocked threads and their
+     * waiting times (see @ref QueueStats).
+     *
+     * Counters are always on and the snapshot is taken without locking the
+     * queue, so it can be polled by a monitoring thread at any time.
+     */
+    virtual QueueStats stats() const = 0;
+
+    /**
+     * @brief Registers an event count to be notified whenever messages are
+     * pushed or the queue is cancelled.
+     *
+     * Used to wait for any of several queues (see @ref Selector).
+     *
+     * @pre
+     * - The listener is removed before either the queue or the listener is
+     *   destroyed.
+     */
+    virtual void add_listener(IEventListener &listener) = 0;
+
+    /**
+     * @brief Removes a listener registered by @ref add_listener.
+     */
+    virtual void remove_listener(IEventListener &listener) = 0;
+
     /**
      * @brief Convenient template method to pop messages.
      *
      * Since by design the user should derive messages from the class @ref
-     * IMessage this template take care to dynamic cast shared pointers to
-     * the user defined derived class.
+     * IMessage this template take care to cast shared pointers to the user
+     * defined derived class (see @ref message_cast).
      *
      * This method is meant to be used when the user uses the queue with one
-     * single derived class and hence don't need to manually dynamic cast every
+     * single derived class and hence don't need to manually cast every
      * popped message from the generic @a IMessage.
      *
+     * @pre
+     * - Every message in the queue is an instance of @a Derived. When RTTI
+     *   is disabled this is verified only if @a Derived is registered with
+     *   @ref MESSAGE_TYPE.
+     *
      * @copydetails pop(Message& message, bool blocking)
      */
     template<typename Derived>
@@ -163,8 +657,7 @@ public:
         if (ret > 0)
         {
             assert(abstract_message.get() != nullptr);
-            message = std::dynamic_pointer_cast<Derived>(abstract_message);
-            assert(message.get() == abstract_message.get());
+            message = message_cast<Derived>(abstract_message);
         }
 
         return ret;
@@ -181,11 +674,19 @@ public:
  * This template class uses compile-time polymorphism to allow message-driven
  * communication and synchronization between two or more threads.
  *
- * The implementation of this template is based on @ref IMessageQueue class.
+ * Messages are kept by value into a growable array of slots (see @ref
+ * SlotRing): queuing a message doesn't allocate unless the array needs to
+ * grow (or to shrink back after a burst), messages can be moved in and out
+ * or built in place, and trivially copyable messages are pushed and popped in
+ * batches with plain memory copies. Copies of the queue object share the same
+ * queue.
+ *
+ * @see @ref SpscMessageQueueT for channels with one single producer and one
+ * single consumer.
  *
  * @note
- * - Only one method of this class can (optionally) block the calling thread:
- *   @ref IMessageQueue::pop.
+ * - Only two methods of this class can (optionally) block the calling thread:
+ *   @ref MessageQueueT::pop and @ref MessageQueueT::push.
  * - This class is 100% thread safe.
  *
  * @ingroup threading-high
@@ -202,15 +703,31 @@ public:
      * @param max_capacity Maximum number of messages that can be queued at
      *        the same time. By default this limit is relaxed as much as
      *        possible.
+     *
+     * @param wait_strategy How blocked consumers and producers wait for the
+     *        queue to become ready.
+     *
+     * @param overflow What a push does when the queue is full (see @ref
+     *        OverflowPolicy).
      */
-    explicit inline MessageQueueT(std::size_t max_capacity
-                                     = std::numeric_limits<std::size_t>::max());
+    explicit MessageQueueT(std::size_t max_capacity
+                               = std::numeric_limits<std::size_t>::max(),
+                           const WaitStrategy &wait_strategy = WaitStrategy(),
+                           const OverflowPolicy<M> &overflow
+                               = OverflowPolicy<M>())
+            :
+            m_impl(std::make_shared<Implementation>(max_capacity,
+                                                    wait_strategy,
+                                                    overflow))
+    {
+    }
 
     /**
      * @brief Pops one message from the queue.
      *
-     * @param[out] dst_message A reference to a message object meant to be set
-     *             with the extracted message only in case of success.
+     * @param[out] dst_message A reference to a message object meant to be
+     *             move-assigned with the extracted message only in case of
+     *             success.
      *
      * @param block If set to @a true the method blocks the current thread
      *        indefinitely until a new message is pushed into the queue
@@ -224,13 +741,21 @@ public:
      * @pre
      * - The queue have not been cancelled.
      */
-    inline std::size_t pop(M &dst_message, bool block);
+    std::size_t
+    pop(M &dst_message, bool block)
+    {
+        return m_impl->pop(dst_message, block, nullptr);
+    }
 
     /**
-     * @brief Pushes one message into the queue.
+     * @brief Pushes a copy of one message into the queue.
      *
      * @param message The message to be inserted.
      *
+     * @param block If set to @a true and the maximum allowed capacity have
+     *        been reached, the method blocks the current thread until another
+     *        thread pops a message or until the queue is cancelled.
+     *
      * @return
      * - On failure, @a zero. This may happen if the maximum allowed capacity
      *   for the queue have been reached.
@@ -240,116 +765,259 @@ public:
      * @pre
      * - The queue have not been cancelled.
      */
-    inline std::size_t push(const M &message);
+    std::size_t
+    push(const M &message, bool block = false)
+    {
+        return m_impl->emplace(block, nullptr, message);
+    }
 
     /**
-     * @copydoc IMessageQueue::cancel()
+     * @brief Moves one message into the queue.
+     *
+     * Same as @ref push(const M &message, bool block), the message is left
+     * untouched on failure.
      */
-    inline void cancel();
+    std::size_t
+    push(M &&message, bool block = false)
+    {
+        return m_impl->emplace(block, nullptr, std::move(message));
+    }
 
     /**
-     * @copydoc IMessageQueue::is_cancelled()
+     * @brief Pushes one message built in place from the passed arguments,
+     * without blocking.
+     *
+     * @param args Arguments passed to the constructor of the message.
+     *
+     * @return
+     * - On failure, @a zero. This may happen if the maximum allowed capacity
+     *   for the queue have been reached.
+     * - On success, the number of messages contained by the queue after the
+     *   insertion that is at least @a one.
      */
-    inline bool is_cancelled() const;
+    template<typename... Args>
+    std::size_t
+    emplace(Args &&... args)
+    {
+        return m_impl->emplace(false, nullptr, std::forward<Args>(args)...);
+    }
 
     /**
-     * @copydoc IMessageQueue::size()
+     * @brief Pops one message from the queue waiting at most until the passed
+     * deadline.
+     *
+     * @copydetails IMessageQueue::pop_until
      */
-    inline std::size_t size() const;
-
-private:
-
-    std::shared_ptr<IMessageQueue> m_impl;
-
-    template<typename P>
-    class MessageImpl
-            : public IMessage
+    std::size_t
+    pop_until(M &dst_message, const Deadline &deadline)
     {
+        return m_impl->pop(dst_message, true, &deadline);
+    }
 
-    public:
+    /**
+     * @brief Pops one message from the queue waiting at most for the passed
+     * timeout.
+     *
+     * Same as @ref pop_until with a deadline computed by @ref deadline_after.
+     */
+    template<typename Rep, typename Period>
+    std::size_t
+    pop_for(M &dst_message, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return pop_until(dst_message, deadline_after(timeout));
+    }
 
-        P m_payload;
+    /**
+     * @brief Pushes one message into the queue waiting at most until the
+     * passed deadline for a free slot.
+     *
+     * @copydetails IMessageQueue::push_until
+     */
+    std::size_t
+    push_until(const M &message, const Deadline &deadline)
+    {
+        return m_impl->emplace(true, &deadline, message);
+    }
 
-        MessageImpl(const P &payload)
-                : m_payload(payload)
-        {
-        }
+    /**
+     * @brief Moves one message into the queue waiting at most until the
+     * passed deadline for a free slot.
+     *
+     * @copydetails IMessageQueue::push_until
+     */
+    std::size_t
+    push_until(M &&message, const Deadline &deadline)
+    {
+        return m_impl->emplace(true, &deadline, std::move(message));
+    }
 
-        virtual ~MessageImpl()
-        {
-        }
-    };
+    /**
+     * @brief Pushes one message into the queue waiting at most for the
+     * passed timeout for a free slot.
+     *
+     * Same as @ref push_until with a deadline computed by @ref
+     * deadline_after.
+     */
+    template<typename Value, typename Rep, typename Period>
+    std::size_t
+    push_for(Value &&message,
+             const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return push_until(std::forward<Value>(message),
+                          deadline_after(timeout));
+    }
 
-};
+    /**
+     * @brief Pushes a range of messages into the queue at once.
+     *
+     * Messages are inserted in order with one single synchronization, until
+     * the maximum allowed capacity is reached.
+     *
+     * @param first Iterator to the first message to be inserted.
+     *
+     * @param last Iterator past the last message to be inserted.
+     *
+     * @return The number of inserted messages, that are the first ones of
+     * the range.
+     */
+    template<typename Iterator>
+    std::size_t
+    push_bulk(Iterator first, Iterator last)
+    {
+        return m_impl->push_range(first, last);
+    }
 
-// ----------------------------------------------------------------------------
+    /**
+     * @brief Pushes an array of messages into the queue at once.
+     *
+     * Same as @ref push_bulk(Iterator first, Iterator last), trivially
+     * copyable messages are copied with plain memory copies.
+     *
+     * @param messages Array of messages to be inserted.
+     *
+     * @param count Number of messages in the array.
+     *
+     * @return The number of inserted messages, that are the first ones of
+     * the array.
+     */
+    std::size_t
+    push_bulk(const M *messages, std::size_t count)
+    {
+        return m_impl->push_bulk(messages, count);
+    }
 
-template<typename M>
-MessageQueueT<M>::MessageQueueT(std::size_t max_capacity)
-        : m_impl(IMessageQueue::create(max_capacity))
-{
-}
+    /**
+     * @brief Pops many messages from the queue at once.
+     *
+     * @copydetails IMessageQueue::pop_bulk
+     */
+    std::size_t
+    pop_bulk(M *dst_messages, std::size_t max_count, bool blocking)
+    {
+        return m_impl->pop_bulk(dst_messages, max_count, blocking);
+    }
 
-// ----------------------------------------------------------------------------
+    /**
+     * @brief Pops many messages from the queue, collecting them until @a
+     * max_count messages have been popped or until the passed deadline.
+     *
+     * @copydetails IMessageQueue::pop_bulk_until
+     */
+    std::size_t
+    pop_bulk_until(M *dst_messages,
+                   std::size_t max_count,
+                   const Deadline &deadline)
+    {
+        return m_impl->pop_bulk_until(dst_messages, max_count, deadline);
+    }
 
-template<typename M>
-std::size_t
-MessageQueueT<M>::pop(M &dst_message, bool blocking)
-{
-    Message abstract_message;
-    std::size_t ret = m_impl->pop(abstract_message, blocking);
+    /**
+     * @brief Pops many messages from the queue, collecting them until @a
+     * max_count messages have been popped or until the passed timeout.
+     *
+     * Same as @ref pop_bulk_until with a deadline computed by @ref
+     * deadline_after.
+     */
+    template<typename Rep, typename Period>
+    std::size_t
+    pop_bulk_for(M *dst_messages,
+                 std::size_t max_count,
+                 const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return pop_bulk_until(dst_messages, max_count, deadline_after(timeout));
+    }
 
-    if (ret > 0)
+    /**
+     * @copydoc IMessageQueue::cancel()
+     */
+    void
+    cancel()
     {
-        assert(nullptr != abstract_message.get());
+        m_impl->cancel();
+    }
 
-        typedef MessageImpl<M> Implementation;
-        auto message =
-                std::dynamic_pointer_cast<Implementation>(abstract_message);
-        assert(message.get() == abstract_message.get());
+    /**
+     * @copydoc IMessageQueue::is_cancelled()
+     */
+    bool
+    is_cancelled() const
+    {
+        return m_impl->is_cancelled();
+    }
 
-        dst_message = message->m_payload;
+    /**
+     * @copydoc IMessageQueue::size()
+     */
+    std::size_t
+    size() const
+    {
+        return m_impl->size();
     }
 
-    return ret;
-}
+    /**
+     * @copydoc IMessageQueue::size_hint()
+     */
+    std::size_t
+    size_hint() const
+    {
+        return m_impl->size_hint();
+    }
 
-// ----------------------------------------------------------------------------
+    /**
+     * @copydoc IMessageQueue::stats()
+     */
+    QueueStats
+    stats() const
+    {
+        return m_impl->stats();
+    }
 
-template<typename M>
-std::size_t
-MessageQueueT<M>::push(const M &message)
-{
-    Message new_message(new MessageImpl<M>(message));
+    /**
+     * @copydoc IMessageQueue::add_listener()
+     */
+    void
+    add_listener(IEventListener &listener)
+    {
+        m_impl->add_listener(listener);
+    }
 
-    return m_impl->push(new_message);
-}
+    /**
+     * @copydoc IMessageQueue::remove_listener()
+     */
+    void
+    remove_listener(IEventListener &listener)
+    {
+        m_impl->remove_listener(listener);
+    }
 
-// ----------------------------------------------------------------------------
+private:
 
-template<typename M>
-void
-MessageQueueT<M>::cancel()
-{
-    m_impl->cancel();
-}
+    typedef BlockingQueue< M, SlotRing<M> > Implementation;
 
-// ----------------------------------------------------------------------------
+    std::shared_ptr<Implementation> m_impl;
 
-template<typename M>
-bool
-MessageQueueT<M>::is_cancelled() const
-{
-    return m_impl->is_cancelled();
-}
+};
 
 // ----------------------------------------------------------------------------
 
-template<typename M>
-std::size_t
-MessageQueueT<M>::size() const
-{
-    return m_impl->size();
-}
-
 #endif // MESSAGEQUEUE_H
@@ -0,0 +1,82 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MESSAGEQUEUEBACKENDS_H
+#define MESSAGEQUEUEBACKENDS_H
+
+#include "MessageQueue.h"
+
+#include <cstddef>
+
+// ----------------------------------------------------------------------------
+// Factories of the implementations selectable by IMessageQueue::create.
+// They are not part of the public interface.
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Creates a lock-free queue (see @ref IMessageQueue::BACKEND_RING).
+ *
+ * @pre
+ * - Parameter @a max_capacity is finite.
+ */
+IMessageQueue *create_ring_message_queue(
+        std::size_t max_capacity,
+        const WaitStrategy &wait_strategy,
+        const OverflowPolicy<Message> &overflow);
+
+/**
+ * @brief Creates a wait-free queue for one producer and one consumer (see
+ * @ref IMessageQueue::BACKEND_SPSC).
+ *
+ * @pre
+ * - Parameter @a max_capacity is finite.
+ * - Parameter @a overflow doesn't evict the oldest messages.
+ */
+IMessageQueue *create_spsc_message_queue(
+        std::size_t max_capacity,
+        const WaitStrategy &wait_strategy,
+        const OverflowPolicy<Message> &overflow);
+
+/**
+ * @brief Creates an unbounded lock-free queue (see @ref
+ * IMessageQueue::BACKEND_RING).
+ */
+IMessageQueue *create_segmented_message_queue(
+        const WaitStrategy &wait_strategy);
+
+/**
+ * @brief Creates a queue made of one lane for each processor (see @ref
+ * IMessageQueue::BACKEND_SHARDED).
+ */
+IMessageQueue *create_sharded_message_queue(
+        std::size_t max_capacity,
+        const WaitStrategy &wait_strategy,
+        const OverflowPolicy<Message> &overflow);
+
+#endif // MESSAGEQUEUEBACKENDS_H
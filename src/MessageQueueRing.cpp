@@ -0,0 +1,494 @@
+/**
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "MessageQueueBackends.h"
+#include "Parker.h"
+#include "QueueStats.h"
+#include "RingBuffer.h"
+#include "SegmentedQueue.h"
+#include "ShardedQueue.h"
+#include "SpscRingBuffer.h"
+
+#include <algorithm>
+#include <thread>
+
+// -----------------------------------------------------------------------------
+
+/**
+ * Lock-free queue: messages are exchanged through a ring buffer (either a
+ * @ref RingBuffer, a @ref SpscRingBuffer or an unbounded @ref
+ * SegmentedQueue), consumers are parked only when the ring is empty and
+ * producers only when it is full. The same engine drives the lanes of a @ref
+ * ShardedQueue, whose locks are private to each lane. Statistics are updated
+ * with relaxed atomic operations along with the ring, except the counters
+ * that a @ref ShardedQueue keeps per lane.
+ */
+template<typename Buffer>
+class MessageQueueLockFree: public IMessageQueue
+{
+
+    Buffer m_ring;
+    Parker m_not_empty;
+    Parker m_not_full;
+    QueueStatsRecorder m_stats;
+    const OverflowPolicy<Message> m_overflow;
+
+public:
+
+    template<typename... Args>
+    MessageQueueLockFree(const WaitStrategy &wait_strategy,
+                         const OverflowPolicy<Message> &overflow,
+                         Args &&... buffer_args)
+            :
+            m_ring(std::forward<Args>(buffer_args)...),
+            m_not_empty(wait_strategy),
+            m_not_full(wait_strategy),
+            m_overflow(overflow)
+    {
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual
+    ~MessageQueueLockFree()
+    {
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    pop(Message &message, bool blocking)
+    {
+        return pop_wait(message, blocking, nullptr);
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    pop_until(Message &message, const Deadline &deadline)
+    {
+        return pop_wait(message, true, &deadline);
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    push(Message message, bool blocking)
+    {
+        return push_wait(message, blocking, nullptr);
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    push_until(Message message, const Deadline &deadline)
+    {
+        return push_wait(message, true, &deadline);
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    push_bulk(const Message *messages, std::size_t count)
+    {
+        if (m_overflow.lossy())
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                Message message(messages[i]);
+                push_lossy(message);
+            }
+
+            return count;
+        }
+
+        std::size_t ret = 0;
+        std::size_t size = 0;
+        while (ret < count)
+        {
+            Message message(messages[ret]);
+            std::size_t pushed = m_ring.try_push(message);
+            if (pushed == 0)
+            {
+                break;
+            }
+            size = std::max(size, pushed);
+            ++ret;
+        }
+
+        count_pushed(ret, size);
+        m_stats.rejected(count - ret);
+        m_not_empty.unpark(ret);
+
+        return ret;
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    pop_bulk(Message *messages, std::size_t max_count, bool blocking)
+    {
+        if (max_count == 0)
+        {
+            return 0;
+        }
+
+        // The first message may be waited for, the others are drained:
+        std::size_t ret = pop_wait(messages[0], blocking, nullptr) ? 1 : 0;
+        if (ret > 0)
+        {
+            ret += drain(messages + 1, max_count - 1);
+        }
+
+        return ret;
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    pop_bulk_until(Message *messages,
+                   std::size_t max_count,
+                   const Deadline &deadline)
+    {
+        // A cancelled queue releases blocking consumers even if not empty:
+        if (is_cancelled())
+        {
+            return 0;
+        }
+
+        std::size_t ret = 0;
+
+        // Collects messages until the batch is complete:
+        while (ret < max_count)
+        {
+            ret += drain(messages + ret, max_count - ret);
+            if (ret == max_count
+                || pop_wait(messages[ret], true, &deadline) == 0)
+            {
+                break;
+            }
+            ++ret;
+        }
+
+        return ret;
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual void
+    cancel()
+    {
+        m_not_empty.cancel();
+        m_not_full.cancel();
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual bool
+    is_cancelled() const
+    {
+        return m_not_empty.is_cancelled();
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual
+    std::size_t
+    size() const
+    {
+        return m_ring.size();
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual QueueStats
+    stats() const
+    {
+        return m_stats.snapshot(m_ring.size());
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual void
+    add_listener(IEventListener &listener)
+    {
+        m_not_empty.add_listener(listener);
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual void
+    remove_listener(IEventListener &listener)
+    {
+        m_not_empty.remove_listener(listener);
+    }
+
+private:
+
+    // Pops one message, waiting if requested until the deadline (if any).
+    std::size_t
+    pop_wait(Message &message, bool blocking, const Deadline *deadline)
+    {
+        // A cancelled queue releases blocking consumers even if not empty:
+        if (blocking && is_cancelled())
+        {
+            return 0;
+        }
+
+        QueueStatsRecorder::Wait waiting(m_stats.consumers());
+        std::size_t ret = m_ring.try_pop(message);
+        if (ret == 0 && blocking)
+        {
+            waiting.start();
+            auto try_pop = [&]() { return m_ring.try_pop(message); };
+            ret = (deadline == nullptr)
+                  ? m_not_empty.park(try_pop)
+                  : m_not_empty.park_until(try_pop, *deadline);
+        }
+
+        if (ret > 0)
+        {
+            count_popped(1);
+            m_not_full.unpark();
+        }
+
+        return ret;
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Pops the available messages without waiting.
+    std::size_t
+    drain(Message *messages, std::size_t max_count)
+    {
+        std::size_t ret = 0;
+        while (ret < max_count && m_ring.try_pop(messages[ret]) > 0)
+        {
+            ++ret;
+        }
+
+        count_popped(ret);
+        m_not_full.unpark(ret);
+
+        return ret;
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Pushes one message, waiting if requested until the deadline (if any).
+    std::size_t
+    push_wait(Message &message, bool blocking, const Deadline *deadline)
+    {
+        if (m_overflow.lossy())
+        {
+            return push_lossy(message);
+        }
+
+        QueueStatsRecorder::Wait waiting(m_stats.producers());
+        std::size_t ret = m_ring.try_push(message);
+        if (ret == 0 && blocking)
+        {
+            waiting.start();
+            auto try_push = [&]() { return m_ring.try_push(message); };
+            ret = (deadline == nullptr)
+                  ? m_not_full.park(try_push)
+                  : m_not_full.park_until(try_push, *deadline);
+        }
+
+        if (ret > 0)
+        {
+            count_pushed(1, ret);
+            m_not_empty.unpark();
+        }
+        else
+        {
+            m_stats.rejected();
+        }
+
+        return ret;
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Pushes one message according to the lossy overflow policy, discarding
+    // either the message itself or the oldest ones when the ring is full.
+    std::size_t
+    push_lossy(Message &message)
+    {
+        std::size_t ret = m_ring.try_push(message);
+
+        // Makes room, unless a consumer does it first:
+        Message evicted;
+        while (ret == 0 && m_overflow.kind() == Overflow::DROP_OLDEST)
+        {
+            if (evict(evicted) > 0)
+            {
+                m_stats.evicted();
+                m_overflow.discard(evicted);
+            }
+
+            ret = m_ring.try_push(message);
+        }
+
+        if (ret == 0)
+        {
+            m_stats.evicted();
+            m_overflow.discard(message);
+            return m_ring.size();
+        }
+
+        count_pushed(1, ret);
+        m_not_empty.unpark();
+
+        return ret;
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Counts pushed messages, see QueueStatsRecorder::pushed.
+    void
+    count_pushed(std::size_t count, std::size_t size)
+    {
+        m_stats.pushed(count, size);
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Counts popped messages, see QueueStatsRecorder::popped.
+    void
+    count_popped(std::size_t count)
+    {
+        m_stats.popped(count);
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Extracts the oldest message to make room for a new one.
+    std::size_t
+    evict(Message &message)
+    {
+        return m_ring.try_pop(message);
+    }
+
+};
+
+// -----------------------------------------------------------------------------
+
+// The lanes of a ShardedQueue count pushes and pops by themselves, so that
+// producers and consumers don't share the counters of the recorder:
+
+template<>
+void
+MessageQueueLockFree< ShardedQueue<Message> >::count_pushed(std::size_t,
+                                                            std::size_t)
+{
+}
+
+template<>
+void
+MessageQueueLockFree< ShardedQueue<Message> >::count_popped(std::size_t)
+{
+}
+
+template<>
+std::size_t
+MessageQueueLockFree< ShardedQueue<Message> >::evict(Message &message)
+{
+    return m_ring.try_evict(message);
+}
+
+template<>
+QueueStats
+MessageQueueLockFree< ShardedQueue<Message> >::stats() const
+{
+    QueueStats ret = m_stats.snapshot(m_ring.size());
+    ret.high_water_mark = m_ring.high_water_mark();
+    ret.pushes = m_ring.pushes();
+    ret.pops = m_ring.pops();
+
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
+
+IMessageQueue *
+create_ring_message_queue(std::size_t max_capacity,
+                          const WaitStrategy &wait_strategy,
+                          const OverflowPolicy<Message> &overflow)
+{
+    return new MessageQueueLockFree< RingBuffer<Message> >(wait_strategy,
+                                                           overflow,
+                                                           max_capacity);
+}
+
+// -----------------------------------------------------------------------------
+
+IMessageQueue *
+create_spsc_message_queue(std::size_t max_capacity,
+                          const WaitStrategy &wait_strategy,
+                          const OverflowPolicy<Message> &overflow)
+{
+    return new MessageQueueLockFree< SpscRingBuffer<Message> >(wait_strategy,
+                                                               overflow,
+                                                               max_capacity);
+}
+
+// -----------------------------------------------------------------------------
+
+IMessageQueue *
+create_segmented_message_queue(const WaitStrategy &wait_strategy)
+{
+    // The queue is never full, hence never overflows:
+    return new MessageQueueLockFree< SegmentedQueue<Message> >(
+            wait_strategy, OverflowPolicy<Message>());
+}
+
+// -----------------------------------------------------------------------------
+
+IMessageQueue *
+create_sharded_message_queue(std::size_t max_capacity,
+                             const WaitStrategy &wait_strategy,
+                             const OverflowPolicy<Message> &overflow)
+{
+    // One lane per processor, at least a few so that threads outnumbering
+    // the processors still spread:
+    const std::size_t MIN_LANES = 4;
+    const std::size_t MAX_LANES = 64;
+    const std::size_t lanes = std::min(
+            MAX_LANES,
+            std::max<std::size_t>(MIN_LANES,
+                                  std::thread::hardware_concurrency()));
+
+    return new MessageQueueLockFree< ShardedQueue<Message> >(wait_strategy,
+                                                             overflow,
+                                                             max_capacity,
+                                                             lanes);
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,409 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MPSCQUEUE_H
+#define MPSCQUEUE_H
+
+#include "Clock.h"
+#include "Message.h"
+#include "Mutex.h"
+#include "Parker.h"
+#include "RingBuffer.h"
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+#include <assert.h>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Intrusive message queue for many producers and one single consumer.
+ *
+ * Messages are chained through the link embedded into @ref IMessage, so
+ * queuing a message never allocates. Pushing costs one atomic exchange on the
+ * head of the chain and one store into the previous node, then a fence and a
+ * read of the sleeping consumers, that are only woken if any (see @ref
+ * Parker::unpark). The consumer walks the chain from the tail without any
+ * atomic read-modify-write (see Dmitry Vyukov's intrusive MPSC queue).
+ *
+ * Consumers are serialized by a mutex while they walk the chain, that
+ * happens once per batch: pops of single messages detach up to @ref
+ * BATCH_SIZE messages at once into a lock-free ring, from where the
+ * following pops take them without locking. Producers never touch the mutex.
+ *
+ * While a message is linked the queue owns it through the self reference
+ * embedded into @ref IMessage, that is moved out when the message is
+ * detached from the chain. The destructor of the queue releases the messages
+ * still linked, so a message can't outlive the queue it is linked into.
+ *
+ * @note
+ * - A message can be linked into one intrusive queue at a time: the same
+ *   message can't be pushed again before being popped.
+ * - The queue doesn't count the linked messages, that would cost producers
+ *   one more contended atomic: pops only tell how many messages have been
+ *   detached from the chain and not popped yet.
+ *
+ * @ingroup threading-base
+ */
+class MpscQueue
+{
+
+public:
+
+    /**
+     * @brief Maximum number of messages detached from the chain at once.
+     */
+    static const std::size_t BATCH_SIZE = 64;
+
+    /**
+     * @brief Constructor.
+     */
+    MpscQueue()
+            :
+            m_head(&m_stub),
+            m_tail(&m_stub),
+            m_ready(BATCH_SIZE)
+    {
+    }
+
+    /**
+     * @brief Destructor.
+     *
+     * Releases the messages still queued.
+     */
+    ~MpscQueue()
+    {
+        Message message;
+        while (unlink(message))
+        {
+            message.reset();
+        }
+    }
+
+    /**
+     * @brief Pushes one message into the queue.
+     *
+     * @param message The message to be inserted.
+     *
+     * @pre
+     * - The parameter message is not null.
+     * - The message is not already queued.
+     */
+    void
+    push(Message message)
+    {
+        assert(message.get() != nullptr);
+
+        IMessage *node = message.get();
+        node->m_self = std::move(message);
+        link(node);
+
+        m_not_empty.unpark();
+    }
+
+    /**
+     * @brief Pops the oldest message from the queue.
+     *
+     * @param[out] message Smart pointer that will be reset with the popped
+     *             message in case of success.
+     *
+     * @param blocking If set to @a true the method blocks the current thread
+     *        indefinitely until a new message is pushed into the queue by
+     *        another thread or until the queue is not cancelled.
+     *
+     * @return
+     * - On success, the number of messages detached from the chain before
+     *   the extraction, that is at least @a one: messages still linked
+     *   behind the batch are not counted.
+     * - On failure, @a zero.
+     */
+    std::size_t
+    pop(Message &message, bool blocking)
+    {
+        std::size_t ret = try_pop(message);
+        if (ret == 0 && blocking)
+        {
+            ret = m_not_empty.park([&]() { return try_pop(message); });
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Pops the oldest message from the queue waiting at most until
+     * the passed deadline.
+     *
+     * @param[out] message Smart pointer that will be reset with the popped
+     *             message in case of success.
+     *
+     * @param deadline Point in time when the method gives up waiting.
+     *
+     * @return
+     * - On success, the number of messages detached from the chain before
+     *   the extraction, that is at least @a one: messages still linked
+     *   behind the batch are not counted.
+     * - On failure, @a zero.
+     */
+    std::size_t
+    pop_until(Message &message, const Deadline &deadline)
+    {
+        std::size_t ret = try_pop(message);
+        if (ret == 0)
+        {
+            ret = m_not_empty.park_until([&]() { return try_pop(message); },
+                                         deadline);
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Pops many messages from the queue at once.
+     *
+     * @param[out] messages Array that will be filled with the popped
+     *             messages.
+     *
+     * @param max_count Maximum number of messages to be popped, that is the
+     *        size of the array.
+     *
+     * @param blocking If set to @a true the method blocks the current thread
+     *        indefinitely until at least one message is pushed into the queue
+     *        or until the queue is not cancelled.
+     *
+     * @return The number of popped messages.
+     */
+    std::size_t
+    pop_bulk(Message *messages, std::size_t max_count, bool blocking)
+    {
+        auto try_drain = [&]() { return drain(messages, max_count); };
+
+        std::size_t ret = try_drain();
+        if (ret == 0 && blocking && max_count > 0)
+        {
+            ret = m_not_empty.park(try_drain);
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Pops many messages from the queue, collecting them until @a
+     * max_count messages have been popped or until the passed deadline.
+     *
+     * @param[out] messages Array that will be filled with the popped
+     *             messages.
+     *
+     * @param max_count Maximum number of messages to be popped, that is the
+     *        size of the array.
+     *
+     * @param deadline Point in time when the method stops waiting for more
+     *        messages.
+     *
+     * @return The number of popped messages.
+     */
+    std::size_t
+    pop_bulk_until(Message *messages,
+                   std::size_t max_count,
+                   const Deadline &deadline)
+    {
+        std::size_t ret = 0;
+
+        while (ret < max_count)
+        {
+            auto try_drain = [&]()
+            {
+                return drain(messages + ret, max_count - ret);
+            };
+
+            ret += try_drain();
+            if (ret == max_count)
+            {
+                break;
+            }
+
+            std::size_t count = m_not_empty.park_until(try_drain, deadline);
+            if (count == 0)
+            {
+                break;
+            }
+            ret += count;
+        }
+
+        return ret;
+    }
+
+    /**
+     * @copydoc IMessageQueue::cancel()
+     */
+    void
+    cancel()
+    {
+        m_not_empty.cancel();
+    }
+
+    /**
+     * @copydoc IMessageQueue::add_listener()
+     */
+    void
+    add_listener(IEventListener &listener)
+    {
+        m_not_empty.add_listener(listener);
+    }
+
+    /**
+     * @copydoc IMessageQueue::remove_listener()
+     */
+    void
+    remove_listener(IEventListener &listener)
+    {
+        m_not_empty.remove_listener(listener);
+    }
+
+private:
+
+    void
+    link(IMessage *node)
+    {
+        node->m_next.store(nullptr, std::memory_order_relaxed);
+        IMessage *prev = m_head.exchange(node, std::memory_order_acq_rel);
+
+        // Until this store the consumer can't reach the node (and the ones
+        // pushed after it):
+        prev->m_next.store(node, std::memory_order_release);
+    }
+
+    std::size_t
+    try_pop(Message &message)
+    {
+        std::size_t ret = m_ready.try_pop(message);
+        if (ret == 0)
+        {
+            refill();
+            ret = m_ready.try_pop(message);
+        }
+
+        return ret;
+    }
+
+    std::size_t
+    drain(Message *messages, std::size_t max_count)
+    {
+        std::size_t ret = 0;
+        while (ret < max_count && m_ready.try_pop(messages[ret]) > 0)
+        {
+            ++ret;
+        }
+
+        // The rest of the batch is detached straight from the chain:
+        if (ret < max_count)
+        {
+            Locker<Mutex> locker(m_consumer_mutex);
+            while (ret < max_count && unlink(messages[ret]))
+            {
+                ++ret;
+            }
+        }
+
+        return ret;
+    }
+
+    void
+    refill()
+    {
+        Locker<Mutex> locker(m_consumer_mutex);
+
+        // Only the thread holding the mutex pushes into the ring, while the
+        // others can only pop from it: the free room can only grow meanwhile.
+        std::size_t room = m_ready.capacity() - m_ready.size();
+
+        Message message;
+        for (std::size_t i = 0; i < room && unlink(message); ++i)
+        {
+            std::size_t pushed = m_ready.try_push(message);
+            assert(pushed > 0);
+            (void) pushed;
+        }
+    }
+
+    bool
+    unlink(Message &message)
+    {
+        IMessage *tail = m_tail;
+        IMessage *next = tail->m_next.load(std::memory_order_acquire);
+
+        // Skips the stub node:
+        if (tail == &m_stub)
+        {
+            if (next == nullptr)
+            {
+                return false;
+            }
+
+            m_tail = next;
+            tail = next;
+            next = next->m_next.load(std::memory_order_acquire);
+        }
+
+        if (next == nullptr)
+        {
+            // The tail is the last linked node, it can be detached only after
+            // putting the stub behind it:
+            if (tail != m_head.load(std::memory_order_acquire))
+            {
+                return false; // A producer is linking a new node right now.
+            }
+
+            link(&m_stub);
+            next = tail->m_next.load(std::memory_order_acquire);
+            if (next == nullptr)
+            {
+                return false;
+            }
+        }
+
+        m_tail = next;
+        message = std::move(tail->m_self);
+
+        return true;
+    }
+
+    std::atomic<IMessage *> m_head; // Last pushed node, written by producers.
+    char m_pad[CACHE_LINE_SIZE];
+    IMessage *m_tail;               // Next node to pop, owned by the consumer.
+    IMessage m_stub;
+
+    Mutex m_consumer_mutex;
+    RingBuffer<Message> m_ready;    // Messages detached from the chain.
+    Parker m_not_empty;
+
+};
+
+#endif // MPSCQUEUE_H
@@ -0,0 +1,161 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef OVERFLOWPOLICY_H
+#define OVERFLOWPOLICY_H
+
+#include <functional>
+#include <utility>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Kinds of behavior of a bounded queue pushed when full, see @ref
+ * OverflowPolicy.
+ *
+ * @ingroup threading-base
+ */
+struct Overflow
+{
+    /**
+     * @brief Available behaviors.
+     */
+    enum Kind
+    {
+        /**
+         * The push fails (or waits for a free slot, when blocking).
+         */
+        REJECT,
+
+        /**
+         * The pushed value is discarded, the queued ones are kept.
+         */
+        DROP_NEWEST,
+
+        /**
+         * The oldest queued value, that is the next one to be popped, is
+         * discarded to make room for the pushed one. Priority queues discard
+         * the oldest value of the lowest priority instead, that may be the
+         * pushed one.
+         */
+        DROP_OLDEST
+    };
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Describes what a bounded queue does when pushed while full.
+ *
+ * Lossy policies never block nor fail a push: they are meant for streams,
+ * such as telemetry or samples, where losing some values is better than
+ * slowing down the producers. Discarded values are counted by the queue
+ * statistics (see @ref QueueStats::evicted) and handed to an optional
+ * callback, for example to recycle their memory.
+ *
+ * @code
+   IMessageQueue *queue = IMessageQueue::create(
+           IMessageQueue::Options(1000).set_overflow(
+                   OverflowPolicy<Message>(Overflow::DROP_OLDEST,
+                                           [](Message &&sample) { ... })));
+   @endcode
+ *
+ * @tparam T Type of the values of the queue.
+ *
+ * @ingroup threading-base
+ */
+template<typename T>
+class OverflowPolicy
+        :
+                public Overflow
+{
+
+public:
+
+    /**
+     * @brief Function called with each discarded value.
+     *
+     * It's called by the pushing thread with the queue unlocked, so it may
+     * use the queue.
+     */
+    typedef std::function<void(T &&)> Discard;
+
+    /**
+     * @brief Constructor.
+     *
+     * @param kind The behavior of the queue when full.
+     *
+     * @param discard Function called with each discarded value, if any.
+     */
+    OverflowPolicy(Kind kind = REJECT, Discard discard = Discard())
+            :
+            m_kind(kind),
+            m_discard(std::move(discard))
+    {
+    }
+
+    /**
+     * @brief Returns the behavior of the queue when full.
+     */
+    Kind
+    kind() const
+    {
+        return m_kind;
+    }
+
+    /**
+     * @brief Returns @a true if values are discarded instead of rejected.
+     */
+    bool
+    lossy() const
+    {
+        return m_kind != REJECT;
+    }
+
+    /**
+     * @brief Hands a discarded value to the callback, if any.
+     */
+    void
+    discard(T &value) const
+    {
+        if (m_discard)
+        {
+            m_discard(std::move(value));
+        }
+    }
+
+private:
+
+    Kind m_kind;
+    Discard m_discard;
+
+};
+
+// ----------------------------------------------------------------------------
+
+#endif // OVERFLOWPOLICY_H
@@ -0,0 +1,218 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef PARKER_H
+#define PARKER_H
+
+#include "Clock.h"
+#include "EventCount.h"
+#include "WaitStrategy.h"
+
+#include <atomic>
+#include <cstddef>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Parks threads waiting for a resource exchanged through lock-free
+ * structures.
+ *
+ * Waiting threads sleep on an @ref EventCount, this way the threads releasing
+ * the resource perform a system call only when somebody is actually parked
+ * and no lock is involved on either side. Before parking, threads may spin
+ * according to the @ref WaitStrategy of the parker.
+ *
+ * @code
+   // Consumer:
+   std::size_t ret = buffer.try_pop(value);
+   if (ret == 0)
+   {
+       ret = parker.park([&]() { return buffer.try_pop(value); });
+   }
+
+   // Producer:
+   if (buffer.try_push(value) > 0)
+   {
+       parker.unpark();
+   }
+   @endcode
+ *
+ * @ingroup threading-base
+ */
+class Parker
+{
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param strategy How threads wait before (or instead of) being parked.
+     */
+    explicit Parker(const WaitStrategy &strategy = WaitStrategy())
+            :
+            m_strategy(strategy),
+            m_cancelled(false)
+    {
+    }
+
+    /**
+     * @brief Blocks the calling thread until the passed function succeeds or
+     * until the parker is cancelled.
+     *
+     * @param try_acquire Function without parameters that tries to acquire
+     *        the resource returning a non-zero value on success.
+     *
+     * @return The value returned by the successful call to @a try_acquire or
+     * @a zero if the parker has been cancelled.
+     */
+    template<typename Function>
+    std::size_t
+    park(Function try_acquire)
+    {
+        return wait(try_acquire, nullptr);
+    }
+
+    /**
+     * @brief Blocks the calling thread until the passed function succeeds,
+     * until the parker is cancelled or until the passed deadline expires.
+     *
+     * @param try_acquire Function without parameters that tries to acquire
+     *        the resource returning a non-zero value on success.
+     *
+     * @param deadline Point in time when the wait expires.
+     *
+     * @return The value returned by the successful call to @a try_acquire or
+     * @a zero if the parker has been cancelled or the deadline expired.
+     */
+    template<typename Function>
+    std::size_t
+    park_until(Function try_acquire, const Deadline &deadline)
+    {
+        return wait(try_acquire, &deadline);
+    }
+
+    /**
+     * @brief Resumes up to @a count parked threads, if any.
+     *
+     * To be called after @a count units of the resource have been released.
+     *
+     * @param count Number of released units.
+     */
+    void
+    unpark(std::size_t count = 1)
+    {
+        m_event.notify(count);
+    }
+
+    /**
+     * @brief Releases all parked threads indefinitely.
+     */
+    void
+    cancel()
+    {
+        m_cancelled = true;
+        m_event.notify_all();
+    }
+
+    /**
+     * @brief Returns @a true if the parker have been cancelled.
+     */
+    bool
+    is_cancelled() const
+    {
+        return m_cancelled;
+    }
+
+    /**
+     * @copydoc EventCount::add_listener
+     */
+    void
+    add_listener(IEventListener &listener)
+    {
+        m_event.add_listener(listener);
+    }
+
+    /**
+     * @copydoc EventCount::remove_listener
+     */
+    void
+    remove_listener(IEventListener &listener)
+    {
+        m_event.remove_listener(listener);
+    }
+
+private:
+
+    template<typename Function>
+    std::size_t
+    wait(Function &try_acquire, const Deadline *deadline)
+    {
+        std::size_t ret = 0;
+
+        // Spins first, the acquired resource (if any) must be returned even
+        // if the parker has been cancelled meanwhile:
+        auto ready = [&]()
+        {
+            ret = try_acquire();
+            return ret > 0 || m_cancelled;
+        };
+        if (m_strategy.spin(ready, deadline) || !m_strategy.parks())
+        {
+            return ret;
+        }
+
+        while (!m_cancelled) // <- while needed because of spurious wake-ups.
+        {
+            EventCount::Key key = m_event.prepare_wait();
+
+            ret = try_acquire();
+            if (ret > 0 || m_cancelled)
+            {
+                m_event.cancel_wait();
+                break;
+            }
+
+            if (!m_event.wait(key, deadline))
+            {
+                ret = try_acquire(); // Last chance after the timeout.
+                break;
+            }
+        }
+
+        return ret;
+    }
+
+    WaitStrategy m_strategy;
+    std::atomic<bool> m_cancelled;
+    EventCount m_event;
+
+};
+
+#endif // PARKER_H
@@ -0,0 +1,280 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef PRIORITYBUCKETS_H
+#define PRIORITYBUCKETS_H
+
+#include "Message.h"
+#include "SlabAllocator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+
+#include <assert.h>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Sequence of messages ordered by priority, then by insertion.
+ *
+ * Messages are stored into one FIFO bucket per priority level (see @ref
+ * IMessage::priority) and a bitmap tells which buckets are not empty, so both
+ * insertion and extraction take constant time regardless of how many
+ * messages are queued.
+ *
+ * With aging enabled, every @a aging extractions the oldest message of each
+ * non-empty bucket below the served one is promoted to the next level:
+ * low priority messages keep climbing towards the front and cannot starve
+ * under a steady flow of high priority ones. The priority stored into the
+ * messages is not modified.
+ *
+ * The class exposes the interface expected by @ref BlockingQueue and it is
+ * not thread safe.
+ *
+ * @ingroup threading-base
+ */
+class PriorityBuckets
+{
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param aging Number of extractions between two promotions of the
+     *        waiting messages, @a zero disables aging.
+     */
+    explicit PriorityBuckets(std::size_t aging = 0)
+            :
+            m_bitmap(0),
+            m_size(0),
+            m_aging(aging),
+            m_extractions(0)
+    {
+    }
+
+    /**
+     * @brief Returns @a true if there are no messages.
+     */
+    bool
+    empty() const
+    {
+        return m_size == 0;
+    }
+
+    /**
+     * @brief Returns the number of messages.
+     */
+    std::size_t
+    size() const
+    {
+        return m_size;
+    }
+
+    /**
+     * @brief Inserts a message after all the ones with the same priority.
+     *
+     * @pre
+     * - The message is not null.
+     */
+    void
+    push_back(const Message &message)
+    {
+        // Precondition verification:
+        assert(nullptr != message.get());
+
+        unsigned level = message->priority();
+        m_buckets[level].push_back(message);
+        m_bitmap |= (Bitmap(1) << level);
+        ++m_size;
+    }
+
+    /**
+     * @brief Inserts a message built from the passed arguments.
+     */
+    template<typename... Args>
+    void
+    emplace_back(Args &&... args)
+    {
+        push_back(Message(std::forward<Args>(args)...));
+    }
+
+    /**
+     * @brief Inserts the passed messages.
+     */
+    void
+    push_back_n(const Message *messages, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            push_back(messages[i]);
+        }
+    }
+
+    /**
+     * @brief Moves out the messages with the highest priority.
+     *
+     * @pre
+     * - There are at least @a count messages.
+     */
+    void
+    pop_front_n(Message *messages, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            messages[i] = std::move(front());
+            pop_front();
+        }
+    }
+
+    /**
+     * @brief Returns the message with the highest priority.
+     *
+     * @pre
+     * - There is at least one message.
+     */
+    Message &
+    front()
+    {
+        // Precondition verification:
+        assert(!empty());
+
+        return m_buckets[top()].front();
+    }
+
+    /**
+     * @brief Removes the message with the highest priority.
+     *
+     * @pre
+     * - There is at least one message.
+     */
+    void
+    pop_front()
+    {
+        // Precondition verification:
+        assert(!empty());
+
+        unsigned level = top();
+        remove_front(level);
+        --m_size;
+
+        if (m_aging > 0 && ++m_extractions == m_aging)
+        {
+            m_extractions = 0;
+            age(level);
+        }
+    }
+
+    /**
+     * @brief Moves out the oldest message with the lowest priority, that is
+     * the last one to be popped among the oldest ones of each priority.
+     *
+     * The extraction doesn't count for aging.
+     *
+     * @pre
+     * - There is at least one message.
+     */
+    void
+    evict(Message &message)
+    {
+        // Precondition verification:
+        assert(!empty());
+
+        unsigned level = bottom();
+        message = std::move(m_buckets[level].front());
+        remove_front(level);
+        --m_size;
+    }
+
+private:
+
+    typedef std::uint32_t Bitmap;
+
+    static_assert(sizeof(Bitmap) * 8 >= IMessage::PRIORITY_LEVELS,
+                  "The bitmap must have one bit per priority level.");
+
+    // Highest non-empty level.
+    unsigned
+    top() const
+    {
+        return (sizeof(unsigned) * 8 - 1) - __builtin_clz(m_bitmap);
+    }
+
+    // Lowest non-empty level.
+    unsigned
+    bottom() const
+    {
+        return __builtin_ctz(m_bitmap);
+    }
+
+    void
+    remove_front(unsigned level)
+    {
+        m_buckets[level].pop_front();
+        if (m_buckets[level].empty())
+        {
+            m_bitmap &= ~(Bitmap(1) << level);
+        }
+    }
+
+    // Promotes the front message of every non-empty level below the one just
+    // served, starting from the highest so that each message climbs one level
+    // only.
+    void
+    age(unsigned served)
+    {
+        Bitmap lower = m_bitmap & ((Bitmap(1) << served) - 1);
+        unsigned level;
+
+        while (lower != 0)
+        {
+            level = (sizeof(unsigned) * 8 - 1) - __builtin_clz(lower);
+            lower &= ~(Bitmap(1) << level);
+
+            m_buckets[level + 1].push_back(std::move(m_buckets[level].front()));
+            m_bitmap |= (Bitmap(1) << (level + 1));
+            remove_front(level);
+        }
+    }
+
+    // Chunks are allocated by producers and released by consumers:
+    std::deque< Message, SlabStdAllocator<Message> >
+            m_buckets[IMessage::PRIORITY_LEVELS];
+    Bitmap m_bitmap;           // Bit N is set when bucket N is not empty.
+    std::size_t m_size;
+    std::size_t m_aging;
+    std::size_t m_extractions; // Extractions since the last promotion.
+
+};
+
+// ----------------------------------------------------------------------------
+
+#endif // PRIORITYBUCKETS_H
@@ -0,0 +1,469 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef QUEUESTATS_H
+#define QUEUESTATS_H
+
+#include "Clock.h"
+#include "RingBuffer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Distribution of the time spent waiting by blocked threads.
+ *
+ * Waits are counted into buckets whose limits grow in powers of two: bucket
+ * @a zero counts the waits shorter than one microsecond, bucket @a i the
+ * waits shorter than 2^i microseconds and the last bucket every longer wait.
+ *
+ * @ingroup threading-base
+ */
+struct WaitHistogram
+{
+    /**
+     * @brief Number of buckets, the last one is open-ended (about four
+     * seconds and more).
+     */
+    static const std::size_t BUCKETS = 24;
+
+    /**
+     * @brief Number of waits counted by each bucket.
+     */
+    std::uint64_t buckets[BUCKETS];
+
+    /**
+     * @brief Returns the upper limit (excluded) of the waits counted by the
+     * passed bucket, @a Clock::duration::max() for the last one.
+     */
+    static Clock::duration
+    bucket_limit(std::size_t bucket)
+    {
+        if (bucket + 1 >= BUCKETS)
+        {
+            return Clock::duration::max();
+        }
+
+        return std::chrono::microseconds(std::uint64_t(1) << bucket);
+    }
+
+    /**
+     * @brief Returns the bucket counting the passed wait.
+     */
+    static std::size_t
+    bucket_of(Clock::duration wait)
+    {
+        std::uint64_t us = std::chrono::duration_cast<
+                std::chrono::microseconds>(wait).count();
+
+        std::size_t ret = 0;
+        while (us > 0 && ret + 1 < BUCKETS)
+        {
+            us >>= 1;
+            ++ret;
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Returns the total number of waits.
+     */
+    std::uint64_t
+    count() const
+    {
+        std::uint64_t ret = 0;
+        for (std::size_t i = 0; i < BUCKETS; ++i)
+        {
+            ret += buckets[i];
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Returns an upper bound of the passed percentile of the waits,
+     * that is the limit of the bucket where the percentile falls.
+     *
+     * @param percentile Value between @a zero and @a one, for example @a 0.99
+     *        for the 99th percentile.
+     *
+     * @return The bucket limit, @a zero if no wait has been counted.
+     */
+    Clock::duration
+    percentile(double percentile) const
+    {
+        const std::uint64_t total = count();
+        if (total == 0)
+        {
+            return Clock::duration::zero();
+        }
+
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < BUCKETS; ++i)
+        {
+            seen += buckets[i];
+            if (seen > 0 && double(seen) >= percentile * double(total))
+            {
+                return bucket_limit(i);
+            }
+        }
+
+        return bucket_limit(BUCKETS - 1);
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Snapshot of the statistics of a queue, see @ref
+ * IMessageQueue::stats.
+ *
+ * Counters are accumulated since the creation of the queue.
+ *
+ * @ingroup threading-base
+ */
+struct QueueStats
+{
+    /**
+     * @brief Number of messages contained by the queue when the snapshot was
+     * taken.
+     */
+    std::size_t size;
+
+    /**
+     * @brief Highest number of messages ever contained by the queue.
+     */
+    std::size_t high_water_mark;
+
+    /**
+     * @brief Number of messages pushed into the queue.
+     */
+    std::uint64_t pushes;
+
+    /**
+     * @brief Number of messages popped from the queue.
+     */
+    std::uint64_t pops;
+
+    /**
+     * @brief Number of messages that couldn't be pushed because the queue
+     * was full (including timed out and cancelled waits for a free slot).
+     */
+    std::uint64_t rejected;
+
+    /**
+     * @brief Number of messages discarded by a lossy overflow policy (see
+     * @ref OverflowPolicy): either pushed into the full queue and never
+     * queued, or queued and evicted by a later push.
+     */
+    std::uint64_t evicted;
+
+    /**
+     * @brief Number of producers waiting for a free slot.
+     */
+    std::size_t blocked_producers;
+
+    /**
+     * @brief Number of consumers waiting for a message.
+     */
+    std::size_t blocked_consumers;
+
+    /**
+     * @brief Time spent by producers waiting for a free slot, pushes that
+     * didn't need to wait are not counted.
+     */
+    WaitHistogram producer_waits;
+
+    /**
+     * @brief Time spent by consumers waiting for messages, pops that didn't
+     * need to wait are not counted.
+     */
+    WaitHistogram consumer_waits;
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Always-on counters behind @ref QueueStats.
+ *
+ * Counters are updated with relaxed atomic operations, the producer side and
+ * the consumer side on separate cache lines, and read without locking the
+ * queue: a snapshot is not atomic as a whole but each counter is exact.
+ * Clocks are read only by threads that actually wait.
+ *
+ * @code
+   // Producer:
+   QueueStatsRecorder::Wait wait(stats.producers());
+   while (!buffer.try_push(value))
+   {
+       wait.start();
+       ... // Waits for a free slot.
+   }
+   @endcode
+ *
+ * @ingroup threading-base
+ */
+class QueueStatsRecorder
+{
+
+public:
+
+    /**
+     * @brief Counters of the threads on one side of the queue.
+     */
+    class Side
+    {
+
+        friend class QueueStatsRecorder;
+
+    public:
+
+        Side()
+                :
+                m_count(0),
+                m_blocked(0)
+        {
+            for (std::size_t i = 0; i < WaitHistogram::BUCKETS; ++i)
+            {
+                m_waits[i].store(0, std::memory_order_relaxed);
+            }
+        }
+
+    private:
+
+        std::atomic<std::uint64_t> m_count;
+        std::atomic<std::size_t> m_blocked;
+        std::atomic<std::uint64_t> m_waits[WaitHistogram::BUCKETS];
+
+        void
+        snapshot(WaitHistogram &histogram) const
+        {
+            for (std::size_t i = 0; i < WaitHistogram::BUCKETS; ++i)
+            {
+                histogram.buckets[i] =
+                        m_waits[i].load(std::memory_order_relaxed);
+            }
+        }
+
+    };
+
+    /**
+     * @brief Measures the wait of one blocked thread, from the first call to
+     * @ref start to the destruction of the object.
+     *
+     * The thread is counted as blocked meanwhile.
+     */
+    class Wait
+    {
+
+    public:
+
+        explicit Wait(Side &side)
+                :
+                m_side(side),
+                m_started(false)
+        {
+        }
+
+        Wait(const Wait &) = delete;
+        Wait &operator=(const Wait &) = delete;
+
+        ~Wait()
+        {
+            if (m_started)
+            {
+                std::size_t bucket =
+                        WaitHistogram::bucket_of(Clock::now() - m_start);
+                m_side.m_waits[bucket].fetch_add(1, std::memory_order_relaxed);
+                m_side.m_blocked.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * @brief To be called before each wait, only the first call starts
+         * the measurement.
+         */
+        void
+        start()
+        {
+            if (!m_started)
+            {
+                m_started = true;
+                m_start = Clock::now();
+                m_side.m_blocked.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+    private:
+
+        Side &m_side;
+        bool m_started;
+        Clock::time_point m_start;
+
+    };
+
+    /**
+     * @brief Constructor.
+     */
+    QueueStatsRecorder()
+            :
+            m_high_water_mark(0),
+            m_rejected(0),
+            m_evicted(0)
+    {
+    }
+
+    QueueStatsRecorder(const QueueStatsRecorder &) = delete;
+    QueueStatsRecorder &operator=(const QueueStatsRecorder &) = delete;
+
+    /**
+     * @brief Counters of the producers.
+     */
+    Side &
+    producers()
+    {
+        return m_producers;
+    }
+
+    /**
+     * @brief Counters of the consumers.
+     */
+    Side &
+    consumers()
+    {
+        return m_consumers;
+    }
+
+    /**
+     * @brief Counts @a count pushed messages.
+     *
+     * @param size Number of messages contained by the queue after the
+     *        insertion, if known.
+     */
+    void
+    pushed(std::size_t count, std::size_t size)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        m_producers.m_count.fetch_add(count, std::memory_order_relaxed);
+
+        std::size_t mark = m_high_water_mark.load(std::memory_order_relaxed);
+        while (size > mark
+               && !m_high_water_mark.compare_exchange_weak(
+                        mark, size, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    /**
+     * @brief Counts @a count messages rejected because the queue was full.
+     */
+    void
+    rejected(std::size_t count = 1)
+    {
+        if (count > 0)
+        {
+            m_rejected.fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Counts @a count messages discarded by a lossy overflow policy.
+     */
+    void
+    evicted(std::size_t count = 1)
+    {
+        if (count > 0)
+        {
+            m_evicted.fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Counts @a count popped messages.
+     */
+    void
+    popped(std::size_t count)
+    {
+        if (count > 0)
+        {
+            m_consumers.m_count.fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief Returns a snapshot of the counters.
+     *
+     * @param size Current number of messages contained by the queue.
+     */
+    QueueStats
+    snapshot(std::size_t size) const
+    {
+        QueueStats ret;
+        ret.size = size;
+        ret.high_water_mark = m_high_water_mark.load(std::memory_order_relaxed);
+        ret.pushes = m_producers.m_count.load(std::memory_order_relaxed);
+        ret.pops = m_consumers.m_count.load(std::memory_order_relaxed);
+        ret.rejected = m_rejected.load(std::memory_order_relaxed);
+        ret.evicted = m_evicted.load(std::memory_order_relaxed);
+        ret.blocked_producers =
+                m_producers.m_blocked.load(std::memory_order_relaxed);
+        ret.blocked_consumers =
+                m_consumers.m_blocked.load(std::memory_order_relaxed);
+        m_producers.snapshot(ret.producer_waits);
+        m_consumers.snapshot(ret.consumer_waits);
+
+        return ret;
+    }
+
+private:
+
+    // Written by producers:
+    Side m_producers;
+    std::atomic<std::size_t> m_high_water_mark;
+    std::atomic<std::uint64_t> m_rejected;
+    std::atomic<std::uint64_t> m_evicted;
+
+    char m_pad[CACHE_LINE_SIZE];
+
+    // Written by consumers:
+    Side m_consumers;
+
+};
+
+// ----------------------------------------------------------------------------
+
+#endif // QUEUESTATS_H
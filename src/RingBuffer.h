@@ -0,0 +1,294 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include <assert.h>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Size in bytes of a cache line, used to keep concurrently written
+ * fields on separate lines.
+ *
+ * @ingroup threading-base
+ */
+const std::size_t CACHE_LINE_SIZE = 64;
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Bounded lock-free ring buffer for multiple producers and multiple
+ * consumers.
+ *
+ * The buffer is an array of slots whose size is a power of two. Every slot
+ * carries a sequence number that tells producers and consumers whether the
+ * slot is ready to be written or to be read for the current lap, so each
+ * operation costs one compare-and-swap on the shared index plus one store on
+ * the slot (see Dmitry Vyukov's bounded MPMC queue).
+ *
+ * The buffer never blocks: waiting for free slots or for new values is up to
+ * the caller.
+ *
+ * @tparam T Type of the stored values, it must be default constructible and
+ *         movable.
+ *
+ * @ingroup threading-base
+ */
+template<typename T>
+class RingBuffer
+{
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param min_capacity Minimum number of values the buffer must be able to
+     *        hold, rounded up to the next power of two (at least @a two).
+     *
+     * @pre
+     * - Parameter @a min_capacity is greater than zero.
+     */
+    explicit inline RingBuffer(std::size_t min_capacity);
+
+    /**
+     * @brief Returns the maximum number of values the buffer can hold.
+     */
+    inline std::size_t capacity() const;
+
+    /**
+     * @brief Tries to append one value to the buffer.
+     *
+     * @param value The value to be appended, moved into the buffer only in
+     *        case of success.
+     *
+     * @return
+     * - On success, the number of values contained by the buffer after the
+     *   insertion, that is at least @a one.
+     * - On failure, @a zero: the buffer is full.
+     */
+    inline std::size_t try_push(T &value);
+
+    /**
+     * @brief Tries to extract the oldest value from the buffer.
+     *
+     * @param[out] value Reset with the extracted value only in case of success.
+     *
+     * @return
+     * - On success, the number of values contained by the buffer before the
+     *   extraction, that is at least @a one.
+     * - On failure, @a zero: the buffer is empty.
+     */
+    inline std::size_t try_pop(T &value);
+
+    /**
+     * @brief Returns the number of values contained by the buffer.
+     *
+     * The result is exact only when no other thread is using the buffer.
+     */
+    inline std::size_t size() const;
+
+private:
+
+    struct Slot
+    {
+        std::atomic<std::size_t> m_sequence;
+        T m_value;
+    };
+
+    inline std::size_t count(std::size_t tail, std::size_t head) const;
+
+    std::unique_ptr<Slot[]> m_slots;
+    std::size_t m_mask;
+
+    char m_pad0[CACHE_LINE_SIZE];
+    std::atomic<std::size_t> m_tail; // Next position to be written.
+    char m_pad1[CACHE_LINE_SIZE - sizeof(std::atomic<std::size_t>)];
+    std::atomic<std::size_t> m_head; // Next position to be read.
+    char m_pad2[CACHE_LINE_SIZE - sizeof(std::atomic<std::size_t>)];
+
+};
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+RingBuffer<T>::RingBuffer(std::size_t min_capacity)
+        :
+        m_mask(0),
+        m_tail(0),
+        m_head(0)
+{
+    assert(min_capacity > 0);
+
+    // With one single slot the sequence number of a written slot would be
+    // the same as the one of a free slot for the next lap:
+    std::size_t capacity = 2;
+    while (capacity < min_capacity)
+    {
+        capacity <<= 1;
+    }
+
+    m_slots.reset(new Slot[capacity]);
+    m_mask = capacity - 1;
+
+    for (std::size_t i = 0; i < capacity; ++i)
+    {
+        m_slots[i].m_sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+RingBuffer<T>::capacity() const
+{
+    return m_mask + 1;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+RingBuffer<T>::try_push(T &value)
+{
+    std::size_t pos = m_tail.load(std::memory_order_relaxed);
+    Slot *slot;
+
+    for (;;)
+    {
+        slot = &m_slots[pos & m_mask];
+        std::size_t sequence = slot->m_sequence.load(std::memory_order_acquire);
+        std::intptr_t diff = std::intptr_t(sequence) - std::intptr_t(pos);
+
+        if (diff == 0)
+        {
+            // The slot is free for this lap, tries to claim it:
+            if (m_tail.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return 0; // Full: the slot still holds the previous lap.
+        }
+        else
+        {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->m_value = std::move(value);
+    slot->m_sequence.store(pos + 1, std::memory_order_release);
+
+    return count(pos + 1, m_head.load(std::memory_order_relaxed));
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+RingBuffer<T>::try_pop(T &value)
+{
+    std::size_t pos = m_head.load(std::memory_order_relaxed);
+    Slot *slot;
+
+    for (;;)
+    {
+        slot = &m_slots[pos & m_mask];
+        std::size_t sequence = slot->m_sequence.load(std::memory_order_acquire);
+        std::intptr_t diff = std::intptr_t(sequence) - std::intptr_t(pos + 1);
+
+        if (diff == 0)
+        {
+            // The slot has been published for this lap, tries to claim it:
+            if (m_head.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return 0; // Empty: the slot has not been written yet.
+        }
+        else
+        {
+            pos = m_head.load(std::memory_order_relaxed);
+        }
+    }
+
+    value = std::move(slot->m_value);
+    slot->m_value = T(); // Does not keep references to popped values.
+    slot->m_sequence.store(pos + m_mask + 1, std::memory_order_release);
+
+    return count(m_tail.load(std::memory_order_relaxed), pos);
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+RingBuffer<T>::size() const
+{
+    std::size_t head = m_head.load(std::memory_order_relaxed);
+    std::size_t tail = m_tail.load(std::memory_order_relaxed);
+
+    return (tail > head) ? count(tail, head) : 0;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+RingBuffer<T>::count(std::size_t tail, std::size_t head) const
+{
+    // Indexes are read at different times so the difference is clamped to the
+    // range of valid results:
+    std::intptr_t diff = std::intptr_t(tail - head);
+    if (diff < 1)
+    {
+        return 1;
+    }
+
+    return std::min(std::size_t(diff), capacity());
+}
+
+#endif // RINGBUFFER_H
@@ -0,0 +1,589 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SEGMENTEDQUEUE_H
+#define SEGMENTEDQUEUE_H
+
+#include "RingBuffer.h"
+#include "WaitStrategy.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <utility>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Unbounded lock-free queue for multiple producers and multiple
+ * consumers, made of linked blocks of slots.
+ *
+ * Producers and consumers claim positions with a compare-and-swap on the
+ * index of their side, then each one works on its own slot: every slot
+ * carries a state word where the producer flags the value as written and the
+ * consumer as read, so no thread ever waits for another one to finish with a
+ * slot (see the segmented queue of the crossbeam library).
+ *
+ * A consumer that claims a slot whose producer didn't finish to write it
+ * doesn't wait: after a few spins it marks the slot as skipped, reports the
+ * queue as empty if nothing else is queued, and the producer pushes its
+ * value again into a later slot. So a preempted producer delays only its own
+ * value.
+ *
+ * Producers and consumers share state at block boundaries only: the
+ * consumers read the index of the producers only while they pop from the
+ * last linked block. The only wait left is at block boundaries: the thread
+ * claiming the last slot of a block publishes the next block, allocated
+ * beforehand, with a few stores that the peers crossing the boundary spin
+ * for.
+ *
+ * Blocks emptied by consumers are kept for reuse by producers (up to @ref
+ * MAX_FREE_BLOCKS), so that bursts don't allocate once the queue has grown.
+ * Blocks are handed over through single atomic exchanges, so reuse is not
+ * exposed to the ABA problem.
+ *
+ * Messages are popped in the order their positions have been claimed, but
+ * for the skipped ones: pushed again at a later position, a skipped message
+ * is overtaken by the ones claimed after it. So the order holds only for
+ * the messages of each single producer, whose pushes return once the value
+ * is written.
+ *
+ * The queue never blocks: waiting for new values is up to the caller.
+ *
+ * @tparam T Type of the stored values, it must be default constructible and
+ *         movable.
+ *
+ * @ingroup threading-base
+ */
+template<typename T>
+class SegmentedQueue
+{
+
+public:
+
+    /**
+     * @brief Number of slots of each block.
+     */
+    static const std::size_t BLOCK_SIZE = 31;
+
+    /**
+     * @brief Number of empty blocks kept for reuse.
+     */
+    static const std::size_t MAX_FREE_BLOCKS = 16;
+
+    /**
+     * @brief Constructor.
+     */
+    inline SegmentedQueue();
+
+    /**
+     * @brief Destructor.
+     *
+     * @pre
+     * - No other thread is using the queue.
+     */
+    inline ~SegmentedQueue();
+
+    SegmentedQueue(const SegmentedQueue &) = delete;
+    SegmentedQueue &operator=(const SegmentedQueue &) = delete;
+
+    /**
+     * @brief Appends one value to the queue.
+     *
+     * @param value The value to be appended, moved into the queue.
+     *
+     * @return The number of values contained by the queue after the
+     *         insertion, that is at least @a one: the queue is never full.
+     *         Computing it costs one relaxed read of the index of the
+     *         consumers.
+     */
+    inline std::size_t try_push(T &value);
+
+    /**
+     * @copydoc RingBuffer::try_pop
+     */
+    inline std::size_t try_pop(T &value);
+
+    /**
+     * @copydoc RingBuffer::size
+     */
+    inline std::size_t size() const;
+
+private:
+
+    // Indexes count positions shifted by one bit: the lowest bit of the
+    // index of the consumers tells that the block being popped is followed
+    // by another one, so the index of the producers need not be checked.
+    static const std::size_t SHIFT = 1;
+    static const std::size_t HAS_NEXT = 1;
+
+    // Each block spans one lap of positions: the last position of a lap has
+    // no slot and means that the next block is being linked.
+    static const std::size_t LAP = BLOCK_SIZE + 1;
+
+    // Slot states:
+    static const unsigned WRITTEN = 1; // The value has been written.
+    static const unsigned READ = 2;    // The slot is done with.
+    static const unsigned DESTROY = 4; // The block waits for the slot.
+    static const unsigned SKIPPED = 8; // The consumer gave up on the value.
+
+    struct Slot
+    {
+        Slot()
+                :
+                m_state(0)
+        {
+        }
+
+        std::atomic<unsigned> m_state;
+        T m_value;
+    };
+
+    struct Block
+    {
+        Block()
+                :
+                m_next(nullptr)
+        {
+        }
+
+        std::atomic<Block *> m_next;
+        Slot m_slots[BLOCK_SIZE];
+    };
+
+    struct Position
+    {
+        std::atomic<std::size_t> m_index;
+        std::atomic<Block *> m_block;
+        char m_pad[CACHE_LINE_SIZE];
+    };
+
+    static inline Block *wait_next(Block *block);
+
+    inline Block *allocate();
+
+    inline void destroy(Block *block, std::size_t start);
+
+    inline void recycle(Block *block);
+
+    static inline std::size_t count(std::size_t tail, std::size_t head);
+
+    static inline std::size_t slots_before(std::size_t index);
+
+    char m_pad0[CACHE_LINE_SIZE];
+    Position m_tail; // Next position to be written.
+    Position m_head; // Next position to be read.
+
+    std::atomic<Block *> m_free[MAX_FREE_BLOCKS];
+
+};
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+SegmentedQueue<T>::SegmentedQueue()
+{
+    Block *block = new Block();
+
+    m_tail.m_index.store(0, std::memory_order_relaxed);
+    m_tail.m_block.store(block, std::memory_order_relaxed);
+    m_head.m_index.store(0, std::memory_order_relaxed);
+    m_head.m_block.store(block, std::memory_order_relaxed);
+
+    for (std::size_t i = 0; i < MAX_FREE_BLOCKS; ++i)
+    {
+        m_free[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+SegmentedQueue<T>::~SegmentedQueue()
+{
+    Block *block = m_head.m_block.load(std::memory_order_relaxed);
+    while (block != nullptr)
+    {
+        Block *next = block->m_next.load(std::memory_order_relaxed);
+        delete block;
+        block = next;
+    }
+
+    for (std::size_t i = 0; i < MAX_FREE_BLOCKS; ++i)
+    {
+        delete m_free[i].load(std::memory_order_relaxed);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+SegmentedQueue<T>::try_push(T &value)
+{
+    std::size_t tail = m_tail.m_index.load(std::memory_order_acquire);
+    Block *block = m_tail.m_block.load(std::memory_order_acquire);
+    Block *next_block = nullptr;
+
+    for (;;)
+    {
+        const std::size_t offset = (tail >> SHIFT) % LAP;
+
+        // The next block is being linked by the producer of the last slot:
+        if (offset == BLOCK_SIZE)
+        {
+            cpu_relax();
+            tail = m_tail.m_index.load(std::memory_order_acquire);
+            block = m_tail.m_block.load(std::memory_order_acquire);
+            continue;
+        }
+
+        // The next block is allocated before claiming the last slot, so that
+        // the peers spin only for a few stores:
+        if (offset + 1 == BLOCK_SIZE && next_block == nullptr)
+        {
+            next_block = allocate();
+        }
+
+        const std::size_t new_tail = tail + (1 << SHIFT);
+        if (!m_tail.m_index.compare_exchange_weak(tail, new_tail,
+                                                  std::memory_order_seq_cst,
+                                                  std::memory_order_acquire))
+        {
+            block = m_tail.m_block.load(std::memory_order_acquire);
+            continue;
+        }
+
+        if (offset + 1 == BLOCK_SIZE)
+        {
+            m_tail.m_block.store(next_block, std::memory_order_release);
+            m_tail.m_index.store(new_tail + (1 << SHIFT),
+                                 std::memory_order_release);
+            block->m_next.store(next_block, std::memory_order_release);
+            next_block = nullptr;
+        }
+
+        Slot &slot = block->m_slots[offset];
+        slot.m_value = std::move(value);
+
+        const unsigned state = slot.m_state.fetch_or(WRITTEN,
+                                                     std::memory_order_acq_rel);
+        if ((state & SKIPPED) == 0)
+        {
+            break;
+        }
+
+        // The consumer of the slot gave up on it: takes the value back and
+        // retires the slot, that is the last access to the block.
+        value = std::move(slot.m_value);
+        slot.m_value = T();
+        if (slot.m_state.fetch_or(READ, std::memory_order_acq_rel) & DESTROY)
+        {
+            destroy(block, offset + 1);
+        }
+
+        tail = m_tail.m_index.load(std::memory_order_acquire);
+        block = m_tail.m_block.load(std::memory_order_acquire);
+    }
+
+    // A block allocated for a boundary crossed by another producer:
+    if (next_block != nullptr)
+    {
+        recycle(next_block);
+    }
+
+    return count(tail + (1 << SHIFT),
+                 m_head.m_index.load(std::memory_order_relaxed));
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+SegmentedQueue<T>::try_pop(T &value)
+{
+    // Spins given to a producer that claimed a slot to finish writing it:
+    const unsigned WRITE_SPINS = 16;
+
+    std::size_t head = m_head.m_index.load(std::memory_order_acquire);
+    Block *block = m_head.m_block.load(std::memory_order_acquire);
+
+    for (;;)
+    {
+        const std::size_t offset = (head >> SHIFT) % LAP;
+
+        // The next block is being linked by the consumer of the last slot:
+        if (offset == BLOCK_SIZE)
+        {
+            cpu_relax();
+            head = m_head.m_index.load(std::memory_order_acquire);
+            block = m_head.m_block.load(std::memory_order_acquire);
+            continue;
+        }
+
+        std::size_t new_head = head + (1 << SHIFT);
+        std::size_t tail = 0;
+        if ((new_head & HAS_NEXT) == 0)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            tail = m_tail.m_index.load(std::memory_order_relaxed);
+
+            if ((head >> SHIFT) == (tail >> SHIFT))
+            {
+                return 0; // Empty.
+            }
+
+            if ((head >> SHIFT) / LAP != (tail >> SHIFT) / LAP)
+            {
+                new_head |= HAS_NEXT;
+            }
+        }
+
+        if (!m_head.m_index.compare_exchange_weak(head, new_head,
+                                                  std::memory_order_seq_cst,
+                                                  std::memory_order_acquire))
+        {
+            block = m_head.m_block.load(std::memory_order_acquire);
+            continue;
+        }
+
+        const bool last = (offset + 1 == BLOCK_SIZE);
+        if (last)
+        {
+            Block *next = wait_next(block);
+            std::size_t next_index = (new_head & ~HAS_NEXT) + (1 << SHIFT);
+            if (next->m_next.load(std::memory_order_relaxed) != nullptr)
+            {
+                next_index |= HAS_NEXT;
+            }
+
+            m_head.m_block.store(next, std::memory_order_release);
+            m_head.m_index.store(next_index, std::memory_order_release);
+        }
+
+        Slot &slot = block->m_slots[offset];
+        unsigned state = slot.m_state.load(std::memory_order_acquire);
+        for (unsigned spins = 0;
+             (state & WRITTEN) == 0 && spins < WRITE_SPINS;
+             ++spins)
+        {
+            cpu_relax();
+            state = slot.m_state.load(std::memory_order_acquire);
+        }
+
+        if ((state & WRITTEN) == 0)
+        {
+            state = slot.m_state.fetch_or(SKIPPED, std::memory_order_acq_rel);
+        }
+
+        bool popped = (state & WRITTEN) != 0;
+        if (popped)
+        {
+            value = std::move(slot.m_value);
+            slot.m_value = T(); // Does not keep references to popped values.
+        }
+
+        // The slot is retired by who touches it last: the consumer if it took
+        // the value, otherwise the producer taking the value back.
+        if (last)
+        {
+            if (popped)
+            {
+                slot.m_state.fetch_or(READ, std::memory_order_release);
+            }
+            destroy(block, 0);
+        }
+        else if (popped
+                 && (slot.m_state.fetch_or(READ, std::memory_order_acq_rel)
+                     & DESTROY))
+        {
+            destroy(block, offset + 1);
+        }
+
+        if (popped)
+        {
+            return count(m_tail.m_index.load(std::memory_order_relaxed),
+                         head);
+        }
+
+        head = m_head.m_index.load(std::memory_order_acquire);
+        block = m_head.m_block.load(std::memory_order_acquire);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+SegmentedQueue<T>::size() const
+{
+    for (;;)
+    {
+        std::size_t tail = m_tail.m_index.load(std::memory_order_seq_cst);
+        std::size_t head = m_head.m_index.load(std::memory_order_seq_cst);
+
+        // Consistent only if the index of the producers didn't move meanwhile:
+        if (m_tail.m_index.load(std::memory_order_seq_cst) == tail)
+        {
+            std::size_t written = slots_before(tail);
+            std::size_t read = slots_before(head);
+
+            return (written > read) ? written - read : 0;
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+typename SegmentedQueue<T>::Block *
+SegmentedQueue<T>::wait_next(Block *block)
+{
+    // Published right after the last slot has been claimed, unless the
+    // producer has been preempted meanwhile:
+    const unsigned SPINS_BEFORE_YIELD = 64;
+
+    Block *next = block->m_next.load(std::memory_order_acquire);
+    for (unsigned spins = 0; next == nullptr; ++spins)
+    {
+        if (spins < SPINS_BEFORE_YIELD)
+        {
+            cpu_relax();
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+        next = block->m_next.load(std::memory_order_acquire);
+    }
+
+    return next;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+typename SegmentedQueue<T>::Block *
+SegmentedQueue<T>::allocate()
+{
+    for (std::size_t i = 0; i < MAX_FREE_BLOCKS; ++i)
+    {
+        if (m_free[i].load(std::memory_order_relaxed) != nullptr)
+        {
+            Block *block = m_free[i].exchange(nullptr,
+                                              std::memory_order_acquire);
+            if (block != nullptr)
+            {
+                return block;
+            }
+        }
+    }
+
+    return new Block();
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+void
+SegmentedQueue<T>::destroy(Block *block, std::size_t start)
+{
+    // Slots not retired yet are flagged, their last user will go on:
+    for (std::size_t i = start; i < BLOCK_SIZE; ++i)
+    {
+        Slot &slot = block->m_slots[i];
+        if ((slot.m_state.load(std::memory_order_acquire) & READ) == 0
+            && (slot.m_state.fetch_or(DESTROY, std::memory_order_acq_rel)
+                & READ) == 0)
+        {
+            return;
+        }
+    }
+
+    recycle(block);
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+void
+SegmentedQueue<T>::recycle(Block *block)
+{
+    // All slots are retired, the block is reset for reuse:
+    for (std::size_t i = 0; i < BLOCK_SIZE; ++i)
+    {
+        block->m_slots[i].m_state.store(0, std::memory_order_relaxed);
+    }
+    block->m_next.store(nullptr, std::memory_order_relaxed);
+
+    for (std::size_t i = 0; i < MAX_FREE_BLOCKS; ++i)
+    {
+        Block *expected = nullptr;
+        if (m_free[i].load(std::memory_order_relaxed) == nullptr
+            && m_free[i].compare_exchange_strong(expected, block,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed))
+        {
+            return;
+        }
+    }
+
+    delete block;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+SegmentedQueue<T>::count(std::size_t tail, std::size_t head)
+{
+    // Indexes are read at different times so the difference is clamped:
+    std::size_t written = slots_before(tail);
+    std::size_t read = slots_before(head);
+
+    return (written > read) ? written - read : 1;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+SegmentedQueue<T>::slots_before(std::size_t index)
+{
+    // The position at the end of a lap has no slot, it counts as the first
+    // one of the next lap:
+    const std::size_t position = index >> SHIFT;
+    const std::size_t offset = position % LAP;
+
+    return (position / LAP) * BLOCK_SIZE
+           + ((offset < BLOCK_SIZE) ? offset : BLOCK_SIZE);
+}
+
+#endif // SEGMENTEDQUEUE_H
@@ -0,0 +1,137 @@
+/**
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "Selector.h"
+
+// -----------------------------------------------------------------------------
+
+Selector::Selector()
+        :
+        m_next(0)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+Selector::~Selector()
+{
+    for (auto &source: m_sources)
+    {
+        source.m_remove_listener(source.m_queue, *this);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+std::size_t
+Selector::size() const
+{
+    return m_sources.size();
+}
+
+// -----------------------------------------------------------------------------
+
+std::size_t
+Selector::poll()
+{
+    const std::size_t count = m_sources.size();
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        std::size_t index = (m_next + i) % count;
+        const Source &source = m_sources[index];
+        if (source.m_is_ready(source.m_queue))
+        {
+            m_next = index + 1;
+            return index;
+        }
+    }
+
+    return NONE;
+}
+
+// -----------------------------------------------------------------------------
+
+std::size_t
+Selector::wait_any()
+{
+    return wait(nullptr);
+}
+
+// -----------------------------------------------------------------------------
+
+std::size_t
+Selector::wait_any_until(const Deadline &deadline)
+{
+    return wait(&deadline);
+}
+
+// -----------------------------------------------------------------------------
+
+void
+Selector::on_notify()
+{
+    m_event.notify_all();
+}
+
+// -----------------------------------------------------------------------------
+
+std::size_t
+Selector::wait(const Deadline *deadline)
+{
+    if (m_sources.empty())
+    {
+        return NONE;
+    }
+
+    std::size_t ret = poll();
+    while (ret == NONE)
+    {
+        // Any push into the queues from now on is seen either by the next
+        // scan or by the wait:
+        EventCount::Key key = m_event.prepare_wait();
+        ret = poll();
+        if (ret != NONE)
+        {
+            m_event.cancel_wait();
+            break;
+        }
+
+        if (!m_event.wait(key, deadline))
+        {
+            ret = poll(); // Deadline expired, last check.
+            break;
+        }
+
+        ret = poll();
+    }
+
+    return ret;
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,213 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SELECTOR_H
+#define SELECTOR_H
+
+#include "Clock.h"
+#include "EventCount.h"
+
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Waits for any of several message queues to become ready.
+ *
+ * A queue is ready when it is not empty or when it has been cancelled. The
+ * selector registers itself as listener of every added queue and wakes its
+ * own @ref EventCount, so that one thread can sleep until any of them is
+ * notified, without polling and without helper threads.
+ *
+ * Queues can be @ref IMessageQueue objects as well as @ref MessageQueueT
+ * objects, mixed in the same selector. Readiness is checked through the
+ * size hint of the queues (see @ref IMessageQueue::size_hint), so scanning
+ * never takes the lock of a queue.
+ *
+ * @code
+   Selector selector;
+   const std::size_t CONTROL = selector.add(control_queue);
+   const std::size_t DATA = selector.add(data_queue);
+
+   for (;;)
+   {
+       std::size_t ready = selector.wait_any();
+       if (ready == CONTROL)
+       {
+           ...
+       }
+   }
+   @endcode
+ *
+ * @warning A queue reported as ready may be emptied by another consumer
+ * before the caller pops from it, so pops should not block unless the
+ * selecting thread is the only consumer.
+ *
+ * @ingroup threading-high
+ */
+class Selector
+        :
+                private IEventListener
+{
+
+public:
+
+    /**
+     * @brief Value returned when no queue is ready.
+     */
+    static const std::size_t NONE = std::numeric_limits<std::size_t>::max();
+
+    /**
+     * @brief Constructor.
+     */
+    Selector();
+
+    /**
+     * @brief Destructor, stops listening to the added queues.
+     */
+    virtual ~Selector();
+
+    Selector(const Selector &) = delete;
+    Selector &operator=(const Selector &) = delete;
+
+    /**
+     * @brief Adds one queue to the set of the waited ones.
+     *
+     * @param queue The queue, either an @ref IMessageQueue or a @ref
+     *        MessageQueueT.
+     *
+     * @return The index of the queue, reported by the wait methods.
+     *
+     * @pre
+     * - The queue outlives the selector.
+     * - No thread is waiting on the selector.
+     */
+    template<typename Queue>
+    std::size_t
+    add(Queue &queue)
+    {
+        Source source;
+        source.m_queue = &queue;
+        source.m_is_ready = &is_ready<Queue>;
+        source.m_remove_listener = &remove_listener<Queue>;
+
+        queue.add_listener(*this);
+        m_sources.push_back(source);
+
+        return m_sources.size() - 1;
+    }
+
+    /**
+     * @brief Returns the number of added queues.
+     */
+    std::size_t size() const;
+
+    /**
+     * @brief Returns the index of one ready queue without waiting.
+     *
+     * Queues are scanned starting after the last reported one, so that a
+     * busy queue cannot hide the others.
+     *
+     * @return The index of a ready queue, @ref NONE if no queue is ready.
+     */
+    std::size_t poll();
+
+    /**
+     * @brief Waits for one of the queues to be ready.
+     *
+     * @return The index of the ready queue, @ref NONE only if no queue has
+     *         been added.
+     */
+    std::size_t wait_any();
+
+    /**
+     * @brief Waits for one of the queues to be ready, at most until the passed
+     * deadline.
+     *
+     * @param deadline Point in time, measured on the monotonic @ref Clock,
+     *        when the wait expires.
+     *
+     * @return The index of the ready queue, @ref NONE if the deadline expired.
+     */
+    std::size_t wait_any_until(const Deadline &deadline);
+
+    /**
+     * @brief Waits for one of the queues to be ready, at most for the passed
+     * timeout.
+     *
+     * Same as @ref wait_any_until with a deadline computed by @ref
+     * deadline_after.
+     */
+    template<typename Rep, typename Period>
+    std::size_t
+    wait_any_for(const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return wait_any_until(deadline_after(timeout));
+    }
+
+private:
+
+    // Queues are kept type-erased, so that different kinds can be mixed.
+    struct Source
+    {
+        void *m_queue;
+        bool (*m_is_ready)(const void *queue);
+        void (*m_remove_listener)(void *queue, IEventListener &listener);
+    };
+
+    template<typename Queue>
+    static bool
+    is_ready(const void *queue)
+    {
+        // Scans never lock the queues:
+        const Queue *self = static_cast<const Queue *>(queue);
+        return self->size_hint() > 0 || self->is_cancelled();
+    }
+
+    template<typename Queue>
+    static void
+    remove_listener(void *queue, IEventListener &listener)
+    {
+        static_cast<Queue *>(queue)->remove_listener(listener);
+    }
+
+    virtual void on_notify();
+
+    std::size_t wait(const Deadline *deadline);
+
+    std::vector<Source> m_sources;
+    std::size_t m_next; // First queue checked by the next scan.
+    EventCount m_event;
+
+};
+
+#endif // SELECTOR_H
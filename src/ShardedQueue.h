@@ -0,0 +1,487 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef SHARDEDQUEUE_H
+#define SHARDEDQUEUE_H
+
+#include "Locker.h"
+#include "Mutex.h"
+#include "RingBuffer.h"
+#include "SlotRing.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include <assert.h>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Queue for many producers made of independent lanes, each one
+ * guarded by its own mutex.
+ *
+ * Every thread is bound to a lane, in order of first use, so that producers
+ * are spread evenly over the lanes and contend only with the threads sharing
+ * their lane. Consumers sweep the lanes starting from the one of their
+ * thread, skipping the empty ones without locking them.
+ *
+ * The order of first use is counted once for all the queues of the same
+ * type of values, not for each queue: a thread has the same index in all of
+ * them, taken modulo the number of lanes. So the producers of one queue are
+ * spread evenly only if they are not picked at a stride of the number of
+ * lanes among the threads using queues of that type.
+ *
+ * Values pushed by the same thread are popped in insertion order, values
+ * pushed by different threads may be popped in any order.
+ *
+ * The capacity is handed out to the lanes in chunks of slots: a lane takes a
+ * new chunk from the shared budget only once it used the slots it already
+ * holds, and gets back the slots of the values popped from it. Most pushes
+ * and pops touch their lane only, the shared budget is updated once per
+ * chunk. When the budget runs out, the slots held but unused by the other
+ * lanes are reclaimed before failing, so the capacity is still enforced
+ * exactly. The counters of pushes and pops are kept per lane as well.
+ *
+ * Popped slots go back to their lane, not to the shared budget, so a push
+ * racing with pops may not see them: it sweeps the lanes twice before
+ * giving up, but can still report the queue as full if the slots are freed
+ * after its last sweep or taken meanwhile by other pushes.
+ *
+ * The queue never blocks: waiting for new values or free slots is up to the
+ * caller.
+ *
+ * @tparam T Type of the stored values, it must be movable.
+ *
+ * @ingroup threading-base
+ */
+template<typename T>
+class ShardedQueue
+{
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param max_capacity Maximum number of values that can be queued at the
+     *        same time.
+     *
+     * @param lanes Number of lanes, at least @a one.
+     */
+    inline ShardedQueue(std::size_t max_capacity, std::size_t lanes);
+
+    ShardedQueue(const ShardedQueue &) = delete;
+    ShardedQueue &operator=(const ShardedQueue &) = delete;
+
+    /**
+     * @brief Appends one value to the lane of the calling thread.
+     *
+     * @param value The value to be moved into the queue, left untouched on
+     *        failure.
+     *
+     * @return
+     * - On success, the number of values contained by the lane of the calling
+     *   thread after the insertion, that is at least @a one.
+     * - On failure, @a zero: the queue is full, or it has just been freed by
+     *   concurrent pops (see above).
+     */
+    inline std::size_t try_push(T &value);
+
+    /**
+     * @brief Extracts the oldest value of the first non-empty lane, starting
+     * from the lane of the calling thread.
+     *
+     * @param[out] value Overwritten with the extracted value on success.
+     *
+     * @return
+     * - On success, the number of values contained by the lane before the
+     *   extraction, that is at least @a one.
+     * - On failure, @a zero: the queue is empty.
+     */
+    inline std::size_t try_pop(T &value);
+
+    /**
+     * @brief Extracts a value as @ref try_pop does, without counting it as
+     * popped: to discard values making room for new ones.
+     */
+    inline std::size_t try_evict(T &value);
+
+    /**
+     * @brief Returns the number of values contained by the queue.
+     *
+     * The result is exact only when no other thread is using the queue.
+     */
+    inline std::size_t size() const;
+
+    /**
+     * @brief Returns the number of values pushed so far.
+     */
+    inline std::uint64_t pushes() const;
+
+    /**
+     * @brief Returns the number of values popped so far, evictions excluded.
+     */
+    inline std::uint64_t pops() const;
+
+    /**
+     * @brief Returns the highest size of the queue seen so far.
+     *
+     * The size is sampled only when a lane takes a new chunk of slots, so
+     * short peaks of lanes holding unused slots can be missed.
+     */
+    std::size_t
+    high_water_mark() const
+    {
+        return m_high_water_mark.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the number of lanes.
+     */
+    std::size_t
+    lanes() const
+    {
+        return m_lane_count;
+    }
+
+private:
+
+    // Largest number of slots taken from the shared budget at once:
+    static const std::size_t MAX_CHUNK = 32;
+
+    // Sweeps of the lanes made by a push before reporting the queue as full:
+    static const unsigned RECLAIM_PASSES = 2;
+
+    struct Lane
+    {
+        Mutex m_mutex;
+        SlotRing<T> m_values;
+
+        // Slots taken from the shared budget and not used yet, guarded by the
+        // mutex:
+        std::size_t m_credits;
+
+        // Size of the lane readable without locking, to skip empty lanes:
+        std::atomic<std::size_t> m_size;
+
+        // Written under the mutex, read by snapshots:
+        std::atomic<std::uint64_t> m_pushes;
+        std::atomic<std::uint64_t> m_pops;
+
+        char m_pad[CACHE_LINE_SIZE];
+    };
+
+    static inline std::size_t thread_index();
+
+    // Pushes into the locked lane if it holds a free slot or gets new ones.
+    inline std::size_t push_locked(Lane &lane, T &value);
+
+    // Moves a chunk of the shared budget to the locked lane.
+    inline bool reserve(Lane &lane);
+
+    // Moves the unused slots of all the lanes back to the shared budget.
+    inline void reclaim();
+
+    inline std::size_t pop(T &value, bool counted);
+
+    const std::size_t m_lane_count;
+    const std::size_t m_chunk;
+    std::unique_ptr<Lane[]> m_lanes;
+
+    char m_pad0[CACHE_LINE_SIZE];
+    std::atomic<std::size_t> m_free; // Slots not held by any lane.
+    std::atomic<std::size_t> m_high_water_mark;
+    char m_pad1[CACHE_LINE_SIZE];
+
+};
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+const std::size_t ShardedQueue<T>::MAX_CHUNK;
+
+template<typename T>
+const unsigned ShardedQueue<T>::RECLAIM_PASSES;
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+ShardedQueue<T>::ShardedQueue(std::size_t max_capacity, std::size_t lanes)
+        :
+        m_lane_count(lanes),
+        m_chunk(std::max<std::size_t>(
+                1, std::min(MAX_CHUNK, max_capacity / (4 * lanes)))),
+        m_lanes(new Lane[lanes]),
+        m_free(max_capacity),
+        m_high_water_mark(0)
+{
+    // Precondition verification:
+    assert(lanes > 0);
+
+    for (std::size_t i = 0; i < m_lane_count; ++i)
+    {
+        m_lanes[i].m_credits = 0;
+        m_lanes[i].m_size.store(0, std::memory_order_relaxed);
+        m_lanes[i].m_pushes.store(0, std::memory_order_relaxed);
+        m_lanes[i].m_pops.store(0, std::memory_order_relaxed);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+ShardedQueue<T>::try_push(T &value)
+{
+    Lane &lane = m_lanes[thread_index() % m_lane_count];
+
+    std::size_t ret;
+    {
+        Locker<Mutex> locker(lane.m_mutex);
+        ret = push_locked(lane, value);
+    }
+
+    // The lane is released first, reclaiming locks the others one by one.
+    // Pops return slots to the lanes already swept, or other pushes take the
+    // reclaimed ones, so the budget is retried even after an empty sweep:
+    for (unsigned pass = 0; ret == 0 && pass < RECLAIM_PASSES; ++pass)
+    {
+        reclaim();
+
+        Locker<Mutex> locker(lane.m_mutex);
+        ret = push_locked(lane, value);
+    }
+
+    return ret;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+ShardedQueue<T>::try_pop(T &value)
+{
+    return pop(value, true);
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+ShardedQueue<T>::try_evict(T &value)
+{
+    return pop(value, false);
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+ShardedQueue<T>::size() const
+{
+    std::size_t ret = 0;
+    for (std::size_t i = 0; i < m_lane_count; ++i)
+    {
+        ret += m_lanes[i].m_size.load(std::memory_order_relaxed);
+    }
+
+    return ret;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::uint64_t
+ShardedQueue<T>::pushes() const
+{
+    std::uint64_t ret = 0;
+    for (std::size_t i = 0; i < m_lane_count; ++i)
+    {
+        ret += m_lanes[i].m_pushes.load(std::memory_order_relaxed);
+    }
+
+    return ret;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::uint64_t
+ShardedQueue<T>::pops() const
+{
+    std::uint64_t ret = 0;
+    for (std::size_t i = 0; i < m_lane_count; ++i)
+    {
+        ret += m_lanes[i].m_pops.load(std::memory_order_relaxed);
+    }
+
+    return ret;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+ShardedQueue<T>::push_locked(Lane &lane, T &value)
+{
+    if (lane.m_credits == 0 && !reserve(lane))
+    {
+        return 0; // Full.
+    }
+    --lane.m_credits;
+
+    lane.m_values.emplace_back(std::move(value));
+
+    const std::size_t ret = lane.m_values.size();
+    lane.m_size.store(ret, std::memory_order_relaxed);
+    lane.m_pushes.store(lane.m_pushes.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+
+    return ret;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+bool
+ShardedQueue<T>::reserve(Lane &lane)
+{
+    std::size_t free = m_free.load(std::memory_order_relaxed);
+    std::size_t chunk;
+    do
+    {
+        if (free == 0)
+        {
+            return false;
+        }
+        chunk = std::min(free, m_chunk);
+    }
+    while (!m_free.compare_exchange_weak(free, free - chunk,
+                                         std::memory_order_relaxed));
+
+    lane.m_credits += chunk;
+
+    // Samples the size of the queue, counting the value being pushed:
+    const std::size_t size = this->size() + 1;
+    std::size_t mark = m_high_water_mark.load(std::memory_order_relaxed);
+    while (size > mark
+           && !m_high_water_mark.compare_exchange_weak(
+                    mark, size, std::memory_order_relaxed))
+    {
+    }
+
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+void
+ShardedQueue<T>::reclaim()
+{
+    std::size_t ret = 0;
+    for (std::size_t i = 0; i < m_lane_count; ++i)
+    {
+        Lane &lane = m_lanes[i];
+        Locker<Mutex> locker(lane.m_mutex);
+
+        ret += lane.m_credits;
+        lane.m_credits = 0;
+    }
+
+    if (ret > 0)
+    {
+        m_free.fetch_add(ret, std::memory_order_relaxed);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+ShardedQueue<T>::pop(T &value, bool counted)
+{
+    const std::size_t home = thread_index();
+
+    for (std::size_t i = 0; i < m_lane_count; ++i)
+    {
+        Lane &lane = m_lanes[(home + i) % m_lane_count];
+        if (lane.m_size.load(std::memory_order_relaxed) == 0)
+        {
+            continue;
+        }
+
+        Locker<Mutex> locker(lane.m_mutex);
+
+        const std::size_t ret = lane.m_values.size();
+        if (ret == 0)
+        {
+            continue; // Drained by another consumer meanwhile.
+        }
+
+        lane.m_values.pop_front_n(&value, 1);
+        lane.m_size.store(ret - 1, std::memory_order_relaxed);
+        if (counted)
+        {
+            lane.m_pops.store(lane.m_pops.load(std::memory_order_relaxed) + 1,
+                              std::memory_order_relaxed);
+        }
+
+        // The slot goes back to the lane, the excess to the shared budget:
+        ++lane.m_credits;
+        if (lane.m_credits > 2 * m_chunk)
+        {
+            m_free.fetch_add(lane.m_credits - m_chunk,
+                             std::memory_order_relaxed);
+            lane.m_credits = m_chunk;
+        }
+
+        return ret;
+    }
+
+    return 0; // Empty.
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+ShardedQueue<T>::thread_index()
+{
+    static std::atomic<std::size_t> next(0);
+    static thread_local std::size_t index =
+            next.fetch_add(1, std::memory_order_relaxed);
+
+    return index;
+}
+
+#endif // SHARDEDQUEUE_H
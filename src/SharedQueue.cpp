@@ -0,0 +1,518 @@
+/**
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "SharedQueue.h"
+#include "Locker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <new>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------
+
+namespace {
+
+// Identifies segments initialized by ISharedQueue::create:
+const std::uint32_t MAGIC = 0x53485251;
+const std::uint32_t VERSION = 1;
+
+// Slots start on a cache line of their own.
+const std::size_t SLOTS_ALIGNMENT = 64;
+
+// Beginning of the segment, followed by the slots.
+struct Header
+{
+    // Written last by the creator, once the rest is initialized:
+    std::atomic<std::uint32_t> m_magic;
+    std::uint32_t m_version;
+
+    std::uint64_t m_capacity;
+    std::uint64_t m_slot_size;
+    std::uint64_t m_slot_stride; // Size prefix plus payload, aligned.
+
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_not_empty;
+    pthread_cond_t m_not_full;
+
+    // Guarded by the mutex:
+    std::uint64_t m_head; // Messages popped since the creation.
+    std::uint64_t m_tail; // Messages pushed since the creation.
+    std::uint32_t m_cancelled;
+};
+
+std::size_t
+align_up(std::size_t value, std::size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+std::size_t
+slots_offset()
+{
+    return align_up(sizeof(Header), SLOTS_ALIGNMENT);
+}
+
+std::size_t
+slot_stride(std::size_t slot_size)
+{
+    return align_up(sizeof(std::uint64_t) + slot_size,
+                    sizeof(std::uint64_t));
+}
+
+// Total size of a segment, zero if it cannot be represented.
+std::size_t
+segment_size(std::size_t capacity, std::size_t slot_size)
+{
+    const std::size_t max = std::numeric_limits<std::size_t>::max();
+    if (slot_size > max / 2 || capacity > (max - slots_offset())
+                                          / slot_stride(slot_size))
+    {
+        return 0;
+    }
+
+    return slots_offset() + capacity * slot_stride(slot_size);
+}
+
+} // anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+class SharedQueuePosix
+        :
+                public ISharedQueue
+{
+
+    Header *m_header;
+    char *m_slots;
+    std::size_t m_mapped_size;
+
+public:
+
+    SharedQueuePosix(void *address, std::size_t mapped_size)
+            :
+            m_header(static_cast<Header *>(address)),
+            m_slots(static_cast<char *>(address) + slots_offset()),
+            m_mapped_size(mapped_size)
+    {
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual
+    ~SharedQueuePosix()
+    {
+        ::munmap(m_header, m_mapped_size);
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    capacity() const
+    {
+        return m_header->m_capacity;
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    slot_size() const
+    {
+        return m_header->m_slot_size;
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    push(const void *data, std::size_t size, bool blocking)
+    {
+        return push_wait(data, size, blocking, nullptr);
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    push_until(const void *data, std::size_t size, const Deadline &deadline)
+    {
+        return push_wait(data, size, true, &deadline);
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    pop(void *data, std::size_t max_size, std::size_t &size, bool blocking)
+    {
+        return pop_wait(data, max_size, size, blocking, nullptr);
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    pop_until(void *data,
+              std::size_t max_size,
+              std::size_t &size,
+              const Deadline &deadline)
+    {
+        return pop_wait(data, max_size, size, true, &deadline);
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual void
+    cancel()
+    {
+        Locker<SharedQueuePosix> locker(*this);
+
+        m_header->m_cancelled = 1;
+        ::pthread_cond_broadcast(&m_header->m_not_empty);
+        ::pthread_cond_broadcast(&m_header->m_not_full);
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual bool
+    is_cancelled() const
+    {
+        Locker<const SharedQueuePosix> locker(*this);
+        return m_header->m_cancelled != 0;
+    }
+
+    // -------------------------------------------------------------------------
+
+    virtual std::size_t
+    size() const
+    {
+        Locker<const SharedQueuePosix> locker(*this);
+        return m_header->m_tail - m_header->m_head;
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Used by Locker:
+    void
+    lock() const
+    {
+        // The owner died while holding the mutex. Counters are updated after
+        // the copies, so the queue is consistent anyway:
+        if (::pthread_mutex_lock(&m_header->m_mutex) == EOWNERDEAD)
+        {
+            ::pthread_mutex_consistent(&m_header->m_mutex);
+        }
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Used by Locker:
+    void
+    unlock() const
+    {
+        ::pthread_mutex_unlock(&m_header->m_mutex);
+    }
+
+private:
+
+    // Returns the size prefix of the slot holding the passed message.
+    std::uint64_t *
+    slot(std::uint64_t position) const
+    {
+        char *slot = m_slots
+                     + (position % m_header->m_capacity)
+                       * m_header->m_slot_stride;
+        return reinterpret_cast<std::uint64_t *>(slot);
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Waits on the condition with the mutex locked, returns false if the
+    // deadline (if any) expired.
+    bool
+    wait(pthread_cond_t &cond, const Deadline *deadline)
+    {
+        int ret;
+        if (deadline == nullptr)
+        {
+            ret = ::pthread_cond_wait(&cond, &m_header->m_mutex);
+        }
+        else
+        {
+            // Clock is steady_clock, whose epoch is the one of
+            // CLOCK_MONOTONIC:
+            Clock::duration since_epoch = deadline->time_since_epoch();
+            if (since_epoch < Clock::duration::zero())
+            {
+                since_epoch = Clock::duration::zero();
+            }
+
+            std::chrono::seconds secs =
+                    std::chrono::duration_cast<std::chrono::seconds>(
+                            since_epoch);
+            std::chrono::nanoseconds nsecs =
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            since_epoch - secs);
+
+            struct timespec abstime;
+            abstime.tv_sec = static_cast<time_t>(secs.count());
+            abstime.tv_nsec = static_cast<long>(nsecs.count());
+
+            ret = ::pthread_cond_timedwait(&cond, &m_header->m_mutex,
+                                           &abstime);
+        }
+
+        if (ret == EOWNERDEAD)
+        {
+            ::pthread_mutex_consistent(&m_header->m_mutex);
+        }
+
+        return ret != ETIMEDOUT;
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Pushes one message, waiting if requested until the deadline (if any).
+    std::size_t
+    push_wait(const void *data,
+              std::size_t size,
+              bool blocking,
+              const Deadline *deadline)
+    {
+        // Precondition verification:
+        assert(size <= m_header->m_slot_size);
+        if (size > m_header->m_slot_size)
+        {
+            return 0;
+        }
+
+        Locker<SharedQueuePosix> locker(*this);
+
+        Header &header = *m_header;
+
+        // Waits for a consumer to make room:
+        while (header.m_tail - header.m_head >= header.m_capacity
+               && blocking && !header.m_cancelled)
+        {
+            if (!wait(header.m_not_full, deadline))
+            {
+                blocking = false; // Deadline expired, last check.
+            }
+        }
+
+        if (header.m_tail - header.m_head >= header.m_capacity)
+        {
+            return 0; // Failure.
+        }
+
+        std::uint64_t *prefix = slot(header.m_tail);
+        *prefix = size;
+        std::memcpy(prefix + 1, data, size);
+        ++header.m_tail;
+
+        ::pthread_cond_signal(&header.m_not_empty);
+
+        return header.m_tail - header.m_head;
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Pops one message, waiting if requested until the deadline (if any).
+    std::size_t
+    pop_wait(void *data,
+             std::size_t max_size,
+             std::size_t &size,
+             bool blocking,
+             const Deadline *deadline)
+    {
+        Locker<SharedQueuePosix> locker(*this);
+
+        Header &header = *m_header;
+
+        // A cancelled queue releases blocking consumers even if not empty:
+        if (blocking && header.m_cancelled)
+        {
+            return 0;
+        }
+
+        // Waits for a producer to push a message:
+        while (header.m_tail == header.m_head
+               && blocking && !header.m_cancelled)
+        {
+            if (!wait(header.m_not_empty, deadline))
+            {
+                blocking = false; // Deadline expired, last check.
+            }
+        }
+
+        if (header.m_tail == header.m_head || (blocking && header.m_cancelled))
+        {
+            return 0; // Failure.
+        }
+
+        const std::size_t ret = header.m_tail - header.m_head;
+
+        const std::uint64_t *prefix = slot(header.m_head);
+        size = *prefix;
+        std::memcpy(data, prefix + 1, std::min<std::size_t>(size, max_size));
+        ++header.m_head;
+
+        ::pthread_cond_signal(&header.m_not_full);
+
+        return ret;
+    }
+
+};
+
+// -----------------------------------------------------------------------------
+
+ISharedQueue *
+ISharedQueue::create(const std::string &name,
+                     std::size_t capacity,
+                     std::size_t slot_size)
+{
+    // Precondition verification:
+    assert(capacity > 0);
+    assert(slot_size > 0);
+
+    const std::size_t mapped_size = segment_size(capacity, slot_size);
+    if (capacity == 0 || slot_size == 0 || mapped_size == 0)
+    {
+        return nullptr;
+    }
+
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    void *address = MAP_FAILED;
+    if (::ftruncate(fd, off_t(mapped_size)) == 0)
+    {
+        address = ::mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+
+    if (address == MAP_FAILED)
+    {
+        ::shm_unlink(name.c_str());
+        return nullptr;
+    }
+
+    Header *header = new(address) Header;
+    header->m_version = VERSION;
+    header->m_capacity = capacity;
+    header->m_slot_size = slot_size;
+    header->m_slot_stride = slot_stride(slot_size);
+    header->m_head = 0;
+    header->m_tail = 0;
+    header->m_cancelled = 0;
+
+    pthread_mutexattr_t mutex_attr;
+    ::pthread_mutexattr_init(&mutex_attr);
+    ::pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    ::pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    ::pthread_mutex_init(&header->m_mutex, &mutex_attr);
+    ::pthread_mutexattr_destroy(&mutex_attr);
+
+    // Timed waits are measured on the monotonic clock (see Clock):
+    pthread_condattr_t cond_attr;
+    ::pthread_condattr_init(&cond_attr);
+    ::pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    ::pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    ::pthread_cond_init(&header->m_not_empty, &cond_attr);
+    ::pthread_cond_init(&header->m_not_full, &cond_attr);
+    ::pthread_condattr_destroy(&cond_attr);
+
+    header->m_magic.store(MAGIC, std::memory_order_release);
+
+    return new SharedQueuePosix(address, mapped_size);
+}
+
+// -----------------------------------------------------------------------------
+
+ISharedQueue *
+ISharedQueue::open(const std::string &name)
+{
+    int fd = ::shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat status;
+    void *address = MAP_FAILED;
+    if (::fstat(fd, &status) == 0
+        && std::size_t(status.st_size) >= sizeof(Header))
+    {
+        address = ::mmap(nullptr, std::size_t(status.st_size),
+                         PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+
+    if (address == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    // Checks that the segment has been initialized by a compatible creator:
+    const std::size_t mapped_size = std::size_t(status.st_size);
+    const Header *header = static_cast<const Header *>(address);
+    if (header->m_magic.load(std::memory_order_acquire) != MAGIC
+        || header->m_version != VERSION
+        || header->m_capacity == 0
+        || header->m_slot_stride != slot_stride(header->m_slot_size)
+        || segment_size(header->m_capacity, header->m_slot_size) == 0
+        || segment_size(header->m_capacity, header->m_slot_size)
+           > mapped_size)
+    {
+        ::munmap(address, mapped_size);
+        return nullptr;
+    }
+
+    return new SharedQueuePosix(address, mapped_size);
+}
+
+// -----------------------------------------------------------------------------
+
+bool
+ISharedQueue::unlink(const std::string &name)
+{
+    return ::shm_unlink(name.c_str()) == 0;
+}
+
+// -----------------------------------------------------------------------------
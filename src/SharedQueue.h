@@ -0,0 +1,407 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SHAREDQUEUE_H
+#define SHAREDQUEUE_H
+
+#include "Clock.h"
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include <assert.h>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Bounded message queue shared between processes.
+ *
+ * The queue lives in a POSIX shared-memory segment (see @a shm_open(3))
+ * identified by a name: one process creates it and the others open it by
+ * name. Messages are byte strings copied into fixed-size slots, hence they
+ * must not contain pointers. Processes synchronize through a process-shared
+ * robust mutex and condition variables stored in the segment, so a process
+ * dying while holding the mutex doesn't block its peers.
+ *
+ * Use @ref SharedQueueT to exchange values of one trivially copyable type.
+ *
+ * @ingroup threading-high
+ */
+class ISharedQueue
+{
+
+public:
+
+    /**
+     * @brief Creates a new shared-memory segment holding an empty queue.
+     *
+     * @param name Name of the segment, a slash followed by up to 254
+     *        characters other than slashes (see @a shm_open(3)).
+     *
+     * @param capacity Maximum number of messages that can be queued at the
+     *        same time.
+     *
+     * @param slot_size Maximum size in bytes of a message.
+     *
+     * @return The newly created queue, @a nullptr if the segment already
+     *         exists or couldn't be created.
+     *
+     * @pre
+     * - Parameters @a capacity and @a slot_size are greater than zero.
+     */
+    static ISharedQueue *create(const std::string &name,
+                                std::size_t capacity,
+                                std::size_t slot_size);
+
+    /**
+     * @brief Opens the queue created by another process.
+     *
+     * @param name Name passed to @ref create.
+     *
+     * @return The opened queue, @a nullptr if the segment doesn't exist or
+     *         doesn't hold a queue initialized by @ref create.
+     */
+    static ISharedQueue *open(const std::string &name);
+
+    /**
+     * @brief Removes the name of a segment, that is released when no process
+     * uses it anymore.
+     *
+     * @return @a true if the segment existed.
+     */
+    static bool unlink(const std::string &name);
+
+    /**
+     * @brief Destructor.
+     *
+     * Detaches the calling process from the segment, that still exists until
+     * it is unlinked (see @ref unlink).
+     */
+    virtual ~ISharedQueue()
+    {
+    }
+
+    /**
+     * @brief Returns the maximum number of messages that can be queued.
+     */
+    virtual std::size_t capacity() const = 0;
+
+    /**
+     * @brief Returns the maximum size in bytes of a message.
+     */
+    virtual std::size_t slot_size() const = 0;
+
+    /**
+     * @brief Pushes one message into the queue.
+     *
+     * @param data The bytes of the message.
+     *
+     * @param size Size in bytes of the message.
+     *
+     * @param blocking If set to @a true the method waits for a free slot
+     *        until the queue is cancelled.
+     *
+     * @return The number of messages contained by the queue after the
+     *         insertion, @a zero on failure.
+     *
+     * @pre
+     * - Parameter @a size is not greater than @ref slot_size.
+     */
+    virtual std::size_t push(const void *data,
+                             std::size_t size,
+                             bool blocking) = 0;
+
+    /**
+     * @brief Pushes one message into the queue waiting at most until the
+     * passed deadline for a free slot.
+     *
+     * @copydetails push
+     */
+    virtual std::size_t push_until(const void *data,
+                                   std::size_t size,
+                                   const Deadline &deadline) = 0;
+
+    /**
+     * @brief Pops the oldest message from the queue.
+     *
+     * @param[out] data Buffer receiving the bytes of the message, truncated
+     *             to @a max_size bytes.
+     *
+     * @param max_size Size in bytes of the buffer.
+     *
+     * @param[out] size Size in bytes of the popped message.
+     *
+     * @param blocking If set to @a true the method waits for a message until
+     *        the queue is cancelled.
+     *
+     * @return The number of messages contained by the queue before the
+     *         extraction, @a zero on failure.
+     */
+    virtual std::size_t pop(void *data,
+                            std::size_t max_size,
+                            std::size_t &size,
+                            bool blocking) = 0;
+
+    /**
+     * @brief Pops the oldest message from the queue waiting at most until the
+     * passed deadline.
+     *
+     * @copydetails pop
+     */
+    virtual std::size_t pop_until(void *data,
+                                  std::size_t max_size,
+                                  std::size_t &size,
+                                  const Deadline &deadline) = 0;
+
+    /**
+     * @brief Cancels the queue releasing the threads blocked on it, in all the
+     * processes.
+     */
+    virtual void cancel() = 0;
+
+    /**
+     * @brief Returns @a true if the queue has been cancelled by any process.
+     */
+    virtual bool is_cancelled() const = 0;
+
+    /**
+     * @brief Returns the number of messages contained inside the queue.
+     */
+    virtual std::size_t size() const = 0;
+
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Typed facade of @ref ISharedQueue to exchange values of a trivially
+ * copyable type between processes.
+ *
+ * Values are copied with one single memory copy in each direction. Copies of
+ * the object share the same queue.
+ *
+ * @code
+   // Producer process:
+   auto queue = SharedQueueT<Sample>::create("/samples", 1024);
+   queue.push(sample, true);
+
+   // Consumer process:
+   auto queue = SharedQueueT<Sample>::open("/samples");
+   Sample sample;
+   while (queue.pop(sample, true))
+   {
+       ...
+   }
+   @endcode
+ *
+ * @tparam T Type of the values, it must be trivially copyable and must not
+ *         contain pointers.
+ *
+ * @ingroup threading-high
+ */
+template<typename T>
+class SharedQueueT
+{
+
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Values are copied as bytes between processes.");
+
+public:
+
+    /**
+     * @brief Creates a new queue (see @ref ISharedQueue::create).
+     *
+     * Use @ref is_open to check the result.
+     */
+    static SharedQueueT
+    create(const std::string &name, std::size_t capacity)
+    {
+        return SharedQueueT(ISharedQueue::create(name, capacity, sizeof(T)));
+    }
+
+    /**
+     * @brief Opens the queue created by another process (see @ref
+     * ISharedQueue::open).
+     *
+     * Fails if the slots of the queue are smaller than the values.
+     *
+     * Use @ref is_open to check the result.
+     */
+    static SharedQueueT
+    open(const std::string &name)
+    {
+        ISharedQueue *queue = ISharedQueue::open(name);
+        if (queue != nullptr && queue->slot_size() < sizeof(T))
+        {
+            delete queue;
+            queue = nullptr;
+        }
+
+        return SharedQueueT(queue);
+    }
+
+    /**
+     * @brief Constructor.
+     *
+     * @param queue The adopted queue, @a nullptr for a closed facade.
+     */
+    explicit SharedQueueT(ISharedQueue *queue = nullptr)
+            :
+            m_impl(queue)
+    {
+    }
+
+    /**
+     * @brief Returns @a true if the facade refers to a queue.
+     */
+    bool
+    is_open() const
+    {
+        return bool(m_impl);
+    }
+
+    /**
+     * @brief Pushes one value into the queue.
+     *
+     * @copydetails ISharedQueue::push
+     */
+    std::size_t
+    push(const T &value, bool blocking = false)
+    {
+        return m_impl->push(&value, sizeof(T), blocking);
+    }
+
+    /**
+     * @brief Pushes one value into the queue waiting at most until the passed
+     * deadline for a free slot.
+     */
+    std::size_t
+    push_until(const T &value, const Deadline &deadline)
+    {
+        return m_impl->push_until(&value, sizeof(T), deadline);
+    }
+
+    /**
+     * @brief Pushes one value into the queue waiting at most for the passed
+     * timeout.
+     *
+     * Same as @ref push_until with a deadline computed by @ref deadline_after.
+     */
+    template<typename Rep, typename Period>
+    std::size_t
+    push_for(const T &value, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return push_until(value, deadline_after(timeout));
+    }
+
+    /**
+     * @brief Pops the oldest value from the queue.
+     *
+     * @param[out] value Overwritten with the popped value.
+     *
+     * @param blocking If set to @a true the method waits for a value until
+     *        the queue is cancelled.
+     *
+     * @return The number of values contained by the queue before the
+     *         extraction, @a zero on failure.
+     */
+    std::size_t
+    pop(T &value, bool blocking)
+    {
+        std::size_t size = 0;
+        std::size_t ret = m_impl->pop(&value, sizeof(T), size, blocking);
+        assert(ret == 0 || size == sizeof(T));
+
+        return ret;
+    }
+
+    /**
+     * @brief Pops the oldest value from the queue waiting at most until the
+     * passed deadline.
+     */
+    std::size_t
+    pop_until(T &value, const Deadline &deadline)
+    {
+        std::size_t size = 0;
+        std::size_t ret = m_impl->pop_until(&value, sizeof(T), size, deadline);
+        assert(ret == 0 || size == sizeof(T));
+
+        return ret;
+    }
+
+    /**
+     * @brief Pops the oldest value from the queue waiting at most for the
+     * passed timeout.
+     *
+     * Same as @ref pop_until with a deadline computed by @ref deadline_after.
+     */
+    template<typename Rep, typename Period>
+    std::size_t
+    pop_for(T &value, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return pop_until(value, deadline_after(timeout));
+    }
+
+    /**
+     * @copydoc ISharedQueue::cancel()
+     */
+    void
+    cancel()
+    {
+        m_impl->cancel();
+    }
+
+    /**
+     * @copydoc ISharedQueue::is_cancelled()
+     */
+    bool
+    is_cancelled() const
+    {
+        return m_impl->is_cancelled();
+    }
+
+    /**
+     * @copydoc ISharedQueue::size()
+     */
+    std::size_t
+    size() const
+    {
+        return m_impl->size();
+    }
+
+private:
+
+    std::shared_ptr<ISharedQueue> m_impl;
+
+};
+
+#endif // SHAREDQUEUE_H
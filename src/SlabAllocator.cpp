@@ -0,0 +1,318 @@
+/**
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "SlabAllocator.h"
+#include "Mutex.h"
+
+// -----------------------------------------------------------------------------
+
+namespace {
+
+const std::size_t MIN_SIZE = 16;
+const std::size_t NUM_CLASSES = 6; // From MIN_SIZE to MAX_SIZE.
+
+static_assert((MIN_SIZE << (NUM_CLASSES - 1)) == SlabAllocator::MAX_SIZE,
+              "The size classes must end with the largest block.");
+
+// Free blocks are chained through their first word. The first block of a
+// magazine stored into the depot chains the magazines through the second one.
+struct FreeBlock
+{
+    FreeBlock *m_next;
+    FreeBlock *m_next_magazine;
+};
+
+static_assert(sizeof(FreeBlock) <= MIN_SIZE,
+              "The smallest block must hold the links.");
+
+std::size_t
+class_of(std::size_t size)
+{
+    std::size_t index = 0;
+    for (std::size_t class_size = MIN_SIZE; class_size < size; class_size <<= 1)
+    {
+        ++index;
+    }
+
+    return index;
+}
+
+// -----------------------------------------------------------------------------
+
+// Magazines of one size class shared by all the threads.
+struct Depot
+{
+    Mutex m_mutex;
+    FreeBlock *m_magazines;
+
+    Depot()
+            :
+            m_magazines(nullptr)
+    {
+    }
+
+    void
+    push(FreeBlock *magazine)
+    {
+        Locker<Mutex> locker(m_mutex);
+        magazine->m_next_magazine = m_magazines;
+        m_magazines = magazine;
+    }
+
+    FreeBlock *
+    pop()
+    {
+        Locker<Mutex> locker(m_mutex);
+        FreeBlock *magazine = m_magazines;
+        if (magazine != nullptr)
+        {
+            m_magazines = magazine->m_next_magazine;
+        }
+
+        return magazine;
+    }
+};
+
+Depot &
+depot(std::size_t index)
+{
+    // Never destroyed: blocks can be released by threads still running
+    // during the destruction of static objects.
+    static Depot *depots = new Depot[NUM_CLASSES];
+
+    return depots[index];
+}
+
+// -----------------------------------------------------------------------------
+
+// Set once the cache of the thread has been destroyed. Trivially destructible,
+// so it can still be read by the thread-local destructors running after the
+// one of the cache, when the cache itself can't be touched anymore.
+thread_local bool cache_destroyed = false;
+
+// Free blocks owned by one thread.
+class ThreadCache
+{
+
+    struct Bin
+    {
+        FreeBlock *m_head;
+        std::size_t m_count;
+    };
+
+    Bin m_bins[NUM_CLASSES];
+
+public:
+
+    ThreadCache()
+    {
+        for (auto &bin: m_bins)
+        {
+            bin.m_head = nullptr;
+            bin.m_count = 0;
+        }
+    }
+
+    ~ThreadCache()
+    {
+        // Hands the remaining blocks to the other threads:
+        for (std::size_t i = 0; i < NUM_CLASSES; ++i)
+        {
+            if (m_bins[i].m_head != nullptr)
+            {
+                depot(i).push(m_bins[i].m_head);
+                m_bins[i].m_head = nullptr;
+                m_bins[i].m_count = 0;
+            }
+        }
+
+        cache_destroyed = true;
+    }
+
+    void *
+    allocate(std::size_t index)
+    {
+        Bin &bin = m_bins[index];
+        if (bin.m_head == nullptr)
+        {
+            refill(index);
+        }
+
+        FreeBlock *block = bin.m_head;
+        bin.m_head = block->m_next;
+        --bin.m_count;
+
+        return block;
+    }
+
+    void
+    deallocate(void *pointer, std::size_t index)
+    {
+        FreeBlock *block = static_cast<FreeBlock *>(pointer);
+
+        Bin &bin = m_bins[index];
+        block->m_next = bin.m_head;
+        bin.m_head = block;
+        ++bin.m_count;
+
+        // Keeps one magazine for the next allocations, gives back the other:
+        if (bin.m_count >= 2 * SlabAllocator::MAGAZINE_SIZE)
+        {
+            flush(index);
+        }
+    }
+
+private:
+
+    void
+    refill(std::size_t index)
+    {
+        Bin &bin = m_bins[index];
+
+        FreeBlock *magazine = depot(index).pop();
+        if (magazine == nullptr)
+        {
+            magazine = carve(index);
+        }
+
+        // Magazines given back by exiting threads can be partial:
+        std::size_t count = 0;
+        for (FreeBlock *block = magazine; block != nullptr; block = block->m_next)
+        {
+            ++count;
+        }
+
+        bin.m_head = magazine;
+        bin.m_count = count;
+    }
+
+    void
+    flush(std::size_t index)
+    {
+        Bin &bin = m_bins[index];
+
+        FreeBlock *last = bin.m_head;
+        for (std::size_t i = 1; i < SlabAllocator::MAGAZINE_SIZE; ++i)
+        {
+            last = last->m_next;
+        }
+
+        FreeBlock *magazine = bin.m_head;
+        bin.m_head = last->m_next;
+        bin.m_count -= SlabAllocator::MAGAZINE_SIZE;
+        last->m_next = nullptr;
+
+        depot(index).push(magazine);
+    }
+
+    // Allocates a new slab and chains its blocks as a magazine.
+    static FreeBlock *
+    carve(std::size_t index)
+    {
+        const std::size_t size = MIN_SIZE << index;
+        char *slab = static_cast<char *>(
+                ::operator new(size * SlabAllocator::MAGAZINE_SIZE));
+
+        FreeBlock *magazine = nullptr;
+        for (std::size_t i = SlabAllocator::MAGAZINE_SIZE; i > 0; --i)
+        {
+            FreeBlock *block = reinterpret_cast<FreeBlock *>(
+                    slab + (i - 1) * size);
+            block->m_next = magazine;
+            magazine = block;
+        }
+
+        return magazine;
+    }
+
+};
+
+ThreadCache &
+thread_cache()
+{
+    static thread_local ThreadCache cache;
+    return cache;
+}
+
+} // anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+void *
+SlabAllocator::allocate(std::size_t size)
+{
+    if (size > MAX_SIZE)
+    {
+        return ::operator new(size);
+    }
+
+    const std::size_t index = class_of(size);
+
+    // Allocations made by thread-local destructors running after the one of
+    // the cache: the block joins the depot once released.
+    if (cache_destroyed)
+    {
+        return ::operator new(MIN_SIZE << index);
+    }
+
+    return thread_cache().allocate(index);
+}
+
+// -----------------------------------------------------------------------------
+
+void
+SlabAllocator::deallocate(void *pointer, std::size_t size)
+{
+    if (pointer == nullptr)
+    {
+        return;
+    }
+
+    if (size > MAX_SIZE)
+    {
+        ::operator delete(pointer);
+        return;
+    }
+
+    const std::size_t index = class_of(size);
+
+    // Blocks released by thread-local destructors running after the one of
+    // the cache go straight to the depot, as a magazine of one block:
+    if (cache_destroyed)
+    {
+        FreeBlock *block = static_cast<FreeBlock *>(pointer);
+        block->m_next = nullptr;
+        depot(index).push(block);
+        return;
+    }
+
+    thread_cache().deallocate(pointer, index);
+}
+
+// -----------------------------------------------------------------------------
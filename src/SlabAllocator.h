@@ -0,0 +1,183 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SLABALLOCATOR_H
+#define SLABALLOCATOR_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Allocator of small blocks with per-thread caches, meant for objects
+ * allocated by one thread and released by another one, as messages and
+ * tasks passed through queues.
+ *
+ * Blocks are grouped in size classes, powers of two from 16 to @ref
+ * MAX_SIZE bytes. Each thread keeps its own free blocks for each class, so
+ * allocating and releasing don't take any lock in the common case. Blocks
+ * released by a thread that doesn't allocate them pile up in its cache and
+ * are handed to a global depot in magazines of @ref MAGAZINE_SIZE blocks;
+ * a thread whose cache is empty takes a whole magazine back from the depot.
+ * The depot lock is taken once every @ref MAGAZINE_SIZE operations at most.
+ *
+ * Memory is carved in slabs of one magazine and it is never returned to the
+ * system: the allocator keeps the peak number of blocks in use.
+ *
+ * Larger blocks are forwarded to the global operator new.
+ *
+ * @ingroup threading-base
+ */
+class SlabAllocator
+{
+
+public:
+
+    /**
+     * @brief Size in bytes of the largest block served by the caches.
+     */
+    static const std::size_t MAX_SIZE = 512;
+
+    /**
+     * @brief Number of blocks moved at once between a thread and the depot.
+     */
+    static const std::size_t MAGAZINE_SIZE = 32;
+
+    /**
+     * @brief Allocates a block of at least @a size bytes, aligned as
+     * the global operator new does.
+     *
+     * @throw std::bad_alloc If the memory is exhausted.
+     */
+    static void *allocate(std::size_t size);
+
+    /**
+     * @brief Releases a block returned by @ref allocate.
+     *
+     * Can be called by any thread.
+     *
+     * @param pointer The block, @a nullptr is ignored.
+     *
+     * @param size The size passed to @ref allocate.
+     */
+    static void deallocate(void *pointer, std::size_t size);
+
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Standard allocator drawing from @ref SlabAllocator, for containers
+ * and shared pointers (see @ref make_message).
+ *
+ * @ingroup threading-base
+ */
+template<typename T>
+class SlabStdAllocator
+{
+
+public:
+
+    typedef T value_type;
+
+    SlabStdAllocator()
+    {
+    }
+
+    template<typename U>
+    SlabStdAllocator(const SlabStdAllocator<U> &)
+    {
+    }
+
+    T *
+    allocate(std::size_t count)
+    {
+        return static_cast<T *>(SlabAllocator::allocate(count * sizeof(T)));
+    }
+
+    void
+    deallocate(T *pointer, std::size_t count)
+    {
+        SlabAllocator::deallocate(pointer, count * sizeof(T));
+    }
+
+};
+
+template<typename T, typename U>
+bool
+operator==(const SlabStdAllocator<T> &, const SlabStdAllocator<U> &)
+{
+    return true;
+}
+
+template<typename T, typename U>
+bool
+operator!=(const SlabStdAllocator<T> &, const SlabStdAllocator<U> &)
+{
+    return false;
+}
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Makes a class allocate its instances through @ref SlabAllocator.
+ *
+ * To be placed in the public section of the class, typically a task or a
+ * message passed between threads:
+ *
+ * @code
+   class MyTask
+           : public ITask
+   {
+   public:
+       SLAB_ALLOCATED
+       ...
+   };
+   @endcode
+ *
+ * Classes derived from it inherit the operators. Deleting an instance
+ * through a base class requires a virtual destructor, as always.
+ *
+ * @ingroup threading-base
+ */
+#define SLAB_ALLOCATED \
+    static void * \
+    operator new(std::size_t size) \
+    { \
+        return SlabAllocator::allocate(size); \
+    } \
+    static void \
+    operator delete(void *pointer, std::size_t size) \
+    { \
+        SlabAllocator::deallocate(pointer, size); \
+    }
+
+#endif // SLABALLOCATOR_H
@@ -0,0 +1,329 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SLOTRING_H
+#define SLOTRING_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include <assert.h>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Growable FIFO sequence that keeps its values inline.
+ *
+ * Values are constructed in place into a circular array of slots whose size
+ * is a power of two, so that queuing a value never allocates unless the
+ * array needs to grow. When full, the array doubles its size; when less than
+ * a quarter full after a pop, it halves its size down to the reserved one, so
+ * that a burst doesn't hold its memory indefinitely.
+ *
+ * Values that are trivially copyable are inserted and extracted in batches
+ * with plain memory copies.
+ *
+ * The class exposes the interface expected by @ref BlockingQueue and it is
+ * not thread safe.
+ *
+ * @ingroup threading-base
+ */
+template<typename T>
+class SlotRing
+{
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param reserved Number of values that can be queued before the first
+     *        growth of the array.
+     */
+    explicit SlotRing(std::size_t reserved = 0)
+            :
+            m_capacity(0),
+            m_head(0),
+            m_size(0)
+    {
+        reserve(reserved);
+        m_reserved = std::max(m_capacity, MIN_CAPACITY);
+    }
+
+    SlotRing(const SlotRing &) = delete;
+    SlotRing &operator=(const SlotRing &) = delete;
+
+    /**
+     * @brief Destructor.
+     */
+    ~SlotRing()
+    {
+        clear();
+    }
+
+    /**
+     * @brief Returns the number of values.
+     */
+    std::size_t
+    size() const
+    {
+        return m_size;
+    }
+
+    /**
+     * @brief Returns the value at the passed position, @a zero being the
+     * first one.
+     *
+     * @pre
+     * - There are more than @a index values.
+     */
+    T &
+    operator[](std::size_t index)
+    {
+        // Precondition verification:
+        assert(index < m_size);
+
+        return *slot(index);
+    }
+
+    /**
+     * @brief Inserts a value constructed in place from the passed arguments.
+     */
+    template<typename... Args>
+    void
+    emplace_back(Args &&... args)
+    {
+        reserve(m_size + 1);
+
+        new (slot(m_size)) T(std::forward<Args>(args)...);
+        ++m_size;
+    }
+
+    /**
+     * @brief Inserts a copy of the passed values.
+     */
+    void
+    push_back_n(const T *values, std::size_t count)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+
+        reserve(m_size + count);
+
+        copy_in(values, count, std::is_trivially_copyable<T>());
+        m_size += count;
+    }
+
+    /**
+     * @brief Inserts a copy of the values of a range, until @a max_count
+     * values have been inserted.
+     *
+     * @param[in,out] first Iterator to the first value, advanced past the
+     *                inserted values.
+     *
+     * @return The number of inserted values, the first ones of the range.
+     */
+    template<typename Iterator>
+    std::size_t
+    push_back_range(Iterator &first, Iterator last, std::size_t max_count)
+    {
+        std::size_t ret = 0;
+        while (first != last && ret < max_count)
+        {
+            emplace_back(*first++);
+            ++ret;
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Moves out the first values.
+     *
+     * @pre
+     * - There are at least @a count values.
+     */
+    void
+    pop_front_n(T *values, std::size_t count)
+    {
+        // Precondition verification:
+        assert(count <= m_size);
+
+        if (count == 0)
+        {
+            return;
+        }
+
+        copy_out(values, count, std::is_trivially_copyable<T>());
+        m_head = (m_head + count) & (m_capacity - 1);
+        m_size -= count;
+
+        // Halving only below a quarter leaves room for as many pushes as pops
+        // before the array needs to grow again:
+        if (m_capacity > m_reserved && m_size < m_capacity / 4)
+        {
+            resize(m_capacity / 2);
+        }
+    }
+
+    /**
+     * @brief Moves out the first value, that is the oldest one.
+     *
+     * @pre
+     * - There is at least one value.
+     */
+    void
+    evict(T &value)
+    {
+        pop_front_n(&value, 1);
+    }
+
+private:
+
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Slot;
+
+    static const std::size_t MIN_CAPACITY = 16;
+
+    // Address of the slot of the value at the passed position.
+    T *
+    slot(std::size_t index)
+    {
+        return reinterpret_cast<T *>(
+                &m_slots[(m_head + index) & (m_capacity - 1)]);
+    }
+
+    // Grows the array to hold at least the passed number of values.
+    void
+    reserve(std::size_t count)
+    {
+        if (count <= m_capacity)
+        {
+            return;
+        }
+
+        std::size_t capacity = (m_capacity > 0) ? m_capacity : MIN_CAPACITY;
+        while (capacity < count)
+        {
+            capacity *= 2;
+        }
+
+        resize(capacity);
+    }
+
+    // Moves the values into a new array of the passed size.
+    void
+    resize(std::size_t capacity)
+    {
+        std::unique_ptr<Slot[]> slots(new Slot[capacity]);
+        for (std::size_t i = 0; i < m_size; ++i)
+        {
+            T *value = slot(i);
+            new (&slots[i]) T(std::move(*value));
+            value->~T();
+        }
+
+        m_slots = std::move(slots);
+        m_capacity = capacity;
+        m_head = 0;
+    }
+
+    // Destroys all values.
+    void
+    clear()
+    {
+        for (std::size_t i = 0; i < m_size; ++i)
+        {
+            slot(i)->~T();
+        }
+        m_size = 0;
+    }
+
+    // Copies values after the last one, space must be reserved.
+    void
+    copy_in(const T *values, std::size_t count, std::false_type)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            new (slot(m_size + i)) T(values[i]);
+        }
+    }
+
+    void
+    copy_in(const T *values, std::size_t count, std::true_type)
+    {
+        // At most two contiguous pieces, before and after the wrap-around:
+        std::size_t first = (m_head + m_size) & (m_capacity - 1);
+        std::size_t piece = std::min(count, m_capacity - first);
+        std::memcpy(&m_slots[first], values, piece * sizeof(T));
+        std::memcpy(&m_slots[0], values + piece, (count - piece) * sizeof(T));
+    }
+
+    // Moves out the first values, destroying them.
+    void
+    copy_out(T *values, std::size_t count, std::false_type)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            T *value = slot(i);
+            values[i] = std::move(*value);
+            value->~T();
+        }
+    }
+
+    void
+    copy_out(T *values, std::size_t count, std::true_type)
+    {
+        std::size_t piece = std::min(count, m_capacity - m_head);
+        std::memcpy(values, &m_slots[m_head], piece * sizeof(T));
+        std::memcpy(values + piece, &m_slots[0], (count - piece) * sizeof(T));
+    }
+
+    std::unique_ptr<Slot[]> m_slots;
+    std::size_t m_capacity; // Power of two, or zero before the first growth.
+    std::size_t m_reserved; // Capacity the array never shrinks below.
+    std::size_t m_head;     // Slot of the first value.
+    std::size_t m_size;
+
+};
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+const std::size_t SlotRing<T>::MIN_CAPACITY;
+
+// ----------------------------------------------------------------------------
+
+#endif // SLOTRING_H
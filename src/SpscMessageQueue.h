@@ -0,0 +1,240 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SPSCMESSAGEQUEUE_H
+#define SPSCMESSAGEQUEUE_H
+
+#include "Clock.h"
+#include "Parker.h"
+#include "SpscRingBuffer.h"
+
+#include <chrono>
+#include <cstddef>
+#include <utility>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Message queue for communication between exactly one producer
+ * thread and one consumer thread.
+ *
+ * Same interface of @ref MessageQueueT, but messages are stored by value into
+ * a @ref SpscRingBuffer: no allocation and no lock is involved in exchanging
+ * messages, the consumer is parked only while the queue is empty and the
+ * producer only while it is full.
+ *
+ * @note
+ * - Only two methods of this class can (optionally) block the calling thread:
+ *   @ref SpscMessageQueueT::pop and @ref SpscMessageQueueT::push.
+ * - Methods @ref push and @ref pop must always be called by the same
+ *   producer and consumer threads respectively. Debug builds assert this.
+ *
+ * @tparam M Type of the messages, it must be default constructible and
+ *         movable.
+ *
+ * @ingroup threading-high
+ */
+template<typename M>
+class SpscMessageQueueT
+{
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param max_capacity Maximum number of messages that can be queued at
+     *        the same time, rounded up to the next power of two.
+     *
+     * @param wait_strategy How the blocked consumer or producer waits for the
+     *        queue to become ready.
+     */
+    explicit SpscMessageQueueT(std::size_t max_capacity,
+                               const WaitStrategy &wait_strategy
+                                   = WaitStrategy())
+            :
+            m_ring(max_capacity),
+            m_not_empty(wait_strategy),
+            m_not_full(wait_strategy)
+    {
+    }
+
+    /**
+     * @copydoc MessageQueueT::pop
+     */
+    std::size_t
+    pop(M &dst_message, bool blocking)
+    {
+        return pop_wait(dst_message, blocking, nullptr);
+    }
+
+    /**
+     * @copydoc MessageQueueT::pop_until
+     */
+    std::size_t
+    pop_until(M &dst_message, const Deadline &deadline)
+    {
+        return pop_wait(dst_message, true, &deadline);
+    }
+
+    /**
+     * @copydoc MessageQueueT::pop_for
+     */
+    template<typename Rep, typename Period>
+    std::size_t
+    pop_for(M &dst_message, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return pop_until(dst_message, deadline_after(timeout));
+    }
+
+    /**
+     * @copydoc MessageQueueT::push
+     */
+    std::size_t
+    push(const M &message, bool blocking = false)
+    {
+        M copy(message);
+        return push_wait(copy, blocking, nullptr);
+    }
+
+    /**
+     * @copydoc MessageQueueT::push
+     *
+     * The message is moved into the queue only in case of success.
+     */
+    std::size_t
+    push(M &&message, bool blocking = false)
+    {
+        return push_wait(message, blocking, nullptr);
+    }
+
+    /**
+     * @copydoc MessageQueueT::push_until
+     */
+    std::size_t
+    push_until(const M &message, const Deadline &deadline)
+    {
+        M copy(message);
+        return push_wait(copy, true, &deadline);
+    }
+
+    /**
+     * @copydoc MessageQueueT::push_for
+     */
+    template<typename Rep, typename Period>
+    std::size_t
+    push_for(const M &message,
+             const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return push_until(message, deadline_after(timeout));
+    }
+
+    /**
+     * @copydoc IMessageQueue::cancel()
+     */
+    void
+    cancel()
+    {
+        m_not_empty.cancel();
+        m_not_full.cancel();
+    }
+
+    /**
+     * @copydoc IMessageQueue::is_cancelled()
+     */
+    bool
+    is_cancelled() const
+    {
+        return m_not_empty.is_cancelled();
+    }
+
+    /**
+     * @copydoc IMessageQueue::size()
+     */
+    std::size_t
+    size() const
+    {
+        return m_ring.size();
+    }
+
+private:
+
+    std::size_t
+    pop_wait(M &dst_message, bool blocking, const Deadline *deadline)
+    {
+        // A cancelled queue releases blocking consumers even if not empty:
+        if (blocking && is_cancelled())
+        {
+            return 0;
+        }
+
+        std::size_t ret = m_ring.try_pop(dst_message);
+        if (ret == 0 && blocking)
+        {
+            auto try_pop = [&]() { return m_ring.try_pop(dst_message); };
+            ret = (deadline == nullptr)
+                  ? m_not_empty.park(try_pop)
+                  : m_not_empty.park_until(try_pop, *deadline);
+        }
+
+        if (ret > 0)
+        {
+            m_not_full.unpark();
+        }
+
+        return ret;
+    }
+
+    std::size_t
+    push_wait(M &message, bool blocking, const Deadline *deadline)
+    {
+        std::size_t ret = m_ring.try_push(message);
+        if (ret == 0 && blocking)
+        {
+            auto try_push = [&]() { return m_ring.try_push(message); };
+            ret = (deadline == nullptr)
+                  ? m_not_full.park(try_push)
+                  : m_not_full.park_until(try_push, *deadline);
+        }
+
+        if (ret > 0)
+        {
+            m_not_empty.unpark();
+        }
+
+        return ret;
+    }
+
+    SpscRingBuffer<M> m_ring;
+    Parker m_not_empty;
+    Parker m_not_full;
+
+};
+
+#endif // SPSCMESSAGEQUEUE_H
@@ -0,0 +1,246 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SPSCRINGBUFFER_H
+#define SPSCRINGBUFFER_H
+
+#include "RingBuffer.h"
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include <assert.h>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Bounded wait-free ring buffer for one single producer and one single
+ * consumer.
+ *
+ * The producer owns the tail index and the consumer owns the head index, each
+ * one on its own cache line. Both sides also keep a private copy of the index
+ * owned by the other side and refresh it only when the buffer looks full (or
+ * empty), so in the common case an operation doesn't read any cache line
+ * written by the peer thread.
+ *
+ * @warning At most one thread can push and at most one thread can pop during
+ * the whole life of the buffer. Debug builds assert this.
+ *
+ * @tparam T Type of the stored values, it must be default constructible and
+ *         movable.
+ *
+ * @ingroup threading-base
+ */
+template<typename T>
+class SpscRingBuffer
+{
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param min_capacity Minimum number of values the buffer must be able to
+     *        hold, rounded up to the next power of two.
+     *
+     * @pre
+     * - Parameter @a min_capacity is greater than zero.
+     */
+    explicit inline SpscRingBuffer(std::size_t min_capacity);
+
+    /**
+     * @copydoc RingBuffer::capacity
+     */
+    inline std::size_t capacity() const;
+
+    /**
+     * @copydoc RingBuffer::try_push
+     *
+     * @pre
+     * - Called always by the same producer thread.
+     */
+    inline std::size_t try_push(T &value);
+
+    /**
+     * @copydoc RingBuffer::try_pop
+     *
+     * @pre
+     * - Called always by the same consumer thread.
+     */
+    inline std::size_t try_pop(T &value);
+
+    /**
+     * @copydoc RingBuffer::size
+     */
+    inline std::size_t size() const;
+
+private:
+
+    inline void check_owner(std::atomic<std::thread::id> &owner);
+
+    std::unique_ptr<T[]> m_slots;
+    std::size_t m_mask;
+
+    // Producer side:
+    char m_pad0[CACHE_LINE_SIZE];
+    std::atomic<std::size_t> m_tail;
+    std::size_t m_head_cache;
+    std::atomic<std::thread::id> m_producer;
+
+    // Consumer side:
+    char m_pad1[CACHE_LINE_SIZE];
+    std::atomic<std::size_t> m_head;
+    std::size_t m_tail_cache;
+    std::atomic<std::thread::id> m_consumer;
+    char m_pad2[CACHE_LINE_SIZE];
+
+};
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+SpscRingBuffer<T>::SpscRingBuffer(std::size_t min_capacity)
+        :
+        m_mask(0),
+        m_tail(0),
+        m_head_cache(0),
+        m_producer(std::thread::id()),
+        m_head(0),
+        m_tail_cache(0),
+        m_consumer(std::thread::id())
+{
+    assert(min_capacity > 0);
+
+    std::size_t capacity = 1;
+    while (capacity < min_capacity)
+    {
+        capacity <<= 1;
+    }
+
+    m_slots.reset(new T[capacity]);
+    m_mask = capacity - 1;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+SpscRingBuffer<T>::capacity() const
+{
+    return m_mask + 1;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+SpscRingBuffer<T>::try_push(T &value)
+{
+    check_owner(m_producer);
+
+    const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head_cache > m_mask)
+    {
+        m_head_cache = m_head.load(std::memory_order_acquire);
+        if (tail - m_head_cache > m_mask)
+        {
+            return 0; // Full.
+        }
+    }
+
+    m_slots[tail & m_mask] = std::move(value);
+    m_tail.store(tail + 1, std::memory_order_release);
+
+    // The cached head may be stale, so this is an upper bound:
+    return tail + 1 - m_head_cache;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+SpscRingBuffer<T>::try_pop(T &value)
+{
+    check_owner(m_consumer);
+
+    const std::size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail_cache)
+    {
+        m_tail_cache = m_tail.load(std::memory_order_acquire);
+        if (head == m_tail_cache)
+        {
+            return 0; // Empty.
+        }
+    }
+
+    T &slot = m_slots[head & m_mask];
+    value = std::move(slot);
+    slot = T(); // Does not keep references to popped values.
+    m_head.store(head + 1, std::memory_order_release);
+
+    // The cached tail may be stale, so this is a lower bound:
+    return m_tail_cache - head;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+std::size_t
+SpscRingBuffer<T>::size() const
+{
+    std::size_t head = m_head.load(std::memory_order_relaxed);
+    std::size_t tail = m_tail.load(std::memory_order_relaxed);
+
+    return (tail > head) ? std::min(tail - head, capacity()) : 0;
+}
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+void
+SpscRingBuffer<T>::check_owner(std::atomic<std::thread::id> &owner)
+{
+#ifndef NDEBUG
+    const std::thread::id self = std::this_thread::get_id();
+    if (owner.load(std::memory_order_relaxed) != self)
+    {
+        std::thread::id none;
+        bool first_use = owner.compare_exchange_strong(none, self);
+        assert(first_use && "SpscRingBuffer used by a second producer or consumer");
+        (void) first_use;
+    }
+#else
+    (void) owner;
+#endif
+}
+
+#endif // SPSCRINGBUFFER_H
@@ -52,6 +52,8 @@ class ITask
 
 public:
 
+    MESSAGE_TYPE(ITask, IMessage)
+
     /**
      * @brief Destructor.
      */
@@ -66,11 +68,28 @@ public:
 
     /**
      * @brief Cancels the task.
+     *
+     * Called by a pool on the pending tasks it drops without executing them
+     * once cancelled, before handing them back (see @ref is_handed_back).
      */
     virtual void cancel()
     {
     }
 
+    /**
+     * @brief Tells whether a pool hands the task back through its queue of
+     * executed tasks (see @ref IThreadPool::pop).
+     *
+     * Tasks whose completion is observed otherwise, like the children of a
+     * @ref TaskGroup or the functions behind a @ref Future, return @a false:
+     * they are handed back neither once executed nor when the pool is
+     * cancelled.
+     */
+    virtual bool is_handed_back() const
+    {
+        return true;
+    }
+
 };
 
 // -----------------------------------------------------------------------------
@@ -90,6 +109,8 @@ class TaskFunction
 
 public:
 
+    MESSAGE_TYPE(TaskFunction, ITask)
+
     /**
      * @brief Constructs the task from a passed function.
      *
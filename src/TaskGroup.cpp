@@ -0,0 +1,205 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "TaskGroup.h"
+
+#include "EventCount.h"
+
+#include <atomic>
+#include <cstddef>
+
+#include <assert.h>
+
+// -----------------------------------------------------------------------------
+
+// Also notified by the pool whenever a task becomes pending, while sync
+// waits:
+struct TaskGroup::State
+        :
+                public IEventListener
+{
+    State()
+            : m_pending(0),
+              m_cancelled(false)
+    {
+    }
+
+    // Called once by each child:
+    void
+    done(bool executed)
+    {
+        if (!executed)
+        {
+            m_cancelled.store(true, std::memory_order_relaxed);
+        }
+
+        if (m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            m_done.notify_all();
+        }
+    }
+
+    virtual void
+    on_notify()
+    {
+        m_done.notify();
+    }
+
+    std::atomic<std::size_t> m_pending;
+    std::atomic<bool> m_cancelled;
+    EventCount m_done;
+};
+
+// -----------------------------------------------------------------------------
+
+// Wraps a spawned task to account for its completion:
+class TaskGroupChild
+        :
+                public ITask
+{
+
+    Task m_task;
+    std::shared_ptr<TaskGroup::State> m_state;
+
+public:
+
+    MESSAGE_TYPE(TaskGroupChild, ITask)
+
+    TaskGroupChild(Task task, const std::shared_ptr<TaskGroup::State> &state)
+            : m_task(task),
+              m_state(state)
+    {
+        set_priority(task->priority());
+    }
+
+    virtual void
+    execute()
+    {
+        m_task->execute();
+        m_state->done(true);
+    }
+
+    virtual void
+    cancel()
+    {
+        m_task->cancel();
+        m_state->done(false);
+    }
+
+    virtual bool
+    is_handed_back() const
+    {
+        return false;
+    }
+
+};
+
+// -----------------------------------------------------------------------------
+
+TaskGroup::TaskGroup(IThreadPool &pool)
+        :
+        m_pool(pool),
+        m_state(std::make_shared<State>())
+{
+}
+
+// -----------------------------------------------------------------------------
+
+TaskGroup::~TaskGroup()
+{
+    sync();
+}
+
+// -----------------------------------------------------------------------------
+
+void
+TaskGroup::spawn(Task task)
+{
+    // Precondition verification:
+    assert(task.get() != nullptr);
+
+    m_state->m_pending.fetch_add(1, std::memory_order_relaxed);
+
+    Task child(new TaskGroupChild(task, m_state));
+    if (m_pool.push(child) == 0)
+    {
+        child->execute();
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+bool
+TaskGroup::sync()
+{
+    State &state = *m_state;
+    bool listening = false;
+
+    while (state.m_pending.load(std::memory_order_acquire) > 0)
+    {
+        if (m_pool.execute_pending())
+        {
+            continue;
+        }
+
+        // Listens to the pool only once there is nothing left to run, pushes
+        // then wake the thread up as completions do:
+        if (!listening)
+        {
+            m_pool.add_pending_listener(state);
+            listening = true;
+        }
+
+        // Looks again once announced, so that neither completions nor tasks
+        // pushed meanwhile are missed:
+        EventCount::Key key = state.m_done.prepare_wait();
+        if (state.m_pending.load(std::memory_order_seq_cst) == 0)
+        {
+            state.m_done.cancel_wait();
+            break;
+        }
+
+        if (m_pool.execute_pending())
+        {
+            state.m_done.cancel_wait();
+            continue;
+        }
+
+        state.m_done.wait(key);
+    }
+
+    if (listening)
+    {
+        m_pool.remove_pending_listener(state);
+    }
+
+    return !state.m_cancelled.exchange(false, std::memory_order_relaxed);
+}
+
+// -----------------------------------------------------------------------------
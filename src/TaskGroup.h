@@ -0,0 +1,150 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TASKGROUP_H
+#define TASKGROUP_H
+
+#include "Task.h"
+#include "ThreadPool.h"
+
+#include <memory>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Group of tasks spawned into a pool and waited for together, for
+ * nested fork/join parallelism.
+ *
+ * A task running on a pool can split its work into children with @ref spawn
+ * and wait for them with @ref sync. While waiting, the thread executes
+ * pending tasks of the pool (see @ref IThreadPool::execute_pending), its own
+ * children first when the pool allows it: recursive divide and conquer
+ * doesn't idle the workers, and can't exhaust the pool however deep the
+ * recursion goes.
+ *
+ * @code
+   void
+   SumTask::execute()
+   {
+       if (m_last - m_first <= GRAIN)
+       {
+           m_sum = std::accumulate(m_first, m_last, 0);
+           return;
+       }
+
+       auto middle = m_first + (m_last - m_first) / 2;
+       auto left = std::make_shared<SumTask>(m_pool, m_first, middle);
+       auto right = std::make_shared<SumTask>(m_pool, middle, m_last);
+
+       TaskGroup group(m_pool);
+       group.spawn(left);
+       group.spawn(right);
+       group.sync();
+
+       m_sum = left->m_sum + right->m_sum;
+   }
+   @endcode
+ *
+ * Children are not handed back as executed tasks (see @ref
+ * ITask::is_handed_back): their results are collected by the spawning
+ * thread through its own references to them. The group can also be used by
+ * threads that are not workers of the pool.
+ *
+ * The methods of a group are meant to be called by one single thread.
+ *
+ * @ingroup threading-high
+ */
+class TaskGroup
+{
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param pool The pool where children are spawned.
+     *
+     * @pre
+     * - The pool outlives the group.
+     */
+    explicit TaskGroup(IThreadPool &pool);
+
+    /**
+     * @brief Destructor.
+     *
+     * Waits for the children still running (see @ref sync).
+     */
+    ~TaskGroup();
+
+    TaskGroup(const TaskGroup &) = delete;
+    TaskGroup &operator=(const TaskGroup &) = delete;
+
+    /**
+     * @brief Spawns a child task into the pool.
+     *
+     * Children spawned by a worker of a pool created with @ref
+     * IThreadPool::SCHEDULER_STEALING stay on that worker unless stolen.
+     * When the pool is full the child is executed on the calling thread,
+     * rather than waiting for a slot that busy workers may never free.
+     *
+     * @pre
+     * - The parameter task is not null.
+     * - The pool have not been cancelled.
+     */
+    void spawn(Task task);
+
+    /**
+     * @brief Waits for all the children spawned so far, executing pending
+     * tasks of the pool meanwhile.
+     *
+     * When nothing is pending the thread sleeps until either a child
+     * completes or a task becomes pending (see @ref
+     * IThreadPool::add_pending_listener).
+     *
+     * @return @a true if all the children have been executed, @a false if
+     * some have been cancelled because the pool was cancelled (see @ref
+     * ITask::cancel).
+     */
+    bool sync();
+
+private:
+
+    friend class TaskGroupChild;
+
+    struct State;
+
+    IThreadPool &m_pool;
+
+    // Shared with the children, that may outlive the group by the time
+    // they take to notify their completion:
+    std::shared_ptr<State> m_state;
+
+};
+
+#endif // TASKGROUP_H
@@ -110,11 +110,13 @@ class ThreadPosix
 
     pthread_t m_thread;
     volatile bool m_running;
+    bool m_joined;
 
 public:
 
     ThreadPosix(bool fetch_self)
-            : m_running(false)
+            : m_running(false),
+              m_joined(false)
     {
         if (fetch_self)
         {
@@ -163,7 +165,13 @@ public:
     join()
     {
         assert(m_thread != ::pthread_self());
-        ::pthread_join(m_thread, nullptr);
+
+        // Joining a thread twice is undefined, the destructor joins too:
+        if (!m_joined)
+        {
+            ::pthread_join(m_thread, nullptr);
+            m_joined = true;
+        }
     }
 
     virtual void yield() const
@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "MessageQueue.h"
 #include "Thread.h"
+#include "ThreadPoolBackends.h"
 
 #include <iostream>
 #include <string>
@@ -44,12 +45,12 @@ class ThreadPoolWorker
 {
 
     IMessageQueue &m_input_queue;
-    IMessageQueue &m_output_queue;
+    ExecutedTasks &m_output_queue;
 
 public:
 
     ThreadPoolWorker(IMessageQueue &input_queue,
-                     IMessageQueue &output_queue)
+                     ExecutedTasks &output_queue)
             : m_input_queue(input_queue),
               m_output_queue(output_queue)
     {
@@ -85,26 +86,37 @@ class ThreadPoolPosix
 
     std::vector<Thread> m_threads;
     std::unique_ptr<IMessageQueue> m_input_queue;
-    std::unique_ptr<IMessageQueue> m_output_queue;
+    ExecutedTasks m_output_queue;
     volatile bool m_cancelled;
 
+    std::unique_ptr<ThreadPoolTimers> m_timers;
+
 public:
 
     ThreadPoolPosix(std::size_t num_threads,
-                    std::size_t task_capacity)
+                    std::size_t task_capacity,
+                    IMessageQueue::Backend input_backend,
+                    std::size_t priority_aging)
             :
             m_cancelled(false)
     {
-        // Creates the message queues (in/out) for the tasks:
-        m_input_queue.reset(IMessageQueue::create(task_capacity));
-        m_output_queue.reset(IMessageQueue::create());
+        // Precondition verification:
+        assert(input_backend != IMessageQueue::BACKEND_SPSC);
+
+        // Creates the message queue for the input tasks, executed ones are
+        // handed back through the intrusive output queue:
+        m_input_queue.reset(IMessageQueue::create(
+                IMessageQueue::Options(task_capacity)
+                        .set_backend(input_backend)
+                        .set_priority_aging(priority_aging)));
+        m_timers.reset(new ThreadPoolTimers(*m_input_queue));
 
         // Creates the threads:
         m_threads.reserve(num_threads);
         for (std::size_t i = 0; i < num_threads; ++i)
         {
             Task worker(new ThreadPoolWorker(*m_input_queue,
-                                             *m_output_queue));
+                                             m_output_queue));
 
             Thread thread_worker(IThread::create(worker));
             m_threads.push_back(thread_worker);
@@ -118,14 +130,40 @@ public:
     }
 
     virtual std::size_t
-    push(Task task)
+    push(Task task, bool blocking)
     {
         // Precondition verification:
         assert(nullptr != task.get());
         assert(!m_cancelled);
 
         // Tries to push the task in the form of message to the input queue:
-        return m_input_queue->push(task);
+        return m_input_queue->push(task, blocking);
+    }
+
+    virtual std::size_t
+    push_until(Task task, const Deadline &deadline)
+    {
+        // Precondition verification:
+        assert(nullptr != task.get());
+        assert(!m_cancelled);
+
+        return m_input_queue->push_until(task, deadline);
+    }
+
+    virtual TimerId
+    push_at(const Deadline &deadline, Task task, Clock::duration period)
+    {
+        // Precondition verification:
+        assert(nullptr != task.get());
+        assert(!m_cancelled);
+
+        return m_timers->push_at(deadline, task, period);
+    }
+
+    virtual bool
+    cancel_timer(const TimerId &timer)
+    {
+        return m_timers->cancel(timer);
     }
 
     virtual std::size_t
@@ -134,13 +172,75 @@ public:
         // Precondition verification:
         assert(!m_cancelled);
 
-        // Fetches the next executed task in the form of message:
-        return m_output_queue->popT(task, blocking);
+        return m_output_queue.pop(task, blocking);
+    }
+
+    virtual std::size_t
+    pop_until(Task &task, const Deadline &deadline)
+    {
+        // Precondition verification:
+        assert(!m_cancelled);
+
+        return m_output_queue.pop_until(task, deadline);
+    }
+
+    virtual std::size_t
+    push_bulk(const Task *tasks, std::size_t count)
+    {
+        // Precondition verification:
+        assert(!m_cancelled);
+
+        return m_input_queue->push_bulk(tasks, tasks + count);
+    }
+
+    virtual std::size_t
+    pop_bulk(Task *tasks, std::size_t max_count, bool blocking)
+    {
+        // Precondition verification:
+        assert(!m_cancelled);
+
+        return m_output_queue.pop_bulk(tasks, max_count, blocking);
+    }
+
+    virtual std::size_t
+    pop_bulk_until(Task *tasks,
+                   std::size_t max_count,
+                   const Deadline &deadline)
+    {
+        // Precondition verification:
+        assert(!m_cancelled);
+
+        return m_output_queue.pop_bulk_until(tasks, max_count, deadline);
+    }
+
+    virtual bool
+    execute_pending()
+    {
+        Task task;
+        if (m_input_queue->popT(task, false) == 0)
+        {
+            return false;
+        }
+
+        // Once cancelled, pending tasks are handed back without executing
+        // them, as join does:
+        if (m_cancelled)
+        {
+            m_output_queue.push_cancelled(task);
+        }
+        else
+        {
+            task->execute();
+            m_output_queue.push(task);
+        }
+
+        return true;
     }
 
     virtual void
     cancel()
     {
+        m_timers->cancel();
         m_input_queue->cancel();
         m_cancelled = true;
     }
@@ -157,23 +257,68 @@ public:
             thread->join();
         }
 
-        // Transfers all pending tasks from the input queue to the output one:
+        // Transfers all scheduled tasks to the output queue, periodic ones
+        // once:
+        m_timers->join(m_output_queue);
+
+        // Cancels all pending tasks and transfers them from the input queue
+        // to the output one:
         Task task;
         while (m_input_queue->popT(task, false) > 0)
         {
-            m_output_queue->push(task);
+            m_output_queue.push_cancelled(task);
         }
     }
 
+    virtual void
+    add_listener(IEventListener &listener)
+    {
+        m_output_queue.add_listener(listener);
+    }
+
+    virtual void
+    remove_listener(IEventListener &listener)
+    {
+        m_output_queue.remove_listener(listener);
+    }
+
+    virtual void
+    add_pending_listener(IEventListener &listener)
+    {
+        m_input_queue->add_listener(listener);
+    }
+
+    virtual void
+    remove_pending_listener(IEventListener &listener)
+    {
+        m_input_queue->remove_listener(listener);
+    }
+
+    virtual QueueStats
+    task_stats() const
+    {
+        return m_input_queue->stats();
+    }
+
 };
 
 // -----------------------------------------------------------------------------
 
 IThreadPool *
 IThreadPool::create(std::size_t num_threads,
-                    std::size_t task_capacity)
+                    std::size_t task_capacity,
+                    IMessageQueue::Backend input_backend,
+                    std::size_t priority_aging,
+                    Scheduler scheduler)
 {
-    return new ThreadPoolPosix(num_threads, task_capacity);
+    if (scheduler == SCHEDULER_STEALING)
+    {
+        return create_stealing_thread_pool(num_threads, task_capacity,
+                                           input_backend, priority_aging);
+    }
+
+    return new ThreadPoolPosix(num_threads, task_capacity, input_backend,
+                               priority_aging);
 }
 
 // -----------------------------------------------------------------------------
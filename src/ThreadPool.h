@@ -30,12 +30,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef TTHREADPOOL_H
 #define TTHREADPOOL_H
 
+#include "Clock.h"
+#include "DelayQueue.h"
+#include "Future.h"
 #include "MessageQueue.h"
 #include "Task.h"
 
+#include <chrono>
 #include <cstddef>
 #include <limits>
 #include <memory>
+#include <type_traits>
 
 // ----------------------------------------------------------------------------
 
@@ -66,6 +71,34 @@ class IThreadPool
 
 public:
 
+    /**
+     * @brief Available ways of dispatching pending tasks to the workers.
+     */
+    enum Scheduler
+    {
+        /**
+         * All workers pop pending tasks from one shared queue, created with
+         * the passed @a input_backend.
+         */
+        SCHEDULER_SHARED,
+
+        /**
+         * Each worker owns a deque of tasks (see @ref WorkStealingDeque):
+         * tasks pushed by a running task go to the deque of its worker, tasks
+         * pushed by other threads go to a shared injection queue, created
+         * with the passed @a input_backend. Idle workers take tasks from the
+         * injection queue in batches and steal from the deques of random
+         * workers.
+         *
+         * Suits many fine-grained tasks, especially when tasks push further
+         * tasks: dispatching rarely touches shared data. Pending tasks are
+         * not executed in a global order and @a task_capacity bounds the
+         * injection queue only: the deques are unbounded, so pushes from
+         * running tasks never block nor fail.
+         */
+        SCHEDULER_STEALING
+    };
+
     /**
      * @brief Factory method to create a thread pool implemented for the current
      * platform.
@@ -77,11 +110,31 @@ public:
      *        same time before their execution. By default this limit is
      *        relaxed as much as possible.
      *
+     * @param input_backend Implementation of the queue of pending tasks (see
+     *        @ref IMessageQueue::create). With @ref
+     *        IMessageQueue::BACKEND_PRIORITY tasks with higher @ref
+     *        IMessage::priority are executed first.
+     *
+     * @param priority_aging Aging of the priority queue of pending tasks (see
+     *        @ref IMessageQueue::create).
+     *
+     * @param scheduler How pending tasks are dispatched to the workers.
+     *
      * @return The newly created thread pool.
+     *
+     * @pre
+     * - @a input_backend is not @ref IMessageQueue::BACKEND_SPSC: besides
+     *   the workers, pending tasks are popped by @ref join and @ref
+     *   execute_pending on the calling thread, and pushed by any thread
+     *   using the pool and by the timer thread (see @ref push_at).
      */
     static IThreadPool *create(std::size_t num_threads,
                                std::size_t task_capacity
-                               = std::numeric_limits<std::size_t>::max());
+                               = std::numeric_limits<std::size_t>::max(),
+                               IMessageQueue::Backend input_backend
+                               = IMessageQueue::BACKEND_MUTEX,
+                               std::size_t priority_aging = 0,
+                               Scheduler scheduler = SCHEDULER_SHARED);
     /**
      * @brief Destructor.
      */
@@ -93,17 +146,199 @@ public:
      *
      * @param task The task to be inserted.
      *
+     * @param blocking If set to @a true and the maximum allowed capacity for
+     *        pending tasks have been reached, the method blocks the current
+     *        thread until a worker fetches a task or until the pool is
+     *        cancelled.
+     *
      * @return
      * - On success, the number of tasks pending to be executed after the
      *   insertion, that is at least @a one.
      * - On failure, @a zero. This may happen if the maximum allowed capacity
-     *   for pending tasks have been reached.
+     *   for pending tasks have been reached (and the pool have been
+     *   cancelled, when blocking).
      *
      * @pre
      * - The parameter task is not null.
      * - The pool have not been cancelled.
      */
-    virtual std::size_t push(Task task) = 0;
+    virtual std::size_t push(Task task, bool blocking) = 0;
+
+    /**
+     * @brief Pushes one task into the pool without blocking.
+     *
+     * Same as calling @ref push(Task task, bool blocking) with parameter
+     * @a blocking set to @a false.
+     */
+    std::size_t
+    push(Task task)
+    {
+        return push(task, false);
+    }
+
+    /**
+     * @brief Pushes one task into the pool waiting at most until the passed
+     * deadline for a free slot.
+     *
+     * @param task The task to be inserted.
+     *
+     * @param deadline Point in time, measured on the monotonic @ref Clock,
+     *        when the method gives up waiting for a free slot.
+     *
+     * @return
+     * - On success, the number of tasks pending to be executed after the
+     *   insertion, that is at least @a one.
+     * - On failure, @a zero. This happens if the maximum allowed capacity for
+     *   pending tasks is still reached when the deadline expires or the pool
+     *   have been cancelled.
+     *
+     * @pre
+     * - The parameter task is not null.
+     * - The pool have not been cancelled.
+     */
+    virtual std::size_t push_until(Task task, const Deadline &deadline) = 0;
+
+    /**
+     * @brief Pushes one task into the pool waiting at most for the passed
+     * timeout for a free slot.
+     *
+     * Same as @ref push_until with a deadline computed by @ref
+     * deadline_after.
+     */
+    template<typename Rep, typename Period>
+    std::size_t
+    push_for(Task task, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return push_until(task, deadline_after(timeout));
+    }
+
+    /**
+     * @brief Pushes a function into the pool, returning the future of its
+     * outcome.
+     *
+     * The function is wrapped into a task that is also the state shared with
+     * the future (see @ref FutureState), allocated at once. While the pool is
+     * full the calling thread executes pending tasks (see @ref
+     * execute_pending) rather than waiting for a free slot, so a worker
+     * submitting into its own full pool can't deadlock it.
+     *
+     * @param function A function class that can be called without any
+     *        parameter, stored by value.
+     *
+     * @param hand_back If set to @a true the task is also handed back once
+     *        executed (see @ref Future::task), by default the future is the
+     *        only way to get the outcome.
+     *
+     * @return The future of the value returned, or the exception thrown, by
+     * the function. If the pool is cancelled before executing the function,
+     * the future throws an @a std::future_error with code @a broken_promise.
+     *
+     * @pre
+     * - The pool have not been cancelled.
+     */
+    template<typename Function>
+    Future<typename std::result_of<Function()>::type>
+    submit(Function function, bool hand_back = false)
+    {
+        typedef typename std::result_of<Function()>::type Result;
+
+        auto task = std::make_shared<SubmittedTask<Result, Function>>(
+                std::move(function), hand_back);
+        while (push(task, false) == 0)
+        {
+            execute_pending();
+        }
+
+        return Future<Result>(task);
+    }
+
+    /**
+     * @brief Schedules one task to be pushed into the pool at the passed
+     * deadline, and optionally again every period.
+     *
+     * Scheduled tasks are held by one timer thread, started by the first
+     * call, that pushes them into the pool when due (see @ref DelayQueue):
+     * scheduling and cancelling cost O(1) however many tasks are pending.
+     *
+     * One-shot tasks are handed back as executed once they run. Periodic
+     * tasks are never handed back while scheduled: an occurrence due while
+     * the previous one is still running is skipped, so the task never runs
+     * concurrently with itself.
+     *
+     * The timer thread pushes due tasks blocking: while the queue of pending
+     * tasks is full (see @a task_capacity of @ref create), every other
+     * scheduled task is delayed until a worker makes room.
+     *
+     * @param deadline Point in time, measured on the monotonic @ref Clock,
+     *        when the task is due.
+     *
+     * @param task The task to be scheduled.
+     *
+     * @param period If positive, the task is pushed again every @a period
+     *        after the deadline, until cancelled by @ref cancel_timer.
+     *
+     * @return The identifier of the scheduled task.
+     *
+     * @pre
+     * - The parameter task is not null.
+     * - The pool have not been cancelled.
+     */
+    virtual TimerId push_at(const Deadline &deadline,
+                            Task task,
+                            Clock::duration period) = 0;
+
+    /**
+     * @brief Schedules one task to be pushed into the pool at the passed
+     * deadline.
+     *
+     * Same as calling @ref push_at(const Deadline &deadline, Task task,
+     * Clock::duration period) without period.
+     */
+    TimerId
+    push_at(const Deadline &deadline, Task task)
+    {
+        return push_at(deadline, task, Clock::duration::zero());
+    }
+
+    /**
+     * @brief Schedules one task to be pushed into the pool after the passed
+     * delay.
+     *
+     * Same as @ref push_at with a deadline computed by @ref deadline_after.
+     */
+    template<typename Rep, typename Period>
+    TimerId
+    push_after(const std::chrono::duration<Rep, Period> &delay, Task task)
+    {
+        return push_at(deadline_after(delay), task);
+    }
+
+    /**
+     * @brief Schedules one task to be pushed into the pool every @a
+     * interval, the first time after one interval.
+     *
+     * Same as @ref push_at with a deadline computed by @ref deadline_after
+     * and a period of @a interval.
+     */
+    template<typename Rep, typename Period>
+    TimerId
+    push_every(const std::chrono::duration<Rep, Period> &interval, Task task)
+    {
+        return push_at(deadline_after(interval), task,
+                       std::chrono::duration_cast<Clock::duration>(interval));
+    }
+
+    /**
+     * @brief Cancels a task scheduled by @ref push_at, periodic ones
+     * included.
+     *
+     * The task is not handed back. An occurrence of a periodic task already
+     * pushed into the pool may still run.
+     *
+     * @return @a true if the task was scheduled, @a false if it has already
+     * been pushed or cancelled.
+     */
+    virtual bool cancel_timer(const TimerId &timer) = 0;
 
     /**
      * @brief Pops one executed/cancelled task from the pool.
@@ -117,7 +352,8 @@ public:
      *
      * @return
      * - On success, the number of tasks already completed not yet popped
-     *   before the extraction, that is at least @a one.
+     *   before the extraction, that is at least @a one. Tasks handed back
+     *   while the previous ones were being popped may not be counted yet.
      * - On failure, @a zero (parameter task is not touched in that case).
      *
      * @pre
@@ -125,11 +361,191 @@ public:
      */
     virtual std::size_t pop(Task &task, bool blocking) = 0;
 
+    /**
+     * @brief Pops one executed/cancelled task from the pool waiting at most
+     * until the passed deadline.
+     *
+     * @param[out] task Smart pointer that will be reset with the popped
+     *             task in case of success.
+     *
+     * @param deadline Point in time, measured on the monotonic @ref Clock,
+     *        when the method gives up waiting for a task.
+     *
+     * @return
+     * - On success, the number of tasks already completed not yet popped
+     *   before the extraction, that is at least @a one. Tasks handed back
+     *   while the previous ones were being popped may not be counted yet.
+     * - On failure, @a zero (parameter task is not touched in that case).
+     *   This happens if the deadline expired.
+     *
+     * @pre
+     * - The pool have not been cancelled.
+     */
+    virtual std::size_t pop_until(Task &task, const Deadline &deadline) = 0;
+
+    /**
+     * @brief Pops one executed/cancelled task from the pool waiting at most
+     * for the passed timeout.
+     *
+     * Same as @ref pop_until with a deadline computed by @ref deadline_after.
+     */
+    template<typename Rep, typename Period>
+    std::size_t
+    pop_for(Task &task, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return pop_until(task, deadline_after(timeout));
+    }
+
+    /**
+     * @brief Pushes many tasks into the pool at once.
+     *
+     * Tasks are inserted in order until the maximum allowed capacity for
+     * pending tasks is reached, with one single synchronization that resumes
+     * as many idle workers as needed.
+     *
+     * @param tasks Array of tasks to be inserted.
+     *
+     * @param count Number of tasks in the array.
+     *
+     * @return The number of inserted tasks, that are the first ones of the
+     * array. It is less than @a count if the maximum allowed capacity for
+     * pending tasks have been reached.
+     *
+     * @pre
+     * - The tasks are not null.
+     * - The pool have not been cancelled.
+     */
+    virtual std::size_t push_bulk(const Task *tasks, std::size_t count) = 0;
+
+    /**
+     * @brief Pushes a range of tasks into the pool at once.
+     *
+     * Same as @ref push_bulk(const Task *tasks, std::size_t count) for any
+     * range of elements convertible to @ref Task.
+     *
+     * The range is copied on the stack in chunks of @ref
+     * IMessageQueue::BULK_BATCH_SIZE tasks and each chunk is inserted with its
+     * own synchronization: only ranges up to that size are inserted with one
+     * single lock. To insert a longer batch at once pass it as an array
+     * instead.
+     *
+     * @param first Iterator to the first task to be inserted.
+     *
+     * @param last Iterator past the last task to be inserted.
+     *
+     * @return The number of inserted tasks, that are the first ones of the
+     * range.
+     */
+    template<typename Iterator>
+    std::size_t
+    push_bulk(Iterator first, Iterator last)
+    {
+        std::size_t ret = 0;
+
+        while (first != last)
+        {
+            Task batch[IMessageQueue::BULK_BATCH_SIZE];
+            std::size_t count = 0;
+            while (first != last && count < IMessageQueue::BULK_BATCH_SIZE)
+            {
+                batch[count++] = *first++;
+            }
+
+            std::size_t pushed = push_bulk(batch, count);
+            ret += pushed;
+            if (pushed < count)
+            {
+                break;
+            }
+        }
+
+        return ret;
+    }
+
+    /**
+     * @brief Pops many executed/cancelled tasks from the pool at once.
+     *
+     * @param[out] tasks Array that will be filled with the popped tasks.
+     *
+     * @param max_count Maximum number of tasks to be popped, that is the size
+     *        of the array.
+     *
+     * @param blocking If set to @a true the method blocks the current thread
+     *        indefinitely until at least one task have been executed.
+     *
+     * @return The number of popped tasks, @a zero on failure.
+     *
+     * @pre
+     * - The pool have not been cancelled.
+     */
+    virtual std::size_t pop_bulk(Task *tasks,
+                                 std::size_t max_count,
+                                 bool blocking) = 0;
+
+    /**
+     * @brief Pops many executed/cancelled tasks from the pool, collecting
+     * them until @a max_count tasks have been popped or until the passed
+     * deadline.
+     *
+     * Meant to drain executed tasks in micro batches: unlike @ref pop_bulk,
+     * the method doesn't return as soon as some task is available but keeps
+     * waiting for more until the batch is complete or the deadline expires.
+     *
+     * @param[out] tasks Array that will be filled with the popped tasks.
+     *
+     * @param max_count Maximum number of tasks to be popped, that is the size
+     *        of the array.
+     *
+     * @param deadline Point in time, measured on the monotonic @ref Clock,
+     *        when the method stops waiting for more tasks.
+     *
+     * @return The number of popped tasks, @a zero on failure.
+     *
+     * @pre
+     * - The pool have not been cancelled.
+     */
+    virtual std::size_t pop_bulk_until(Task *tasks,
+                                       std::size_t max_count,
+                                       const Deadline &deadline) = 0;
+
+    /**
+     * @brief Pops many executed/cancelled tasks from the pool, collecting
+     * them until @a max_count tasks have been popped or until the passed
+     * timeout.
+     *
+     * Same as @ref pop_bulk_until with a deadline computed by @ref
+     * deadline_after.
+     */
+    template<typename Rep, typename Period>
+    std::size_t
+    pop_bulk_for(Task *tasks,
+                 std::size_t max_count,
+                 const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return pop_bulk_until(tasks, max_count, deadline_after(timeout));
+    }
+
+    /**
+     * @brief Executes one pending task on the calling thread, if any.
+     *
+     * Lets a thread that waits for other tasks of the pool, typically a task
+     * waiting for its children (see @ref TaskGroup::sync), run them instead
+     * of idling. The task is handed back as if executed by a worker. Once
+     * the pool is cancelled, the task is cancelled and handed back without
+     * being executed (see @ref ITask::cancel).
+     *
+     * @return @a true if a task was taken, @a false if none is pending.
+     */
+    virtual bool execute_pending() = 0;
+
     /**
      * @brief Cancel the pool functionality indefinitely releasing any thread.
      *
      * Also cancel any task that have not yet executed. Those task are queued
      * on the list of executed one and can be popped (see method @ref pop).
+     * Tasks scheduled by @ref push_at are handed back by @ref join, periodic
+     * ones once. Every task handed back without being executed is notified
+     * first through @ref ITask::cancel.
      *
      * The cancelled status is not reversible and is meant mainly as an action
      * to be performed before the pool destruction.
@@ -143,7 +559,8 @@ public:
      * @brief Cancel and wait for the termination of pool's threads.
      *
      * This method calls the method @ref cancel and than waits indefinitely for
-     * the pool's threads.
+     * the pool's threads. The tasks still pending or scheduled are then
+     * handed back, each one after a call to @ref ITask::cancel.
      *
      * @pre
      * - The behaviour of this method if called during the task execution is
@@ -151,17 +568,68 @@ public:
      */
     virtual void join() = 0;
 
+    /**
+     * @brief Registers a listener to be notified whenever an executed task is
+     * ready to be popped.
+     *
+     * Lets executed tasks be waited for along with other events, for example
+     * by an @a epoll(7) loop through an @ref EventFd.
+     *
+     * @pre
+     * - The listener is removed before either the pool or the listener is
+     *   destroyed.
+     */
+    virtual void add_listener(IEventListener &listener) = 0;
+
+    /**
+     * @brief Removes a listener registered by @ref add_listener.
+     */
+    virtual void remove_listener(IEventListener &listener) = 0;
+
+    /**
+     * @brief Registers a listener to be notified whenever a task becomes
+     * pending, that is whenever @ref execute_pending may find one.
+     *
+     * Lets a thread that runs pending tasks while waiting for something else
+     * sleep without polling (see @ref TaskGroup::sync). Tasks pushed after
+     * the registration are not missed.
+     *
+     * @pre
+     * - The listener is removed before either the pool or the listener is
+     *   destroyed.
+     */
+    virtual void add_pending_listener(IEventListener &listener) = 0;
+
+    /**
+     * @brief Removes a listener registered by @ref add_pending_listener.
+     */
+    virtual void remove_pending_listener(IEventListener &listener) = 0;
+
+    /**
+     * @brief Returns a snapshot of the statistics of the queue of pending
+     * tasks (see @ref IMessageQueue::stats).
+     *
+     * The high-water mark, the rejected pushes and the waiting times of the
+     * producers tell whether @a task_capacity fits the load.
+     */
+    virtual QueueStats task_stats() const = 0;
+
     /**
      * @brief Convenient template method to pop executed tasks.
      *
      * Since by design the user should derive messages from the class @ref
-     * ITask this template take care to dynamic cast shared pointers to
-     * the user defined derived class.
+     * ITask this template take care to cast shared pointers to the user
+     * defined derived class (see @ref message_cast).
      *
      * This method is meant to be used when the user uses the pool with one
-     * single derived class and hence don't need to manually dynamic cast every
+     * single derived class and hence don't need to manually cast every
      * popped message from the generic @a ITask.
      *
+     * @pre
+     * - Every executed task is an instance of @a Derived. When RTTI is
+     *   disabled this is verified only if @a Derived is registered with @ref
+     *   MESSAGE_TYPE.
+     *
      * @copydetails pop(ITaskPtr& task, bool blocking)
      */
     template<typename Derived>
@@ -172,8 +640,7 @@ public:
         if (ret > 0)
         {
             assert(task_abstract.get() != nullptr);
-            task = std::dynamic_pointer_cast<Derived>(task_abstract);
-            assert(task.get() == task_abstract.get());
+            task = message_cast<Derived>(task_abstract);
         }
 
         return ret;
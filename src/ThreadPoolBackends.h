@@ -0,0 +1,381 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef THREADPOOLBACKENDS_H
+#define THREADPOOLBACKENDS_H
+
+#include "DelayQueue.h"
+#include "Locker.h"
+#include "MessageQueue.h"
+#include "MpscQueue.h"
+#include "Mutex.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// ----------------------------------------------------------------------------
+// Factories of the implementations selectable by IThreadPool::create, and the
+// parts they share. They are not part of the public interface.
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Creates a pool whose workers steal tasks from each other (see @ref
+ * IThreadPool::SCHEDULER_STEALING).
+ */
+IThreadPool *create_stealing_thread_pool(std::size_t num_threads,
+                                         std::size_t task_capacity,
+                                         IMessageQueue::Backend input_backend,
+                                         std::size_t priority_aging);
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Occurrence of a task scheduled periodically, pushed again at each
+ * period.
+ *
+ * Occurrences are not handed back: the task is handed back once when the
+ * pool is joined (see @ref ThreadPoolTimers::join).
+ */
+class PeriodicTask
+        :
+                public ITask
+{
+
+    Task m_task;
+    std::atomic<bool> m_running;
+
+public:
+
+    MESSAGE_TYPE(PeriodicTask, ITask)
+
+    PeriodicTask(Task task)
+            : m_task(task),
+              m_running(false)
+    {
+    }
+
+    virtual void
+    execute()
+    {
+        // Skips the occurrence if the previous one is still running:
+        if (m_running.exchange(true, std::memory_order_acquire))
+        {
+            return;
+        }
+
+        m_task->execute();
+        m_running.store(false, std::memory_order_release);
+    }
+
+    const Task &
+    task() const
+    {
+        return m_task;
+    }
+
+    virtual bool
+    is_handed_back() const
+    {
+        return false;
+    }
+
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Queue of executed/cancelled tasks of a pool, popped by the user.
+ *
+ * Tasks are handed back through an intrusive queue (see @ref MpscQueue), so
+ * that workers never allocate nor contend on a lock to hand them back, while
+ * the user takes the lock of the queue once per batch of popped tasks.
+ */
+class ExecutedTasks
+{
+
+    MpscQueue m_queue;
+
+public:
+
+    /**
+     * @brief Hands back an executed task, unless it opted out (see @ref
+     * ITask::is_handed_back).
+     */
+    void
+    push(const Task &task)
+    {
+        if (task->is_handed_back())
+        {
+            m_queue.push(task);
+        }
+    }
+
+    /**
+     * @brief Cancels a task not executed because the pool is cancelled, then
+     * hands it back unless it opted out.
+     */
+    void
+    push_cancelled(const Task &task)
+    {
+        task->cancel();
+        push(task);
+    }
+
+    /**
+     * @copydoc IThreadPool::pop
+     */
+    std::size_t
+    pop(Task &task, bool blocking)
+    {
+        Message message;
+        std::size_t ret = m_queue.pop(message, blocking);
+        if (ret > 0)
+        {
+            // Only tasks are pushed into the queue:
+            task = std::static_pointer_cast<ITask>(message);
+        }
+
+        return ret;
+    }
+
+    /**
+     * @copydoc IThreadPool::pop_until
+     */
+    std::size_t
+    pop_until(Task &task, const Deadline &deadline)
+    {
+        Message message;
+        std::size_t ret = m_queue.pop_until(message, deadline);
+        if (ret > 0)
+        {
+            task = std::static_pointer_cast<ITask>(message);
+        }
+
+        return ret;
+    }
+
+    /**
+     * @copydoc IThreadPool::pop_bulk
+     */
+    std::size_t
+    pop_bulk(Task *tasks, std::size_t max_count, bool blocking)
+    {
+        const std::size_t BATCH_SIZE = IMessageQueue::BULK_BATCH_SIZE;
+
+        std::size_t ret = 0;
+        while (ret < max_count)
+        {
+            // Only the first batch may wait:
+            Message batch[BATCH_SIZE];
+            std::size_t count = std::min(BATCH_SIZE, max_count - ret);
+            std::size_t popped = m_queue.pop_bulk(batch, count,
+                                                  blocking && ret == 0);
+
+            ret += to_tasks(batch, popped, tasks + ret);
+            if (popped < count)
+            {
+                break;
+            }
+        }
+
+        return ret;
+    }
+
+    /**
+     * @copydoc IThreadPool::pop_bulk_until
+     */
+    std::size_t
+    pop_bulk_until(Task *tasks,
+                   std::size_t max_count,
+                   const Deadline &deadline)
+    {
+        const std::size_t BATCH_SIZE = IMessageQueue::BULK_BATCH_SIZE;
+
+        std::size_t ret = 0;
+        while (ret < max_count)
+        {
+            Message batch[BATCH_SIZE];
+            std::size_t count = std::min(BATCH_SIZE, max_count - ret);
+            std::size_t popped = m_queue.pop_bulk_until(batch, count,
+                                                        deadline);
+
+            ret += to_tasks(batch, popped, tasks + ret);
+            if (popped < count)
+            {
+                break;
+            }
+        }
+
+        return ret;
+    }
+
+    /**
+     * @copydoc IThreadPool::add_listener
+     */
+    void
+    add_listener(IEventListener &listener)
+    {
+        m_queue.add_listener(listener);
+    }
+
+    /**
+     * @copydoc IThreadPool::remove_listener
+     */
+    void
+    remove_listener(IEventListener &listener)
+    {
+        m_queue.remove_listener(listener);
+    }
+
+private:
+
+    static std::size_t
+    to_tasks(Message *messages, std::size_t count, Task *tasks)
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            tasks[i] = std::static_pointer_cast<ITask>(messages[i]);
+        }
+
+        return count;
+    }
+
+};
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Tasks scheduled by @ref IThreadPool::push_at, pushed into the queue
+ * of pending tasks of a pool when due.
+ *
+ * The timer thread is started by the first scheduled task. It pushes into the
+ * queue of pending tasks besides the threads using the pool, so that queue
+ * must accept many producers: it can't be an @ref IMessageQueue::BACKEND_SPSC
+ * one, that the pools refuse anyway.
+ */
+class ThreadPoolTimers
+{
+
+    IMessageQueue &m_input_queue;
+
+    Mutex m_mutex;
+    std::unique_ptr<DelayQueue> m_timers;
+
+public:
+
+    explicit ThreadPoolTimers(IMessageQueue &input_queue)
+            : m_input_queue(input_queue)
+    {
+    }
+
+    /**
+     * @copydoc IThreadPool::push_at
+     */
+    TimerId
+    push_at(const Deadline &deadline, Task task, Clock::duration period)
+    {
+        if (period > Clock::duration::zero())
+        {
+            task = make_message<PeriodicTask>(task);
+        }
+
+        return timers().push_at(deadline, task, period);
+    }
+
+    /**
+     * @copydoc IThreadPool::cancel_timer
+     */
+    bool
+    cancel(const TimerId &timer)
+    {
+        Locker<Mutex> locker(m_mutex);
+        return m_timers && m_timers->cancel(timer);
+    }
+
+    /**
+     * @brief Stops pushing scheduled tasks.
+     */
+    void
+    cancel()
+    {
+        Locker<Mutex> locker(m_mutex);
+        if (m_timers)
+        {
+            m_timers->cancel();
+        }
+    }
+
+    /**
+     * @brief Stops the timer thread and hands back the scheduled tasks,
+     * periodic ones once.
+     */
+    void
+    join(ExecutedTasks &output_queue)
+    {
+        std::vector<Message> scheduled;
+        {
+            Locker<Mutex> locker(m_mutex);
+            if (m_timers)
+            {
+                m_timers->join(scheduled);
+            }
+        }
+
+        for (auto &message: scheduled)
+        {
+            Task task = std::static_pointer_cast<ITask>(message);
+            if (task->is_a(message_type_id<PeriodicTask>()))
+            {
+                task = message_cast<PeriodicTask>(task)->task();
+            }
+            output_queue.push_cancelled(task);
+        }
+    }
+
+private:
+
+    DelayQueue &
+    timers()
+    {
+        Locker<Mutex> locker(m_mutex);
+        if (!m_timers)
+        {
+            m_timers.reset(new DelayQueue(m_input_queue));
+        }
+
+        return *m_timers;
+    }
+
+};
+
+#endif // THREADPOOLBACKENDS_H
@@ -0,0 +1,567 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ThreadPoolBackends.h"
+
+#include "EventCount.h"
+#include "MessageQueue.h"
+#include "Thread.h"
+#include "WorkStealingDeque.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+class ThreadPoolStealing;
+
+// State of one worker, its deque is pushed by the tasks it runs:
+struct StealingWorkerState
+{
+    StealingWorkerState(ThreadPoolStealing &pool, std::size_t index)
+            : m_pool(pool),
+              m_index(index),
+              m_seed(index + 1)
+    {
+    }
+
+    // Picks the first victim of a steal round (xorshift):
+    std::size_t
+    random(std::size_t range)
+    {
+        m_seed ^= m_seed << 13;
+        m_seed ^= m_seed >> 7;
+        m_seed ^= m_seed << 17;
+        return std::size_t(m_seed % range);
+    }
+
+    ThreadPoolStealing &m_pool;
+    const std::size_t m_index;
+    std::uint64_t m_seed;
+
+    WorkStealingDeque m_deque;
+};
+
+// -----------------------------------------------------------------------------
+
+class StealingWorker
+        :
+                public ITask
+{
+
+    StealingWorkerState &m_state;
+
+public:
+
+    StealingWorker(StealingWorkerState &state)
+            : m_state(state)
+    {
+    }
+
+    virtual void execute();
+
+};
+
+// -----------------------------------------------------------------------------
+
+namespace {
+
+// Worker running on the calling thread, if any:
+StealingWorkerState *&
+current_worker()
+{
+    static thread_local StealingWorkerState *worker = nullptr;
+    return worker;
+}
+
+} // anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+class ThreadPoolStealing
+        :
+                public IThreadPool,
+                private IEventListener
+{
+
+    // Maximum number of tasks taken from the injection queue at once:
+    static const std::size_t INJECTION_BATCH = 32;
+
+    std::vector<std::unique_ptr<StealingWorkerState>> m_workers;
+    std::vector<Thread> m_threads;
+    std::unique_ptr<IMessageQueue> m_input_queue;
+    ExecutedTasks m_output_queue;
+    std::atomic<bool> m_cancelled;
+
+    // Idle workers wait here for tasks pushed anywhere:
+    EventCount m_idle;
+
+    std::unique_ptr<ThreadPoolTimers> m_timers;
+
+public:
+
+    ThreadPoolStealing(std::size_t num_threads,
+                       std::size_t task_capacity,
+                       IMessageQueue::Backend input_backend,
+                       std::size_t priority_aging)
+            :
+            m_cancelled(false)
+    {
+        // Precondition verification:
+        assert(input_backend != IMessageQueue::BACKEND_SPSC);
+
+        // External pushes go through the injection queue, that resumes the
+        // idle workers through the listener:
+        m_input_queue.reset(IMessageQueue::create(
+                IMessageQueue::Options(task_capacity)
+                        .set_backend(input_backend)
+                        .set_priority_aging(priority_aging)));
+        m_input_queue->add_listener(*this);
+        m_timers.reset(new ThreadPoolTimers(*m_input_queue));
+
+        // The deques exist before any worker may steal from them:
+        m_workers.reserve(num_threads);
+        for (std::size_t i = 0; i < num_threads; ++i)
+        {
+            m_workers.emplace_back(new StealingWorkerState(*this, i));
+        }
+
+        m_threads.reserve(num_threads);
+        for (auto &worker: m_workers)
+        {
+            Task task(new StealingWorker(*worker));
+
+            Thread thread_worker(IThread::create(task));
+            m_threads.push_back(thread_worker);
+        }
+    }
+
+    virtual
+    ~ThreadPoolStealing()
+    {
+        join();
+        m_input_queue->remove_listener(*this);
+    }
+
+    virtual std::size_t
+    push(Task task, bool blocking)
+    {
+        // Precondition verification:
+        assert(nullptr != task.get());
+        assert(!m_cancelled);
+
+        StealingWorkerState *worker = local_worker();
+        if (worker != nullptr)
+        {
+            return push_local(*worker, task);
+        }
+
+        return m_input_queue->push(task, blocking);
+    }
+
+    virtual std::size_t
+    push_until(Task task, const Deadline &deadline)
+    {
+        // Precondition verification:
+        assert(nullptr != task.get());
+        assert(!m_cancelled);
+
+        StealingWorkerState *worker = local_worker();
+        if (worker != nullptr)
+        {
+            return push_local(*worker, task);
+        }
+
+        return m_input_queue->push_until(task, deadline);
+    }
+
+    virtual TimerId
+    push_at(const Deadline &deadline, Task task, Clock::duration period)
+    {
+        // Precondition verification:
+        assert(nullptr != task.get());
+        assert(!m_cancelled);
+
+        return m_timers->push_at(deadline, task, period);
+    }
+
+    virtual bool
+    cancel_timer(const TimerId &timer)
+    {
+        return m_timers->cancel(timer);
+    }
+
+    virtual std::size_t
+    pop(Task &task, bool blocking)
+    {
+        // Precondition verification:
+        assert(!m_cancelled);
+
+        return m_output_queue.pop(task, blocking);
+    }
+
+    virtual std::size_t
+    pop_until(Task &task, const Deadline &deadline)
+    {
+        // Precondition verification:
+        assert(!m_cancelled);
+
+        return m_output_queue.pop_until(task, deadline);
+    }
+
+    virtual std::size_t
+    push_bulk(const Task *tasks, std::size_t count)
+    {
+        // Precondition verification:
+        assert(!m_cancelled);
+
+        StealingWorkerState *worker = local_worker();
+        if (worker == nullptr)
+        {
+            return m_input_queue->push_bulk(tasks, tasks + count);
+        }
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            worker->m_deque.push(tasks[i]);
+        }
+        m_idle.notify(count);
+
+        return count;
+    }
+
+    virtual std::size_t
+    pop_bulk(Task *tasks, std::size_t max_count, bool blocking)
+    {
+        // Precondition verification:
+        assert(!m_cancelled);
+
+        return m_output_queue.pop_bulk(tasks, max_count, blocking);
+    }
+
+    virtual std::size_t
+    pop_bulk_until(Task *tasks,
+                   std::size_t max_count,
+                   const Deadline &deadline)
+    {
+        // Precondition verification:
+        assert(!m_cancelled);
+
+        return m_output_queue.pop_bulk_until(tasks, max_count, deadline);
+    }
+
+    virtual bool
+    execute_pending()
+    {
+        // Workers look where they look for their next task, other threads
+        // take injected tasks or steal:
+        Task task;
+        StealingWorkerState *worker = local_worker();
+        if (worker != nullptr)
+        {
+            if (!find(*worker, task))
+            {
+                return false;
+            }
+        }
+        else if (m_input_queue->popT(task, false) == 0)
+        {
+            Message message;
+            if (!steal(0, m_workers.size(), message))
+            {
+                return false;
+            }
+            task = std::static_pointer_cast<ITask>(message);
+        }
+
+        // Once cancelled, pending tasks are handed back without executing
+        // them, as join does:
+        if (m_cancelled.load(std::memory_order_acquire))
+        {
+            m_output_queue.push_cancelled(task);
+        }
+        else
+        {
+            task->execute();
+            m_output_queue.push(task);
+        }
+
+        return true;
+    }
+
+    virtual void
+    cancel()
+    {
+        m_timers->cancel();
+        m_input_queue->cancel();
+        m_cancelled.store(true, std::memory_order_seq_cst);
+        m_idle.notify_all();
+    }
+
+    virtual void
+    join()
+    {
+        // Cancel the pool in order to terminate all workers:
+        cancel();
+
+        // Joins all workers threads:
+        for (auto &thread: m_threads)
+        {
+            thread->join();
+        }
+
+        // Transfers all scheduled tasks to the output queue, periodic ones
+        // once:
+        m_timers->join(m_output_queue);
+
+        // Cancels all pending tasks and transfers them from the deques and the
+        // injection queue to the output queue:
+        Message message;
+        for (auto &worker: m_workers)
+        {
+            while (worker->m_deque.pop(message))
+            {
+                m_output_queue.push_cancelled(
+                        std::static_pointer_cast<ITask>(message));
+            }
+        }
+
+        Task task;
+        while (m_input_queue->popT(task, false) > 0)
+        {
+            m_output_queue.push_cancelled(task);
+        }
+    }
+
+    virtual void
+    add_listener(IEventListener &listener)
+    {
+        m_output_queue.add_listener(listener);
+    }
+
+    virtual void
+    remove_listener(IEventListener &listener)
+    {
+        m_output_queue.remove_listener(listener);
+    }
+
+    virtual void
+    add_pending_listener(IEventListener &listener)
+    {
+        // Notified at each push, either into a deque or into the injection
+        // queue (see on_notify):
+        m_idle.add_listener(listener);
+    }
+
+    virtual void
+    remove_pending_listener(IEventListener &listener)
+    {
+        m_idle.remove_listener(listener);
+    }
+
+    virtual QueueStats
+    task_stats() const
+    {
+        return m_input_queue->stats();
+    }
+
+    // Body of the worker threads:
+    void
+    run(StealingWorkerState &worker)
+    {
+        current_worker() = &worker;
+
+        Task task;
+        while (next(worker, task))
+        {
+            task->execute();
+            m_output_queue.push(task);
+            task.reset();
+        }
+
+        current_worker() = nullptr;
+    }
+
+private:
+
+    // Notified by the injection queue at each push:
+    virtual void
+    on_notify()
+    {
+        m_idle.notify();
+    }
+
+    // The worker of this pool running on the calling thread, if any:
+    StealingWorkerState *
+    local_worker() const
+    {
+        StealingWorkerState *worker = current_worker();
+        return worker != nullptr && &worker->m_pool == this ? worker : nullptr;
+    }
+
+    // Pushes into the deque of the running worker. The deque grows as
+    // needed: local pushes never block nor fail, whatever the blocking flag,
+    // the deadline or the task capacity, that bounds the injection queue only.
+    std::size_t
+    push_local(StealingWorkerState &worker, Task task)
+    {
+        worker.m_deque.push(task);
+        m_idle.notify();
+
+        return std::max<std::size_t>(worker.m_deque.size(), 1);
+    }
+
+    // Fetches the next task to be run by the worker, waiting while there is
+    // none. Fails once the pool is cancelled.
+    bool
+    next(StealingWorkerState &worker, Task &task)
+    {
+        for (;;)
+        {
+            if (m_cancelled.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+
+            if (find(worker, task))
+            {
+                return true;
+            }
+
+            // Looks again once announced, so that tasks pushed meanwhile
+            // aren't missed:
+            EventCount::Key key = m_idle.prepare_wait();
+            if (m_cancelled.load(std::memory_order_seq_cst))
+            {
+                m_idle.cancel_wait();
+                return false;
+            }
+
+            if (find(worker, task))
+            {
+                m_idle.cancel_wait();
+                return true;
+            }
+
+            m_idle.wait(key);
+        }
+    }
+
+    // Looks for a task in the own deque first, then in the injection queue
+    // and finally in the deques of the other workers, starting from a random
+    // one:
+    bool
+    find(StealingWorkerState &worker, Task &task)
+    {
+        Message message;
+        if (worker.m_deque.pop(message)
+            || take_injected(worker, message)
+            || steal(worker.random(m_workers.size()), worker.m_index,
+                     message))
+        {
+            task = std::static_pointer_cast<ITask>(message);
+            return true;
+        }
+
+        return false;
+    }
+
+    // Takes a batch of tasks from the injection queue, keeping the first one
+    // and queuing the others into the own deque where they can be stolen:
+    bool
+    take_injected(StealingWorkerState &worker, Message &message)
+    {
+        Message batch[INJECTION_BATCH];
+        const std::size_t count = m_input_queue->pop_bulk(batch,
+                                                          INJECTION_BATCH,
+                                                          false);
+        if (count == 0)
+        {
+            return false;
+        }
+
+        // Pushed backward, so that the owner pops them in order:
+        for (std::size_t i = count - 1; i > 0; --i)
+        {
+            worker.m_deque.push(std::move(batch[i]));
+        }
+        message = std::move(batch[0]);
+
+        if (count > 1)
+        {
+            m_idle.notify(count - 1);
+        }
+
+        return true;
+    }
+
+    // Steals one task from the workers but the one at index self, starting
+    // from the one at index first:
+    bool
+    steal(std::size_t first, std::size_t self, Message &message)
+    {
+        const std::size_t num_workers = m_workers.size();
+        for (std::size_t i = 0; i < num_workers; ++i)
+        {
+            const std::size_t victim = (first + i) % num_workers;
+            if (victim != self && m_workers[victim]->m_deque.steal(message))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+};
+
+// -----------------------------------------------------------------------------
+
+void
+StealingWorker::execute()
+{
+    m_state.m_pool.run(m_state);
+}
+
+// -----------------------------------------------------------------------------
+
+IThreadPool *
+create_stealing_thread_pool(std::size_t num_threads,
+                            std::size_t task_capacity,
+                            IMessageQueue::Backend input_backend,
+                            std::size_t priority_aging)
+{
+    return new ThreadPoolStealing(num_threads, task_capacity, input_backend,
+                                  priority_aging);
+}
+
+// -----------------------------------------------------------------------------
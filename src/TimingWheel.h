@@ -0,0 +1,657 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+#include <assert.h>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Hierarchical timing wheel: a set of timers that expire at given
+ * ticks of a discrete clock.
+ *
+ * Timers are kept in @ref LEVELS wheels of @ref SLOTS slots each, every
+ * level covering a @ref SLOTS times longer span of time than the one below.
+ * A timer is linked into the slot of the lowest level whose span contains its
+ * expiry, and it is moved down one level each time the clock enters that
+ * slot, until it is delivered from the lowest level. Timers farther than the
+ * span of the highest level wait in an overflow list, that is redistributed
+ * every time the highest level completes a turn.
+ *
+ * Inserting and cancelling a timer cost O(1) regardless of the number of
+ * pending timers: timers are chained into the slots through intrusive lists
+ * and their nodes are recycled, so the steady state never allocates. A timer
+ * is moved at most once per level before expiring.
+ *
+ * Advancing the clock jumps over the empty slots of every level, found
+ * through one bitmap per level, so it stops only where timers expire or move
+ * down.
+ *
+ * The class is not thread safe.
+ *
+ * @tparam T Type of the values delivered by the timers, it must be default
+ *         constructible and movable. Periodic timers also require it to be
+ *         copyable.
+ *
+ * @ingroup threading-base
+ */
+template<typename T>
+class TimingWheel
+{
+
+    struct Node;
+
+public:
+
+    /**
+     * @brief Number of levels of the wheel.
+     */
+    static const std::size_t LEVELS = 4;
+
+    /**
+     * @brief Base 2 logarithm of @ref SLOTS.
+     */
+    static const unsigned SLOT_BITS = 8;
+
+    /**
+     * @brief Number of slots of each level.
+     */
+    static const std::size_t SLOTS = std::size_t(1) << SLOT_BITS;
+
+    /**
+     * @brief Tick returned by @ref next_tick when no timer is pending.
+     */
+    static const std::uint64_t NEVER = ~std::uint64_t(0);
+
+    /**
+     * @brief Identifies an inserted timer in order to cancel it.
+     *
+     * Handles of expired or cancelled timers are stale: cancelling them
+     * through @ref cancel is harmless.
+     */
+    class Handle
+    {
+
+    public:
+
+        /**
+         * @brief Constructs a handle that doesn't identify any timer.
+         */
+        Handle()
+                :
+                m_node(nullptr),
+                m_id(0)
+        {
+        }
+
+        /**
+         * @brief Tells whether the handle has been returned by @ref insert.
+         */
+        bool
+        valid() const
+        {
+            return m_id != 0;
+        }
+
+    private:
+
+        friend class TimingWheel;
+
+        Handle(Node *node, std::uint64_t id)
+                :
+                m_node(node),
+                m_id(id)
+        {
+        }
+
+        Node *m_node;
+        std::uint64_t m_id;
+
+    };
+
+    /**
+     * @brief Constructor.
+     *
+     * @param now Initial tick of the clock.
+     */
+    inline explicit TimingWheel(std::uint64_t now = 0);
+
+    /**
+     * @brief Destructor.
+     *
+     * Pending timers are discarded.
+     */
+    inline ~TimingWheel();
+
+    TimingWheel(const TimingWheel &) = delete;
+    TimingWheel &operator=(const TimingWheel &) = delete;
+
+    /**
+     * @brief Returns the current tick of the clock.
+     */
+    std::uint64_t
+    now() const
+    {
+        return m_now;
+    }
+
+    /**
+     * @brief Returns the number of pending timers.
+     */
+    std::size_t
+    size() const
+    {
+        return m_size;
+    }
+
+    /**
+     * @brief Inserts a timer.
+     *
+     * @param expiry Tick when the timer expires. Ticks not later than @ref
+     *        now expire at the next one.
+     *
+     * @param value Value delivered by @ref advance when the timer expires.
+     *
+     * @param period If not @a zero, the timer is periodic: each time it
+     *        expires a copy of the value is delivered and the timer is
+     *        inserted again @a period ticks later.
+     *
+     * @return The handle identifying the timer.
+     */
+    inline Handle insert(std::uint64_t expiry,
+                         T value,
+                         std::uint64_t period = 0);
+
+    /**
+     * @brief Cancels a pending timer, periodic ones included.
+     *
+     * @return @a true if the timer was pending, @a false if the handle is
+     * stale.
+     */
+    inline bool cancel(const Handle &handle);
+
+    /**
+     * @brief Returns the first tick, later than @ref now, that @ref advance
+     * has to stop at.
+     *
+     * That is the expiry of the nearest timer of the lowest level or, if
+     * empty, the tick when the nearest timers of the higher levels move down.
+     * It is @ref NEVER if no timer is pending.
+     */
+    inline std::uint64_t next_tick() const;
+
+    /**
+     * @brief Advances the clock up to the passed tick delivering the expired
+     * timers.
+     *
+     * Timers are delivered in order of expiry, those expiring at the same
+     * tick in order of insertion. Periodic timers count as inserted again
+     * at each expiry.
+     *
+     * @param tick The new current tick, ticks not later than @ref now are
+     *        ignored.
+     *
+     * @param expired Function called as @a expired(T &value, bool periodic)
+     *        for each expired timer. The value can be moved away, for
+     *        periodic timers it is a copy. The function must not access the
+     *        wheel.
+     */
+    template<typename Function>
+    inline void advance(std::uint64_t tick, Function expired);
+
+    /**
+     * @brief Cancels all pending timers.
+     *
+     * @param visit Function called as @a visit(T &value) for each pending
+     *        timer, before cancelling it. The value can be moved away.
+     */
+    template<typename Function>
+    inline void clear(Function visit);
+
+private:
+
+    struct Link
+    {
+        Link *m_prev;
+        Link *m_next;
+    };
+
+    struct Node
+            : Link
+    {
+        // Zero while the node is recycled:
+        std::uint64_t m_id;
+
+        std::uint64_t m_expiry;
+        std::uint64_t m_period;
+
+        // Level and slot of the list the node is linked into:
+        std::size_t m_level;
+        std::size_t m_slot;
+
+        T m_value;
+    };
+
+    static const std::size_t WORD_BITS = 64;
+    static const std::size_t WORDS = SLOTS / WORD_BITS;
+
+    static void
+    init(Link &list)
+    {
+        list.m_prev = &list;
+        list.m_next = &list;
+    }
+
+    static bool
+    empty(const Link &list)
+    {
+        return list.m_next == &list;
+    }
+
+    // Moves all nodes of src to the empty list dst:
+    static inline void splice(Link &src, Link &dst);
+
+    inline void link(Node *node);
+    inline void unlink(Node *node);
+    inline void release(Node *node);
+    inline void expire(std::uint64_t tick);
+
+    template<typename Function>
+    inline void deliver(Link &list, Function expired);
+
+    // Index of the first non-empty slot of the level not before first, or
+    // SLOTS:
+    inline std::size_t find_slot(std::size_t level, std::size_t first) const;
+
+    std::uint64_t m_now;
+    std::size_t m_size;
+    std::uint64_t m_next_id;
+
+    Link m_slots[LEVELS][SLOTS];
+    std::uint64_t m_used[LEVELS][WORDS];
+
+    // Level LEVELS: timers farther than the span of the highest level.
+    Link m_overflow;
+
+    // Recycled nodes, chained through m_next:
+    Link *m_free;
+
+};
+
+// ----------------------------------------------------------------------------
+
+template<typename T>
+TimingWheel<T>::TimingWheel(std::uint64_t now)
+        :
+        m_now(now),
+        m_size(0),
+        m_next_id(1),
+        m_free(nullptr)
+{
+    for (std::size_t level = 0; level < LEVELS; ++level)
+    {
+        for (std::size_t slot = 0; slot < SLOTS; ++slot)
+        {
+            init(m_slots[level][slot]);
+        }
+
+        for (std::size_t word = 0; word < WORDS; ++word)
+        {
+            m_used[level][word] = 0;
+        }
+    }
+
+    init(m_overflow);
+}
+
+template<typename T>
+TimingWheel<T>::~TimingWheel()
+{
+    clear([](T &) { });
+
+    while (m_free != nullptr)
+    {
+        Node *node = static_cast<Node *>(m_free);
+        m_free = m_free->m_next;
+        delete node;
+    }
+}
+
+template<typename T>
+typename TimingWheel<T>::Handle
+TimingWheel<T>::insert(std::uint64_t expiry, T value, std::uint64_t period)
+{
+    Node *node;
+    if (m_free != nullptr)
+    {
+        node = static_cast<Node *>(m_free);
+        m_free = m_free->m_next;
+    }
+    else
+    {
+        node = new Node();
+    }
+
+    node->m_id = m_next_id++;
+    node->m_expiry = std::max(expiry, m_now + 1);
+    node->m_period = period;
+    node->m_value = std::move(value);
+
+    link(node);
+    ++m_size;
+
+    return Handle(node, node->m_id);
+}
+
+template<typename T>
+bool
+TimingWheel<T>::cancel(const Handle &handle)
+{
+    Node *node = handle.m_node;
+    if (node == nullptr || node->m_id != handle.m_id)
+    {
+        return false;
+    }
+
+    unlink(node);
+    release(node);
+    return true;
+}
+
+template<typename T>
+std::uint64_t
+TimingWheel<T>::next_tick() const
+{
+    if (m_size == 0)
+    {
+        return NEVER;
+    }
+
+    // Levels are searched from the lowest, after the slot of the current
+    // tick: past their last slot a level is done with its turn, and the next
+    // timers are found in the higher levels.
+    for (std::size_t level = 0; level < LEVELS; ++level)
+    {
+        const unsigned shift = SLOT_BITS * unsigned(level);
+        const std::size_t current = std::size_t(m_now >> shift) & (SLOTS - 1);
+        const std::size_t slot = current + 1 < SLOTS
+                                 ? find_slot(level, current + 1)
+                                 : SLOTS;
+
+        if (slot < SLOTS)
+        {
+            const unsigned turn_shift = shift + SLOT_BITS;
+            return ((m_now >> turn_shift) << turn_shift)
+                   | (std::uint64_t(slot) << shift);
+        }
+    }
+
+    // The overflow moves down when the highest level completes its turn:
+    const unsigned span_shift = SLOT_BITS * unsigned(LEVELS);
+    return ((m_now >> span_shift) + 1) << span_shift;
+}
+
+template<typename T>
+template<typename Function>
+void
+TimingWheel<T>::advance(std::uint64_t tick, Function expired)
+{
+    while (m_now < tick)
+    {
+        // Jumps over the ticks with nothing to deliver or to move down:
+        const std::uint64_t next = next_tick();
+        if (next > tick)
+        {
+            m_now = tick;
+            break;
+        }
+
+        m_now = next;
+
+        // Moves down the timers of the slots entered by the higher levels,
+        // the highest first, since their timers may land into the slots of
+        // the lower ones entered at the same tick:
+        expire(m_now);
+
+        Link list;
+        init(list);
+        splice(m_slots[0][m_now & (SLOTS - 1)], list);
+        m_used[0][(m_now & (SLOTS - 1)) / WORD_BITS]
+                &= ~(std::uint64_t(1) << (m_now & (WORD_BITS - 1)));
+
+        deliver(list, expired);
+    }
+}
+
+template<typename T>
+template<typename Function>
+void
+TimingWheel<T>::clear(Function visit)
+{
+    for (std::size_t level = 0; level <= LEVELS; ++level)
+    {
+        for (std::size_t slot = 0; slot < SLOTS; ++slot)
+        {
+            Link &list = level < LEVELS ? m_slots[level][slot] : m_overflow;
+            while (!empty(list))
+            {
+                Node *node = static_cast<Node *>(list.m_next);
+                visit(node->m_value);
+                unlink(node);
+                release(node);
+            }
+
+            if (level == LEVELS)
+            {
+                break;
+            }
+        }
+    }
+
+    assert(m_size == 0);
+}
+
+template<typename T>
+void
+TimingWheel<T>::splice(Link &src, Link &dst)
+{
+    assert(empty(dst));
+
+    if (!empty(src))
+    {
+        dst.m_next = src.m_next;
+        dst.m_prev = src.m_prev;
+        dst.m_next->m_prev = &dst;
+        dst.m_prev->m_next = &dst;
+        init(src);
+    }
+}
+
+template<typename T>
+void
+TimingWheel<T>::link(Node *node)
+{
+    assert(node->m_expiry >= m_now);
+
+    // The lowest level whose current turn includes the expiry:
+    std::size_t level = 0;
+    while (level < LEVELS)
+    {
+        const unsigned shift = SLOT_BITS * unsigned(level + 1);
+        if ((node->m_expiry >> shift) == (m_now >> shift))
+        {
+            break;
+        }
+        ++level;
+    }
+
+    Link *list = &m_overflow;
+    std::size_t slot = 0;
+    if (level < LEVELS)
+    {
+        slot = std::size_t(node->m_expiry >> (SLOT_BITS * level))
+               & (SLOTS - 1);
+        list = &m_slots[level][slot];
+        m_used[level][slot / WORD_BITS]
+                |= std::uint64_t(1) << (slot & (WORD_BITS - 1));
+    }
+
+    node->m_level = level;
+    node->m_slot = slot;
+
+    // Appends, to deliver in order of insertion:
+    node->m_prev = list->m_prev;
+    node->m_next = list;
+    list->m_prev->m_next = node;
+    list->m_prev = node;
+}
+
+template<typename T>
+void
+TimingWheel<T>::unlink(Node *node)
+{
+    node->m_prev->m_next = node->m_next;
+    node->m_next->m_prev = node->m_prev;
+
+    if (node->m_level < LEVELS)
+    {
+        const std::size_t slot = node->m_slot;
+        if (empty(m_slots[node->m_level][slot]))
+        {
+            m_used[node->m_level][slot / WORD_BITS]
+                    &= ~(std::uint64_t(1) << (slot & (WORD_BITS - 1)));
+        }
+    }
+}
+
+template<typename T>
+void
+TimingWheel<T>::release(Node *node)
+{
+    node->m_id = 0;
+    node->m_value = T();
+
+    node->m_next = m_free;
+    m_free = node;
+
+    --m_size;
+}
+
+template<typename T>
+void
+TimingWheel<T>::expire(std::uint64_t tick)
+{
+    for (std::size_t level = LEVELS; level > 0; --level)
+    {
+        const unsigned shift = SLOT_BITS * unsigned(level);
+        if ((tick & ((std::uint64_t(1) << shift) - 1)) != 0)
+        {
+            continue;
+        }
+
+        Link list;
+        init(list);
+        if (level == LEVELS)
+        {
+            splice(m_overflow, list);
+        }
+        else
+        {
+            const std::size_t slot = std::size_t(tick >> shift) & (SLOTS - 1);
+            splice(m_slots[level][slot], list);
+            m_used[level][slot / WORD_BITS]
+                    &= ~(std::uint64_t(1) << (slot & (WORD_BITS - 1)));
+        }
+
+        while (!empty(list))
+        {
+            Node *node = static_cast<Node *>(list.m_next);
+            list.m_next = node->m_next;
+            link(node);
+        }
+    }
+}
+
+template<typename T>
+template<typename Function>
+void
+TimingWheel<T>::deliver(Link &list, Function expired)
+{
+    while (!empty(list))
+    {
+        Node *node = static_cast<Node *>(list.m_next);
+        list.m_next = node->m_next;
+        node->m_next->m_prev = &list;
+
+        assert(node->m_expiry == m_now);
+        if (node->m_period == 0)
+        {
+            expired(node->m_value, false);
+            release(node);
+        }
+        else
+        {
+            T value(node->m_value);
+            node->m_expiry += node->m_period;
+            link(node);
+            expired(value, true);
+        }
+    }
+}
+
+template<typename T>
+std::size_t
+TimingWheel<T>::find_slot(std::size_t level, std::size_t first) const
+{
+    std::size_t word = first / WORD_BITS;
+    std::uint64_t bits = m_used[level][word]
+                         & (~std::uint64_t(0) << (first & (WORD_BITS - 1)));
+
+    while (bits == 0)
+    {
+        if (++word == WORDS)
+        {
+            return SLOTS;
+        }
+        bits = m_used[level][word];
+    }
+
+    return word * WORD_BITS + std::size_t(__builtin_ctzll(bits));
+}
+
+// ----------------------------------------------------------------------------
+
+#endif // TIMINGWHEEL_H
@@ -0,0 +1,280 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef WAITSTRATEGY_H
+#define WAITSTRATEGY_H
+
+#include "Clock.h"
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Hints the CPU that the calling thread is busy-waiting.
+ *
+ * @ingroup threading-base
+ */
+inline void
+cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Describes how a thread waits for a queue to become ready before (or
+ * instead of) being parked by the kernel.
+ *
+ * Parking a thread costs a system call and a context switch on both sides of
+ * the exchange; spinning for a while avoids both when the wait is short, at
+ * the cost of keeping a CPU busy.
+ *
+ * Waiting threads call @ref spin before parking: it returns as soon as the
+ * queue is ready, when the deadline expires or, for the strategies that
+ * park, when the spin budget is exhausted.
+ *
+ * @ingroup threading-base
+ */
+class WaitStrategy
+{
+
+public:
+
+    /**
+     * @brief Available strategies.
+     */
+    enum Kind
+    {
+        /**
+         * The thread is parked immediately.
+         */
+        PARK,
+
+        /**
+         * The thread busy-spins with a CPU pause until the queue is ready,
+         * it's never parked. Meant for threads owning a dedicated CPU: with
+         * more threads than CPUs, spinning threads steal time from the ones
+         * they are waiting for.
+         */
+        SPIN,
+
+        /**
+         * The thread busy-spins for the spin budget, then keeps yielding the
+         * CPU until the queue is ready. It's never parked.
+         */
+        SPIN_YIELD,
+
+        /**
+         * The thread busy-spins for the spin budget, then it's parked.
+         */
+        SPIN_PARK,
+
+        /**
+         * As @ref SPIN_PARK, but the spin budget adapts to recent waits: it
+         * grows while waits end during the spin and shrinks when they end up
+         * parking, never exceeding the configured spin budget.
+         */
+        ADAPTIVE
+    };
+
+    /**
+     * @brief Default number of spin iterations before parking.
+     */
+    static const std::size_t DEFAULT_SPIN_BUDGET = 1000;
+
+    /**
+     * @brief Constructor.
+     *
+     * @param kind The strategy.
+     *
+     * @param spin_budget Number of busy-spin iterations before yielding or
+     *        parking, the upper limit for @ref ADAPTIVE.
+     */
+    WaitStrategy(Kind kind = PARK,
+                 std::size_t spin_budget = DEFAULT_SPIN_BUDGET)
+            :
+            m_kind(kind),
+            m_max_budget(spin_budget > MIN_SPIN_BUDGET
+                         ? spin_budget
+                         : MIN_SPIN_BUDGET),
+            m_budget(kind == ADAPTIVE ? MIN_SPIN_BUDGET : spin_budget)
+    {
+    }
+
+    /**
+     * @brief Copy constructor.
+     *
+     * The adaptive state is not copied.
+     */
+    WaitStrategy(const WaitStrategy &other)
+            :
+            m_kind(other.m_kind),
+            m_max_budget(other.m_max_budget),
+            m_budget(other.m_kind == ADAPTIVE
+                     ? MIN_SPIN_BUDGET
+                     : other.m_budget.load(std::memory_order_relaxed))
+    {
+    }
+
+    /**
+     * @brief Assignment operator.
+     *
+     * The adaptive state is not copied.
+     */
+    WaitStrategy &
+    operator=(const WaitStrategy &other)
+    {
+        m_kind = other.m_kind;
+        m_max_budget = other.m_max_budget;
+        m_budget.store(other.m_kind == ADAPTIVE
+                       ? MIN_SPIN_BUDGET
+                       : other.m_budget.load(std::memory_order_relaxed),
+                       std::memory_order_relaxed);
+        return *this;
+    }
+
+    /**
+     * @brief Returns the strategy.
+     */
+    Kind
+    kind() const
+    {
+        return m_kind;
+    }
+
+    /**
+     * @brief Returns @a true if the strategy eventually parks the waiting
+     * thread.
+     */
+    bool
+    parks() const
+    {
+        return m_kind != SPIN && m_kind != SPIN_YIELD;
+    }
+
+    /**
+     * @brief Waits without parking until the passed predicate is satisfied.
+     *
+     * @param ready Function without parameters that returns @a true when the
+     *        wait is over (typically when the queue is ready or cancelled).
+     *
+     * @param deadline Point in time when the wait expires, @a nullptr to
+     *        wait indefinitely.
+     *
+     * @return @a true if the predicate have been satisfied, @a false if the
+     * deadline expired or if the thread should be parked.
+     */
+    template<typename Predicate>
+    bool
+    spin(Predicate ready, const Deadline *deadline)
+    {
+        if (m_kind == PARK)
+        {
+            return false;
+        }
+
+        const std::size_t budget = m_budget.load(std::memory_order_relaxed);
+
+        for (std::size_t i = 0; ; ++i)
+        {
+            if (ready())
+            {
+                adapt(2 * i);
+                return true;
+            }
+
+            // The clock is not cheap, it's read once in a while:
+            if (deadline != nullptr && (i % CLOCK_PERIOD) == 0
+                && Clock::now() >= *deadline)
+            {
+                return false;
+            }
+
+            if (i < budget || m_kind == SPIN)
+            {
+                cpu_relax();
+            }
+            else if (m_kind == SPIN_YIELD)
+            {
+                std::this_thread::yield();
+            }
+            else
+            {
+                adapt(0); // Spinning didn't help, time to park.
+                return false;
+            }
+        }
+    }
+
+private:
+
+    static const std::size_t MIN_SPIN_BUDGET = 16;
+    static const std::size_t CLOCK_PERIOD = 64;
+
+    // Moves the adaptive budget by one eighth towards the passed target.
+    void
+    adapt(std::size_t target)
+    {
+        if (m_kind != ADAPTIVE)
+        {
+            return;
+        }
+
+        target = (target < MIN_SPIN_BUDGET) ? MIN_SPIN_BUDGET : target;
+        target = (target > m_max_budget) ? m_max_budget : target;
+
+        std::size_t budget = m_budget.load(std::memory_order_relaxed);
+        if (target > budget)
+        {
+            budget += (target - budget + 7) / 8;
+        }
+        else
+        {
+            budget -= (budget - target) / 8;
+        }
+        m_budget.store(budget, std::memory_order_relaxed);
+    }
+
+    Kind m_kind;
+    std::size_t m_max_budget;
+    std::atomic<std::size_t> m_budget;
+
+};
+
+// ----------------------------------------------------------------------------
+
+#endif // WAITSTRATEGY_H
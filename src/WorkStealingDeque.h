@@ -0,0 +1,332 @@
+/*
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef WORKSTEALINGDEQUE_H
+#define WORKSTEALINGDEQUE_H
+
+#include "Message.h"
+#include "RingBuffer.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include <assert.h>
+
+// ----------------------------------------------------------------------------
+
+/**
+ * @brief Intrusive work-stealing deque: one owner thread pushes and pops
+ * messages at the bottom, any other thread steals them from the top.
+ *
+ * Implements the Chase-Lev deque with the memory orders of Lê et al.
+ * ("Correct and Efficient Work-Stealing for Weak Memory Models"): the owner
+ * pushes and pops without any atomic read-modify-write unless it races with
+ * a thief for the last message, thieves compete with one compare-and-swap
+ * on the top index.
+ *
+ * The owner works in LIFO order, so that the messages it has just pushed
+ * are still hot in its cache, while thieves take the oldest messages, that
+ * are likely the biggest chunks of work left.
+ *
+ * @note
+ * - Messages are kept alive through the link embedded into @ref IMessage,
+ *   that is shared with @ref MpscQueue: a message can be in one intrusive
+ *   queue at a time.
+ * - The array of slots doubles when full and never shrinks. The replaced
+ *   arrays are released by the destructor, since thieves may still be
+ *   reading them.
+ *
+ * @ingroup threading-base
+ */
+class WorkStealingDeque
+{
+
+public:
+
+    /**
+     * @brief Constructor.
+     *
+     * @param capacity Initial number of slots, rounded up to the next power
+     *        of two.
+     */
+    explicit WorkStealingDeque(std::size_t capacity = 256)
+            :
+            m_top(0),
+            m_bottom(0),
+            m_array(new Array(capacity, nullptr))
+    {
+    }
+
+    /**
+     * @brief Destructor.
+     *
+     * Releases the messages still queued.
+     *
+     * @pre
+     * - Called by the owner thread, or once no other thread uses the deque.
+     */
+    ~WorkStealingDeque()
+    {
+        Message message;
+        while (pop(message))
+        {
+            message.reset();
+        }
+
+        Array *array = m_array.load(std::memory_order_relaxed);
+        while (array != nullptr)
+        {
+            Array *previous = array->m_previous;
+            delete array;
+            array = previous;
+        }
+    }
+
+    WorkStealingDeque(const WorkStealingDeque &) = delete;
+    WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+    /**
+     * @brief Pushes one message at the bottom of the deque.
+     *
+     * @pre
+     * - Called by the owner thread.
+     * - The parameter message is not null and not already queued.
+     */
+    void
+    push(Message message)
+    {
+        assert(message.get() != nullptr);
+
+        IMessage *node = message.get();
+        node->m_self = std::move(message);
+
+        const std::int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        const std::int64_t top = m_top.load(std::memory_order_acquire);
+        Array *array = m_array.load(std::memory_order_relaxed);
+
+        if (bottom - top > std::int64_t(array->m_mask))
+        {
+            array = grow(array, top, bottom);
+        }
+
+        array->put(bottom, node);
+
+        // Publishes the slot and the link before the new bottom:
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Pops the message pushed last.
+     *
+     * @param[out] message Smart pointer that will be reset with the popped
+     *             message in case of success.
+     *
+     * @return @a true on success, @a false if the deque is empty.
+     *
+     * @pre
+     * - Called by the owner thread.
+     */
+    bool
+    pop(Message &message)
+    {
+        const std::int64_t bottom
+                = m_bottom.load(std::memory_order_relaxed) - 1;
+        Array *array = m_array.load(std::memory_order_relaxed);
+        m_bottom.store(bottom, std::memory_order_relaxed);
+
+        // Pairs with the fence in steal: either the owner sees the top moved
+        // by a thief or the thief sees the bottom reserved by the owner.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        std::int64_t top = m_top.load(std::memory_order_relaxed);
+        if (top > bottom)
+        {
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        IMessage *node = array->get(bottom);
+        if (top == bottom)
+        {
+            // The last message, thieves may be racing for it:
+            const bool won = m_top.compare_exchange_strong(
+                    top, top + 1,
+                    std::memory_order_seq_cst, std::memory_order_relaxed);
+            m_bottom.store(bottom + 1, std::memory_order_relaxed);
+
+            if (!won)
+            {
+                return false;
+            }
+        }
+
+        message = std::move(node->m_self);
+        return true;
+    }
+
+    /**
+     * @brief Steals the message pushed first.
+     *
+     * Retries while losing races with other thieves, so that it fails only
+     * if the deque is found empty.
+     *
+     * @param[out] message Smart pointer that will be reset with the stolen
+     *             message in case of success.
+     *
+     * @return @a true on success, @a false if the deque is empty.
+     */
+    bool
+    steal(Message &message)
+    {
+        for (;;)
+        {
+            std::int64_t top = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const std::int64_t bottom
+                    = m_bottom.load(std::memory_order_acquire);
+
+            if (top >= bottom)
+            {
+                return false;
+            }
+
+            // The slot may be overwritten as soon as the top moves, the node
+            // is owned only after winning it:
+            Array *array = m_array.load(std::memory_order_acquire);
+            IMessage *node = array->get(top);
+
+            if (m_top.compare_exchange_strong(top, top + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed))
+            {
+                message = std::move(node->m_self);
+                return true;
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the number of queued messages.
+     *
+     * The value is only a hint when other threads use the deque.
+     */
+    std::size_t
+    size() const
+    {
+        const std::int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+        const std::int64_t top = m_top.load(std::memory_order_relaxed);
+
+        return bottom > top ? std::size_t(bottom - top) : 0;
+    }
+
+    /**
+     * @brief Returns @a true if the deque looks empty.
+     *
+     * The value is only a hint when other threads use the deque.
+     */
+    bool
+    empty() const
+    {
+        return size() == 0;
+    }
+
+private:
+
+    struct Array
+    {
+        Array(std::size_t capacity, Array *previous)
+                :
+                m_mask(next_power_of_two(capacity) - 1),
+                m_slots(new std::atomic<IMessage *>[m_mask + 1]),
+                m_previous(previous)
+        {
+        }
+
+        ~Array()
+        {
+            delete[] m_slots;
+        }
+
+        IMessage *
+        get(std::int64_t index) const
+        {
+            return m_slots[std::size_t(index) & m_mask]
+                    .load(std::memory_order_relaxed);
+        }
+
+        void
+        put(std::int64_t index, IMessage *node)
+        {
+            m_slots[std::size_t(index) & m_mask]
+                    .store(node, std::memory_order_relaxed);
+        }
+
+        static std::size_t
+        next_power_of_two(std::size_t value)
+        {
+            std::size_t ret = 2;
+            while (ret < value)
+            {
+                ret <<= 1;
+            }
+
+            return ret;
+        }
+
+        const std::size_t m_mask;
+        std::atomic<IMessage *> *m_slots;
+
+        // Replaced array, kept until the destruction of the deque:
+        Array *const m_previous;
+    };
+
+    Array *
+    grow(Array *array, std::int64_t top, std::int64_t bottom)
+    {
+        Array *ret = new Array(2 * (array->m_mask + 1), array);
+        for (std::int64_t i = top; i < bottom; ++i)
+        {
+            ret->put(i, array->get(i));
+        }
+
+        m_array.store(ret, std::memory_order_release);
+        return ret;
+    }
+
+    std::atomic<std::int64_t> m_top;    // Next slot to steal, moved by thieves.
+    char m_pad[CACHE_LINE_SIZE];
+    std::atomic<std::int64_t> m_bottom; // Next slot to push, owned by the owner.
+    std::atomic<Array *> m_array;
+
+};
+
+#endif // WORKSTEALINGDEQUE_H
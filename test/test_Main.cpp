@@ -33,6 +33,8 @@ void test_PI();
 void test_Thread();
 void test_MessageQueue();
 void test_ThreadPool();
+void test_Utilization();
+void test_Scaling();
 
 int main(int argc, char *argv[])
 {
@@ -45,6 +47,8 @@ int main(int argc, char *argv[])
     test_MessageQueue();
     test_ThreadPool();
     test_PI();
+    test_Utilization();
+    test_Scaling();
 
     return 0;
 }
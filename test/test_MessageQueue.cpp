@@ -27,16 +27,37 @@ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include "CoalescingMessageQueue.h"
+#include "DelayQueue.h"
+#include "EventFd.h"
 #include "MessageQueue.h"
+#include "MpscQueue.h"
+#include "SegmentedQueue.h"
+#include "Selector.h"
+#include "SharedQueue.h"
+#include "SpscMessageQueue.h"
 #include "Thread.h"
+#include "TimingWheel.h"
 #include "Trace.h"
+#include "WorkStealingDeque.h"
+#include "test_Utils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
 #include <deque>
 #include <string>
 #include <iostream>
+#include <iterator>
 #include <sstream>
+#include <thread>
 #include <vector>
 
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
 // ------------------------------------------------------------------------....
 
 namespace
@@ -80,11 +101,8 @@ public:
             std::stringstream response;
             response << "Response to '" << message << " from '" << m_id << "'";
 
-            while (0 == m_out_queue.push(response.str()))
-            {
-                trace("Waiting for a free slot into the output queue");
-                sched_yield();
-            }
+            // Waits for a free slot into the output queue:
+            m_out_queue.push(response.str(), true);
         }
 
         trace("Done.");
@@ -92,12 +110,10 @@ public:
 
 };
 
-} // anonymous namespace
-
 // ----------------------------------------------------------------------------
 
 void
-test_MessageQueue()
+test_typed()
 {
     const int NUM_THREADS = 100;
     const int NUM_MESSAGES = 100000;
@@ -178,3 +194,1766 @@ test_MessageQueue()
 }
 
 // ----------------------------------------------------------------------------
+
+class TestMessage
+    : public IMessage
+{
+
+public:
+
+    MESSAGE_TYPE(TestMessage, IMessage)
+    SLAB_ALLOCATED
+
+    const int m_value;
+
+    TestMessage(int value, unsigned priority = 0)
+            :
+            IMessage(priority),
+            m_value(value)
+    {
+    }
+
+};
+
+// ----------------------------------------------------------------------------
+
+class TestProducerTask
+    : public ITask
+{
+
+    int m_first;
+    int m_count;
+    IMessageQueue &m_queue;
+
+public:
+
+    TestProducerTask(int first, int count, IMessageQueue &queue)
+            :
+            m_first(first),
+            m_count(count),
+            m_queue(queue)
+    {
+    }
+
+    void
+    execute()
+    {
+        for (int i = m_first; i < m_first + m_count; ++i)
+        {
+            Message message(new TestMessage(i));
+            TEST_CHECK(m_queue.push(message, true) > 0);
+        }
+    }
+
+};
+
+// ----------------------------------------------------------------------------
+
+class TestConsumerTask
+    : public ITask
+{
+
+    IMessageQueue &m_queue;
+    std::atomic<long long> &m_sum;
+    std::atomic<int> &m_count;
+
+public:
+
+    TestConsumerTask(IMessageQueue &queue,
+                     std::atomic<long long> &sum,
+                     std::atomic<int> &count)
+            :
+            m_queue(queue),
+            m_sum(sum),
+            m_count(count)
+    {
+    }
+
+    void
+    execute()
+    {
+        std::shared_ptr<TestMessage> message;
+        while (m_queue.popT(message, true))
+        {
+            m_sum += message->m_value;
+            ++m_count;
+        }
+    }
+
+};
+
+// ----------------------------------------------------------------------------
+
+void
+test_backend(IMessageQueue::Backend backend,
+             int num_producers,
+             int num_consumers,
+             const WaitStrategy &strategy = WaitStrategy(),
+             std::size_t capacity = 100)
+{
+    const int NUM_MESSAGES = 100000;
+
+    std::unique_ptr<IMessageQueue> queue(
+            IMessageQueue::create(IMessageQueue::Options(capacity)
+                                          .set_backend(backend)
+                                          .set_wait_strategy(strategy)));
+
+    std::atomic<long long> sum(0);
+    std::atomic<int> count(0);
+
+    std::vector<Thread> consumers;
+    for (int i = 0; i < num_consumers; ++i)
+    {
+        Task consumer(new TestConsumerTask(*queue, sum, count));
+        consumers.push_back(IThread::create(consumer));
+    }
+
+    std::vector<Thread> producers;
+    const int per_producer = NUM_MESSAGES / num_producers;
+    for (int i = 0; i < num_producers; ++i)
+    {
+        Task producer(new TestProducerTask(i * per_producer, per_producer,
+                                           *queue));
+        producers.push_back(IThread::create(producer));
+    }
+
+    for (auto &thread: producers)
+    {
+        thread->join();
+    }
+
+    const int total = per_producer * num_producers;
+    while (count < total)
+    {
+        sched_yield();
+    }
+
+    queue->cancel();
+    for (auto &thread: consumers)
+    {
+        thread->join();
+    }
+
+    const long long expected = (long long)(total) * (total - 1) / 2;
+    TEST_CHECK(count == total);
+    TEST_CHECK(sum == expected);
+    TEST_CHECK(queue->size() == 0);
+    TEST_CHECK(queue->size_hint() == 0);
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_ring_capacity()
+{
+    std::unique_ptr<IMessageQueue> queue(
+            IMessageQueue::create(IMessageQueue::Options(100).set_backend(
+                    IMessageQueue::BACKEND_RING)));
+
+    // The capacity is rounded up to the next power of two:
+    for (int i = 0; i < 128; ++i)
+    {
+        TEST_CHECK(queue->push(Message(new TestMessage(i))) == std::size_t(i + 1));
+    }
+    TEST_CHECK(queue->push(Message(new TestMessage(128))) == 0);
+
+    // Messages are popped in FIFO order:
+    for (int i = 0; i < 128; ++i)
+    {
+        std::shared_ptr<TestMessage> message;
+        TEST_CHECK(queue->popT(message, false) == std::size_t(128 - i));
+        TEST_CHECK(message->m_value == i);
+    }
+
+    Message message;
+    TEST_CHECK(queue->pop(message, false) == 0);
+    TEST_CHECK(message.get() == nullptr);
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_unbounded_ring()
+{
+    // Enough messages to fill many blocks, twice so that emptied blocks are
+    // reused:
+    const int NUM_MESSAGES = 3000;
+
+    std::unique_ptr<IMessageQueue> queue(
+            IMessageQueue::create(IMessageQueue::Options().set_backend(
+                    IMessageQueue::BACKEND_RING)));
+
+    for (int round = 0; round < 2; ++round)
+    {
+        for (int i = 0; i < NUM_MESSAGES; ++i)
+        {
+            TEST_CHECK(queue->push(Message(new TestMessage(i)))
+                       == std::size_t(i + 1));
+        }
+        TEST_CHECK(queue->size() == std::size_t(NUM_MESSAGES));
+
+        // Messages are popped in FIFO order:
+        for (int i = 0; i < NUM_MESSAGES; ++i)
+        {
+            std::shared_ptr<TestMessage> message;
+            TEST_CHECK(queue->popT(message, false)
+                       == std::size_t(NUM_MESSAGES - i));
+            TEST_CHECK(message->m_value == i);
+        }
+
+        Message message;
+        TEST_CHECK(queue->pop(message, false) == 0);
+        TEST_CHECK(queue->size() == 0);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+// Value whose move blocks the writing thread until the gate is open, so that
+// a producer can be held between claiming its slot and writing it.
+struct GatedValue
+{
+    int m_value;
+    std::atomic<bool> *m_entered;
+    std::atomic<bool> *m_open;
+
+    explicit GatedValue(int value = 0,
+                        std::atomic<bool> *entered = nullptr,
+                        std::atomic<bool> *open = nullptr)
+            :
+            m_value(value),
+            m_entered(entered),
+            m_open(open)
+    {
+    }
+
+    GatedValue &
+    operator=(GatedValue &&other)
+    {
+        if (other.m_open != nullptr && !*other.m_open)
+        {
+            *other.m_entered = true;
+            while (!*other.m_open)
+            {
+                std::this_thread::yield();
+            }
+        }
+
+        m_value = other.m_value;
+        m_entered = other.m_entered;
+        m_open = other.m_open;
+        return *this;
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+void
+test_segmented_skip()
+{
+    SegmentedQueue<GatedValue> queue;
+    std::atomic<bool> entered(false);
+    std::atomic<bool> open(false);
+
+    // The first producer claims its slot, then stalls writing it:
+    std::thread producer([&]()
+    {
+        GatedValue value(1, &entered, &open);
+        TEST_CHECK(queue.try_push(value) > 0);
+    });
+    while (!entered)
+    {
+        std::this_thread::yield();
+    }
+
+    // The consumer skips the stalled slot rather than waiting for it, so the
+    // value claimed later overtakes it:
+    GatedValue value(2);
+    TEST_CHECK(queue.try_push(value) > 0);
+
+    GatedValue popped;
+    TEST_CHECK(queue.try_pop(popped) > 0);
+    TEST_CHECK(popped.m_value == 2);
+    TEST_CHECK(queue.try_pop(popped) == 0);
+
+    // Once written, the skipped value is pushed again at a later position:
+    open = true;
+    producer.join();
+
+    TEST_CHECK(queue.try_pop(popped) > 0);
+    TEST_CHECK(popped.m_value == 1);
+    TEST_CHECK(queue.try_pop(popped) == 0);
+    TEST_CHECK(queue.size() == 0);
+}
+
+// ----------------------------------------------------------------------------
+
+class TestSpscProducerTask
+    : public ITask
+{
+
+    int m_count;
+    SpscMessageQueueT<int> &m_queue;
+
+public:
+
+    TestSpscProducerTask(int count, SpscMessageQueueT<int> &queue)
+            :
+            m_count(count),
+            m_queue(queue)
+    {
+    }
+
+    void
+    execute()
+    {
+        for (int i = 0; i < m_count; ++i)
+        {
+            TEST_CHECK(m_queue.push(i, true) > 0);
+        }
+    }
+
+};
+
+// ----------------------------------------------------------------------------
+
+void
+test_spsc_typed()
+{
+    const int NUM_MESSAGES = 1000000;
+    const int QUEUE_CAPACITY = 1024;
+
+    SpscMessageQueueT<int> queue(QUEUE_CAPACITY);
+
+    Task producer(new TestSpscProducerTask(NUM_MESSAGES, queue));
+    Thread thread(IThread::create(producer));
+
+    // Messages are received in the same order they have been pushed:
+    for (int i = 0; i < NUM_MESSAGES; ++i)
+    {
+        int message = -1;
+        TEST_CHECK(queue.pop(message, true) > 0);
+        TEST_CHECK(message == i);
+    }
+
+    thread->join();
+
+    int message = -1;
+    TEST_CHECK(queue.pop(message, false) == 0);
+    TEST_CHECK(message == -1);
+
+    queue.cancel();
+    TEST_CHECK(queue.pop(message, true) == 0);
+}
+
+// ----------------------------------------------------------------------------
+
+class TestMpscProducerTask
+    : public ITask
+{
+
+    int m_producer;
+    int m_count;
+    MpscQueue &m_queue;
+
+public:
+
+    TestMpscProducerTask(int producer, int count, MpscQueue &queue)
+            :
+            m_producer(producer),
+            m_count(count),
+            m_queue(queue)
+    {
+    }
+
+    void
+    execute()
+    {
+        for (int i = 0; i < m_count; ++i)
+        {
+            m_queue.push(Message(new TestMessage(m_producer * m_count + i)));
+        }
+    }
+
+};
+
+// ----------------------------------------------------------------------------
+
+void
+test_mpsc()
+{
+    const int NUM_PRODUCERS = 8;
+    const int NUM_MESSAGES = 100000;
+
+    MpscQueue queue;
+
+    std::vector<Thread> producers;
+    for (int i = 0; i < NUM_PRODUCERS; ++i)
+    {
+        Task producer(new TestMpscProducerTask(i, NUM_MESSAGES, queue));
+        producers.push_back(IThread::create(producer));
+    }
+
+    // Messages of each producer are received in the same order they have
+    // been pushed:
+    std::vector<int> next(NUM_PRODUCERS, 0);
+    for (int i = 0; i < NUM_PRODUCERS * NUM_MESSAGES; ++i)
+    {
+        Message message;
+        TEST_CHECK(queue.pop(message, true) > 0);
+
+        auto test_message = message_cast<TestMessage>(message);
+        int producer = test_message->m_value / NUM_MESSAGES;
+        TEST_CHECK(test_message->m_value % NUM_MESSAGES == next[producer]);
+        ++next[producer];
+    }
+
+    for (auto &thread: producers)
+    {
+        thread->join();
+    }
+
+    Message message;
+    TEST_CHECK(queue.pop(message, false) == 0);
+
+    // Pops tell how many messages were detached before the extraction: the
+    // ones linked after the last batch are not counted until detached.
+    for (int i = 0; i < 3; ++i)
+    {
+        queue.push(Message(new TestMessage(i)));
+    }
+    TEST_CHECK(queue.pop(message, false) == 3);
+    queue.push(Message(new TestMessage(3)));
+    TEST_CHECK(queue.pop(message, false) == 2);
+    TEST_CHECK(message_cast<TestMessage>(message)->m_value == 1);
+
+    Message batch[4];
+    TEST_CHECK(queue.pop_bulk(batch, 4, false) == 2);
+    TEST_CHECK(message_cast<TestMessage>(batch[1])->m_value == 3);
+    TEST_CHECK(queue.pop(message, false) == 0);
+
+    queue.cancel();
+    TEST_CHECK(queue.pop(message, true) == 0);
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_work_stealing_deque()
+{
+    const int NUM_THIEVES = 4;
+    const int NUM_MESSAGES = 200000;
+
+    // The owner pops in LIFO order, thieves steal in FIFO order:
+    {
+        WorkStealingDeque deque(2);
+        for (int i = 0; i < 5; ++i)
+        {
+            deque.push(Message(new TestMessage(i)));
+        }
+        TEST_CHECK(deque.size() == 5);
+
+        Message message;
+        TEST_CHECK(deque.pop(message));
+        TEST_CHECK(message_cast<TestMessage>(message)->m_value == 4);
+        TEST_CHECK(deque.steal(message));
+        TEST_CHECK(message_cast<TestMessage>(message)->m_value == 0);
+        TEST_CHECK(deque.size() == 3);
+    }
+
+    // Every message is taken once, either by the owner or by a thief, while
+    // the deque grows:
+    WorkStealingDeque deque(16);
+    std::atomic<bool> done(false);
+    std::vector<std::vector<int>> taken(NUM_THIEVES + 1);
+
+    std::vector<std::thread> thieves;
+    for (int i = 0; i < NUM_THIEVES; ++i)
+    {
+        thieves.push_back(std::thread([&, i]() {
+            Message message;
+            while (!done || !deque.empty())
+            {
+                if (deque.steal(message))
+                {
+                    taken[i].push_back(
+                            message_cast<TestMessage>(message)->m_value);
+                }
+            }
+        }));
+    }
+
+    Message message;
+    for (int i = 0; i < NUM_MESSAGES; ++i)
+    {
+        deque.push(Message(new TestMessage(i)));
+        if (i % 3 == 0 && deque.pop(message))
+        {
+            taken[NUM_THIEVES].push_back(
+                    message_cast<TestMessage>(message)->m_value);
+        }
+    }
+    while (deque.pop(message))
+    {
+        taken[NUM_THIEVES].push_back(
+                message_cast<TestMessage>(message)->m_value);
+    }
+
+    done = true;
+    for (auto &thread: thieves)
+    {
+        thread.join();
+    }
+
+    std::vector<int> all;
+    for (auto &values: taken)
+    {
+        all.insert(all.end(), values.begin(), values.end());
+    }
+    std::sort(all.begin(), all.end());
+
+    TEST_CHECK(all.size() == std::size_t(NUM_MESSAGES));
+    for (int i = 0; i < int(all.size()); ++i)
+    {
+        TEST_CHECK(all[i] == i);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+class TestBlockedPushTask
+    : public ITask
+{
+
+    IMessageQueue &m_queue;
+    std::atomic<int> &m_result;
+
+public:
+
+    TestBlockedPushTask(IMessageQueue &queue, std::atomic<int> &result)
+            :
+            m_queue(queue),
+            m_result(result)
+    {
+    }
+
+    void
+    execute()
+    {
+        m_result = int(m_queue.push(Message(new TestMessage(1)), true));
+    }
+
+};
+
+// ----------------------------------------------------------------------------
+
+void
+test_blocking_push(IMessageQueue::Backend backend)
+{
+    std::unique_ptr<IMessageQueue> queue(IMessageQueue::create(
+            IMessageQueue::Options(1).set_backend(backend)));
+
+    // Fills the queue (the ring rounds its capacity up):
+    int num_messages = 0;
+    while (queue->push(Message(new TestMessage(num_messages))) > 0)
+    {
+        ++num_messages;
+    }
+    TEST_CHECK(num_messages > 0);
+
+    // A producer blocked on a full queue is resumed by a consumer:
+    {
+        std::atomic<int> result(-1);
+        Task producer(new TestBlockedPushTask(*queue, result));
+        Thread thread(IThread::create(producer));
+
+        std::shared_ptr<TestMessage> message;
+        TEST_CHECK(queue->popT(message, true) > 0);
+        TEST_CHECK(message->m_value == 0);
+
+        thread->join();
+        TEST_CHECK(result == num_messages);
+    }
+
+    // A producer blocked on a full queue is released by cancel:
+    {
+        std::atomic<int> result(-1);
+        Task producer(new TestBlockedPushTask(*queue, result));
+        Thread thread(IThread::create(producer));
+
+        for (int i = 0; i < 100; ++i)
+        {
+            sched_yield();
+        }
+        TEST_CHECK(result == -1);
+
+        queue->cancel();
+        thread->join();
+        TEST_CHECK(result == 0);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_timed(IMessageQueue::Backend backend,
+           const WaitStrategy &strategy = WaitStrategy())
+{
+    const std::chrono::milliseconds TIMEOUT(10);
+
+    std::unique_ptr<IMessageQueue> queue(IMessageQueue::create(
+            IMessageQueue::Options(2)
+                    .set_backend(backend)
+                    .set_wait_strategy(strategy)));
+
+    // Times out on an empty queue:
+    {
+        Message message;
+        Deadline begin = Clock::now();
+        TEST_CHECK(queue->pop_for(message, TIMEOUT) == 0);
+        TEST_CHECK(Clock::now() - begin >= TIMEOUT);
+        TEST_CHECK(message.get() == nullptr);
+    }
+
+    // Times out on a full queue:
+    {
+        while (queue->push(Message(new TestMessage(0))) > 0)
+        {
+        }
+
+        Deadline begin = Clock::now();
+        TEST_CHECK(queue->push_for(Message(new TestMessage(1)), TIMEOUT) == 0);
+        TEST_CHECK(Clock::now() - begin >= TIMEOUT);
+    }
+
+    // Doesn't wait when not needed:
+    {
+        Message message;
+        TEST_CHECK(queue->pop_until(message, Deadline::max()) > 0);
+        TEST_CHECK(queue->push_until(message, Deadline::max()) > 0);
+        TEST_CHECK(queue->pop_for(message, std::chrono::hours::max()) > 0);
+    }
+
+    // A cancelled queue doesn't wait:
+    {
+        queue->cancel();
+
+        Message message;
+        TEST_CHECK(queue->pop_until(message, Deadline::max()) == 0);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_bulk(IMessageQueue::Backend backend)
+{
+    const std::size_t CAPACITY = 100;
+
+    std::unique_ptr<IMessageQueue> queue(IMessageQueue::create(
+            IMessageQueue::Options(CAPACITY).set_backend(backend)));
+
+    // Pushes more messages than the capacity, only the first ones fit:
+    std::vector<Message> messages;
+    for (int i = 0; i < 2 * int(CAPACITY); ++i)
+    {
+        messages.push_back(Message(new TestMessage(i)));
+    }
+    std::size_t pushed = queue->push_bulk(messages.begin(), messages.end());
+    TEST_CHECK(pushed >= CAPACITY && pushed < messages.size());
+    TEST_CHECK(queue->size() == pushed);
+
+    // Pops them back in order and in batches:
+    std::vector<Message> popped(pushed + 1);
+    std::size_t count = 0;
+    while (count < pushed)
+    {
+        std::size_t batch = queue->pop_bulk(&popped[count], 7, false);
+        TEST_CHECK(batch > 0 && batch <= 7);
+        count += batch;
+    }
+    TEST_CHECK(count == pushed);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        TEST_CHECK(popped[i] == messages[i]);
+    }
+
+    // An empty queue doesn't pop anything:
+    TEST_CHECK(queue->pop_bulk(&popped[0], popped.size(), false) == 0);
+
+    // Micro batches are returned when the deadline expires:
+    {
+        const std::chrono::milliseconds TIMEOUT(10);
+
+        TEST_CHECK(queue->push_bulk(&messages[0], 3) == 3);
+
+        Deadline begin = Clock::now();
+        TEST_CHECK(queue->pop_bulk_for(&popped[0], 10, TIMEOUT) == 3);
+        TEST_CHECK(Clock::now() - begin >= TIMEOUT);
+
+        TEST_CHECK(queue->push_bulk(&messages[0], 10) == 10);
+        TEST_CHECK(queue->pop_bulk_until(&popped[0], 10, Deadline::max())
+                   == 10);
+    }
+
+    // A cancelled queue doesn't wait:
+    {
+        queue->cancel();
+        TEST_CHECK(queue->pop_bulk(&popped[0], 10, true) == 0);
+        TEST_CHECK(queue->pop_bulk_until(&popped[0], 10, Deadline::max())
+                   == 0);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+int
+value_of(const Message &message)
+{
+    return message_cast<TestMessage>(message)->m_value;
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_priority()
+{
+    const int NUM_MESSAGES = 100;
+    const unsigned NUM_PRIORITIES = 4;
+
+    // Higher priorities first, insertion order within the same priority:
+    {
+        std::unique_ptr<IMessageQueue> queue(IMessageQueue::create(
+                IMessageQueue::Options(NUM_MESSAGES).set_backend(
+                        IMessageQueue::BACKEND_PRIORITY)));
+
+        for (int i = 0; i < NUM_MESSAGES; ++i)
+        {
+            TEST_CHECK(queue->push(Message(new TestMessage(
+                    i, i % NUM_PRIORITIES))) > 0);
+        }
+        TEST_CHECK(queue->push(Message(new TestMessage(-1))) == 0);
+
+        Message message;
+        int last = -1;
+        unsigned priority = NUM_PRIORITIES - 1;
+        while (queue->pop(message, false) > 0)
+        {
+            if (message->priority() != priority)
+            {
+                TEST_CHECK(message->priority() < priority);
+                priority = message->priority();
+                last = -1;
+            }
+            TEST_CHECK(value_of(message) > last);
+            last = value_of(message);
+        }
+        TEST_CHECK(priority == 0);
+        TEST_CHECK(queue->size() == 0);
+    }
+
+    // A low priority message starves under a steady flow of higher priority
+    // ones unless aging is enabled:
+    for (std::size_t aging = 0; aging < 2; ++aging)
+    {
+        std::unique_ptr<IMessageQueue> queue(IMessageQueue::create(
+                IMessageQueue::Options(NUM_MESSAGES)
+                        .set_backend(IMessageQueue::BACKEND_PRIORITY)
+                        .set_priority_aging(aging)));
+
+        TEST_CHECK(queue->push(Message(new TestMessage(-1, 0))) > 0);
+
+        int pops_before_low = -1;
+        for (int i = 0; i < NUM_MESSAGES && pops_before_low < 0; ++i)
+        {
+            Message message;
+            TEST_CHECK(queue->push(Message(new TestMessage(
+                    i, IMessage::PRIORITY_LEVELS - 1))) > 0);
+            TEST_CHECK(queue->pop(message, false) > 0);
+            if (value_of(message) == -1)
+            {
+                pops_before_low = i;
+            }
+        }
+
+        if (aging == 0)
+        {
+            TEST_CHECK(pops_before_low < 0);
+        }
+        else
+        {
+            TEST_CHECK(pops_before_low >= 0);
+            TEST_CHECK(pops_before_low <= int(IMessage::PRIORITY_LEVELS));
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_typed_values()
+{
+    // Move-only messages are moved in and out:
+    {
+        MessageQueueT< std::unique_ptr<int> > queue(2);
+
+        std::unique_ptr<int> message(new int(1));
+        TEST_CHECK(queue.push(std::move(message)) == 1);
+        TEST_CHECK(message.get() == nullptr);
+        TEST_CHECK(queue.emplace(new int(2)) == 2);
+
+        // A full queue leaves the message untouched:
+        message.reset(new int(3));
+        TEST_CHECK(queue.push(std::move(message)) == 0);
+        TEST_CHECK(message.get() != nullptr);
+
+        TEST_CHECK(queue.pop(message, false) == 2);
+        TEST_CHECK(*message == 1);
+        TEST_CHECK(queue.pop(message, false) == 1);
+        TEST_CHECK(*message == 2);
+        TEST_CHECK(queue.pop(message, false) == 0);
+    }
+
+    // Trivially copyable messages wrap around the slots and grow them:
+    {
+        const int NUM_MESSAGES = 100;
+
+        MessageQueueT<int> queue;
+        int values[NUM_MESSAGES];
+        int popped[NUM_MESSAGES];
+        for (int i = 0; i < NUM_MESSAGES; ++i)
+        {
+            values[i] = i;
+        }
+
+        TEST_CHECK(queue.push_bulk(values, 10) == 10);
+        TEST_CHECK(queue.pop_bulk(popped, 8, false) == 8);
+        TEST_CHECK(queue.push_bulk(values + 10, 10) == 10);
+        TEST_CHECK(queue.push_bulk(values + 20, values + NUM_MESSAGES)
+                   == NUM_MESSAGES - 20);
+        TEST_CHECK(queue.size() == NUM_MESSAGES - 8);
+
+        TEST_CHECK(queue.pop_bulk(popped + 8, NUM_MESSAGES, false)
+                   == NUM_MESSAGES - 8);
+        for (int i = 0; i < NUM_MESSAGES; ++i)
+        {
+            TEST_CHECK(popped[i] == i);
+        }
+    }
+
+    // Other messages are copied one by one:
+    {
+        std::vector<std::string> values = { "a", "b", "c" };
+
+        MessageQueueT<std::string> queue(2);
+        TEST_CHECK(queue.push_bulk(values.begin(), values.end()) == 2);
+        TEST_CHECK(queue.push_bulk(&values[2], 1) == 0);
+
+        std::string popped[2];
+        TEST_CHECK(queue.pop_bulk(popped, 2, true) == 2);
+        TEST_CHECK(popped[0] == "a" && popped[1] == "b");
+    }
+
+    // Single-pass ranges are consumed once, counting the rejected values:
+    {
+        std::istringstream input("a b c d");
+
+        MessageQueueT<std::string> queue(2);
+        TEST_CHECK(queue.push_bulk(std::istream_iterator<std::string>(input),
+                                   std::istream_iterator<std::string>())
+                   == 2);
+        TEST_CHECK(queue.stats().rejected == 2);
+    }
+
+    // The slots shrink back after a burst, keeping the order:
+    {
+        const int NUM_MESSAGES = 1000;
+
+        MessageQueueT<int> queue;
+        for (int round = 0; round < 2; ++round)
+        {
+            for (int i = 0; i < NUM_MESSAGES; ++i)
+            {
+                TEST_CHECK(queue.push(i) == std::size_t(i + 1));
+            }
+
+            int message = -1;
+            for (int i = 0; i < NUM_MESSAGES; ++i)
+            {
+                TEST_CHECK(queue.pop(message, false)
+                           == std::size_t(NUM_MESSAGES - i));
+                TEST_CHECK(message == i);
+            }
+        }
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_type_tags()
+{
+    Message message(new TestMessage(1));
+    TEST_CHECK(message_is<IMessage>(*message));
+    TEST_CHECK(message_is<TestMessage>(*message));
+    TEST_CHECK(!message_is<ITask>(*message));
+    TEST_CHECK(message_cast<TestMessage>(message)->m_value == 1);
+
+    // Tags are inherited along the class hierarchy:
+    auto function = []() {};
+    Message task(new TaskFunction<decltype(function)>(function));
+    TEST_CHECK(message_is<IMessage>(*task));
+    TEST_CHECK(message_is<ITask>(*task));
+    TEST_CHECK(message_is< TaskFunction<decltype(function)> >(*task));
+    TEST_CHECK(!message_is<TestMessage>(*task));
+
+    // Without RTTI only registered classes can be verified:
+    class UntaggedMessage
+        : public TestMessage
+    {
+    public:
+        UntaggedMessage() : TestMessage(2) {}
+    };
+    Message untagged(new UntaggedMessage());
+    TEST_CHECK(message_is_verifiable<TestMessage>());
+#if defined(__GXX_RTTI) || defined(_CPPRTTI)
+    TEST_CHECK(message_is_verifiable<UntaggedMessage>());
+    TEST_CHECK(message_is<UntaggedMessage>(*untagged));
+#else
+    TEST_CHECK(!message_is_verifiable<UntaggedMessage>());
+#endif
+    TEST_CHECK(message_cast<UntaggedMessage>(untagged)->m_value == 2);
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_selector()
+{
+    std::unique_ptr<IMessageQueue> control(IMessageQueue::create());
+    std::unique_ptr<IMessageQueue> data(
+            IMessageQueue::create(IMessageQueue::Options().set_backend(
+                    IMessageQueue::BACKEND_RING)));
+    MessageQueueT<int> results;
+
+    Selector selector;
+    TEST_CHECK(selector.add(*control) == 0);
+    TEST_CHECK(selector.add(*data) == 1);
+    TEST_CHECK(selector.add(results) == 2);
+    TEST_CHECK(selector.size() == 3);
+
+    // Nothing is ready:
+    TEST_CHECK(selector.poll() == Selector::NONE);
+    TEST_CHECK(selector.wait_any_for(std::chrono::milliseconds(10))
+               == Selector::NONE);
+
+    TEST_CHECK(data->push(Message(new TestMessage(1))) > 0);
+    TEST_CHECK(selector.wait_any() == 1);
+
+    // Ready queues are reported in turn:
+    TEST_CHECK(control->push(Message(new TestMessage(0))) > 0);
+    TEST_CHECK(selector.poll() == 0);
+    TEST_CHECK(selector.poll() == 1);
+    TEST_CHECK(selector.poll() == 0);
+
+    Message message;
+    TEST_CHECK(control->pop(message, false) > 0);
+    TEST_CHECK(data->pop(message, false) > 0);
+    TEST_CHECK(selector.poll() == Selector::NONE);
+
+    // A sleeping selector is woken by a push from another thread:
+    std::thread producer([&results]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        results.push(42);
+    });
+    TEST_CHECK(selector.wait_any() == 2);
+    producer.join();
+
+    int value = 0;
+    TEST_CHECK(results.pop(value, false) > 0);
+    TEST_CHECK(value == 42);
+
+    // ... as well as by the cancellation of a queue:
+    std::thread canceller([&control]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        control->cancel();
+    });
+    TEST_CHECK(selector.wait_any_for(std::chrono::seconds(10)) == 0);
+    canceller.join();
+}
+
+// ----------------------------------------------------------------------------
+
+bool
+is_readable(int fd, int timeout_ms)
+{
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    return ::poll(&pfd, 1, timeout_ms) == 1 && (pfd.revents & POLLIN);
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_event_fd(IMessageQueue::Backend backend)
+{
+    std::unique_ptr<IMessageQueue> queue(IMessageQueue::create(
+            IMessageQueue::Options(1000).set_backend(backend)));
+
+    EventFd ready;
+    TEST_CHECK(ready.fd() >= 0);
+    queue->add_listener(ready);
+    TEST_CHECK(!is_readable(ready.fd(), 0));
+
+    // A burst of pushes makes the descriptor readable with one write:
+    for (int i = 0; i < 100; ++i)
+    {
+        TEST_CHECK(queue->push(Message(new TestMessage(i))) > 0);
+    }
+    TEST_CHECK(is_readable(ready.fd(), 0));
+#if defined(__linux__)
+    std::uint64_t writes = 0;
+    TEST_CHECK(::read(ready.fd(), &writes, sizeof(writes)) == sizeof(writes));
+    TEST_CHECK(writes == 1);
+    ready.reset();
+#else
+    ready.reset();
+#endif
+    TEST_CHECK(!is_readable(ready.fd(), 0));
+
+    Message message;
+    while (queue->pop(message, false))
+    {
+    }
+
+    // Pushes from another thread wake a poller:
+    std::thread producer([&queue]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        queue->push(Message(new TestMessage(0)));
+    });
+    TEST_CHECK(is_readable(ready.fd(), 10000));
+    producer.join();
+    ready.reset();
+    TEST_CHECK(queue->pop(message, false) > 0);
+
+    // So does the cancellation:
+    queue->cancel();
+    TEST_CHECK(is_readable(ready.fd(), 0));
+
+    queue->remove_listener(ready);
+}
+
+// ----------------------------------------------------------------------------
+
+struct SharedSample
+{
+    int m_value;
+    double m_square;
+};
+
+void
+test_shared_queue()
+{
+    const int NUM_VALUES = 1000;
+
+    std::ostringstream name;
+    name << "/tp-ut-" << ::getpid();
+    ISharedQueue::unlink(name.str());
+
+    // Small enough to make both processes wait for each other:
+    auto queue = SharedQueueT<SharedSample>::create(name.str(), 16);
+    TEST_CHECK(queue.is_open());
+    TEST_CHECK(!SharedQueueT<SharedSample>::create(name.str(), 16).is_open());
+    TEST_CHECK(!SharedQueueT<double[4]>::open(name.str()).is_open());
+
+    // Raw messages are truncated to the buffer but report their size:
+    {
+        std::unique_ptr<ISharedQueue> raw(ISharedQueue::open(name.str()));
+        TEST_CHECK(raw->capacity() == 16);
+        TEST_CHECK(raw->slot_size() == sizeof(SharedSample));
+
+        const char bytes[] = "0123";
+        TEST_CHECK(raw->push(bytes, 4, false) == 1);
+
+        char buffer[2] = { 0, 0 };
+        std::size_t size = 0;
+        TEST_CHECK(raw->pop(buffer, 2, size, false) == 1);
+        TEST_CHECK(size == 4 && buffer[0] == '0' && buffer[1] == '1');
+        TEST_CHECK(raw->pop(buffer, 2, size, false) == 0);
+    }
+
+    pid_t child = ::fork();
+    if (child == 0)
+    {
+        // The producer process opens the queue by name:
+        auto peer = SharedQueueT<SharedSample>::open(name.str());
+        bool ok = peer.is_open();
+        for (int i = 0; ok && i < NUM_VALUES; ++i)
+        {
+            SharedSample sample = { i, double(i) * i };
+            ok = peer.push_for(sample, std::chrono::seconds(10)) > 0;
+        }
+        ::_exit(ok ? 0 : 1);
+    }
+    TEST_CHECK(child > 0);
+
+    for (int i = 0; i < NUM_VALUES; ++i)
+    {
+        SharedSample sample;
+        TEST_CHECK(queue.pop_for(sample, std::chrono::seconds(10)) > 0);
+        TEST_CHECK(sample.m_value == i && sample.m_square == double(i) * i);
+    }
+
+    int status = 0;
+    TEST_CHECK(::waitpid(child, &status, 0) == child);
+    TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    queue.cancel();
+    SharedSample sample;
+    TEST_CHECK(queue.pop(sample, true) == 0);
+
+    TEST_CHECK(ISharedQueue::unlink(name.str()));
+    TEST_CHECK(!SharedQueueT<SharedSample>::open(name.str()).is_open());
+}
+
+// ----------------------------------------------------------------------------
+
+// Releases its message when the thread exits, after the cache of the slab
+// allocator if the message has been created after the holder.
+struct ExitingHolder
+{
+    Message m_message;
+
+    ~ExitingHolder()
+    {
+        m_message.reset();
+
+        // Allocating is still possible too:
+        Message message = make_message<TestMessage>(1);
+        TEST_CHECK(message_cast<TestMessage>(message)->m_value == 1);
+    }
+};
+
+// ----------------------------------------------------------------------------
+
+void
+test_slab_allocator()
+{
+    // Blocks of every size class, and larger ones, are distinct and usable:
+    const std::size_t sizes[] = { 1, 16, 17, 100, 512, 513, 4096 };
+    std::vector<void *> blocks;
+    for (std::size_t size: sizes)
+    {
+        for (int i = 0; i < 100; ++i)
+        {
+            void *block = SlabAllocator::allocate(size);
+            std::memset(block, i, size);
+            blocks.push_back(block);
+        }
+    }
+
+    std::vector<void *> sorted(blocks);
+    std::sort(sorted.begin(), sorted.end());
+    TEST_CHECK(std::adjacent_find(sorted.begin(), sorted.end())
+               == sorted.end());
+
+    for (std::size_t i = 0; i < blocks.size(); ++i)
+    {
+        SlabAllocator::deallocate(blocks[i], sizes[i / 100]);
+    }
+
+    // Messages created by one thread are released by another one, more than
+    // a magazine at a time:
+    std::vector<Message> messages;
+    for (int i = 0; i < 1000; ++i)
+    {
+        messages.push_back(make_message<TestMessage>(i));
+    }
+    std::thread releaser([&messages]() { messages.clear(); });
+    releaser.join();
+
+    // Messages released and created by thread-local destructors running
+    // after the one of the cache of their thread:
+    std::thread exiting([]()
+    {
+        static thread_local ExitingHolder holder;
+        holder.m_message = make_message<TestMessage>(0);
+    });
+    exiting.join();
+
+    std::shared_ptr<TestMessage> message = make_message<TestMessage>(7, 3);
+    TEST_CHECK(message->m_value == 7);
+    TEST_CHECK(message->priority() == 3);
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_queue_stats(IMessageQueue::Backend backend)
+{
+    std::unique_ptr<IMessageQueue> queue(IMessageQueue::create(
+            IMessageQueue::Options(4).set_backend(backend)));
+
+    QueueStats stats = queue->stats();
+    TEST_CHECK(stats.size == 0);
+    TEST_CHECK(stats.high_water_mark == 0);
+    TEST_CHECK(stats.pushes == 0 && stats.pops == 0 && stats.rejected == 0);
+
+    // Fills the queue, the last push is rejected:
+    for (int i = 0; i < 5; ++i)
+    {
+        queue->push(Message(new TestMessage(i)));
+    }
+    Message message;
+    TEST_CHECK(queue->pop(message, false) > 0);
+    TEST_CHECK(queue->pop(message, false) > 0);
+
+    // Only the room left is filled by bulk pushes:
+    Message batch[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        batch[i] = Message(new TestMessage(i));
+    }
+    TEST_CHECK(queue->push_bulk(batch, 3) == 2);
+
+    stats = queue->stats();
+    TEST_CHECK(stats.size == 4);
+    TEST_CHECK(stats.high_water_mark == 4);
+    TEST_CHECK(stats.pushes == 6);
+    TEST_CHECK(stats.pops == 2);
+    TEST_CHECK(stats.rejected == 2);
+    TEST_CHECK(stats.producer_waits.count() == 0);
+
+    Message messages[4];
+    TEST_CHECK(queue->pop_bulk(messages, 4, false) == 4);
+
+    // A blocked consumer is counted until a message is pushed:
+    std::thread consumer([&queue]() {
+        Message message;
+        TEST_CHECK(queue->pop(message, true) > 0);
+    });
+    while (queue->stats().blocked_consumers == 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    TEST_CHECK(queue->push(Message(new TestMessage(0))) > 0);
+    consumer.join();
+
+    stats = queue->stats();
+    TEST_CHECK(stats.size == 0);
+    TEST_CHECK(stats.pushes == 7);
+    TEST_CHECK(stats.pops == 7);
+    TEST_CHECK(stats.blocked_consumers == 0);
+    TEST_CHECK(stats.consumer_waits.count() == 1);
+    TEST_CHECK(stats.consumer_waits.percentile(0.5)
+               > std::chrono::milliseconds(8));
+
+    // So does a producer timing out on a full queue:
+    for (int i = 0; i < 4; ++i)
+    {
+        TEST_CHECK(queue->push(Message(new TestMessage(i))) > 0);
+    }
+    TEST_CHECK(queue->push_for(Message(new TestMessage(4)),
+                               std::chrono::milliseconds(1)) == 0);
+
+    stats = queue->stats();
+    TEST_CHECK(stats.rejected == 3);
+    TEST_CHECK(stats.blocked_producers == 0);
+    TEST_CHECK(stats.producer_waits.count() == 1);
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_sharded_order()
+{
+    const int NUM_PRODUCERS = 8;
+    const int NUM_MESSAGES = 20000;
+
+    std::unique_ptr<IMessageQueue> queue(
+            IMessageQueue::create(IMessageQueue::Options(1000).set_backend(
+                    IMessageQueue::BACKEND_SHARDED)));
+
+    std::vector<std::thread> producers;
+    for (int i = 0; i < NUM_PRODUCERS; ++i)
+    {
+        producers.push_back(std::thread([&queue, i]() {
+            for (int j = 0; j < NUM_MESSAGES; ++j)
+            {
+                Message message(new TestMessage(i * NUM_MESSAGES + j));
+                TEST_CHECK(queue->push(message, true) > 0);
+            }
+        }));
+    }
+
+    // Messages of each producer are received in the same order they have
+    // been pushed, whatever their lane:
+    std::vector<int> next(NUM_PRODUCERS, 0);
+    for (int i = 0; i < NUM_PRODUCERS * NUM_MESSAGES; ++i)
+    {
+        std::shared_ptr<TestMessage> message;
+        TEST_CHECK(queue->popT(message, true) > 0);
+
+        int producer = message->m_value / NUM_MESSAGES;
+        TEST_CHECK(message->m_value % NUM_MESSAGES == next[producer]);
+        ++next[producer];
+    }
+
+    for (auto &thread: producers)
+    {
+        thread.join();
+    }
+
+    TEST_CHECK(queue->size() == 0);
+    TEST_CHECK(queue->stats().high_water_mark <= 1000);
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_overflow(IMessageQueue::Backend backend)
+{
+    const Overflow::Kind kinds[] = { Overflow::DROP_NEWEST,
+                                     Overflow::DROP_OLDEST };
+
+    for (auto kind: kinds)
+    {
+        std::vector<int> discarded;
+        OverflowPolicy<Message> overflow(kind, [&](Message &&message) {
+            discarded.push_back(value_of(message));
+        });
+
+        std::unique_ptr<IMessageQueue> queue(
+                IMessageQueue::create(IMessageQueue::Options(4)
+                                              .set_backend(backend)
+                                              .set_overflow(overflow)));
+
+        // Pushes into a full queue neither block nor fail:
+        for (int i = 0; i < 6; ++i)
+        {
+            std::size_t size = queue->push(Message(new TestMessage(i)), true);
+            TEST_CHECK(size == std::size_t(std::min(i + 1, 4)));
+        }
+
+        Message batch[2] = { Message(new TestMessage(6)),
+                             Message(new TestMessage(7)) };
+        TEST_CHECK(queue->push_bulk(batch, 2) == 2);
+
+        const std::vector<int> expected_discarded =
+                (kind == Overflow::DROP_NEWEST) ? std::vector<int>{ 4, 5, 6, 7 }
+                                                : std::vector<int>{ 0, 1, 2, 3 };
+        TEST_CHECK(discarded == expected_discarded);
+
+        const int first = (kind == Overflow::DROP_NEWEST) ? 0 : 4;
+        for (int i = first; i < first + 4; ++i)
+        {
+            Message message;
+            TEST_CHECK(queue->pop(message, false) > 0);
+            TEST_CHECK(value_of(message) == i);
+        }
+
+        QueueStats stats = queue->stats();
+        TEST_CHECK(stats.evicted == 4);
+        TEST_CHECK(stats.rejected == 0);
+        TEST_CHECK(stats.pushes == (kind == Overflow::DROP_NEWEST ? 4 : 8));
+        TEST_CHECK(stats.pops == 4);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_overflow_priority()
+{
+    std::vector<int> discarded;
+    OverflowPolicy<Message> overflow(Overflow::DROP_OLDEST,
+                                     [&](Message &&message) {
+                                         discarded.push_back(value_of(message));
+                                     });
+
+    std::unique_ptr<IMessageQueue> queue(
+            IMessageQueue::create(
+                    IMessageQueue::Options(3)
+                            .set_backend(IMessageQueue::BACKEND_PRIORITY)
+                            .set_overflow(overflow)));
+
+    TEST_CHECK(queue->push(Message(new TestMessage(0, 1))) == 1);
+    TEST_CHECK(queue->push(Message(new TestMessage(1, 0))) == 2);
+    TEST_CHECK(queue->push(Message(new TestMessage(2, 0))) == 3);
+
+    // The oldest message of the lowest priority makes room, never the pushed
+    // one when it has a higher priority:
+    TEST_CHECK(queue->push(Message(new TestMessage(3, 5))) == 3);
+    TEST_CHECK(queue->push(Message(new TestMessage(4, 0))) == 3);
+    TEST_CHECK(queue->push(Message(new TestMessage(5, 7))) == 3);
+
+    // The pushed message itself is discarded when it has the lowest priority:
+    TEST_CHECK(queue->push(Message(new TestMessage(6, 0))) == 3);
+
+    TEST_CHECK(discarded == std::vector<int>({ 1, 2, 4, 6 }));
+
+    const int expected[] = { 5, 3, 0 };
+    for (int value: expected)
+    {
+        Message message;
+        TEST_CHECK(queue->pop(message, false) > 0);
+        TEST_CHECK(value_of(message) == value);
+    }
+    TEST_CHECK(queue->stats().evicted == 4);
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_overflow_typed()
+{
+    std::vector<int> discarded;
+    MessageQueueT<int> queue(2, WaitStrategy(),
+                             OverflowPolicy<int>(Overflow::DROP_OLDEST,
+                                                 [&](int &&value) {
+                                                     discarded.push_back(value);
+                                                 }));
+
+    for (int i = 0; i < 3; ++i)
+    {
+        TEST_CHECK(queue.push(i) > 0);
+    }
+    const int more[] = { 3, 4 };
+    TEST_CHECK(queue.push_bulk(more, more + 2) == 2);
+
+    TEST_CHECK(discarded == std::vector<int>({ 0, 1, 2 }));
+    TEST_CHECK(queue.stats().evicted == 3);
+
+    int value = -1;
+    TEST_CHECK(queue.pop(value, false) == 2);
+    TEST_CHECK(value == 3);
+    TEST_CHECK(queue.pop(value, false) == 1);
+    TEST_CHECK(value == 4);
+}
+
+// ----------------------------------------------------------------------------
+
+struct SumPending
+{
+    void
+    operator()(int &pending, int &&incoming) const
+    {
+        pending += incoming;
+    }
+};
+
+void
+test_coalescing()
+{
+    // Superseded messages are replaced in place:
+    {
+        CoalescingMessageQueueT<int, std::string> queue;
+
+        TEST_CHECK(queue.push(1, std::string("a")) == 1);
+        TEST_CHECK(queue.push(2, std::string("b")) == 2);
+        TEST_CHECK(queue.push(1, std::string("c")) == 2);
+
+        int key = 0;
+        std::string message;
+        TEST_CHECK(queue.pop(key, message, false) == 2);
+        TEST_CHECK(key == 1);
+        TEST_CHECK(message == "c");
+
+        // A key no longer pending is appended again:
+        TEST_CHECK(queue.push(1, std::string("d")) == 2);
+        TEST_CHECK(queue.pop(message, false) == 2);
+        TEST_CHECK(message == "b");
+        TEST_CHECK(queue.pop(key, message, false) == 1);
+        TEST_CHECK(key == 1);
+        TEST_CHECK(message == "d");
+        TEST_CHECK(queue.pop(message, false) == 0);
+
+        QueueStats stats = queue.stats();
+        TEST_CHECK(stats.pushes == 4);
+        TEST_CHECK(stats.pops == 3);
+        TEST_CHECK(stats.high_water_mark == 2);
+    }
+
+    // Many updates of few entities are merged by the functor:
+    {
+        const int NUM_KEYS = 10;
+        const int NUM_UPDATES = 10000;
+
+        CoalescingMessageQueueT<int, int, SumPending> queue;
+
+        std::thread producer([&queue]() {
+            for (int i = 0; i < NUM_UPDATES; ++i)
+            {
+                TEST_CHECK(queue.push(i % NUM_KEYS, 1) > 0);
+            }
+        });
+
+        std::vector<int> totals(NUM_KEYS, 0);
+        int total = 0;
+        while (total < NUM_UPDATES)
+        {
+            int key = -1;
+            int count = 0;
+            TEST_CHECK(queue.pop_for(key, count, std::chrono::seconds(10)) > 0);
+            TEST_CHECK(queue.size() <= std::size_t(NUM_KEYS));
+            totals[key] += count;
+            total += count;
+        }
+        producer.join();
+
+        for (int key = 0; key < NUM_KEYS; ++key)
+        {
+            TEST_CHECK(totals[key] == NUM_UPDATES / NUM_KEYS);
+        }
+        TEST_CHECK(queue.stats().high_water_mark <= std::size_t(NUM_KEYS));
+
+        queue.cancel();
+        int count = 0;
+        TEST_CHECK(queue.pop(count, true) == 0);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_timing_wheel()
+{
+    const int NUM_TIMERS = 20000;
+
+    // Timers expire at their tick in order, through every level and the
+    // overflow:
+    {
+        TimingWheel<std::uint64_t> wheel(12345);
+
+        std::vector<std::uint64_t> expiries;
+        std::vector<TimingWheel<std::uint64_t>::Handle> handles;
+        std::uint64_t seed = 1;
+        for (int i = 0; i < NUM_TIMERS; ++i)
+        {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            const unsigned bits = 1 + unsigned(seed >> 58) % 40;
+            const std::uint64_t expiry
+                    = wheel.now() + 1
+                      + ((seed >> 8) & ((std::uint64_t(1) << bits) - 1));
+
+            handles.push_back(wheel.insert(expiry, expiry));
+            expiries.push_back(expiry);
+        }
+        TEST_CHECK(wheel.size() == std::size_t(NUM_TIMERS));
+
+        // Every other timer is cancelled, once:
+        std::vector<std::uint64_t> expected;
+        for (int i = 0; i < NUM_TIMERS; ++i)
+        {
+            if (i % 2 == 0)
+            {
+                TEST_CHECK(wheel.cancel(handles[i]));
+                TEST_CHECK(!wheel.cancel(handles[i]));
+            }
+            else
+            {
+                expected.push_back(expiries[i]);
+            }
+        }
+        std::stable_sort(expected.begin(), expected.end());
+
+        std::vector<std::uint64_t> expired;
+        while (wheel.size() > 0)
+        {
+            const std::uint64_t next = wheel.next_tick();
+            TEST_CHECK(next > wheel.now());
+
+            wheel.advance(next, [&](std::uint64_t &value, bool periodic)
+            {
+                TEST_CHECK(value == next);
+                TEST_CHECK(!periodic);
+                expired.push_back(value);
+            });
+            TEST_CHECK(wheel.now() == next);
+        }
+        TEST_CHECK(expired == expected);
+        TEST_CHECK(wheel.next_tick() == TimingWheel<std::uint64_t>::NEVER);
+
+        // Handles of expired timers are stale:
+        TEST_CHECK(!wheel.cancel(handles[1]));
+    }
+
+    // Periodic timers expire again every period until cancelled, inserted
+    // again at each expiry:
+    {
+        TimingWheel<int> wheel;
+
+        TimingWheel<int>::Handle periodic = wheel.insert(10, 1, 300);
+        wheel.insert(0, 2);
+        wheel.insert(310, 3);
+
+        std::vector<int> expired;
+        auto collect = [&expired](int &value, bool)
+        {
+            expired.push_back(value);
+        };
+
+        wheel.advance(1, collect);
+        TEST_CHECK(expired == std::vector<int>({2}));
+
+        wheel.advance(1000, collect);
+        TEST_CHECK(expired == std::vector<int>({2, 1, 3, 1, 1, 1}));
+        TEST_CHECK(wheel.size() == 1);
+
+        TEST_CHECK(wheel.cancel(periodic));
+        TEST_CHECK(wheel.size() == 0);
+
+        wheel.advance(100000, collect);
+        TEST_CHECK(expired.size() == 6);
+        TEST_CHECK(wheel.now() == 100000);
+    }
+}
+
+// ----------------------------------------------------------------------------
+
+void
+test_delay_queue()
+{
+    std::unique_ptr<IMessageQueue> target(IMessageQueue::create(16));
+    DelayQueue delayed(*target, std::chrono::milliseconds(1));
+
+    // Messages become visible at their deadline, in order of deadline:
+    const Deadline start = Clock::now();
+    delayed.push_after(std::chrono::milliseconds(30),
+                       make_message<TestMessage>(2));
+    delayed.push_after(std::chrono::milliseconds(10),
+                       make_message<TestMessage>(1));
+    TimerId cancelled = delayed.push_after(std::chrono::milliseconds(20),
+                                           make_message<TestMessage>(0));
+    TEST_CHECK(delayed.size() == 3);
+    TEST_CHECK(delayed.cancel(cancelled));
+    TEST_CHECK(!delayed.cancel(cancelled));
+
+    Message message;
+    TEST_CHECK(target->pop(message, false) == 0);
+    TEST_CHECK(target->pop_for(message, std::chrono::seconds(10)) > 0);
+    TEST_CHECK(message_cast<TestMessage>(message)->m_value == 1);
+    TEST_CHECK(Clock::now() - start >= std::chrono::milliseconds(10));
+    TEST_CHECK(target->pop_for(message, std::chrono::seconds(10)) > 0);
+    TEST_CHECK(message_cast<TestMessage>(message)->m_value == 2);
+    TEST_CHECK(Clock::now() - start >= std::chrono::milliseconds(30));
+
+    // Periodic messages are pushed until cancelled:
+    TimerId periodic = delayed.push_every(std::chrono::milliseconds(2),
+                                          make_message<TestMessage>(3));
+    for (int i = 0; i < 3; ++i)
+    {
+        TEST_CHECK(target->pop_for(message, std::chrono::seconds(10)) > 0);
+        TEST_CHECK(message_cast<TestMessage>(message)->m_value == 3);
+    }
+    TEST_CHECK(delayed.cancel(periodic));
+    TEST_CHECK(delayed.size() == 0);
+
+    // Pending messages are handed back:
+    delayed.push_after(std::chrono::hours(1), make_message<TestMessage>(4));
+    std::vector<Message> pending;
+    delayed.join(pending);
+    TEST_CHECK(pending.size() == 1);
+}
+
+} // anonymous namespace
+
+// ----------------------------------------------------------------------------
+
+void
+test_MessageQueue()
+{
+    test_typed();
+    test_typed_values();
+    test_type_tags();
+
+    test_ring_capacity();
+    test_backend(IMessageQueue::BACKEND_MUTEX, 4, 4);
+    test_backend(IMessageQueue::BACKEND_RING, 4, 4);
+    test_backend(IMessageQueue::BACKEND_RING, 1, 16);
+    test_backend(IMessageQueue::BACKEND_RING, 16, 1);
+    test_backend(IMessageQueue::BACKEND_SPSC, 1, 1);
+
+    test_unbounded_ring();
+    test_segmented_skip();
+    test_backend(IMessageQueue::BACKEND_RING, 4, 4, WaitStrategy(),
+                 std::numeric_limits<std::size_t>::max());
+    test_backend(IMessageQueue::BACKEND_RING, 16, 16, WaitStrategy(),
+                 std::numeric_limits<std::size_t>::max());
+    test_backend(IMessageQueue::BACKEND_RING, 16, 4,
+                 WaitStrategy(WaitStrategy::SPIN_YIELD),
+                 std::numeric_limits<std::size_t>::max());
+
+    test_blocking_push(IMessageQueue::BACKEND_MUTEX);
+    test_blocking_push(IMessageQueue::BACKEND_RING);
+
+    test_timed(IMessageQueue::BACKEND_MUTEX);
+    test_timed(IMessageQueue::BACKEND_RING);
+
+    test_bulk(IMessageQueue::BACKEND_MUTEX);
+    test_bulk(IMessageQueue::BACKEND_RING);
+
+    test_backend(IMessageQueue::BACKEND_PRIORITY, 4, 4);
+    test_blocking_push(IMessageQueue::BACKEND_PRIORITY);
+    test_timed(IMessageQueue::BACKEND_PRIORITY);
+    test_bulk(IMessageQueue::BACKEND_PRIORITY);
+    test_priority();
+
+    const WaitStrategy::Kind strategies[] = {
+            WaitStrategy::SPIN,
+            WaitStrategy::SPIN_YIELD,
+            WaitStrategy::SPIN_PARK,
+            WaitStrategy::ADAPTIVE
+    };
+    for (auto kind: strategies)
+    {
+        // Pure spinning needs a CPU for each thread:
+        if (kind != WaitStrategy::SPIN
+            || std::thread::hardware_concurrency() >= 4)
+        {
+            test_backend(IMessageQueue::BACKEND_MUTEX, 2, 2,
+                         WaitStrategy(kind));
+            test_backend(IMessageQueue::BACKEND_RING, 2, 2,
+                         WaitStrategy(kind));
+        }
+        test_timed(IMessageQueue::BACKEND_MUTEX, WaitStrategy(kind));
+        test_timed(IMessageQueue::BACKEND_RING, WaitStrategy(kind));
+    }
+
+    test_spsc_typed();
+    test_mpsc();
+    test_work_stealing_deque();
+    test_selector();
+    test_event_fd(IMessageQueue::BACKEND_MUTEX);
+    test_event_fd(IMessageQueue::BACKEND_RING);
+    test_shared_queue();
+    test_slab_allocator();
+    test_queue_stats(IMessageQueue::BACKEND_MUTEX);
+    test_queue_stats(IMessageQueue::BACKEND_RING);
+    test_queue_stats(IMessageQueue::BACKEND_PRIORITY);
+
+    test_backend(IMessageQueue::BACKEND_SHARDED, 4, 4);
+    test_backend(IMessageQueue::BACKEND_SHARDED, 32, 2);
+    test_blocking_push(IMessageQueue::BACKEND_SHARDED);
+    test_timed(IMessageQueue::BACKEND_SHARDED);
+    test_bulk(IMessageQueue::BACKEND_SHARDED);
+    test_queue_stats(IMessageQueue::BACKEND_SHARDED);
+    test_sharded_order();
+
+    test_overflow(IMessageQueue::BACKEND_MUTEX);
+    test_overflow(IMessageQueue::BACKEND_RING);
+    test_overflow(IMessageQueue::BACKEND_SPSC);
+    test_overflow(IMessageQueue::BACKEND_PRIORITY);
+    test_overflow(IMessageQueue::BACKEND_SHARDED);
+    test_overflow_priority();
+    test_overflow_typed();
+    test_coalescing();
+    test_timing_wheel();
+    test_delay_queue();
+}
+
+// ----------------------------------------------------------------------------
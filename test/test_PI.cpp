@@ -29,14 +29,18 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "test_Utils.h"
 
+#include "Clock.h"
 #include "Thread.h"
 #include "ThreadPool.h"
 #include "Trace.h"
 
 #include <atomic>
+#include <chrono>
 #include <sstream>
 #include <cstdlib>
 #include <ctime>
+#include <limits>
+#include <memory>
 #include <random>
 
 // -----------------------------------------------------------------------------
@@ -56,6 +60,8 @@ class TestTask
 
 public:
 
+    MESSAGE_TYPE(TestTask, ITask)
+
     TestTask(double x, double y)
             :
             m_x(x),
@@ -82,12 +88,66 @@ public:
 
 };
 
+// -----------------------------------------------------------------------------
+
+/**
+ * Task that splits its range of samples in two halves pushed into the pool
+ * from the running task, down to one sample per task.
+ */
+class SplitTask
+        :
+                public ITask
+{
+
+    IThreadPool &m_pool;
+    const int m_first;
+    const int m_count;
+    bool m_result;
+
+public:
+
+    MESSAGE_TYPE(SplitTask, ITask)
+
+    SplitTask(IThreadPool &pool, int first, int count)
+            :
+            m_pool(pool),
+            m_first(first),
+            m_count(count),
+            m_result(false)
+    {
+    }
+
+    virtual void
+    execute()
+    {
+        if (m_count > 1)
+        {
+            const int half = m_count / 2;
+            TEST_CHECK(m_pool.push(std::make_shared<SplitTask>(
+                    m_pool, m_first, half)) != 0);
+            TEST_CHECK(m_pool.push(std::make_shared<SplitTask>(
+                    m_pool, m_first + half, m_count - half)) != 0);
+            return;
+        }
+
+        // Each sample is drawn from its own seed, whatever the worker:
+        std::minstd_rand pick(m_first + 1);
+        std::uniform_real_distribution<double> zeroToOne(0.0, 1.0);
+        double x = zeroToOne(pick);
+        double y = zeroToOne(pick);
+        m_result = (x * x + y * y <= 1.0);
+    }
+
+    bool result() const { return m_result; }
+
+};
+
 } // anonymous namespace
 
 // -----------------------------------------------------------------------------
 
 void
-test_PI(int NUM_THREADS)
+test_PI(int NUM_THREADS, IThreadPool::Scheduler scheduler)
 {
     // const int NUM_THREADS = 4;
     const int NUM_TASKS = 100000;
@@ -97,9 +157,12 @@ test_PI(int NUM_THREADS)
     std::size_t numPositive = 0;
 
     std::clock_t begin = std::clock();
+    Deadline wall_begin = Clock::now();
     {
         std::unique_ptr <IThreadPool> pool(
-                IThreadPool::create(NUM_THREADS, QUEUE_CAPACITY));
+                IThreadPool::create(NUM_THREADS, QUEUE_CAPACITY,
+                                    IMessageQueue::BACKEND_MUTEX, 0,
+                                    scheduler));
 
         std::default_random_engine pick;
         std::uniform_real_distribution<double> zeroToOne(0.0, 1.0);
@@ -133,10 +196,13 @@ test_PI(int NUM_THREADS)
         pool->join();
     }
     std::clock_t end = clock();
+    Deadline wall_end = Clock::now();
 
     {
         std::stringstream message;
-        message << "[" << NUM_THREADS << "]";
+        message << "[" << NUM_THREADS << "] "
+                << (scheduler == IThreadPool::SCHEDULER_STEALING
+                    ? "stealing" : "shared");
         trace(message);
 
         TEST_CHECK(numPositive < NUM_TASKS);
@@ -147,16 +213,89 @@ test_PI(int NUM_THREADS)
         double elapsed_secs = double(end - begin) / CLOCKS_PER_SEC;
         message << "Duration: " << elapsed_secs;
         trace(message);
+
+        double wall_secs
+                = std::chrono::duration<double>(wall_end - wall_begin).count();
+        message << "Wall duration: " << wall_secs;
+        trace(message);
         trace(message);
     }
 
 }
 
+// -----------------------------------------------------------------------------
+
+void
+test_PI_nested(int NUM_THREADS, IThreadPool::Scheduler scheduler)
+{
+    // Splitting down to single samples, every task but the root one is
+    // pushed by a running task: the stealing scheduler queues them into the
+    // deques of the workers.
+    const int NUM_SAMPLES = 65536;
+    const int NUM_TASKS = 2 * NUM_SAMPLES - 1;
+
+    std::size_t numPositive = 0;
+
+    Deadline wall_begin = Clock::now();
+    {
+        std::unique_ptr <IThreadPool> pool(
+                IThreadPool::create(NUM_THREADS,
+                                    std::numeric_limits<std::size_t>::max(),
+                                    IMessageQueue::BACKEND_MUTEX, 0,
+                                    scheduler));
+
+        TEST_CHECK(pool->push(std::make_shared<SplitTask>(*pool, 0,
+                                                          NUM_SAMPLES)) != 0);
+
+        // Collects all the tasks, the results are held by the leaves:
+        for (int i = 0; i < NUM_TASKS; ++i)
+        {
+            std::shared_ptr<SplitTask> task;
+            TEST_CHECK(pool->popT(task, true) != 0);
+            if (task->result())
+            {
+                ++numPositive;
+            }
+        }
+
+        pool->join();
+    }
+    Deadline wall_end = Clock::now();
+
+    {
+        std::stringstream message;
+        message << "[" << NUM_THREADS << "] nested "
+                << (scheduler == IThreadPool::SCHEDULER_STEALING
+                    ? "stealing" : "shared");
+        trace(message);
+
+        TEST_CHECK(numPositive > 0 && numPositive < NUM_SAMPLES);
+        double pi = 4.0 * double(numPositive) / double(NUM_SAMPLES);
+        message << "PI: " << pi;
+        trace(message);
+
+        double wall_secs
+                = std::chrono::duration<double>(wall_end - wall_begin).count();
+        message << "Wall duration: " << wall_secs;
+        trace(message);
+    }
+}
+
 void test_PI()
 {
+    // Both schedulers on the same fine-grained tasks, durations are only
+    // reported:
     for (auto i = 1; i <= 16; ++i)
     {
-        test_PI(i);
+        test_PI(i, IThreadPool::SCHEDULER_SHARED);
+        test_PI(i, IThreadPool::SCHEDULER_STEALING);
+    }
+
+    // Same with tasks pushed from running tasks:
+    for (auto i = 1; i <= 16; i *= 2)
+    {
+        test_PI_nested(i, IThreadPool::SCHEDULER_SHARED);
+        test_PI_nested(i, IThreadPool::SCHEDULER_STEALING);
     }
 }
 
@@ -0,0 +1,195 @@
+/**
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "test_Utils.h"
+
+#include "Clock.h"
+#include "MessageQueue.h"
+#include "Trace.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace {
+
+/**
+ * Message carrying its producer and its position in the producer sequence.
+ */
+class SequenceMessage
+        :
+                public IMessage
+{
+
+public:
+
+    MESSAGE_TYPE(SequenceMessage, IMessage)
+    SLAB_ALLOCATED
+
+    const int m_producer;
+    const int m_sequence;
+
+    SequenceMessage(int producer, int sequence)
+            :
+            m_producer(producer),
+            m_sequence(sequence)
+    {
+    }
+
+};
+
+// -----------------------------------------------------------------------------
+
+/**
+ * Lets many producers push into one queue drained by a few consumers,
+ * checking that each producer sequence is received in order.
+ *
+ * Returns the throughput in messages per second.
+ */
+double
+test_producers(IMessageQueue::Backend backend, int num_producers)
+{
+    const int NUM_CONSUMERS = 2;
+    const int NUM_MESSAGES = 64000;
+    const std::size_t CAPACITY = 4096;
+    const std::size_t BATCH_SIZE = 32;
+
+    std::unique_ptr<IMessageQueue> queue(IMessageQueue::create(
+            IMessageQueue::Options(CAPACITY).set_backend(backend)));
+
+    const int per_producer = NUM_MESSAGES / num_producers;
+    std::atomic<int> received(0);
+    std::atomic<int> ordered(0);
+
+    std::vector<std::thread> threads;
+    Deadline begin = Clock::now();
+
+    for (int i = 0; i < NUM_CONSUMERS; ++i)
+    {
+        threads.push_back(std::thread([&]() {
+            // Each consumer sees the messages of a producer in order, even
+            // if not all of them:
+            std::vector<int> last(num_producers, -1);
+            Message messages[BATCH_SIZE];
+            std::size_t count;
+            while ((count = queue->pop_bulk(messages, BATCH_SIZE, true)) > 0)
+            {
+                for (std::size_t j = 0; j < count; ++j)
+                {
+                    auto message = message_cast<SequenceMessage>(messages[j]);
+                    if (message->m_sequence > last[message->m_producer])
+                    {
+                        ++ordered;
+                    }
+                    last[message->m_producer] = message->m_sequence;
+                    messages[j].reset();
+                }
+                received += int(count);
+            }
+        }));
+    }
+
+    std::vector<std::thread> producers;
+    for (int i = 0; i < num_producers; ++i)
+    {
+        producers.push_back(std::thread([&, i]() {
+            for (int j = 0; j < per_producer; ++j)
+            {
+                Message message(new SequenceMessage(i, j));
+                TEST_CHECK(queue->push(message, true) > 0);
+            }
+        }));
+    }
+
+    for (auto &thread: producers)
+    {
+        thread.join();
+    }
+
+    const int total = per_producer * num_producers;
+    while (received < total)
+    {
+        std::this_thread::yield();
+    }
+    Deadline end = Clock::now();
+
+    queue->cancel();
+    for (auto &thread: threads)
+    {
+        thread.join();
+    }
+
+    TEST_CHECK(received == total);
+    TEST_CHECK(ordered == total);
+
+    QueueStats stats = queue->stats();
+    double seconds = std::chrono::duration<double>(end - begin).count();
+    double throughput = total / seconds;
+
+    std::stringstream message;
+    message << "[" << backend << "] " << num_producers << " producers: "
+            << int(throughput) << " msg/s, producer waits: "
+            << stats.producer_waits.count() << ", consumer waits: "
+            << stats.consumer_waits.count();
+    trace(message);
+
+    return throughput;
+}
+
+} // anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+void
+test_Scaling()
+{
+    const IMessageQueue::Backend backends[] = {
+            IMessageQueue::BACKEND_MUTEX,
+            IMessageQueue::BACKEND_RING,
+            IMessageQueue::BACKEND_SHARDED
+    };
+
+    const int producers[] = { 1, 2, 4, 8, 16, 32 };
+
+    // Throughput is only reported, it depends on the machine:
+    for (int num_producers: producers)
+    {
+        for (auto backend: backends)
+        {
+            TEST_CHECK(test_producers(backend, num_producers) > 0.0);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
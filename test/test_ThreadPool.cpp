@@ -27,16 +27,27 @@ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include "EventFd.h"
 #include "ThreadPool.h"
 #include "test_Utils.h"
 
 #include "Trace.h"
 #include "Mutex.h"
+#include "TaskGroup.h"
 
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <poll.h>
+#include <unistd.h>
+
 // -----------------------------------------------------------------------------
 
 namespace {
@@ -56,6 +67,9 @@ class TestTask
 
 public:
 
+    MESSAGE_TYPE(TestTask, ITask)
+    SLAB_ALLOCATED
+
     TestTask(int id,
              Mutex &mutex,
              int &instance_counter,
@@ -116,19 +130,532 @@ public:
 
 };
 
-} // anonymous namespace
+// -----------------------------------------------------------------------------
+
+class CountingTask
+        :
+                public ITask
+{
+
+    std::atomic<int> m_executions;
+
+public:
+
+    MESSAGE_TYPE(CountingTask, ITask)
+
+    CountingTask()
+            : m_executions(0)
+    {
+    }
+
+    virtual void
+    execute()
+    {
+        ++m_executions;
+    }
+
+    int
+    executions() const
+    {
+        return m_executions;
+    }
+
+};
+
+// -----------------------------------------------------------------------------
+
+/**
+ * Task that splits itself pushing two halves into the pool while running,
+ * until the halves are single items.
+ */
+class SplittingTask
+        :
+                public ITask
+{
+
+    IThreadPool &m_pool;
+    const int m_items;
+    std::atomic<int> &m_leaves;
+
+public:
+
+    MESSAGE_TYPE(SplittingTask, ITask)
+
+    SplittingTask(IThreadPool &pool, int items, std::atomic<int> &leaves)
+            : m_pool(pool),
+              m_items(items),
+              m_leaves(leaves)
+    {
+    }
+
+    virtual void
+    execute()
+    {
+        if (m_items == 1)
+        {
+            ++m_leaves;
+            return;
+        }
+
+        const int half = m_items / 2;
+        TEST_CHECK(m_pool.push(Task(new SplittingTask(m_pool, half,
+                                                      m_leaves))) > 0);
+        TEST_CHECK(m_pool.push(Task(new SplittingTask(m_pool, m_items - half,
+                                                      m_leaves))) > 0);
+    }
+
+};
+
+// -----------------------------------------------------------------------------
+
+/**
+ * Task that sums a range of integers splitting it into two children, waiting
+ * for them through a group.
+ */
+class SumTask
+        :
+                public ITask
+{
+
+    IThreadPool &m_pool;
+    const long m_first;
+    const long m_last;
+    std::atomic<int> &m_cancelled;
+
+public:
+
+    MESSAGE_TYPE(SumTask, ITask)
+
+    long m_sum;
+
+    SumTask(IThreadPool &pool, long first, long last,
+            std::atomic<int> &cancelled)
+            : m_pool(pool),
+              m_first(first),
+              m_last(last),
+              m_cancelled(cancelled),
+              m_sum(0)
+    {
+    }
+
+    virtual void
+    execute()
+    {
+        if (m_last - m_first <= 8)
+        {
+            for (long i = m_first; i < m_last; ++i)
+            {
+                m_sum += i;
+            }
+            return;
+        }
+
+        const long middle = m_first + (m_last - m_first) / 2;
+        auto left = std::make_shared<SumTask>(m_pool, m_first, middle,
+                                              m_cancelled);
+        auto right = std::make_shared<SumTask>(m_pool, middle, m_last,
+                                               m_cancelled);
+
+        TaskGroup group(m_pool);
+        group.spawn(left);
+        group.spawn(right);
+        TEST_CHECK(group.sync());
+
+        m_sum = left->m_sum + right->m_sum;
+    }
+
+    virtual void
+    cancel()
+    {
+        ++m_cancelled;
+    }
+
+};
+
+// -----------------------------------------------------------------------------
+
+// Keeps its worker busy until another thread executed the task it pushes.
+class RelayTask
+        :
+                public ITask
+{
+
+    IThreadPool &m_pool;
+
+public:
+
+    MESSAGE_TYPE(RelayTask, ITask)
+
+    std::atomic<bool> m_started;
+    std::shared_ptr<CountingTask> m_pushed;
+
+    explicit RelayTask(IThreadPool &pool)
+            : m_pool(pool),
+              m_started(false),
+              m_pushed(std::make_shared<CountingTask>())
+    {
+    }
+
+    virtual void
+    execute()
+    {
+        m_started = true;
+
+        // Lets the waiting thread fall asleep first:
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+        TEST_CHECK(m_pool.push(m_pushed) > 0);
+        while (m_pushed->executions() == 0)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+};
+
+// -----------------------------------------------------------------------------
+
+// Keeps its worker busy until opened.
+class GateTask
+        :
+                public ITask
+{
+
+public:
+
+    MESSAGE_TYPE(GateTask, ITask)
+
+    std::atomic<bool> m_started;
+    std::atomic<bool> m_open;
+
+    GateTask()
+            : m_started(false),
+              m_open(false)
+    {
+    }
+
+    virtual void
+    execute()
+    {
+        m_started = true;
+        while (!m_open)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+};
 
 // -----------------------------------------------------------------------------
 
 void
-test_ThreadPool()
+test_fork_join_wake(IThreadPool::Scheduler scheduler)
+{
+    std::unique_ptr<IThreadPool> pool(
+            IThreadPool::create(1, std::numeric_limits<std::size_t>::max(),
+                                IMessageQueue::BACKEND_MUTEX, 0, scheduler));
+
+    // The only worker runs the child, so the task it pushes can only be
+    // executed by the thread waiting for the group: that thread must be
+    // woken by the push, not by a completion.
+    auto relay = std::make_shared<RelayTask>(*pool);
+    TaskGroup group(*pool);
+    group.spawn(relay);
+    while (!relay->m_started)
+    {
+        std::this_thread::yield();
+    }
+
+    TEST_CHECK(group.sync());
+    TEST_CHECK(relay->m_pushed->executions() == 1);
+}
+
+// -----------------------------------------------------------------------------
+
+void
+test_fork_join(IThreadPool::Scheduler scheduler,
+               std::size_t num_threads,
+               std::size_t task_capacity)
+{
+    const long NUM_ITEMS = 100000;
+
+    std::unique_ptr<IThreadPool> pool(
+            IThreadPool::create(num_threads, task_capacity,
+                                IMessageQueue::BACKEND_MUTEX, 0, scheduler));
+    std::atomic<int> cancelled(0);
+
+    // Nested groups neither idle nor exhaust the workers, even with one
+    // single worker or a tiny capacity. Only the root is handed back:
+    {
+        auto root = std::make_shared<SumTask>(*pool, 0, NUM_ITEMS, cancelled);
+        TEST_CHECK(pool->push(root, true) > 0);
+
+        Task task;
+        TEST_CHECK(pool->pop_for(task, std::chrono::seconds(60)) > 0);
+        TEST_CHECK(task == root);
+        TEST_CHECK(root->m_sum == NUM_ITEMS * (NUM_ITEMS - 1) / 2);
+        TEST_CHECK(pool->pop_for(task, std::chrono::milliseconds(10)) == 0);
+    }
+
+    // Threads that are not workers help too:
+    {
+        SumTask root(*pool, 0, NUM_ITEMS, cancelled);
+        root.execute();
+        TEST_CHECK(root.m_sum == NUM_ITEMS * (NUM_ITEMS - 1) / 2);
+    }
+
+    TEST_CHECK(cancelled == 0);
+}
+
+// -----------------------------------------------------------------------------
+
+void
+test_fork_join_pools(IThreadPool::Scheduler scheduler)
+{
+    const int NUM_POOLS = 64;
+
+    // Many pools alive at once, so that their event counts land everywhere
+    // in memory. Each group waits while the only worker runs its child: the
+    // pushes of this thread, that is not a worker, notify the group nested
+    // into the notification of the pool queue.
+    std::vector< std::unique_ptr<IThreadPool> > pools;
+    std::vector< std::shared_ptr<GateTask> > gates;
+    const IMessageQueue::Backend backends[] = {
+            IMessageQueue::BACKEND_MUTEX,
+            IMessageQueue::BACKEND_RING,
+            IMessageQueue::BACKEND_PRIORITY
+    };
+    for (int i = 0; i < NUM_POOLS; ++i)
+    {
+        // Queues of different kinds and sizes don't lay out the same way:
+        pools.emplace_back(
+                IThreadPool::create(1, 16 + i * 8, backends[i % 3], 0,
+                                    scheduler));
+        gates.push_back(std::make_shared<GateTask>());
+    }
+
+    std::vector<std::thread> waiters;
+    for (int i = 0; i < NUM_POOLS; ++i)
+    {
+        IThreadPool &pool = *pools[i];
+        std::shared_ptr<GateTask> gate = gates[i];
+        waiters.emplace_back([&pool, gate]()
+        {
+            TaskGroup group(pool);
+            group.spawn(gate);
+            while (!gate->m_started)
+            {
+                std::this_thread::yield();
+            }
+            TEST_CHECK(group.sync());
+        });
+    }
+
+    for (auto &gate: gates)
+    {
+        while (!gate->m_started)
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    // Lets the groups fall asleep first:
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+    auto counting = std::make_shared<CountingTask>();
+    for (auto &pool: pools)
+    {
+        TEST_CHECK(pool->push(counting) > 0);
+    }
+
+    for (auto &gate: gates)
+    {
+        gate->m_open = true;
+    }
+    for (auto &waiter: waiters)
+    {
+        waiter.join();
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void
+test_fork_join_cancel(IThreadPool::Scheduler scheduler)
+{
+    const int NUM_CHILDREN = 10;
+
+    // Without workers, children are executed only by the waiting thread:
+    {
+        std::unique_ptr<IThreadPool> pool(
+                IThreadPool::create(0, std::numeric_limits<std::size_t>::max(),
+                                    IMessageQueue::BACKEND_MUTEX, 0,
+                                    scheduler));
+
+        std::shared_ptr<CountingTask> child(new CountingTask());
+        TaskGroup group(*pool);
+        for (int i = 0; i < NUM_CHILDREN; ++i)
+        {
+            group.spawn(child);
+        }
+        TEST_CHECK(group.sync());
+        TEST_CHECK(child->executions() == NUM_CHILDREN);
+    }
+
+    // Children pending when the pool is cancelled are cancelled:
+    {
+        std::unique_ptr<IThreadPool> pool(
+                IThreadPool::create(0, std::numeric_limits<std::size_t>::max(),
+                                    IMessageQueue::BACKEND_MUTEX, 0,
+                                    scheduler));
+        std::atomic<int> cancelled(0);
+
+        TaskGroup group(*pool);
+        for (int i = 0; i < NUM_CHILDREN; ++i)
+        {
+            group.spawn(std::make_shared<SumTask>(*pool, 0, 1, cancelled));
+        }
+        pool->cancel();
+
+        TEST_CHECK(!group.sync());
+        TEST_CHECK(cancelled == NUM_CHILDREN);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void
+test_submit(IThreadPool::Scheduler scheduler)
+{
+    const int NUM_FUTURES = 1000;
+
+    std::unique_ptr<IThreadPool> pool(
+            IThreadPool::create(4, std::numeric_limits<std::size_t>::max(),
+                                IMessageQueue::BACKEND_MUTEX, 0, scheduler));
+    Task task;
+
+    // Values are returned through the futures only:
+    {
+        std::vector<Future<int>> futures;
+        for (int i = 0; i < NUM_FUTURES; ++i)
+        {
+            futures.push_back(pool->submit([i]() { return i * 2; }));
+        }
+
+        for (int i = 0; i < NUM_FUTURES; ++i)
+        {
+            TEST_CHECK(futures[i].valid());
+            TEST_CHECK(futures[i].get() == i * 2);
+            TEST_CHECK(!futures[i].valid());
+        }
+
+        TEST_CHECK(pool->pop_for(task, std::chrono::milliseconds(10)) == 0);
+    }
+
+    // Outcomes already available, of any movable type:
+    {
+        Future<std::string> future = pool->submit(
+                []() { return std::string("done"); });
+        TEST_CHECK(future.wait_for(std::chrono::seconds(10)));
+        TEST_CHECK(future.is_ready());
+        TEST_CHECK(future.get() == "done");
+
+        std::atomic<int> calls(0);
+        Future<void> nothing = pool->submit([&calls]() { ++calls; });
+        nothing.get();
+        TEST_CHECK(calls == 1);
+    }
+
+    // Exceptions are thrown by the futures:
+    {
+        Future<int> future = pool->submit([]() -> int
+        {
+            throw std::runtime_error("failed");
+        });
+
+        bool thrown = false;
+        try
+        {
+            future.get();
+        }
+        catch (const std::runtime_error &error)
+        {
+            thrown = std::string(error.what()) == "failed";
+        }
+        TEST_CHECK(thrown);
+    }
+
+    // Tasks are handed back only if asked:
+    {
+        Future<int> future = pool->submit([]() { return 1; }, true);
+        TEST_CHECK(pool->pop_for(task, std::chrono::seconds(10)) > 0);
+        TEST_CHECK(task == future.task());
+        TEST_CHECK(future.is_ready());
+        TEST_CHECK(future.get() == 1);
+    }
+
+    // Functions dropped by a cancelled pool break their promise:
+    {
+        std::unique_ptr<IThreadPool> idle(
+                IThreadPool::create(0, std::numeric_limits<std::size_t>::max(),
+                                    IMessageQueue::BACKEND_MUTEX, 0,
+                                    scheduler));
+
+        Future<int> future = idle->submit([]() { return 1; });
+        TEST_CHECK(!future.wait_for(std::chrono::milliseconds(10)));
+        idle->join();
+
+        bool broken = false;
+        try
+        {
+            future.get();
+        }
+        catch (const std::future_error &error)
+        {
+            broken = error.code() == std::future_errc::broken_promise;
+        }
+        TEST_CHECK(broken);
+    }
+
+    // The only worker submitting into its own full pool runs the pending
+    // functions to make room, rather than waiting for itself:
+    {
+        const int NUM_INNER = 10;
+
+        std::unique_ptr<IThreadPool> full(
+                IThreadPool::create(1, 1, IMessageQueue::BACKEND_MUTEX, 0,
+                                    scheduler));
+
+        std::vector<Future<int>> inner;
+        Future<void> outer = full->submit([&full, &inner]() {
+            for (int i = 0; i < NUM_INNER; ++i)
+            {
+                inner.push_back(full->submit([i]() { return i; }));
+            }
+        });
+        TEST_CHECK(outer.wait_for(std::chrono::seconds(10)));
+        outer.get();
+
+        for (int i = 0; i < NUM_INNER; ++i)
+        {
+            TEST_CHECK(inner[i].get() == i);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void
+test_pool(IThreadPool::Scheduler scheduler)
 {
     const int NUM_THREADS = 16;
     const int NUM_TASKS = 1000000;
     const int QUEUE_CAPACITY = 100;
+    const int NUM_BULK_TASKS = 50;
 
     std::unique_ptr<IThreadPool> pool(
-            IThreadPool::create(NUM_THREADS, QUEUE_CAPACITY));
+            IThreadPool::create(NUM_THREADS, QUEUE_CAPACITY,
+                                IMessageQueue::BACKEND_MUTEX, 0, scheduler));
 
     Mutex mutex;
     int num_tasks_in = NUM_TASKS;
@@ -147,15 +674,10 @@ test_ThreadPool()
             Task task(new TestTask(id, mutex, instance_counter,
                                    execution_counter));
 
-            std::size_t num = pool->push(task);
-            if (num > 0)
-            {
-                --num_tasks_in;
-            }
-            else
-            {
-                sched_yield();
-            }
+            // Waits for a free slot into the pool:
+            std::size_t num = pool->push(task, true);
+            TEST_CHECK(num > 0);
+            --num_tasks_in;
         }
 
         if (num_tasks_out > 0)
@@ -175,10 +697,156 @@ test_ThreadPool()
 
     }
 
+    // Pushes and collects a batch of tasks at once:
+    {
+        std::vector<Task> tasks;
+        for (int id = 0; id < NUM_BULK_TASKS; ++id)
+        {
+            tasks.push_back(Task(new TestTask(NUM_TASKS + id, mutex,
+                                              instance_counter,
+                                              execution_counter)));
+        }
+        TEST_CHECK(pool->push_bulk(tasks.begin(), tasks.end())
+                   == tasks.size());
+
+        std::vector<Task> executed(NUM_BULK_TASKS);
+        TEST_CHECK(pool->pop_bulk_until(&executed[0], executed.size(),
+                                        Deadline::max())
+                   == executed.size());
+    }
+
+    // Executed tasks can be waited for through a file descriptor:
+    {
+        EventFd ready;
+        pool->add_listener(ready);
+
+        TEST_CHECK(pool->push(Task(new TestTask(NUM_TASKS + NUM_BULK_TASKS,
+                                                mutex,
+                                                instance_counter,
+                                                execution_counter)),
+                              true) > 0);
+
+        struct pollfd pfd;
+        pfd.fd = ready.fd();
+        pfd.events = POLLIN;
+        TEST_CHECK(::poll(&pfd, 1, 10000) == 1);
+        ready.reset();
+
+        Task task;
+        TEST_CHECK(pool->pop(task, false) > 0);
+
+        pool->remove_listener(ready);
+    }
+
+    // Nothing left to be collected:
+    Task task;
+    TEST_CHECK(pool->pop_for(task, std::chrono::milliseconds(10)) == 0);
+
+    // Every pending task has been taken by a worker:
+    QueueStats stats = pool->task_stats();
+    TEST_CHECK(stats.pushes == std::uint64_t(NUM_TASKS + NUM_BULK_TASKS + 1));
+    TEST_CHECK(stats.pops == stats.pushes);
+    TEST_CHECK(stats.high_water_mark > 0);
+
+    // Scheduled tasks are pushed when due, periodic ones until cancelled
+    // without being handed back:
+    {
+        std::shared_ptr<CountingTask> delayed(new CountingTask());
+        std::shared_ptr<CountingTask> periodic(new CountingTask());
+        std::shared_ptr<CountingTask> cancelled(new CountingTask());
+
+        const Deadline start = Clock::now();
+        pool->push_after(std::chrono::milliseconds(20), delayed);
+        TimerId every = pool->push_every(std::chrono::milliseconds(2),
+                                         periodic);
+        TimerId never = pool->push_after(std::chrono::hours(1), cancelled);
+        TEST_CHECK(pool->cancel_timer(never));
+        TEST_CHECK(!pool->cancel_timer(never));
+
+        TEST_CHECK(pool->pop_for(task, std::chrono::seconds(10)) > 0);
+        TEST_CHECK(task == delayed);
+        TEST_CHECK(Clock::now() - start >= std::chrono::milliseconds(20));
+        TEST_CHECK(delayed->executions() == 1);
+
+        const Deadline deadline = deadline_after(std::chrono::seconds(10));
+        while (periodic->executions() < 3 && Clock::now() < deadline)
+        {
+            ::usleep(1000);
+        }
+        TEST_CHECK(periodic->executions() >= 3);
+        TEST_CHECK(pool->cancel_timer(every));
+
+        TEST_CHECK(pool->pop_for(task, std::chrono::milliseconds(10)) == 0);
+        TEST_CHECK(cancelled->executions() == 0);
+    }
+
+    // Tasks still scheduled are handed back by join, periodic ones once:
+    {
+        std::unique_ptr<IThreadPool> idle(
+                IThreadPool::create(1, std::numeric_limits<std::size_t>::max(),
+                                    IMessageQueue::BACKEND_MUTEX, 0,
+                                    scheduler));
+
+        std::shared_ptr<CountingTask> delayed(new CountingTask());
+        std::shared_ptr<CountingTask> periodic(new CountingTask());
+        idle->push_after(std::chrono::hours(1), delayed);
+        idle->push_every(std::chrono::hours(1), periodic);
+
+        idle->join();
+
+        // Referenced by the queue of executed tasks:
+        TEST_CHECK(delayed.use_count() == 2);
+        TEST_CHECK(periodic.use_count() == 2);
+        TEST_CHECK(periodic->executions() == 0);
+    }
+
+    // Tasks pushed by running tasks are executed and handed back too:
+    {
+        // Never more pending tasks than items, within the capacity:
+        const int NUM_ITEMS = 64;
+
+        std::atomic<int> leaves(0);
+        TEST_CHECK(pool->push(Task(new SplittingTask(*pool, NUM_ITEMS,
+                                                     leaves)), true) > 0);
+
+        // Splitting n items takes 2n - 1 tasks:
+        for (int i = 0; i < 2 * NUM_ITEMS - 1; ++i)
+        {
+            TEST_CHECK(pool->pop_for(task, std::chrono::seconds(10)) > 0);
+        }
+        TEST_CHECK(leaves == NUM_ITEMS);
+    }
+
     pool->join();
 
     TEST_CHECK(0 == instance_counter);
-    TEST_CHECK(NUM_TASKS == execution_counter);
+    TEST_CHECK(NUM_TASKS + NUM_BULK_TASKS + 1 == execution_counter);
+}
+
+} // anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+void
+test_ThreadPool()
+{
+    test_pool(IThreadPool::SCHEDULER_SHARED);
+    test_pool(IThreadPool::SCHEDULER_STEALING);
+
+    const IThreadPool::Scheduler schedulers[] = {
+            IThreadPool::SCHEDULER_SHARED,
+            IThreadPool::SCHEDULER_STEALING
+    };
+    for (auto scheduler: schedulers)
+    {
+        test_fork_join(scheduler, 1, 4);
+        test_fork_join(scheduler, 8, 4);
+        test_fork_join(scheduler, 8, std::numeric_limits<std::size_t>::max());
+        test_fork_join_cancel(scheduler);
+        test_fork_join_wake(scheduler);
+        test_fork_join_pools(scheduler);
+        test_submit(scheduler);
+    }
 }
 
 // -----------------------------------------------------------------------------
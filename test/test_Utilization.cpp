@@ -0,0 +1,195 @@
+/**
+Copyright (c) 2015, Riccardo Ressi
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+Redistributions of source code must retain the above copyright notice, this list
+of conditions and the following disclaimer.
+Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+Neither the name of Riccardo Ressi nor the names of its contributors may be
+used to endorse or promote products derived from this software without specific
+prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "test_Utils.h"
+
+#include "Clock.h"
+#include "Thread.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <sstream>
+#include <thread>
+
+// -----------------------------------------------------------------------------
+
+namespace {
+
+const int NUM_THREADS = 8;
+
+/**
+ * Keeps its worker busy for a while, recording when and where it run.
+ */
+class BurstTask
+        :
+                public ITask
+{
+
+    const std::chrono::microseconds m_duration;
+
+public:
+
+    MESSAGE_TYPE(BurstTask, ITask)
+
+    Deadline m_begin;
+    Deadline m_end;
+    std::thread::id m_worker;
+
+    BurstTask(std::chrono::microseconds duration)
+            :
+            m_duration(duration)
+    {
+    }
+
+    virtual void
+    execute()
+    {
+        m_worker = std::this_thread::get_id();
+        m_begin = Clock::now();
+        do
+        {
+            m_end = Clock::now();
+        }
+        while (m_end - m_begin < m_duration);
+    }
+
+};
+
+// -----------------------------------------------------------------------------
+
+/**
+ * Pushes bursts of tasks into a pool whose workers went idle, measuring how
+ * long it takes for the burst to be spread over the workers.
+ *
+ * Returns the average fraction of the workers that executed a task of each
+ * burst.
+ */
+double
+test_bursts(IMessageQueue::Backend backend)
+{
+    const int NUM_BURSTS = 20;
+    const std::chrono::microseconds TASK_DURATION(1000);
+    const std::chrono::milliseconds IDLE_DURATION(5);
+
+    typedef std::chrono::duration<double, std::milli> Milliseconds;
+
+    std::unique_ptr<IThreadPool> pool(
+            IThreadPool::create(NUM_THREADS, NUM_THREADS, backend));
+
+    double workers = 0.0;
+    double ramp_up = 0.0;
+    double utilization = 0.0;
+
+    for (int burst = 0; burst < NUM_BURSTS; ++burst)
+    {
+        // Lets all workers park:
+        std::this_thread::sleep_for(IDLE_DURATION);
+
+        Deadline begin = Clock::now();
+        for (int i = 0; i < NUM_THREADS; ++i)
+        {
+            TEST_CHECK(pool->push(Task(new BurstTask(TASK_DURATION)), true)
+                       > 0);
+        }
+
+        // Waits for the whole burst:
+        std::set<std::thread::id> ids;
+        Deadline last_begin = begin;
+        Deadline last_end = begin;
+        for (int i = 0; i < NUM_THREADS; ++i)
+        {
+            std::shared_ptr<BurstTask> task;
+            TEST_CHECK(pool->popT(task, true) > 0);
+
+            ids.insert(task->m_worker);
+            last_begin = std::max(last_begin, task->m_begin);
+            last_end = std::max(last_end, task->m_end);
+        }
+
+        // Busy time of the workers over their available time:
+        double busy = Milliseconds(TASK_DURATION).count() * NUM_THREADS;
+        double available = Milliseconds(last_end - begin).count() * NUM_THREADS;
+
+        workers += ids.size();
+        ramp_up += Milliseconds(last_begin - begin).count();
+        utilization += busy / available;
+    }
+
+    pool->join();
+
+    workers /= NUM_BURSTS;
+    ramp_up /= NUM_BURSTS;
+    utilization /= NUM_BURSTS;
+
+    std::stringstream message;
+    message << "[" << backend << "]";
+    trace(message);
+    message << "Workers per burst: " << workers << "/" << NUM_THREADS;
+    trace(message);
+    message << "Ramp-up: " << ramp_up << " ms";
+    trace(message);
+    message << "Utilization: " << (utilization * 100.0) << " %";
+    trace(message);
+
+    return workers / NUM_THREADS;
+}
+
+} // anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+void
+test_Utilization()
+{
+    const IMessageQueue::Backend backends[] = {
+            IMessageQueue::BACKEND_MUTEX,
+            IMessageQueue::BACKEND_RING,
+            IMessageQueue::BACKEND_PRIORITY
+    };
+
+    // Woken workers can run in parallel only with a CPU each, otherwise the
+    // first ones may drain the burst before the others get scheduled:
+    bool enough_cpus =
+            std::thread::hardware_concurrency() >= unsigned(NUM_THREADS);
+
+    for (auto backend: backends)
+    {
+        // A burst must wake most of the idle workers, not just the first:
+        double workers = test_bursts(backend);
+        if (enough_cpus)
+        {
+            TEST_CHECK(workers > 0.5);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------